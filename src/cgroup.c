@@ -0,0 +1,449 @@
+/* Copyright 2014-2019 Gregor Uhlenheuer
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#define _GNU_SOURCE
+
+#include "cgroup.h"
+#include "def.h"
+#include "log.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <sys/types.h>
+#include <unistd.h>
+
+static int32_t
+open_file(const char *path, const char *file, int32_t flags)
+{
+    char buffer[512] = {0};
+
+    if (snprintf(buffer, sizeof(buffer), "%s/%s", path, file) >= (int32_t)sizeof(buffer))
+    {
+        errno = ENAMETOOLONG;
+        return -1;
+    }
+
+    return open(buffer, flags | O_CLOEXEC);
+}
+
+static bool
+write_file(const char *path, const char *file, const char *value)
+{
+    int32_t fd = open_file(path, file, O_WRONLY);
+
+    if (fd < 0)
+        return false;
+
+    size_t length = strlen(value);
+    bool success = write(fd, value, length) == (ssize_t)length;
+
+    close(fd);
+    return success;
+}
+
+/**
+ * @brief Read the whole (small) file of the given descriptor
+ * @return number of bytes read (terminated by '\0'), -1 on error
+ */
+static ssize_t
+read_fd(int32_t fd, char *buffer, size_t size)
+{
+    ssize_t bytes = pread(fd, buffer, size - 1, 0);
+
+    if (bytes < 0)
+        return -1;
+
+    buffer[bytes] = '\0';
+    return bytes;
+}
+
+/**
+ * @brief Open the given cgroup file on first use
+ * @return file descriptor, -1 if the file cannot be opened
+ */
+static int32_t
+lazy_open(cgroup_t *cgroup, int32_t *fd, const char *file)
+{
+    if (*fd < 0)
+        *fd = open_file(cgroup->path, file, O_RDONLY);
+
+    return *fd;
+}
+
+/**
+ * @brief Parse the value of the given key of a flat keyed cgroup file
+ *        like cpu.stat ("<key> <value>" per line)
+ * @param buffer  contents of the file (not necessarily terminated)
+ * @param length  number of bytes in the buffer
+ * @param key     key to search for
+ * @param value   parsed value
+ * @return true if the key was found, false otherwise
+ */
+bool
+cgroup_parse_value(const char *buffer, size_t length, const char *key, uint64_t *value)
+{
+    size_t key_length = strlen(key);
+    const char *end = buffer + length;
+    const char *pos = buffer;
+
+    while (pos < end)
+    {
+        const char *eol = memchr(pos, '\n', end - pos);
+
+        if (eol == NULL)
+            eol = end;
+
+        if ((size_t)(eol - pos) > key_length &&
+                pos[key_length] == ' ' &&
+                strncmp(pos, key, key_length) == 0)
+        {
+            uint64_t result = 0;
+            const char *num = pos + key_length + 1;
+
+            if (num >= eol || *num < '0' || *num > '9')
+                return false;
+
+            while (num < eol && *num >= '0' && *num <= '9')
+                result = result * 10 + (*num++ - '0');
+
+            *value = result;
+            return true;
+        }
+
+        pos = eol + 1;
+    }
+
+    return false;
+}
+
+/**
+ * @brief Prepare the cgroup root all watches' cgroups are created in
+ * @param root path of the cgroup root (e.g. /sys/fs/cgroup/nyx)
+ * @return true on success, false otherwise
+ *
+ * The memory controller is enabled for the children of the root so
+ * the watches' cgroups provide their memory usage. The root itself
+ * must not contain any processes for that reason.
+ */
+bool
+cgroup_init(const char *root)
+{
+    if (*root != '/' || strrchr(root, '/') == root)
+    {
+        log_warn("Invalid cgroup root '%s' - absolute path below the cgroup mount expected", root);
+        return false;
+    }
+
+    char *parent = strdup(root);
+
+    *strrchr(parent, '/') = '\0';
+
+    /* cgroup v2 hierarchies only */
+    int32_t fd = open_file(parent, "cgroup.controllers", O_RDONLY);
+
+    if (fd < 0)
+    {
+        log_warn("Directory '%s' is not part of a cgroup v2 hierarchy", parent);
+        free(parent);
+        return false;
+    }
+
+    close(fd);
+
+    if (mkdir(root, 0755) == -1 && errno != EEXIST)
+    {
+        log_perror("nyx: mkdir");
+        log_warn("Failed to create cgroup '%s'", root);
+        free(parent);
+        return false;
+    }
+
+    /* the controller might be enabled in the parent already */
+    if (!write_file(parent, "cgroup.subtree_control", "+memory") ||
+        !write_file(root, "cgroup.subtree_control", "+memory"))
+    {
+        log_warn("Failed to enable the memory controller in cgroup '%s': %s",
+                root, strerror(errno));
+    }
+
+    free(parent);
+    return true;
+}
+
+/**
+ * @brief Determine the cgroup path of the given watch
+ * @return path (to be freed) or NULL if the watch name is no valid
+ *         directory name
+ */
+char *
+cgroup_path(const char *root, const char *name)
+{
+    if (root == NULL || name == NULL || *name == '\0' || *name == '.' ||
+            strchr(name, '/') != NULL)
+        return NULL;
+
+    size_t length = strlen(root) + strlen(name) + 2;
+    char *path = xcalloc(length, sizeof(char));
+
+    snprintf(path, length, "%s/%s", root, name);
+
+    return path;
+}
+
+bool
+cgroup_create(const char *path)
+{
+    if (mkdir(path, 0755) == -1 && errno != EEXIST)
+    {
+        log_perror("nyx: mkdir");
+        return false;
+    }
+
+    return true;
+}
+
+/**
+ * @brief Open the cgroup.procs file processes are moved into the cgroup with
+ * @return file descriptor (close-on-exec), -1 on error
+ */
+int32_t
+cgroup_open_procs(const char *path)
+{
+    return open_file(path, "cgroup.procs", O_WRONLY);
+}
+
+/**
+ * @brief Determine whether any process is left in the given cgroup
+ * @return 1 if populated, 0 if empty, -1 on error
+ */
+int32_t
+cgroup_populated(const char *path)
+{
+    char buffer[NYX_CGROUP_BUFFER_SIZE];
+    uint64_t populated = 0;
+    int32_t fd = open_file(path, "cgroup.events", O_RDONLY);
+
+    if (fd < 0)
+        return -1;
+
+    ssize_t bytes = read_fd(fd, buffer, sizeof(buffer));
+
+    close(fd);
+
+    if (bytes < 0 || !cgroup_parse_value(buffer, bytes, "populated", &populated))
+        return -1;
+
+    return populated ? 1 : 0;
+}
+
+/**
+ * @brief Determine whether the contents of /proc/<pid>/cgroup place the
+ *        process into the cgroup of the given path
+ * @param buffer  contents of the file (not necessarily terminated)
+ * @param length  number of bytes in the buffer
+ * @param path    path of the cgroup directory
+ * @return true if the process is a member of the cgroup, false otherwise
+ *
+ * The cgroup v2 entry ("0::<cgroup>") is relative to the mount point
+ * of the hierarchy so it has to match the end of the directory path.
+ */
+bool
+cgroup_parse_member(const char *buffer, size_t length, const char *path)
+{
+    size_t path_length = strlen(path);
+    const char *end = buffer + length;
+    const char *pos = buffer;
+
+    while (pos < end)
+    {
+        const char *eol = memchr(pos, '\n', end - pos);
+
+        if (eol == NULL)
+            eol = end;
+
+        if (eol - pos > 3 && strncmp(pos, "0::", 3) == 0)
+        {
+            const char *cgroup = pos + 3;
+            size_t cgroup_length = eol - cgroup;
+
+            /* the root cgroup is no watch's cgroup */
+            if (*cgroup != '/' || cgroup_length < 2 || cgroup_length > path_length)
+                return false;
+
+            return strncmp(path + path_length - cgroup_length, cgroup, cgroup_length) == 0;
+        }
+
+        pos = eol + 1;
+    }
+
+    return false;
+}
+
+/**
+ * @brief Determine whether the given process is a member of the cgroup
+ * @return true if the process is in the cgroup, false otherwise
+ *         (including the process not existing anymore)
+ */
+bool
+cgroup_contains(const char *path, pid_t pid)
+{
+    char buffer[NYX_CGROUP_BUFFER_SIZE];
+    char file[64] = {0};
+
+    snprintf(file, sizeof(file), "/proc/%d/cgroup", pid);
+
+    int32_t fd = open(file, O_RDONLY | O_CLOEXEC);
+
+    if (fd < 0)
+        return false;
+
+    ssize_t bytes = read_fd(fd, buffer, sizeof(buffer));
+
+    close(fd);
+
+    return bytes > 0 && cgroup_parse_member(buffer, bytes, path);
+}
+
+/**
+ * @brief Kill all processes of the given cgroup
+ * @return true on success, false otherwise
+ *
+ * Kernels before 5.14 do not provide cgroup.kill, so the processes
+ * listed in cgroup.procs are killed one by one instead.
+ */
+bool
+cgroup_kill(const char *path)
+{
+    if (write_file(path, "cgroup.kill", "1"))
+        return true;
+
+    if (errno != ENOENT)
+        return false;
+
+    int32_t fd = open_file(path, "cgroup.procs", O_RDONLY);
+
+    if (fd < 0)
+        return false;
+
+    FILE *procs = fdopen(fd, "r");
+
+    if (procs == NULL)
+    {
+        close(fd);
+        return false;
+    }
+
+    pid_t pid = 0;
+
+    while (fscanf(procs, "%d", &pid) == 1)
+    {
+        if (kill(pid, SIGKILL) == -1 && errno != ESRCH)
+            log_perror("nyx: kill");
+    }
+
+    fclose(procs);
+    return true;
+}
+
+cgroup_t *
+cgroup_new(const char *root, const char *name)
+{
+    char *path = cgroup_path(root, name);
+
+    if (path == NULL)
+        return NULL;
+
+    cgroup_t *cgroup = xcalloc1(sizeof(cgroup_t));
+
+    cgroup->path = path;
+    cgroup->cpu_fd = -1;
+    cgroup->memory_fd = -1;
+    cgroup->memory_stat_fd = -1;
+    cgroup->events_fd = -1;
+
+    return cgroup;
+}
+
+void
+cgroup_destroy(cgroup_t *cgroup)
+{
+    if (cgroup == NULL)
+        return;
+
+    int32_t fds[] = { cgroup->cpu_fd, cgroup->memory_fd, cgroup->memory_stat_fd, cgroup->events_fd };
+
+    for (size_t i = 0; i < LEN(fds); i++)
+    {
+        if (fds[i] >= 0)
+            close(fds[i]);
+    }
+
+    free(cgroup->path);
+    free(cgroup);
+}
+
+/**
+ * @brief Read the current CPU/memory usage of the given cgroup
+ * @return true on success, false if the cgroup (or its memory
+ *         controller) is not available
+ *
+ * The files are opened on first use and kept open. The memory usage
+ * is determined like 'docker stats' does: the inactive page cache is
+ * not counted as it may be reclaimed any time.
+ */
+bool
+cgroup_sample(cgroup_t *cgroup, cgroup_stat_t *stat)
+{
+    char buffer[NYX_CGROUP_BUFFER_SIZE];
+    ssize_t bytes = 0;
+    uint64_t inactive_file = 0;
+
+    memset(stat, 0, sizeof(cgroup_stat_t));
+
+    if (lazy_open(cgroup, &cgroup->cpu_fd, "cpu.stat") < 0 ||
+        lazy_open(cgroup, &cgroup->memory_fd, "memory.current") < 0)
+        return false;
+
+    if ((bytes = read_fd(cgroup->cpu_fd, buffer, sizeof(buffer))) < 0 ||
+        !cgroup_parse_value(buffer, bytes, "usage_usec", &stat->usage_usec))
+        return false;
+
+    if (read_fd(cgroup->memory_fd, buffer, sizeof(buffer)) < 0)
+        return false;
+
+    stat->memory = strtoull(buffer, NULL, 10);
+
+    if (lazy_open(cgroup, &cgroup->memory_stat_fd, "memory.stat") >= 0 &&
+        (bytes = read_fd(cgroup->memory_stat_fd, buffer, sizeof(buffer))) >= 0 &&
+        cgroup_parse_value(buffer, bytes, "inactive_file", &inactive_file))
+    {
+        stat->memory -= MIN(stat->memory, inactive_file);
+    }
+
+    if (lazy_open(cgroup, &cgroup->events_fd, "memory.events") >= 0 &&
+        (bytes = read_fd(cgroup->events_fd, buffer, sizeof(buffer))) >= 0)
+    {
+        cgroup_parse_value(buffer, bytes, "oom_kill", &stat->oom_kills);
+    }
+
+    return true;
+}
+
+/* vim: set et sw=4 sts=4 tw=80: */
@@ -0,0 +1,94 @@
+/* Copyright 2014-2019 Gregor Uhlenheuer
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#pragma once
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <sys/types.h>
+
+/* Every watch may be placed into its own cgroup (v2) below a common
+ * root, e.g. /sys/fs/cgroup/nyx/<watch>. The forker moves the spawned
+ * processes into the cgroup so all of their descendants belong to it
+ * as well. The CPU/memory usage of the whole process tree is then read
+ * from a few small files of the cgroup instead of /proc. */
+
+/* large enough for memory.stat */
+#define NYX_CGROUP_BUFFER_SIZE 4096
+
+typedef struct
+{
+    /** CPU time of all processes (in us) */
+    uint64_t usage_usec;
+    /** memory usage without the inactive page cache (in bytes) */
+    uint64_t memory;
+    /** number of processes killed by the OOM killer */
+    uint64_t oom_kills;
+} cgroup_stat_t;
+
+typedef struct
+{
+    /** path of the cgroup directory */
+    char *path;
+    /** persistent file descriptors of cpu.stat, memory.current,
+     * memory.stat and memory.events (-1 if not open) */
+    int32_t cpu_fd;
+    int32_t memory_fd;
+    int32_t memory_stat_fd;
+    int32_t events_fd;
+    /** whether 'last' contains a sample already */
+    bool sampled;
+    /** statistics of the last sample */
+    cgroup_stat_t last;
+} cgroup_t;
+
+bool
+cgroup_init(const char *root);
+
+char *
+cgroup_path(const char *root, const char *name);
+
+bool
+cgroup_create(const char *path);
+
+int32_t
+cgroup_open_procs(const char *path);
+
+int32_t
+cgroup_populated(const char *path);
+
+bool
+cgroup_contains(const char *path, pid_t pid);
+
+bool
+cgroup_kill(const char *path);
+
+cgroup_t *
+cgroup_new(const char *root, const char *name);
+
+void
+cgroup_destroy(cgroup_t *cgroup);
+
+bool
+cgroup_sample(cgroup_t *cgroup, cgroup_stat_t *stat);
+
+bool
+cgroup_parse_value(const char *buffer, size_t length, const char *key, uint64_t *value);
+
+bool
+cgroup_parse_member(const char *buffer, size_t length, const char *path);
+
+/* vim: set et sw=4 sts=4 tw=80: */
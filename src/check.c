@@ -0,0 +1,1049 @@
+/* Copyright 2014-2019 Gregor Uhlenheuer
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#define _GNU_SOURCE
+
+#include "check.h"
+#include "def.h"
+#include "log.h"
+#include "utils.h"
+
+#include <arpa/inet.h>
+#include <errno.h>
+#include <netdb.h>
+#include <stdio.h>
+#include <string.h>
+#include <strings.h>
+#include <sys/resource.h>
+#include <time.h>
+#include <unistd.h>
+
+#define NYX_CHECK_MAX_EVENTS 64
+
+#define REQUEST_TEMPLATE "%s /%s HTTP/1.1\r\nHost: localhost\r\nUser-Agent: nyx\r\nConnection: keep-alive\r\n\r\n"
+
+typedef struct
+{
+    /** idle connection (-1 if none) */
+    int32_t fd;
+    /** time in ms the connection is idle since */
+    uint64_t idle_since;
+} check_connection_t;
+
+static uint64_t
+time_us(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+
+    return (uint64_t)ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+}
+
+static void
+connection_destroy(void *data)
+{
+    check_connection_t *conn = data;
+
+    if (conn->fd >= 0)
+        close(conn->fd);
+
+    free(conn);
+}
+
+check_engine_t *
+check_engine_new(uint32_t max_concurrent)
+{
+    struct rlimit limit;
+    check_engine_t *engine = xcalloc1(sizeof(check_engine_t));
+
+    /* leave at least half of the allowed file descriptors
+     * to the rest of nyx */
+    if (getrlimit(RLIMIT_NOFILE, &limit) == 0 && limit.rlim_cur != RLIM_INFINITY)
+        max_concurrent = MIN(max_concurrent, limit.rlim_cur / 2);
+
+    engine->max_concurrent = MAX(1, max_concurrent);
+    engine->active = xcalloc(engine->max_concurrent, sizeof(uint32_t));
+    engine->connections = hash_new(connection_destroy);
+
+#ifndef OSX
+    engine->epfd = epoll_create1(EPOLL_CLOEXEC);
+
+    if (engine->epfd < 0)
+    {
+        log_perror("nyx: epoll_create1");
+
+        hash_destroy(engine->connections);
+        free(engine->active);
+        free(engine);
+        return NULL;
+    }
+#endif
+
+    return engine;
+}
+
+/**
+ * @brief Add a new check that is run on the next 'check_engine_run'
+ * @param engine   check engine
+ * @param type     type of check
+ * @param port     port to connect to
+ * @param timeout  time in ms the check has to finish in
+ * @return check instance that may be adjusted by the caller
+ */
+check_t *
+check_engine_add(check_engine_t *engine, check_type_e type, uint16_t port, uint32_t timeout)
+{
+    if (engine->count == engine->capacity)
+    {
+        engine->capacity = MAX(16, engine->capacity * 2);
+
+        void *checks = realloc(engine->checks, engine->capacity * sizeof(check_t));
+
+        if (checks == NULL)
+            log_critical_perror("nyx: realloc");
+
+        engine->checks = checks;
+
+        /* every check is waiting for a runner at most once */
+        void *waiting = realloc(engine->waiting, engine->capacity * sizeof(uint32_t));
+
+        if (waiting == NULL)
+            log_critical_perror("nyx: realloc");
+
+        engine->waiting = waiting;
+    }
+
+    check_t *check = &engine->checks[engine->count++];
+    memset(check, 0, sizeof(check_t));
+
+    check->type = type;
+    check->port = port;
+    check->timeout = timeout;
+    check->fd = -1;
+
+    return check;
+}
+
+/**
+ * @brief Parse the status line and headers of an HTTP response
+ * @param buffer    received response
+ * @param length    length of the received response
+ * @param response  response information to fill
+ * @return 1 if the headers are complete, 0 if more data is needed
+ *         and -1 if the response is malformed
+ */
+int32_t
+http_parse_response(const char *buffer, uint32_t length, http_response_t *response)
+{
+    const char *end = memmem(buffer, length, "\r\n\r\n", 4);
+
+    if (end == NULL)
+        return 0;
+
+    memset(response, 0, sizeof(http_response_t));
+
+    response->content_length = -1;
+    response->header_length = end - buffer + 4;
+
+    /* HTTP/1.x xxx */
+    if (response->header_length < 16 ||
+            strncmp(buffer, "HTTP/1.", 7) != 0 ||
+            (buffer[7] != '0' && buffer[7] != '1') ||
+            buffer[8] != ' ')
+        return -1;
+
+    for (uint32_t i = 9; i < 12; i++)
+    {
+        if (buffer[i] < '0' || buffer[i] > '9')
+            return -1;
+
+        response->status = response->status * 10 + (buffer[i] - '0');
+    }
+
+    if (buffer[12] != ' ' && buffer[12] != '\r')
+        return -1;
+
+    /* HTTP/1.1 connections are persistent unless stated otherwise */
+    response->keep_alive = buffer[7] == '1';
+
+    /* the status line is terminated by the first CRLF at 'end' the latest */
+    const char *line = (const char *)memchr(buffer, '\n', end + 2 - buffer) + 1;
+
+    while (line < end + 2)
+    {
+        const char *eol = memchr(line, '\r', end + 2 - line);
+        const char *colon = memchr(line, ':', eol - line);
+
+        if (colon == NULL)
+            return -1;
+
+        size_t name_length = colon - line;
+        const char *value = colon + 1;
+        const char *value_end = eol;
+
+        while (value < value_end && (*value == ' ' || *value == '\t'))
+            value++;
+        while (value_end > value && (value_end[-1] == ' ' || value_end[-1] == '\t'))
+            value_end--;
+
+        size_t value_length = value_end - value;
+
+#define IS_HEADER(name_) \
+        (name_length == LEN(name_) - 1 && strncasecmp(line, name_, name_length) == 0)
+#define IS_VALUE(value_) \
+        (value_length == LEN(value_) - 1 && strncasecmp(value, value_, value_length) == 0)
+
+        if (IS_HEADER("Content-Length"))
+        {
+            int64_t content_length = 0;
+
+            if (value_length < 1 || value_length > 18)
+                return -1;
+
+            for (size_t i = 0; i < value_length; i++)
+            {
+                if (value[i] < '0' || value[i] > '9')
+                    return -1;
+
+                content_length = content_length * 10 + (value[i] - '0');
+            }
+
+            response->content_length = content_length;
+        }
+        else if (IS_HEADER("Connection"))
+        {
+            if (IS_VALUE("close"))
+                response->keep_alive = false;
+            else if (IS_VALUE("keep-alive"))
+                response->keep_alive = true;
+        }
+        else if (IS_HEADER("Transfer-Encoding"))
+        {
+            response->chunked = !IS_VALUE("identity");
+        }
+
+#undef IS_HEADER
+#undef IS_VALUE
+
+        line = eol + 2;
+    }
+
+    return 1;
+}
+
+#ifndef OSX
+static void
+connection_key(char *key, uint16_t port)
+{
+    snprintf(key, 8, "%u", port);
+}
+
+/**
+ * @brief Take the idle keep-alive connection to the given port (if any)
+ * @return connected socket or -1
+ */
+static int32_t
+connection_take(check_engine_t *engine, uint16_t port)
+{
+    char key[8];
+    char buffer;
+
+    connection_key(key, port);
+
+    check_connection_t *conn = hash_get(engine->connections, key);
+
+    if (conn == NULL || conn->fd < 0)
+        return -1;
+
+    int32_t fd = conn->fd;
+    conn->fd = -1;
+
+    /* the server might have closed the idle connection in the meantime */
+    ssize_t res = recv(fd, &buffer, 1, MSG_PEEK | MSG_DONTWAIT);
+
+    if (res == 0 || (res < 0 && errno != EAGAIN && errno != EWOULDBLOCK))
+    {
+        close(fd);
+        return -1;
+    }
+
+    return fd;
+}
+
+/**
+ * @brief Keep the connection of the given check for subsequent checks
+ *
+ * There is at most one idle connection per port - any surplus
+ * connection is closed.
+ */
+static void
+connection_put(check_engine_t *engine, check_t *check)
+{
+    char key[8];
+
+    connection_key(key, check->port);
+
+    check_connection_t *conn = hash_get(engine->connections, key);
+
+    if (conn == NULL)
+    {
+        conn = xcalloc1(sizeof(check_connection_t));
+        conn->fd = -1;
+
+        hash_add(engine->connections, key, conn);
+    }
+
+    if (conn->fd >= 0 || epoll_ctl(engine->epfd, EPOLL_CTL_DEL, check->fd, NULL) != 0)
+    {
+        close(check->fd);
+    }
+    else
+    {
+        conn->fd = check->fd;
+        conn->idle_since = time_ms();
+    }
+
+    check->fd = -1;
+}
+
+/**
+ * @brief Close all idle connections that were not used for a while
+ */
+static void
+connection_expire(check_engine_t *engine, uint64_t now)
+{
+    const char *key = NULL;
+    void *data = NULL;
+    hash_iter_t *iter = hash_iter_start(engine->connections);
+
+    while (hash_iter(iter, &key, &data))
+    {
+        check_connection_t *conn = data;
+
+        if (conn->fd >= 0 && conn->idle_since + NYX_CHECK_KEEPALIVE_MS <= now)
+        {
+            close(conn->fd);
+            conn->fd = -1;
+        }
+    }
+
+    free(iter);
+}
+#endif
+
+static void
+check_finish(UNUSED check_engine_t *engine, check_t *check, bool success, UNUSED bool keep)
+{
+#ifndef OSX
+    if (keep && check->fd >= 0)
+        connection_put(engine, check);
+
+    if (check->runner)
+    {
+        /* the runner's reply pipe is not closed but used for
+         * subsequent checks */
+        if (check->runner->pid > 0)
+            epoll_ctl(engine->epfd, EPOLL_CTL_DEL, check->runner->reply_fd, NULL);
+
+        runner_release(check->runner);
+        check->runner = NULL;
+    }
+#endif
+
+    /* closing the socket removes it from the epoll set as well */
+    if (check->fd >= 0)
+    {
+        close(check->fd);
+        check->fd = -1;
+    }
+
+    if (check->request)
+    {
+        free(check->request);
+        check->request = NULL;
+    }
+
+    /* try the endpoint's next address on the next check */
+    if (!success && check->endpoint && check->address.sin_family == AF_INET)
+        endpoint_failed(check->endpoint, &check->address);
+
+    if (check->started)
+        check->latency = time_us() - check->started;
+
+    check->success = success;
+    check->state = CHECK_DONE;
+}
+
+#ifndef OSX
+static bool
+check_watch(check_engine_t *engine, uint32_t idx, uint32_t events, int32_t op)
+{
+    struct epoll_event event =
+    {
+        .events = events,
+        .data.u64 = idx
+    };
+
+    if (epoll_ctl(engine->epfd, op, engine->checks[idx].fd, &event) != 0)
+    {
+        log_perror("nyx: epoll_ctl");
+        return false;
+    }
+
+    return true;
+}
+
+/**
+ * @brief Start a non-blocking connect to the check's address
+ * @return false if the connect failed immediately
+ */
+static bool
+check_connect(check_engine_t *engine, uint32_t idx)
+{
+    check_t *check = &engine->checks[idx];
+
+    if (check->endpoint == NULL)
+    {
+        memset(&check->address, 0, sizeof(check->address));
+
+        check->address.sin_family = AF_INET;
+        check->address.sin_port = htons(check->port);
+        check->address.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    }
+
+    check->fd = socket(AF_INET, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, IPPROTO_TCP);
+
+    if (check->fd < 0)
+    {
+        log_perror("nyx: socket");
+        return false;
+    }
+
+    if (connect(check->fd, (struct sockaddr *)&check->address, sizeof(check->address)) != 0 &&
+            errno != EINPROGRESS)
+        return false;
+
+    check->state = CHECK_CONNECTING;
+
+    return check_watch(engine, idx, EPOLLOUT, EPOLL_CTL_ADD);
+}
+
+/**
+ * @brief Hand the exec check to an idle runner
+ *
+ * The check is queued until a runner finished its command
+ * if all runners are busy.
+ */
+static void
+check_exec(check_engine_t *engine, uint32_t idx)
+{
+    check_t *check = &engine->checks[idx];
+    runner_t *runner = engine->runners ? runner_acquire(engine->runners) : NULL;
+
+    if (runner == NULL)
+    {
+        if (engine->runners && runner_pool_alive(engine->runners) > 0)
+        {
+            uint32_t tail = (engine->waiting_head + engine->num_waiting++) % engine->capacity;
+
+            check->state = CHECK_PENDING;
+            engine->waiting[tail] = idx;
+            return;
+        }
+
+        /* not being able to run the check says nothing
+         * about the health of the watched process */
+        log_warn("No check runner available to run exec check - skipping");
+
+        check->error = ECHILD;
+        check->skipped = true;
+        check_finish(engine, check, false, false);
+        return;
+    }
+
+    check->request_id = runner_submit(engine->runners, runner, check->watch, check->timeout);
+
+    if (check->request_id == 0)
+    {
+        check->error = errno;
+        check_finish(engine, check, false, false);
+        return;
+    }
+
+    struct epoll_event event =
+    {
+        .events = EPOLLIN,
+        .data.u64 = idx
+    };
+
+    check->runner = runner;
+    check->state = CHECK_RECEIVING;
+    check->started = time_us();
+
+    /* the runner kills the command on timeout and reports
+     * that within the grace period */
+    check->deadline = time_ms() + check->timeout + NYX_RUNNER_GRACE_MS;
+
+    if (epoll_ctl(engine->epfd, EPOLL_CTL_ADD, runner->reply_fd, &event) != 0)
+    {
+        log_perror("nyx: epoll_ctl");
+
+        check->error = errno;
+        check_finish(engine, check, false, false);
+        return;
+    }
+
+    engine->active[engine->num_active++] = idx;
+}
+
+static void
+check_exec_receive(check_engine_t *engine, check_t *check)
+{
+    runner_result_t result;
+    int32_t received = runner_receive(check->runner, &result);
+
+    if (received == 0)
+        return;
+
+    if (received < 0)
+    {
+        check->error = EPIPE;
+        check_finish(engine, check, false, false);
+        return;
+    }
+
+    if (result.id != check->request_id)
+        return;
+
+    check->status = result.status;
+    check->error = result.error;
+
+    check_finish(engine, check, result.error == 0 && result.status == 0, false);
+}
+
+/**
+ * @brief Hand the waiting exec checks to the runners that became idle
+ *
+ * Runners may become available while the concurrency limit is reached
+ * (respawned runners or abandoned requests of earlier runs finishing),
+ * so the waiting checks stay queued until an active check finished.
+ */
+static void
+check_dispatch(check_engine_t *engine)
+{
+    while (engine->num_waiting > 0 && engine->num_active < engine->max_concurrent)
+    {
+        /* keep the order of the waiting checks as long as there
+         * are busy runners at all */
+        if (runner_pool_alive(engine->runners) > 0 && runner_acquire(engine->runners) == NULL)
+            break;
+
+        uint32_t idx = engine->waiting[engine->waiting_head];
+
+        engine->waiting_head = (engine->waiting_head + 1) % engine->capacity;
+        engine->num_waiting--;
+
+        check_exec(engine, idx);
+    }
+}
+
+static void
+check_start(check_engine_t *engine, uint32_t idx, uint64_t now)
+{
+    check_t *check = &engine->checks[idx];
+
+    check->deadline = now + check->timeout;
+    check->started = time_us();
+
+    if (check->type == CHECK_EXEC)
+    {
+        check_exec(engine, idx);
+        return;
+    }
+
+    if (check->type == CHECK_HTTP)
+    {
+        const char *method = http_method_to_string(check->method);
+        const char *path = check->url ? check->url : "";
+
+        /* remove leading slash if necessary */
+        if (*path == '/')
+            path = path + 1;
+
+        size_t length = LEN(REQUEST_TEMPLATE) + strlen(method) + strlen(path);
+        char *request = check->request_buffer;
+
+        if (length > sizeof(check->request_buffer))
+            request = check->request = xcalloc(length, sizeof(char));
+
+        check->request_length = snprintf(request, length, REQUEST_TEMPLATE, method, path);
+
+        /* reuse an idle connection to the same port */
+        check->fd = connection_take(engine, check->port);
+
+        if (check->fd >= 0)
+        {
+            check->reused = true;
+            check->state = CHECK_SENDING;
+
+            if (!check_watch(engine, idx, EPOLLOUT, EPOLL_CTL_ADD))
+            {
+                check_finish(engine, check, false, false);
+                return;
+            }
+
+            engine->active[engine->num_active++] = idx;
+            return;
+        }
+    }
+
+    if (check->endpoint)
+    {
+        /* the endpoint's addresses are resolved in the background
+         * so a slow resolver never stalls the checks */
+        int32_t resolved = endpoint_address(check->endpoint, &check->address);
+
+        if (resolved == 0)
+        {
+            log_debug("Skipping check of '%s' - address is not resolved yet",
+                    check->endpoint->host);
+
+            check_finish(engine, check, true, false);
+            return;
+        }
+
+        if (resolved < 0)
+        {
+            check_finish(engine, check, false, false);
+            return;
+        }
+    }
+
+    if (!check_connect(engine, idx))
+    {
+        check_finish(engine, check, false, false);
+        return;
+    }
+
+    engine->active[engine->num_active++] = idx;
+}
+
+/**
+ * @brief Reconnect a reused connection that was closed by the server
+ *        before it sent any response
+ * @return true if the check is resumed on a new connection
+ */
+static bool
+check_retry(check_engine_t *engine, uint32_t idx)
+{
+    check_t *check = &engine->checks[idx];
+
+    if (!check->reused || check->received > 0)
+        return false;
+
+    check->reused = false;
+    check->sent = 0;
+
+    close(check->fd);
+    check->fd = -1;
+
+    return check_connect(engine, idx);
+}
+
+static void
+check_fail(check_engine_t *engine, uint32_t idx)
+{
+    if (!check_retry(engine, idx))
+        check_finish(engine, &engine->checks[idx], false, false);
+}
+
+/**
+ * @brief Evaluate the complete response headers and decide whether
+ *        the body has to be drained before the connection is reused
+ */
+static void
+check_evaluate(check_engine_t *engine, check_t *check)
+{
+    http_response_t *http = &check->http;
+    bool success = http->status == 200;
+    uint32_t body_received = check->received - http->header_length;
+
+    if (!success)
+    {
+        log_warn("HTTP check to '%s' failed with return code %u",
+                (check->url ? check->url : "/"), http->status);
+    }
+
+    if (check->method == HTTP_HEAD ||
+            http->status / 100 == 1 ||
+            http->status == 204 ||
+            http->status == 304)
+    {
+        /* there is no body at all */
+        check_finish(engine, check, success, http->keep_alive && body_received == 0);
+        return;
+    }
+
+    /* chunked bodies and bodies delimited by the connection's end
+     * are not drained but the connection is not reused instead */
+    if (!http->keep_alive ||
+            http->chunked ||
+            http->content_length < 0 ||
+            http->content_length > NYX_CHECK_MAX_DRAIN ||
+            body_received > http->content_length)
+    {
+        check_finish(engine, check, success, false);
+        return;
+    }
+
+    check->success = success;
+    check->body_remaining = http->content_length - body_received;
+
+    if (check->body_remaining == 0)
+        check_finish(engine, check, success, true);
+    else
+        check->state = CHECK_DRAINING;
+}
+
+static void
+check_drain(check_engine_t *engine, check_t *check)
+{
+    char buffer[4096];
+
+    while (check->body_remaining > 0)
+    {
+        ssize_t res = recv(check->fd, buffer,
+                MIN(sizeof(buffer), check->body_remaining), 0);
+
+        if (res > 0)
+            check->body_remaining -= res;
+        else if (res < 0 && (errno == EAGAIN || errno == EWOULDBLOCK))
+            return;
+        else if (res < 0 && errno == EINTR)
+            continue;
+        else
+        {
+            /* the status is known already - just don't reuse the connection */
+            check_finish(engine, check, check->success, false);
+            return;
+        }
+    }
+
+    check_finish(engine, check, check->success, true);
+}
+
+static void
+check_receive(check_engine_t *engine, uint32_t idx)
+{
+    check_t *check = &engine->checks[idx];
+
+    while (check->received < sizeof(check->response))
+    {
+        ssize_t res = recv(check->fd, check->response + check->received,
+                sizeof(check->response) - check->received, 0);
+
+        if (res > 0)
+        {
+            check->received += res;
+
+            int32_t parsed = http_parse_response(check->response, check->received, &check->http);
+
+            if (parsed > 0)
+            {
+                check_evaluate(engine, check);
+
+                if (check->state == CHECK_DRAINING)
+                    check_drain(engine, check);
+                return;
+            }
+
+            if (parsed < 0)
+                break;
+        }
+        else if (res < 0 && (errno == EAGAIN || errno == EWOULDBLOCK))
+            return;
+        else if (res < 0 && errno == EINTR)
+            continue;
+        else
+        {
+            check_fail(engine, idx);
+            return;
+        }
+    }
+
+    log_warn("HTTP check to '%s' received a malformed response",
+            (check->url ? check->url : "/"));
+
+    check_finish(engine, check, false, false);
+}
+
+static void
+check_send(check_engine_t *engine, uint32_t idx)
+{
+    check_t *check = &engine->checks[idx];
+    const char *request = check->request ? check->request : check->request_buffer;
+
+    while (check->sent < check->request_length)
+    {
+        ssize_t res = send_safe(check->fd, request + check->sent,
+                check->request_length - check->sent);
+
+        if (res > 0)
+            check->sent += res;
+        else if (res < 0 && (errno == EAGAIN || errno == EWOULDBLOCK))
+            return;
+        else if (res < 0 && errno == EINTR)
+            continue;
+        else
+        {
+            check_fail(engine, idx);
+            return;
+        }
+    }
+
+    check->state = CHECK_RECEIVING;
+
+    if (!check_watch(engine, idx, EPOLLIN | EPOLLRDHUP, EPOLL_CTL_MOD))
+        check_finish(engine, check, false, false);
+}
+
+static void
+check_handle(check_engine_t *engine, uint32_t idx)
+{
+    check_t *check = &engine->checks[idx];
+
+    switch (check->state)
+    {
+        case CHECK_CONNECTING:
+        {
+            int32_t error = 0;
+            socklen_t len = sizeof(error);
+
+            if (getsockopt(check->fd, SOL_SOCKET, SO_ERROR, &error, &len) != 0 || error != 0)
+            {
+                check_finish(engine, check, false, false);
+                return;
+            }
+
+            if (check->type == CHECK_PORT)
+            {
+                check_finish(engine, check, true, false);
+                return;
+            }
+
+            check->state = CHECK_SENDING;
+            check_send(engine, idx);
+            break;
+        }
+
+        case CHECK_SENDING:
+            check_send(engine, idx);
+            break;
+
+        case CHECK_RECEIVING:
+            if (check->type == CHECK_EXEC)
+                check_exec_receive(engine, check);
+            else
+                check_receive(engine, idx);
+            break;
+
+        case CHECK_DRAINING:
+            check_drain(engine, check);
+            break;
+
+        default:
+            break;
+    }
+}
+
+/**
+ * @brief Drop finished checks from the active ones and fail all
+ *        checks that exceeded their deadline
+ * @return time in ms until the next deadline
+ */
+static int32_t
+check_expire(check_engine_t *engine, uint64_t now, bool cancel)
+{
+    uint32_t i = 0;
+    uint64_t next = UINT64_MAX;
+
+    while (i < engine->num_active)
+    {
+        check_t *check = &engine->checks[engine->active[i]];
+
+        if (check->state != CHECK_DONE && (cancel || check->deadline <= now))
+        {
+            /* the status of a check that is draining the body is known already */
+            bool success = check->state == CHECK_DRAINING && check->success;
+
+            check_finish(engine, check, success, false);
+        }
+
+        if (check->state == CHECK_DONE)
+        {
+            engine->active[i] = engine->active[--engine->num_active];
+            continue;
+        }
+
+        next = MIN(next, check->deadline);
+        i++;
+    }
+
+    return next == UINT64_MAX ? 0 : next - now;
+}
+
+/**
+ * @brief Run all added checks concurrently
+ * @param engine  check engine
+ * @param cancel  checked on interruption - all pending checks
+ *                are aborted if set
+ * @return false if the run was cancelled, true otherwise
+ *
+ * At most 'max_concurrent' checks are in flight at any time and every
+ * check is failed once its timeout elapsed. So the run takes roughly as
+ * long as the slowest check (per batch of 'max_concurrent' checks).
+ */
+bool
+check_engine_run(check_engine_t *engine, const volatile bool *cancel)
+{
+    uint32_t next = 0;
+    struct epoll_event events[NYX_CHECK_MAX_EVENTS];
+
+    while (next < engine->count || engine->num_active > 0 || engine->num_waiting > 0)
+    {
+        uint64_t now = time_ms();
+
+        if (cancel && *cancel)
+        {
+            check_expire(engine, now, true);
+            return false;
+        }
+
+        /* issue further checks up to the concurrency limit */
+        check_dispatch(engine);
+
+        while (next < engine->count && engine->num_active < engine->max_concurrent)
+            check_start(engine, next++, now);
+
+        int32_t timeout = check_expire(engine, now, false);
+
+        /* runners might become idle without notice (abandoned
+         * requests of earlier runs) so waiting checks are retried
+         * regularly */
+        if (engine->num_waiting > 0)
+        {
+            timeout = engine->num_active > 0
+                ? MIN(timeout, NYX_CHECK_RUNNER_POLL_MS)
+                : NYX_CHECK_RUNNER_POLL_MS;
+        }
+        else if (engine->num_active < 1)
+            continue;
+
+        int32_t count = epoll_wait(engine->epfd, events, NYX_CHECK_MAX_EVENTS, timeout);
+
+        if (count < 0 && errno != EINTR)
+        {
+            log_perror("nyx: epoll_wait");
+            check_expire(engine, now, true);
+            break;
+        }
+
+        for (int32_t i = 0; i < count; i++)
+            check_handle(engine, events[i].data.u64);
+
+        check_expire(engine, time_ms(), false);
+    }
+
+    connection_expire(engine, time_ms());
+
+    return true;
+}
+#else
+bool
+check_engine_run(check_engine_t *engine, const volatile bool *cancel)
+{
+    for (uint32_t i = 0; i < engine->count; i++)
+    {
+        check_t *check = &engine->checks[i];
+
+        if (cancel && *cancel)
+            return false;
+
+        if (check->type == CHECK_EXEC)
+        {
+            runner_result_t result;
+
+            check->success = engine->runners &&
+                runner_run(engine->runners, check->watch, check->timeout, &result);
+
+            check->status = check->success ? result.status : -1;
+            check->error = check->success ? result.error : errno;
+            check->success &= check->error == 0 && check->status == 0;
+
+            /* no runner available to run the check at all */
+            check->skipped = engine->runners == NULL || check->error == EBUSY;
+        }
+        else if (check->type == CHECK_HTTP)
+            check->success = check_http(check->url, check->port, check->method);
+        else if (check->endpoint)
+            check->success = check_port(check->endpoint->host, check->port);
+        else
+            check->success = check_local_port(check->port);
+
+        check->state = CHECK_DONE;
+    }
+
+    return true;
+}
+#endif
+
+/**
+ * @brief Remove all checks (of the last run) from the engine
+ */
+void
+check_engine_reset(check_engine_t *engine)
+{
+    for (uint32_t i = 0; i < engine->count; i++)
+    {
+        check_t *check = &engine->checks[i];
+
+        if (check->state != CHECK_DONE)
+            check_finish(engine, check, false, false);
+    }
+
+    engine->count = 0;
+    engine->num_active = 0;
+    engine->waiting_head = 0;
+    engine->num_waiting = 0;
+}
+
+void
+check_engine_destroy(check_engine_t *engine)
+{
+    check_engine_reset(engine);
+
+#ifndef OSX
+    close(engine->epfd);
+#endif
+
+    hash_destroy(engine->connections);
+    free(engine->checks);
+    free(engine->waiting);
+    free(engine->active);
+    free(engine);
+}
+
+/* vim: set et sw=4 sts=4 tw=80: */
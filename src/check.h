@@ -0,0 +1,171 @@
+/* Copyright 2014-2019 Gregor Uhlenheuer
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#pragma once
+
+#include "hash.h"
+#include "runner.h"
+#include "socket.h"
+#include "watch.h"
+
+#include <stdbool.h>
+#include <stdint.h>
+
+/* maximum number of checks that are in flight at the same time
+ * (further limited by the number of open files allowed) */
+#define NYX_CHECK_MAX_CONCURRENT 1024
+
+/* timeouts (in ms) of the individual checks */
+#define NYX_CHECK_PORT_TIMEOUT_MS  3000
+#define NYX_CHECK_LOCAL_TIMEOUT_MS 1000
+#define NYX_CHECK_HTTP_TIMEOUT_MS  1000
+
+/* time in ms exec checks waiting for an idle runner are retried after */
+#define NYX_CHECK_RUNNER_POLL_MS 50
+
+/* time in ms idle keep-alive connections are kept open */
+#define NYX_CHECK_KEEPALIVE_MS 60000
+
+/* maximum size of an HTTP response's status line and headers */
+#define NYX_CHECK_RESPONSE_SIZE 2048
+
+/* HTTP response bodies larger than that are not drained
+ * but the connection is closed instead */
+#define NYX_CHECK_MAX_DRAIN (64 * 1024)
+
+typedef enum
+{
+    CHECK_PORT,
+    CHECK_HTTP,
+    CHECK_EXEC
+} check_type_e;
+
+typedef enum
+{
+    CHECK_PENDING,
+    CHECK_CONNECTING,
+    CHECK_SENDING,
+    CHECK_RECEIVING,
+    CHECK_DRAINING,
+    CHECK_DONE
+} check_state_e;
+
+typedef struct
+{
+    /** HTTP status code */
+    uint16_t status;
+    /** whether the connection may be reused */
+    bool keep_alive;
+    /** whether the body is sent in chunks */
+    bool chunked;
+    /** length of the body (-1 if not specified) */
+    int64_t content_length;
+    /** length of the status line and headers including the empty line */
+    uint32_t header_length;
+} http_response_t;
+
+typedef struct
+{
+    check_type_e type;
+    /** remote endpoint to connect to (NULL for localhost) */
+    endpoint_t *endpoint;
+    uint16_t port;
+    /** HTTP endpoint (CHECK_HTTP only) */
+    const char *url;
+    http_method_e method;
+    /** watch whose exec check is run (CHECK_EXEC only) */
+    watch_t *watch;
+    /** time in ms the check has to finish in */
+    uint32_t timeout;
+    /** arbitrary data of the check's issuer */
+    void *data;
+    /** arbitrary identifier of the check's issuer */
+    int64_t id;
+    /** whether the check succeeded (valid once the engine is run) */
+    bool success;
+    /** time in us the check took (valid once the engine is run) */
+    uint64_t latency;
+    /** exit code of the command (CHECK_EXEC only) */
+    int32_t status;
+    /** errno of the failed command (CHECK_EXEC only) */
+    int32_t error;
+    /** the check could not be run at all - neither success nor failure */
+    bool skipped;
+
+    /* internal state */
+    check_state_e state;
+    int32_t fd;
+    uint64_t started;
+    uint64_t deadline;
+    struct sockaddr_in address;
+    /** whether the connection was reused from an earlier check */
+    bool reused;
+    /** request (NULL if it fits into 'request_buffer') */
+    char *request;
+    char request_buffer[256];
+    uint32_t request_length;
+    uint32_t sent;
+    http_response_t http;
+    uint64_t body_remaining;
+    uint32_t received;
+    char response[NYX_CHECK_RESPONSE_SIZE];
+    /** runner executing the command (CHECK_EXEC only) */
+    runner_t *runner;
+    uint32_t request_id;
+} check_t;
+
+typedef struct check_engine_t
+{
+    /** checks that are run on the next 'check_engine_run' */
+    check_t *checks;
+    uint32_t count;
+    uint32_t capacity;
+    /** maximum number of checks in flight */
+    uint32_t max_concurrent;
+    /** indexes of the checks in flight */
+    uint32_t *active;
+    uint32_t num_active;
+    /** idle keep-alive HTTP connections by their port */
+    hash_t *connections;
+    /** runners executing the exec checks (NULL if not available) */
+    runner_pool_t *runners;
+    /** ring of the exec checks waiting for an idle runner */
+    uint32_t *waiting;
+    uint32_t waiting_head;
+    uint32_t num_waiting;
+#ifndef OSX
+    int32_t epfd;
+#endif
+} check_engine_t;
+
+check_engine_t *
+check_engine_new(uint32_t max_concurrent);
+
+check_t *
+check_engine_add(check_engine_t *engine, check_type_e type, uint16_t port, uint32_t timeout);
+
+bool
+check_engine_run(check_engine_t *engine, const volatile bool *cancel);
+
+void
+check_engine_reset(check_engine_t *engine);
+
+void
+check_engine_destroy(check_engine_t *engine);
+
+int32_t
+http_parse_response(const char *buffer, uint32_t length, http_response_t *response);
+
+/* vim: set et sw=4 sts=4 tw=80: */
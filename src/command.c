@@ -174,6 +174,18 @@ handle_config(sender_callback_t *cb, const char **input, nyx_t *nyx)
     if (watch->max_cpu)
         cb->sender(cb, "max_cpu: %u", watch->max_cpu);
 
+    if (watch->max_cpu || watch->max_memory)
+    {
+        cb->sender(cb, "check_window: %u", watch_check_window(watch));
+        cb->sender(cb, "check_limit: %u", watch_check_limit(watch));
+    }
+
+    if (watch->sample_interval)
+        cb->sender(cb, "sample_interval: %u", watch->sample_interval);
+
+    if (watch->check_interval)
+        cb->sender(cb, "check_interval: %u", watch->check_interval);
+
     if (watch->port_check)
     {
         if (watch->port_check->host)
@@ -196,6 +208,14 @@ handle_config(sender_callback_t *cb, const char **input, nyx_t *nyx)
                 watch->http_check_port ? watch->http_check_port : 80);
     }
 
+    if (watch->exec_check)
+    {
+        send_strings(cb, "exec_check", watch->exec_check);
+        cb->sender(cb, "exec_check_timeout: %u", watch->exec_check_timeout
+                ? watch->exec_check_timeout
+                : WATCH_DEFAULT_EXEC_CHECK_TIMEOUT);
+    }
+
     cb->sender(cb, "startup_delay: %u", watch->startup_delay);
 
     send_keys(cb, "env", watch->env);
@@ -222,7 +242,7 @@ handle_history(sender_callback_t *cb, const char **input, nyx_t *nyx)
 
     while (i-- > 0)
     {
-        timestack_elem_t *elem = &state->history->elements[i];
+        timestack_elem_t *elem = timestack_get(state->history, i);
         struct tm *ltime = localtime(&elem->time);
 
         cb->sender(cb, "%04d-%02d-%02dT%02d:%02d:%02d: %s",
@@ -254,7 +274,7 @@ static bool
 handle_terminate(sender_callback_t *cb, UNUSED const char **input, nyx_t *nyx)
 {
     /* trigger the eventfd */
-    signal_eventfd(4, nyx);
+    signal_eventfd(NYX_EVENT_LOOPS, nyx);
 
     /* trigger the termination handler (if specified) */
     if (nyx->terminate_handler)
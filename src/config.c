@@ -360,11 +360,17 @@ DECLARE_WATCH_STR_VALUE(error_file)
 DECLARE_WATCH_STR_VALUE(http_check)
 DECLARE_WATCH_STR_LIST_VALUE(start)
 DECLARE_WATCH_STR_LIST_VALUE(stop)
+DECLARE_WATCH_STR_LIST_VALUE(exec_check)
 DECLARE_WATCH_STR_FUNC(max_memory, parse_size_unit)
 DECLARE_WATCH_STR_FUNC(max_cpu, uatoi)
+DECLARE_WATCH_STR_FUNC(check_window, uatoi)
+DECLARE_WATCH_STR_FUNC(check_limit, uatoi)
+DECLARE_WATCH_STR_FUNC(sample_interval, uatoi)
+DECLARE_WATCH_STR_FUNC(check_interval, uatoi)
 DECLARE_WATCH_STR_FUNC(stop_timeout, uatoi)
 DECLARE_WATCH_STR_FUNC(port_check, parse_endpoint)
 DECLARE_WATCH_STR_FUNC(startup_delay, uatoi)
+DECLARE_WATCH_STR_FUNC(exec_check_timeout, uatoi)
 
 #undef DECLARE_WATCH_STR_VALUE
 #undef DECLARE_WATCH_STR_LIST_VALUE
@@ -568,6 +574,7 @@ handle_watch_string(parse_info_t *info, yaml_event_t *event, void *data)
 
 DECLARE_WATCH_STR_LIST(start)
 DECLARE_WATCH_STR_LIST(stop)
+DECLARE_WATCH_STR_LIST(exec_check)
 
 #undef DECLARE_WATCH_STR_LIST
 
@@ -582,13 +589,19 @@ static struct config_parser_map watch_value_map[] =
     SCALAR_HANDLER("error_file", handle_watch_map_value_error_file),
     SCALAR_HANDLER("max_memory", handle_watch_map_value_max_memory),
     SCALAR_HANDLER("max_cpu", handle_watch_map_value_max_cpu),
+    SCALAR_HANDLER("check_window", handle_watch_map_value_check_window),
+    SCALAR_HANDLER("check_limit", handle_watch_map_value_check_limit),
+    SCALAR_HANDLER("sample_interval", handle_watch_map_value_sample_interval),
+    SCALAR_HANDLER("check_interval", handle_watch_map_value_check_interval),
     SCALAR_HANDLER("stop_timeout", handle_watch_map_value_stop_timeout),
     SCALAR_HANDLER("port_check", handle_watch_map_value_port_check),
     SCALAR_HANDLER("startup_delay", handle_watch_map_value_startup_delay),
+    SCALAR_HANDLER("exec_check_timeout", handle_watch_map_value_exec_check_timeout),
     MAP_HANDLER("env", handle_watch_env),
     HANDLERS("http_check", handle_watch_map_value_http_check, NULL, handle_watch_http_check_map),
     HANDLERS("start", handle_watch_map_value_start, handle_watch_strings_start, NULL),
     HANDLERS("stop", handle_watch_map_value_stop, handle_watch_strings_stop, NULL),
+    HANDLERS("exec_check", handle_watch_map_value_exec_check, handle_watch_strings_exec_check, NULL),
     { NULL, {0}, NULL }
 };
 
@@ -785,7 +798,9 @@ DECLARE_NYX_FUNC_VALUE(uatoi, check_interval)
 DECLARE_NYX_FUNC_VALUE(uatoi, history_size)
 DECLARE_NYX_FUNC_VALUE(uatoi, http_port)
 DECLARE_NYX_FUNC_VALUE(uatoi, startup_delay)
+DECLARE_NYX_FUNC_VALUE(uatoi, check_runners)
 DECLARE_NYX_FUNC_VALUE(strdup, log_file)
+DECLARE_NYX_FUNC_VALUE(strdup, cgroup_root)
 
 #ifdef USE_PLUGINS
 DECLARE_NYX_FUNC_VALUE(strdup, plugins)
@@ -798,9 +813,11 @@ static struct config_parser_map nyx_value_map[] =
     SCALAR_HANDLER("polling_interval", handle_nyx_value_polling_interval),
     SCALAR_HANDLER("check_interval", handle_nyx_value_check_interval),
     SCALAR_HANDLER("startup_delay", handle_nyx_value_startup_delay),
+    SCALAR_HANDLER("check_runners", handle_nyx_value_check_runners),
     SCALAR_HANDLER("history_size", handle_nyx_value_history_size),
     SCALAR_HANDLER("http_port", handle_nyx_value_http_port),
     SCALAR_HANDLER("log_file", handle_nyx_value_log_file),
+    SCALAR_HANDLER("cgroup_root", handle_nyx_value_cgroup_root),
 #ifdef USE_PLUGINS
     SCALAR_HANDLER("plugin_dir", handle_nyx_value_plugins),
 #endif
@@ -1177,7 +1194,7 @@ parse_config(nyx_t *nyx, bool silent)
             char *file_path = xcalloc(full_path_len, sizeof(char));
             snprintf(file_path, full_path_len, "%s/%s", config_file, file_name);
 
-            cfg = fopen(file_path, "r");
+            cfg = fopen(file_path, "re");
             if (cfg == NULL)
             {
                 log_warn("failed to load config file %s", file_path);
@@ -1196,7 +1213,7 @@ parse_config(nyx_t *nyx, bool silent)
     else
     {
         /* read input file */
-        cfg = fopen(config_file, "r");
+        cfg = fopen(config_file, "re");
         if (cfg == NULL)
         {
             log_perror("nyx: fopen");
@@ -222,7 +222,7 @@ connector_call(const char *socket_path, const char **commands, bool quiet)
         return NYX_NO_DAEMON_FOUND;
 
     /* create a UNIX domain, connection based socket */
-    sock = socket(AF_UNIX, SOCK_STREAM, 0);
+    sock = socket(AF_UNIX, SOCK_STREAM | NYX_SOCK_CLOEXEC, 0);
 
     if (sock == -1)
     {
@@ -475,12 +475,7 @@ connector_run(nyx_t *nyx)
     mode_t old_mask = umask(0);
 
     /* create a UNIX domain, connection based socket */
-    int32_t sock =
-#if defined(SOCK_CLOEXEC)
-        socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
-#else
-        socket(AF_UNIX, SOCK_STREAM, 0);
-#endif
+    int32_t sock = socket(AF_UNIX, SOCK_STREAM | NYX_SOCK_CLOEXEC, 0);
 
     if (sock == -1)
     {
@@ -526,10 +521,10 @@ connector_run(nyx_t *nyx)
 
     /* initialize epoll/kqueue */
 #ifndef OSX
-    epfd = epoll_create(NYX_CONNECTOR_MAX_CONN);
+    epfd = epoll_create1(EPOLL_CLOEXEC);
     if (epfd == -1)
     {
-        log_perror("nyx: epoll_create");
+        log_perror("nyx: epoll_create1");
         goto teardown;
     }
 #else
@@ -633,7 +628,11 @@ connector_run(nyx_t *nyx)
                 struct sockaddr_un caddr;
                 socklen_t client_len = sizeof(struct sockaddr_un);
 
+#if defined(SOCK_CLOEXEC)
+                client = accept4(extra->fd, (struct sockaddr *)&caddr, &client_len, SOCK_CLOEXEC);
+#else
                 client = accept(extra->fd, (struct sockaddr *)&caddr, &client_len);
+#endif
 
                 if (client == -1)
                 {
@@ -13,19 +13,27 @@
  * limitations under the License.
  */
 
+#define _GNU_SOURCE
+
 #include "def.h"
 #include "event.h"
 #include "log.h"
+#include "process.h"
+#include "state.h"
 #include "socket.h"
 
 /* we want to include sys/socket.h before linux/netlink.h
  * to avoid some compilation problems with some 2.6 kernels */
 #include <sys/socket.h>
 
+#include <arpa/inet.h>
 #include <errno.h>
 #include <linux/cn_proc.h>
 #include <linux/connector.h>
+#include <linux/filter.h>
 #include <linux/netlink.h>
+#include <pthread.h>
+#include <stddef.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
@@ -33,8 +41,53 @@
 
 #define NYX_MAX_EVENTS 16
 
+/** number of netlink messages received with one system call */
+#define NYX_NETLINK_BATCH 64
+
+/** receive buffer size of the netlink socket */
+#define NYX_NETLINK_RCVBUF (4 * 1024 * 1024)
+
+/** offset of the 'proc_event' in a received netlink message */
+#define NYX_PROC_EVENT_OFFSET (NLMSG_LENGTH(0) + sizeof(struct cn_msg))
+
+/** number of PID comparisons that share one 'accept' instruction
+ * (jump offsets of classic BPF are limited to 8 bits) */
+#define NYX_FILTER_BLOCK 250
+
 static volatile bool need_exit = false;
 
+/** a process event as received from the netlink socket */
+typedef struct __attribute__ ((aligned(NLMSG_ALIGNTO)))
+{
+    struct nlmsghdr nl_hdr;
+    struct __attribute__ ((__packed__))
+    {
+        struct cn_msg cn_msg;
+        struct proc_event proc_ev;
+    } data;
+} proc_message_t;
+
+/** buffers to receive a batch of process events */
+typedef struct
+{
+    proc_message_t messages[NYX_NETLINK_BATCH];
+    struct iovec iovecs[NYX_NETLINK_BATCH];
+    struct mmsghdr headers[NYX_NETLINK_BATCH];
+} proc_batch_t;
+
+/** netlink socket the PID filter is attached to (or -1) */
+static int32_t filter_sock = -1;
+
+/** lock serializing the filter updates */
+static pthread_mutex_t filter_lock = PTHREAD_MUTEX_INITIALIZER;
+
+/** number of requested and applied filter updates */
+static uint64_t filter_requested = 0;
+static uint64_t filter_applied = 0;
+
+/** filter program buffer (guarded by 'filter_lock') */
+static struct sock_filter filter_program[BPF_MAXINSNS];
+
 /**
  * Open netlink socket connection
  */
@@ -61,6 +114,14 @@ netlink_connect(void)
     addr.nl_groups = CN_IDX_PROC;
     addr.nl_pid = getpid();
 
+    /* a larger receive buffer for bursts of process events -
+     * try to exceed the system limit first (requires CAP_NET_ADMIN) */
+    int32_t rcvbuf = NYX_NETLINK_RCVBUF;
+
+    if (setsockopt(netlink_socket, SOL_SOCKET, SO_RCVBUFFORCE, &rcvbuf, sizeof(rcvbuf)) == -1 &&
+        setsockopt(netlink_socket, SOL_SOCKET, SO_RCVBUF, &rcvbuf, sizeof(rcvbuf)) == -1)
+        log_perror("nyx: setsockopt");
+
     int32_t rc = bind(netlink_socket, (struct sockaddr *)&addr, sizeof(addr));
 
     if (rc == -1)
@@ -116,6 +177,146 @@ set_process_event_listen(int32_t sock, bool enable)
     return true;
 }
 
+/**
+ * @brief Number of instructions of the filter program for the given
+ *        number of PIDs
+ */
+static uint32_t
+filter_length(uint32_t count)
+{
+    uint32_t blocks = (count + NYX_FILTER_BLOCK - 1) / NYX_FILTER_BLOCK;
+
+    /* 5 instructions overhead plus 2 per block */
+    return 5 + count + 2 * blocks;
+}
+
+/**
+ * @brief Generate the socket filter program for the given PIDs
+ * @param program buffer of at least BPF_MAXINSNS instructions
+ * @param pids    watched PIDs (NULL to pass all exit events)
+ * @param count   number of PIDs
+ * @return number of instructions
+ *
+ * The program drops all events but EXIT events of the given PIDs.
+ * All exit events are passed if there are too many PIDs for one
+ * program. Note that BPF_ABS loads are in network byte order whereas
+ * the netlink messages are in host byte order.
+ */
+uint16_t
+event_build_filter(struct sock_filter *program, pid_t *pids, uint32_t count)
+{
+    uint16_t length = 0;
+
+    const uint32_t what_offset = NYX_PROC_EVENT_OFFSET +
+        offsetof(struct proc_event, what);
+    const uint32_t pid_offset = NYX_PROC_EVENT_OFFSET +
+        offsetof(struct proc_event, event_data.exit.process_pid);
+
+    /* drop everything but exit events */
+    program[length++] = (struct sock_filter)BPF_STMT(BPF_LD | BPF_W | BPF_ABS, what_offset);
+    program[length++] = (struct sock_filter)BPF_JUMP(BPF_JMP | BPF_JEQ | BPF_K,
+            htonl(PROC_EVENT_EXIT), 1, 0);
+    program[length++] = (struct sock_filter)BPF_STMT(BPF_RET | BPF_K, 0);
+
+    if (pids == NULL || filter_length(count) > BPF_MAXINSNS)
+    {
+        program[length++] = (struct sock_filter)BPF_STMT(BPF_RET | BPF_K, 0xffffffff);
+        return length;
+    }
+
+    program[length++] = (struct sock_filter)BPF_STMT(BPF_LD | BPF_W | BPF_ABS, pid_offset);
+
+    /* the PIDs are compared in blocks: every match jumps to the
+     * 'accept' at the end of its block, otherwise the 'accept' is
+     * skipped and the next block is checked */
+    for (uint32_t i = 0; i < count; i += NYX_FILTER_BLOCK)
+    {
+        uint32_t block = MIN(count - i, NYX_FILTER_BLOCK);
+
+        for (uint32_t j = 0; j < block; j++)
+        {
+            program[length++] = (struct sock_filter)BPF_JUMP(BPF_JMP | BPF_JEQ | BPF_K,
+                    htonl(pids[i + j]), block - j, 0);
+        }
+
+        program[length++] = (struct sock_filter)BPF_JUMP(BPF_JMP | BPF_JA, 1, 0, 0);
+        program[length++] = (struct sock_filter)BPF_STMT(BPF_RET | BPF_K, 0xffffffff);
+    }
+
+    program[length++] = (struct sock_filter)BPF_STMT(BPF_RET | BPF_K, 0);
+
+    return length;
+}
+
+/**
+ * @brief Attach a filter of the currently watched PIDs to the socket
+ */
+static void
+attach_filter(int32_t sock, nyx_t *nyx)
+{
+    uint32_t count = 0;
+    pid_t *pids = state_collect_pids(nyx, &count);
+
+    struct sock_fprog fprog =
+    {
+        .len = event_build_filter(filter_program, pids, count),
+        .filter = filter_program
+    };
+
+    if (setsockopt(sock, SOL_SOCKET, SO_ATTACH_FILTER, &fprog, sizeof(fprog)) == -1)
+    {
+        log_perror("nyx: setsockopt");
+    }
+    else
+    {
+        log_debug("Attached process event filter for %u PIDs",
+                filter_length(count) > BPF_MAXINSNS ? 0 : count);
+    }
+
+    free(pids);
+}
+
+/**
+ * @brief Update the process event filter after the PID of
+ *        some watch changed
+ * @param nyx nyx instance
+ *
+ * The filter is updated before this function returns. Concurrent
+ * updates are coalesced into one.
+ */
+void
+event_filter_update(nyx_t *nyx)
+{
+    uint64_t generation = __atomic_add_fetch(&filter_requested, 1, __ATOMIC_SEQ_CST);
+
+    pthread_mutex_lock(&filter_lock);
+
+    if (filter_applied < generation && filter_sock >= 0)
+    {
+        /* this update covers all requests up to now */
+        uint64_t requested = __atomic_load_n(&filter_requested, __ATOMIC_SEQ_CST);
+
+        attach_filter(filter_sock, nyx);
+
+        filter_applied = requested;
+    }
+
+    pthread_mutex_unlock(&filter_lock);
+}
+
+static void
+set_filter_socket(int32_t sock, nyx_t *nyx)
+{
+    pthread_mutex_lock(&filter_lock);
+
+    filter_sock = sock;
+
+    if (sock >= 0)
+        attach_filter(sock, nyx);
+
+    pthread_mutex_unlock(&filter_lock);
+}
+
 static bool
 subscribe_event_listen(int32_t sock)
 {
@@ -200,7 +401,97 @@ static void handle_eventfd(struct epoll_event *event, nyx_t *nyx)
 }
 
 /**
- * Handle a single process event
+ * @brief Revalidate all watched processes
+ *
+ * This is done whenever the kernel dropped process events because
+ * the receive buffer overflowed. Every watched process that does not
+ * exist anymore is handled as if its exit event was received.
+ */
+static void
+resync_processes(nyx_t *nyx, process_handler_t handler, process_event_data_t *event_data)
+{
+    uint32_t count = 0;
+    pid_t *pids = state_collect_pids(nyx, &count);
+
+    for (uint32_t i = 0; i < count; i++)
+    {
+        pid_t pid = pids[i];
+
+        if (check_process_running(pid))
+            continue;
+
+        log_debug("Resync: watched process %d is gone", pid);
+
+        memset(event_data, 0, sizeof(process_event_data_t));
+
+        event_data->type = EVENT_EXIT;
+        event_data->data.exit.pid = pid;
+        event_data->data.exit.thread_group_id = pid;
+
+        handler(pid, event_data, nyx);
+    }
+
+    free(pids);
+}
+
+/**
+ * @brief Receive and handle all pending process events
+ * @return false on a socket error, true otherwise
+ */
+static bool
+receive_process_events(int32_t sock, proc_batch_t *batch, nyx_t *nyx,
+        process_handler_t handler, process_event_data_t *event_data)
+{
+    const size_t min_length = NYX_PROC_EVENT_OFFSET +
+        offsetof(struct proc_event, event_data) + sizeof(struct exit_proc_event);
+
+    for (;;)
+    {
+        int32_t count = recvmmsg(sock, batch->headers, NYX_NETLINK_BATCH, MSG_DONTWAIT, NULL);
+
+        if (count == -1)
+        {
+            /* interrupted by a signal */
+            if (errno == EINTR)
+                continue;
+
+            /* all pending events received */
+            if (errno == EAGAIN || errno == EWOULDBLOCK)
+                return true;
+
+            /* the kernel dropped events - we have to find out
+             * which of our processes exited in the meantime */
+            if (errno == ENOBUFS)
+            {
+                log_warn("Process events were lost - revalidating all watched processes");
+
+                resync_processes(nyx, handler, event_data);
+                continue;
+            }
+
+            log_perror("nyx: recvmmsg");
+            return false;
+        }
+
+        for (int32_t i = 0; i < count; i++)
+        {
+            if (batch->headers[i].msg_len < min_length)
+                continue;
+
+            int32_t pid = set_event_data(event_data,
+                    (struct proc_event *)(void *)&(batch->messages[i].data.proc_ev));
+
+            if (pid > 0)
+                handler(pid, event_data, nyx);
+        }
+
+        if (count < NYX_NETLINK_BATCH)
+            return true;
+    }
+}
+
+/**
+ * Handle the process events
  */
 static bool
 handle_process_event(int32_t nl_sock, nyx_t *nyx, process_handler_t handler)
@@ -211,24 +502,24 @@ handle_process_event(int32_t nl_sock, nyx_t *nyx, process_handler_t handler)
     struct epoll_event *events = NULL;
 
     process_event_data_t *event_data = new_event_data();
+    proc_batch_t *batch = xcalloc1(sizeof(proc_batch_t));
 
-    struct __attribute__ ((aligned(NLMSG_ALIGNTO)))
+    for (int32_t i = 0; i < NYX_NETLINK_BATCH; i++)
     {
-        struct nlmsghdr nl_hdr;
-        struct __attribute__ ((__packed__))
-        {
-            struct cn_msg cn_msg;
-            struct proc_event proc_ev;
-        } data;
-    } nlcn_msg;
+        batch->iovecs[i].iov_base = &batch->messages[i];
+        batch->iovecs[i].iov_len = sizeof(proc_message_t);
+
+        batch->headers[i].msg_hdr.msg_iov = &batch->iovecs[i];
+        batch->headers[i].msg_hdr.msg_iovlen = 1;
+    }
 
     log_debug("Starting event manager loop");
 
     /* initialize epoll */
-    int32_t epfd = epoll_create(NYX_MAX_EVENTS);
+    int32_t epfd = epoll_create1(EPOLL_CLOEXEC);
     if (epfd == -1)
     {
-        log_perror("nyx: epoll_create");
+        log_perror("nyx: epoll_create1");
         goto teardown;
     }
 
@@ -271,32 +562,10 @@ handle_process_event(int32_t nl_sock, nyx_t *nyx, process_handler_t handler)
             else
             {
                 success = true;
-                int32_t rc = recv(fd, &nlcn_msg, sizeof(nlcn_msg), 0);
 
-                /* socket shutdown */
-                if (rc == 0)
-                {
-                    success = true;
-                    break;
-                }
-                else if (rc == -1)
-                {
-                    /* interrupted by a signal */
-                    if (errno == EINTR)
-                    {
-                        success = true;
-                        continue;
-                    }
-
-                    log_perror("nyx: recv");
+                /* drain all events that are pending */
+                if (!receive_process_events(fd, batch, nyx, handler, event_data))
                     break;
-                }
-
-                int32_t pid = set_event_data(event_data,
-                        (struct proc_event *)(void *)&(nlcn_msg.data.proc_ev));
-
-                if (pid > 0)
-                    handler(pid, event_data, nyx);
             }
         }
     }
@@ -308,6 +577,8 @@ teardown:
         event_data = NULL;
     }
 
+    free(batch);
+
     if (events != NULL)
     {
         free(events);
@@ -352,6 +623,9 @@ event_loop(nyx_t *nyx, process_handler_t handler)
     if (sock == -1)
         return false;
 
+    /* only exit events of watched processes are received */
+    set_filter_socket(sock, nyx);
+
     bool success = subscribe_event_listen(sock);
     if (!success)
         goto out;
@@ -367,6 +641,7 @@ event_loop(nyx_t *nyx, process_handler_t handler)
     unsubscribe_event_listen(sock);
 
 out:
+    set_filter_socket(-1, nyx);
     close(sock);
 
     log_debug("Event manager: terminated");
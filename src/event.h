@@ -17,6 +17,8 @@
 
 #include "nyx.h"
 
+struct sock_filter;
+
 typedef enum process_event_t
 {
     EVENT_FORK,
@@ -55,4 +57,10 @@ typedef bool (*process_handler_t)(pid_t pid, process_event_data_t *event_data, n
 bool
 event_loop(nyx_t *nyx, process_handler_t handler);
 
+void
+event_filter_update(nyx_t *nyx);
+
+uint16_t
+event_build_filter(struct sock_filter *program, pid_t *pids, uint32_t count);
+
 /* vim: set et sw=4 sts=4 tw=80: */
@@ -15,93 +15,552 @@
 
 #define _GNU_SOURCE
 
+#include "cgroup.h"
 #include "config.h"
 #include "def.h"
 #include "forker.h"
 #include "fs.h"
 #include "log.h"
 #include "process.h"
+#include "state.h"
 #include "watch.h"
 
 #include <dirent.h>
 #include <errno.h>
 #include <fcntl.h>
 #include <grp.h>
+#include <limits.h>
+#include <poll.h>
+#include <sched.h>
 #include <pwd.h>
 #include <signal.h>
 #include <stdlib.h>
 #include <stdio.h>
 #include <string.h>
 #include <sys/stat.h>
+#include <sys/syscall.h>
 #include <sys/types.h>
 #include <sys/wait.h>
+#include <time.h>
 #include <unistd.h>
 
-static watch_t *
-find_watch(nyx_t *nyx, int32_t id)
+/** maximum number of requests processed as one batch */
+#define NYX_FORKER_MAX_PENDING  (4 * NYX_FORKER_MAX_BATCH)
+
+static const char *
+get_exec_directory(watch_t *watch, nyx_t *nyx)
 {
-    if (nyx->watches == NULL)
-        return NULL;
+    /* no watch specific directory given */
+    if (watch->dir == NULL || *watch->dir == '\0')
+    {
+        /* either root dir ('/') or the current directory (in local-mode) */
+        if (nyx->options.local_mode)
+            return nyx->nyx_dir;
+        return "/";
+    }
+
+    return watch->dir;
+}
+
+#ifndef CLOSE_RANGE_CLOEXEC
+#define CLOSE_RANGE_CLOEXEC (1U << 2)
+#endif
+
+/** default search path of executables without a 'PATH' environment */
+#define NYX_DEFAULT_PATH "/usr/local/bin:/bin:/usr/bin"
+
+/**
+ * Precomputed execution context of a watch's start or stop command
+ *
+ * The contexts are built by the forker whenever the configuration is
+ * loaded. This way the spawned process (that shares the forker's
+ * memory until 'execve') does not have to resolve users, build the
+ * environment or search the executable - it only applies the context
+ * with a few system calls.
+ */
+typedef struct
+{
+    char * const *argv;
+    /** NULL-terminated environment (owned) */
+    char **envp;
+    int32_t envc;
+    /** absolute executable path or NULL if not found (yet) */
+    const char *path;
+    const char *dir;
+    uid_t uid;
+    gid_t gid;
+    /** supplementary groups (owned) */
+    gid_t *groups;
+    int32_t num_groups;
+    /** keep the forker's stdout/stderr */
+    bool proxy_output;
+    /** absolute path of the stdout log file or NULL (owned) */
+    char *out_file;
+    /** absolute path of the stderr log file or NULL (owned) */
+    char *err_file;
+    /** cgroup of the watch (start context only, owned) */
+    char *cgroup;
+    char path_buffer[PATH_MAX];
+} exec_context_t;
+
+/** watch known to the forker with its execution contexts */
+typedef struct
+{
+    watch_t *watch;
+    exec_context_t start;
+    /** stop context (only with a custom stop command) */
+    exec_context_t *stop;
+} watch_exec_t;
+
+/** state of the forker process */
+typedef struct
+{
+    nyx_t *nyx;
+    /** watches indexed by their id (see 'reindex_watches') */
+    watch_exec_t **watches;
+    /** size of 'watches' (highest watch id + 1) */
+    uint32_t num_watches;
+    /** /dev/null for the standard streams of spawned processes */
+    int32_t null_fd;
+    int32_t reply_fd;
+} forker_process_t;
+
+/**
+ * Everything that is specific to one spawn of an execution context
+ */
+typedef struct
+{
+    const exec_context_t *context;
+    char * const *envp;
+    int32_t null_fd;
+    /** cgroup.procs of the watch's cgroup or -1 */
+    int32_t cgroup_fd;
+    /** signal mask of the forker to restore after the spawn */
+    sigset_t sigmask;
+    /** errno of a failed spawn (set by the spawned process) */
+    int32_t error;
+    /** errno of failing to switch user/group (set by the spawned process) */
+    int32_t setid_error;
+    /** errno of failing to join the cgroup (set by the spawned process) */
+    int32_t cgroup_error;
+    /** pid of the actual process of a double-fork (set by the
+     * intermediate process) */
+    pid_t pid;
+} spawn_actions_t;
+
+#ifdef OSX
+/**
+ * Outcome of a spawn reported by the intermediate process of a double-fork
+ */
+typedef struct
+{
+    pid_t pid;
+    int32_t error;
+    int32_t setid_error;
+    int32_t cgroup_error;
+} spawn_result_t;
+#endif
+
+static bool
+env_key_equals(const char *entry, const char *key)
+{
+    size_t length = strlen(key);
+
+    return strncmp(entry, key, length) == 0 && entry[length] == '=';
+}
+
+static char *
+env_entry(const char *key, const char *value)
+{
+    size_t length = strlen(key) + strlen(value) + 2;
+    char *entry = xcalloc(length, sizeof(char));
+
+    snprintf(entry, length, "%s=%s", key, value);
 
+    return entry;
+}
+
+/**
+ * @brief Build the environment of a watch's processes
+ * @param watch   watch to build the environment for
+ * @param uid     uid the process is running as (0 to keep)
+ * @param context context to store the environment in
+ *
+ * The forker's environment is extended with the watch specific
+ * variables and $USER and $HOME of a configured user.
+ */
+static void
+build_environment(const watch_t *watch, uid_t uid, exec_context_t *context)
+{
+    int32_t count = 0, size = 3;
     const char *key = NULL;
     void *data = NULL;
+    const char *user = NULL, *home = NULL;
 
-    hash_iter_t *iter = hash_iter_start(nyx->watches);
+    for (char **env = environ; *env; env++)
+        size++;
 
-    while (hash_iter(iter, &key, &data))
+    if (watch->env)
+        size += hash_count(watch->env);
+
+    char **envp = xcalloc(size, sizeof(char *));
+
+    /* in case the uid is modified we adjust the $USER and $HOME
+     * environment variables appropriately */
+    if (uid)
     {
-        watch_t *watch = data;
+        struct passwd *pw = getpwuid(uid);
+
+        user = watch->uid;
+
+        if (pw && pw->pw_dir)
+            home = pw->pw_dir;
+    }
+
+    if (watch->env)
+    {
+        if (hash_get(watch->env, "USER"))
+            user = NULL;
+
+        if (hash_get(watch->env, "HOME"))
+            home = NULL;
+    }
 
-        if (watch && watch->id == id)
+    /* inherit all variables that are not overridden */
+    for (char **env = environ; *env; env++)
+    {
+        const char *entry = *env;
+        const char *equals = strchr(entry, '=');
+
+        if (equals == NULL)
+            continue;
+
+        if ((user && env_key_equals(entry, "USER")) ||
+            (home && env_key_equals(entry, "HOME")) ||
+            env_key_equals(entry, "NYX_PID"))
+            continue;
+
+        if (watch->env)
         {
-            free(iter);
-            return watch;
+            char name[256] = {0};
+            size_t length = MIN((size_t)(equals - entry), LEN(name)-1);
+
+            strncpy(name, entry, length);
+
+            if (hash_get(watch->env, name))
+                continue;
         }
+
+        envp[count++] = strdup(entry);
+    }
+
+    if (watch->env)
+    {
+        hash_iter_t *iter = hash_iter_start(watch->env);
+
+        while (hash_iter(iter, &key, &data))
+            envp[count++] = env_entry(key, data);
+
+        free(iter);
+    }
+
+    if (user)
+        envp[count++] = env_entry("USER", user);
+
+    if (home)
+        envp[count++] = env_entry("HOME", home);
+
+    context->envp = envp;
+    context->envc = count;
+}
+
+/**
+ * @brief Find the executable of a command like 'execvp' would
+ * @param context execution context with the environment built already
+ * @return path to execute or NULL if not found
+ */
+static const char *
+resolve_executable(exec_context_t *context)
+{
+    const char *name = *context->argv;
+    const char *path = NYX_DEFAULT_PATH;
+
+    /* names with a slash are taken as they are (possibly
+     * relative to the working directory) */
+    if (strchr(name, '/'))
+        return name;
+
+    for (char **env = context->envp; *env; env++)
+    {
+        if (env_key_equals(*env, "PATH"))
+        {
+            path = *env + 5;
+            break;
+        }
+    }
+
+    while (*path)
+    {
+        const char *end = strchr(path, ':');
+        size_t length = end ? (size_t)(end - path) : strlen(path);
+
+        snprintf(context->path_buffer, LEN(context->path_buffer)-1, "%.*s%s%s",
+                (int)length, path, length ? "/" : "./", name);
+
+        if (access(context->path_buffer, X_OK) == 0)
+            return context->path_buffer;
+
+        if (end == NULL)
+            break;
+
+        path = end + 1;
     }
 
-    free(iter);
     return NULL;
 }
 
+/**
+ * @brief Determine the absolute path of a log file
+ * @return path (owned) or NULL if no log file is given
+ *
+ * The log file itself is opened by the spawned process after it
+ * switched to the watch's user (see 'redirect_stream'), so it is
+ * neither created before the watch is started nor does it occupy a
+ * file descriptor of the forker.
+ */
+static char *
+exec_log_path(const char *file, const exec_context_t *context)
+{
+    if (file == NULL)
+        return NULL;
+
+    /* relative log files are relative to the working directory */
+    if (*file == '/')
+        return strdup(file);
+
+    size_t length = strlen(context->dir) + strlen(file) + 2;
+    char *path = xcalloc(length, sizeof(char));
+
+    snprintf(path, length, "%s/%s", context->dir, file);
+
+    return path;
+}
+
+static void
+exec_context_init(nyx_t *nyx, watch_t *watch, bool start, exec_context_t *context)
+{
+    memset(context, 0, sizeof(exec_context_t));
+
+    /* determine user and group */
+    if (watch->uid)
+        get_user(watch->uid, &context->uid, &context->gid);
+
+    if (watch->gid)
+        get_group(watch->gid, &context->gid);
+
+    if (context->gid)
+    {
+        int32_t num_groups = 32;
+
+        /* with a user given we want all of its groups */
+        if (context->uid)
+        {
+            context->groups = xcalloc(num_groups, sizeof(gid_t));
+
+            if (getgrouplist(watch->uid, context->gid, context->groups, &num_groups) == -1)
+            {
+                context->groups = realloc(context->groups, num_groups * sizeof(gid_t));
+
+                if (context->groups == NULL ||
+                    getgrouplist(watch->uid, context->gid, context->groups, &num_groups) == -1)
+                    num_groups = 0;
+            }
+        }
+        else
+            num_groups = 0;
+
+        if (num_groups < 1)
+        {
+            free(context->groups);
+            context->groups = xcalloc1(sizeof(gid_t));
+            context->groups[0] = context->gid;
+            num_groups = 1;
+        }
+
+        context->num_groups = num_groups;
+    }
+
+    context->argv = (char * const *)(start ? watch->start : watch->stop);
+    context->dir = get_exec_directory(watch, nyx);
+
+    build_environment(watch, context->uid, context);
+
+    context->path = resolve_executable(context);
+
+    /* In 'init-mode' and quiet output we will probably proxy
+     * the service's stdout/stderr instead.
+     * This will be the desired effect if using nyx as the
+     * docker entrypoint for example */
+    context->proxy_output = start && nyx->is_init && nyx->options.quiet;
+
+    if (start)
+    {
+        context->out_file = exec_log_path(watch->log_file, context);
+        context->err_file = exec_log_path(watch->error_file, context);
+    }
+
+    /* the started processes (and all of their descendants) are
+     * put into the watch's cgroup - custom stop commands are not */
+    if (start && nyx->cgroup_root)
+    {
+        context->cgroup = cgroup_path(nyx->cgroup_root, watch->name);
+
+        if (context->cgroup == NULL)
+            log_warn("forker: watch '%s' cannot be put into a cgroup", watch->name);
+    }
+}
+
+static void
+exec_context_destroy(exec_context_t *context)
+{
+    for (int32_t i = 0; i < context->envc; i++)
+        free(context->envp[i]);
+
+    free(context->envp);
+    free(context->groups);
+    free(context->cgroup);
+    free(context->out_file);
+    free(context->err_file);
+}
+
+static void
+watch_exec_destroy(watch_exec_t *exec)
+{
+    exec_context_destroy(&exec->start);
+
+    if (exec->stop)
+    {
+        exec_context_destroy(exec->stop);
+        free(exec->stop);
+    }
+
+    free(exec);
+}
+
 static void
-set_environment(const watch_t *watch)
+destroy_watches(forker_process_t *forker)
+{
+    for (uint32_t id = 0; id < forker->num_watches; id++)
+    {
+        if (forker->watches[id])
+            watch_exec_destroy(forker->watches[id]);
+    }
+
+    free(forker->watches);
+
+    forker->watches = NULL;
+    forker->num_watches = 0;
+}
+
+/**
+ * @brief Build the id-indexed array of all configured watches
+ *        including their execution contexts
+ *
+ * The watch ids are dense (1..N) so requests are dispatched by
+ * indexing this array directly.
+ */
+static void
+build_watches(forker_process_t *forker)
 {
     const char *key = NULL;
     void *data = NULL;
+    nyx_t *nyx = forker->nyx;
+    uint32_t max_id = 0;
+
+    destroy_watches(forker);
 
-    if (watch->env == NULL || hash_count(watch->env) < 1)
+    if (nyx->watches == NULL)
         return;
 
-    hash_iter_t *iter = hash_iter_start(watch->env);
+    hash_iter_t *iter = hash_iter_start(nyx->watches);
+
+    while (hash_iter(iter, &key, &data))
+    {
+        watch_t *watch = data;
+
+        if (watch->id > 0)
+            max_id = MAX(max_id, (uint32_t)watch->id);
+    }
+
+    forker->num_watches = max_id + 1;
+    forker->watches = xcalloc(forker->num_watches, sizeof(watch_exec_t *));
+
+    hash_iter_rewind(iter);
 
     while (hash_iter(iter, &key, &data))
     {
-        char *value = data;
+        watch_t *watch = data;
+
+        if (watch->id < 1)
+            continue;
+
+        watch_exec_t *exec = xcalloc1(sizeof(watch_exec_t));
+
+        exec->watch = watch;
+        exec_context_init(nyx, watch, true, &exec->start);
+
+        if (watch->stop && *watch->stop)
+        {
+            exec->stop = xcalloc1(sizeof(exec_context_t));
+            exec_context_init(nyx, watch, false, exec->stop);
+        }
 
-        setenv(key, value, 1);
+        forker->watches[watch->id] = exec;
     }
 
     free(iter);
 }
 
-static void
-set_magic_pid(pid_t pid)
+static watch_exec_t *
+find_watch(forker_process_t *forker, int32_t id)
 {
-    char str[32] = {0};
-    snprintf(str, LEN(str)-1, "%d", pid);
+    if (id < 1 || (uint32_t)id >= forker->num_watches)
+        return NULL;
 
-    setenv("NYX_PID", str, 1);
+    return forker->watches[id];
 }
 
-static void
-close_fds(pid_t pid)
+/**
+ * @brief Mark all file descriptors except stdin, stdout and stderr
+ *        as close-on-exec with a single system call
+ * @return true on success, false if not supported
+ */
+static bool
+cloexec_fds(void)
 {
-    char path[256] = {0};
+#ifdef SYS_close_range
+    return syscall(SYS_close_range, 3, ~0U, CLOSE_RANGE_CLOEXEC) == 0;
+#else
+    return false;
+#endif
+}
 
-    /* first we try to search in /proc/{pid}/fd */
-    snprintf(path, LEN(path)-1, "/proc/%d/fd", pid);
+/**
+ * @brief Make sure no file descriptor the forker inherited is passed
+ *        on to the spawned processes
+ *
+ * All descriptors nyx opens itself are close-on-exec already. This is
+ * done once on startup of the forker, so the spawned processes do not
+ * have to walk the (possibly huge) descriptor table.
+ */
+static void
+cloexec_inherited_fds(void)
+{
+    if (cloexec_fds())
+        return;
 
-    DIR *dir = opendir(path);
+    /* first we try to search in /proc/self/fd */
+    DIR *dir = opendir("/proc/self/fd");
     if (dir)
     {
         int32_t dir_fd = dirfd(dir);
@@ -112,240 +571,394 @@ close_fds(pid_t pid)
             int32_t fd = atoi(entry->d_name);
 
             if (fd >= 3 && fd != dir_fd)
-                close(fd);
+                fcntl(fd, F_SETFD, FD_CLOEXEC);
         }
 
         closedir(dir);
         return;
     }
 
-    /* otherwise we will close all file descriptors up
+    /* otherwise we will mark all file descriptors up
      * to the maximum descriptor index */
     int32_t max;
     if ((max = getdtablesize()) == -1)
         max = 256;
 
     for (int32_t fd = 3 /* stderr + 1 */; fd < max; fd++)
-        close(fd);
+        fcntl(fd, F_SETFD, FD_CLOEXEC);
 }
 
+/**
+ * @brief Redirect a standard stream of the spawned process
+ * @param target standard file descriptor to redirect
+ * @param file   log file to append to or NULL
+ * @return true on success, false otherwise (errno is set)
+ *
+ * The log file is opened with the permissions of the watch's user, so
+ * a rotated log file is simply created anew.
+ */
 static bool
-write_pipe(int32_t fd, int32_t value)
+redirect_stream(int32_t target, const char *file, const spawn_actions_t *actions)
 {
-    FILE *stream = fdopen(fd, "w");
+    if (file == NULL)
+        return actions->context->proxy_output || dup2(actions->null_fd, target) != -1;
+
+    int32_t fd = open(file, O_RDWR | O_APPEND | O_CREAT | O_NOCTTY,
+            S_IRUSR | S_IWUSR | S_IRGRP | S_IROTH);
+
+    if (fd == -1)
+        return false;
 
-    if (stream != NULL)
+    if (fd != target)
     {
-        fprintf(stream, "%d\n", value);
+        if (dup2(fd, target) == -1)
+            return false;
 
-        fclose(stream);
-        return true;
+        close(fd);
     }
 
-    return false;
+    return true;
 }
 
-static int32_t
-read_pipe(int32_t fd)
+/**
+ * @brief Execute the prepared command in the spawned process
+ *
+ * This function runs between 'vfork' (or 'clone', see 'spawn_detached')
+ * and 'execve', i.e. in the forker's memory: only system calls are
+ * allowed here, no logging, no allocations and no stdio. The forker is single threaded so the
+ * uid/gid functions boil down to the plain system calls as well.
+ */
+static void __attribute__((noreturn))
+spawn_child(spawn_actions_t *actions)
 {
-    int32_t value = 0;
-    FILE *stream = fdopen(fd, "r");
+    const exec_context_t *context = actions->context;
+    struct sigaction action = { .sa_handler = SIG_DFL };
+    sigset_t empty;
 
-    if (stream != NULL)
+    /* handlers of the forker must not run in here */
+    for (int32_t signum = 1; signum < NSIG; signum++)
     {
-        if (fscanf(stream, "%d", &value) != 1)
-            value = 0;
+        struct sigaction current;
+
+        if (sigaction(signum, NULL, &current) == 0 &&
+            current.sa_handler != SIG_DFL && current.sa_handler != SIG_IGN)
+            sigaction(signum, &action, NULL);
+    }
+
+    /* TODO: configurable mask */
+    umask(0);
+
+    /* create session */
+    setsid();
+
+    /* join the cgroup while still privileged */
+    if (actions->cgroup_fd >= 0 && write(actions->cgroup_fd, "0", 1) == -1)
+        actions->cgroup_error = errno;
 
-        fclose(stream);
+    /* set user/group */
+    if (context->gid)
+    {
+        if (setgroups(context->num_groups, context->groups) == -1 ||
+            setgid(context->gid) == -1)
+            actions->setid_error = errno;
     }
 
-    return value;
+    if (context->uid && setuid(context->uid) == -1)
+        actions->setid_error = errno;
+
+    if (chdir(context->dir) == -1)
+        goto error;
+
+    /* standard streams */
+    if (dup2(actions->null_fd, STDIN_FILENO) == -1)
+        goto error;
+
+    if (!redirect_stream(STDOUT_FILENO, context->out_file, actions))
+        goto error;
+
+    if (!redirect_stream(STDERR_FILENO, context->err_file, actions))
+        goto error;
+
+    /* just in case some library opened a descriptor without
+     * O_CLOEXEC in the meantime */
+    cloexec_fds();
+
+    /* the services start with an empty signal mask - the forker's mask
+     * is inherited from nyx which blocks SIGCHLD as a subreaper */
+    sigemptyset(&empty);
+    sigprocmask(SIG_SETMASK, &empty, NULL);
+
+    /* on success this call won't return */
+    execve(context->path, context->argv, actions->envp);
+
+error:
+    actions->error = errno;
+    _exit(EXIT_FAILURE);
 }
 
-static const char *
-get_exec_directory(watch_t *watch, nyx_t *nyx)
+static bool
+read_full(int32_t fd, void *buffer, size_t length)
 {
-    /* no watch specific directory given */
-    if (watch->dir == NULL || *watch->dir == '\0')
+    char *ptr = buffer;
+
+    while (length > 0)
     {
-        /* either root dir ('/') or the current directory (in local-mode) */
-        if (nyx->options.local_mode)
-            return nyx->nyx_dir;
-        return "/";
+        ssize_t bytes = read(fd, ptr, length);
+
+        if (bytes == -1 && errno == EINTR)
+            continue;
+
+        if (bytes < 1)
+            return false;
+
+        ptr += bytes;
+        length -= bytes;
     }
 
-    return watch->dir;
+    return true;
 }
 
-static void
-spawn_exec(watch_t *watch, const char *dir, bool start, bool proxy_output, pid_t stop_pid)
+#ifndef OSX
+/** stack size of the processes spawned with 'clone' */
+#define NYX_SPAWN_STACK_SIZE (64 * 1024)
+
+/* stacks of the intermediate and the actual process of a double-fork:
+ * both run in the forker's memory while the forker is suspended */
+static char spawn_stacks[2][NYX_SPAWN_STACK_SIZE] __attribute__((aligned(16)));
+
+static int
+spawn_inner(void *actions)
 {
-    uid_t uid = 0;
-    gid_t gid = 0;
+    spawn_child(actions);
+}
 
-    const char **args = start ? watch->start : watch->stop;
-    const char *executable = *args;
+static int
+spawn_intermediate(void *arg)
+{
+    spawn_actions_t *actions = arg;
 
-    /* determine user and group */
-    if (watch->uid)
-        get_user(watch->uid, &uid, &gid);
+    actions->pid = clone(spawn_inner, spawn_stacks[1] + NYX_SPAWN_STACK_SIZE,
+            CLONE_VM | CLONE_VFORK | SIGCHLD, actions);
 
-    if (watch->gid)
-        get_group(watch->gid, &gid);
+    if (actions->pid == -1)
+        actions->error = errno;
+    else if (actions->error)
+        waitpid(actions->pid, NULL, 0);
 
-    /* TODO: configurable mask */
-    umask(0);
+    _exit(EXIT_SUCCESS);
+}
 
-    /* create session */
-    setsid();
+/**
+ * @brief Spawn the actual process of a double-fork via an intermediate
+ *        process that terminates right after
+ * @return pid of the actual process, -1 on error (see 'actions->error')
+ *
+ * Both processes are created with 'clone(CLONE_VM|CLONE_VFORK)' on
+ * their own stacks, i.e. like 'vfork' but without the restriction of
+ * returning into the stack frame of the suspended parent. The forker
+ * is suspended until the intermediate process terminated, which in
+ * turn is suspended until the actual process called 'execve' (or
+ * failed to). So all outcomes of the spawn are found in the actions
+ * as soon as the forker resumes.
+ */
+static pid_t
+spawn_detached(spawn_actions_t *actions)
+{
+    pid_t pid = clone(spawn_intermediate, spawn_stacks[0] + NYX_SPAWN_STACK_SIZE,
+            CLONE_VM | CLONE_VFORK | SIGCHLD, actions);
 
-    /* set user/group */
-    if (gid)
+    if (pid == -1)
     {
-        gid_t groups[] = { gid };
+        actions->error = errno;
+        return -1;
+    }
+
+    /* the intermediate process is gone already */
+    waitpid(pid, NULL, 0);
 
-        setgroups(1, groups);
+    return actions->pid;
+}
+#else
+/**
+ * @brief Spawn the actual process of a double-fork via an intermediate
+ *        process that terminates right after
+ * @return pid of the actual process, -1 on error (see 'actions->error')
+ *
+ * Without 'clone' the intermediate process is created with 'fork': it
+ * 'vforks' the actual process on its own copy of the actions and
+ * reports the outcome via a pipe.
+ */
+static pid_t
+spawn_detached(spawn_actions_t *actions)
+{
+    int32_t fds[2] = { -1, -1 };
+    spawn_result_t result = { .pid = -1, .error = EPIPE };
 
-        if (setgid(gid) == -1)
-            log_perror("nyx: setgid");
+    if (!pipe_cloexec(fds))
+    {
+        actions->error = errno;
+        return -1;
     }
 
-    if (uid && gid)
-        initgroups(watch->uid, gid);
+    pid_t pid = fork();
 
-    if (uid)
+    if (pid == 0)
     {
-        /* in case the uid was modified we adjust the $USER and $HOME
-         * environment variables appropriately */
-        if (setuid(uid) != -1)
-        {
-            if (!watch->env)
-                watch->env = hash_new(free);
+        close(fds[0]);
 
-            if (!hash_get(watch->env, "USER"))
-            {
-                hash_add(watch->env, "USER", strdup(watch->uid));
-            }
+        pid_t inner_pid = vfork();
 
-            if (!hash_get(watch->env, "HOME"))
-            {
-                struct passwd *pw = getpwuid(uid);
+        if (inner_pid == 0)
+            spawn_child(actions);
 
-                if (pw && pw->pw_dir)
-                    hash_add(watch->env, "HOME", strdup(pw->pw_dir));
-            }
-        }
-    }
+        if (inner_pid == -1)
+            actions->error = errno;
 
-    if (chdir(dir) == -1)
-        log_critical_perror("nyx: chdir");
+        result.pid = inner_pid;
+        result.error = actions->error;
+        result.setid_error = actions->setid_error;
+        result.cgroup_error = actions->cgroup_error;
 
-    /* stdin */
-    close(STDIN_FILENO);
+        if (write(fds[1], &result, sizeof(result)) != sizeof(result))
+            _exit(EXIT_FAILURE);
 
-    if (open("/dev/null", O_RDONLY) == -1)
-    {
-        fprintf(stderr, "Failed to open /dev/null");
-        exit(EXIT_FAILURE);
-    };
+        _exit(EXIT_SUCCESS);
+    }
 
-    /* STDOUT */
+    close(fds[1]);
 
-    if (start && watch->log_file)
+    if (pid == -1)
+        result.error = errno;
+    else
     {
-        close(STDOUT_FILENO);
+        if (!read_full(fds[0], &result, sizeof(result)))
+            result.error = EPIPE;
 
-        if (open(watch->log_file,
-                    O_RDWR | O_APPEND | O_CREAT,
-                    S_IRUSR | S_IWUSR | S_IRGRP | S_IROTH) == -1)
-        {
-            fprintf(stderr, "Failed to open log file '%s'",
-                    watch->log_file);
-            exit(EXIT_FAILURE);
-        }
+        /* wait for the intermediate process to terminate */
+        waitpid(pid, NULL, 0);
     }
-    else if (start && proxy_output)
+
+    close(fds[0]);
+
+    actions->error = result.error;
+    actions->setid_error = result.setid_error;
+    actions->cgroup_error = result.cgroup_error;
+
+    return result.pid;
+}
+#endif
+
+/**
+ * @brief Spawn the process of the given actions
+ * @param actions     prepared spawn actions
+ * @param double_fork whether to detach the process via an
+ *                    intermediate process
+ * @return pid of the spawned process, -1 on error (see 'actions->error')
+ *
+ * The processes are created with 'vfork' so the forker's page tables
+ * are not copied, no matter how big the configuration is. 'vfork'
+ * suspends the forker until the spawned process called 'execve' (or
+ * failed to), so the outcome of the spawn is known right away. In
+ * case of a 'double-fork' the process is reparented to init by
+ * terminating an intermediate process (see 'spawn_detached'). A
+ * process created by 'vfork' must not call anything but 'execve' or
+ * '_exit'.
+ */
+static pid_t
+spawn_process(spawn_actions_t *actions, bool double_fork)
+{
+    sigset_t all;
+    pid_t pid;
+
+    /* no signal handler may run in the spawned processes */
+    sigfillset(&all);
+    sigprocmask(SIG_SETMASK, &all, &actions->sigmask);
+
+    if (double_fork)
+        pid = spawn_detached(actions);
+    else if ((pid = vfork()) == 0)
+        spawn_child(actions);
+    else if (pid == -1)
+        actions->error = errno;
+    else if (actions->error)
     {
-        /* in this case we want to keep stdout open as it is */
+        /* the failed process is gone already */
+        waitpid(pid, NULL, 0);
     }
-    else
-    {
-        close(STDOUT_FILENO);
 
-        if (open("/dev/null", O_WRONLY) == -1)
-        {
-            fprintf(stderr, "Failed to open /dev/null");
-            exit(EXIT_FAILURE);
-        }
-    }
+    sigprocmask(SIG_SETMASK, &actions->sigmask, NULL);
 
-    /* STDERR */
+    return actions->error ? -1 : pid;
+}
 
-    if (start && watch->error_file)
+/**
+ * @brief Spawn a process of the given execution context
+ * @return pid of the spawned process, -1 on error (errno is set)
+ */
+static pid_t
+spawn_context(forker_process_t *forker, watch_t *watch, exec_context_t *context,
+        pid_t stop_pid, bool double_fork)
+{
+    char pid_env[32] = {0};
+    char **envp = context->envp;
+    spawn_actions_t actions =
     {
-        close(STDERR_FILENO);
+        .context = context,
+        .null_fd = forker->null_fd,
+        .cgroup_fd = -1
+    };
 
-        if (open(watch->error_file,
-                    O_RDWR | O_APPEND | O_CREAT,
-                    S_IRUSR | S_IWUSR | S_IRGRP | S_IROTH) == -1)
-        {
-            fprintf(stdout, "Failed to open error file '%s'",
-                    watch->error_file);
-            exit(EXIT_FAILURE);
-        }
-    }
-    else if (start && proxy_output)
+    /* the executable may have been installed after the config was loaded */
+    if (context->path == NULL && (context->path = resolve_executable(context)) == NULL)
     {
-        /* in this case we want to keep stderr open as it is */
+        errno = ENOENT;
+        return -1;
     }
-    else
-    {
-        close(STDERR_FILENO);
 
-        if (open("/dev/null", O_RDWR) == -1)
-        {
-            fprintf(stdout, "Failed to open /dev/null");
-            exit(EXIT_FAILURE);
-        }
+    /* the cgroup is created on start only, so watches that are never
+     * started do not leave (empty) cgroups behind */
+    if (context->cgroup && (!cgroup_create(context->cgroup) ||
+                (actions.cgroup_fd = cgroup_open_procs(context->cgroup)) < 0))
+    {
+        log_warn("forker: failed to set up cgroup '%s': %s",
+                context->cgroup, strerror(errno));
     }
 
-    /* set user defined environment variables */
-    set_environment(watch);
-
     /* set the 'magic' environment NYX_PID for custom stop-commands */
     if (stop_pid)
     {
-        set_magic_pid(stop_pid);
-    }
+        envp = xcalloc(context->envc + 2, sizeof(char *));
 
-    close_fds(getpid());
+        memcpy(envp, context->envp, context->envc * sizeof(char *));
+        snprintf(pid_env, LEN(pid_env)-1, "NYX_PID=%d", stop_pid);
 
-    /* on success this call won't return */
-    execvp(executable, (char * const *)args);
+        envp[context->envc] = pid_env;
+    }
 
-    if (errno == ENOENT)
-        exit(EXIT_SUCCESS);
+    actions.envp = envp;
 
-    log_critical_perror("nyx: execvp %s", executable);
-}
+    pid_t pid = spawn_process(&actions, double_fork);
 
-static pid_t
-spawn_stop(nyx_t *nyx, watch_t *watch, pid_t stop_pid)
-{
-    pid_t pid = fork();
+    if (actions.cgroup_fd >= 0)
+        close(actions.cgroup_fd);
 
-    if (pid == -1)
-        log_critical_perror("nyx: fork");
+    if (actions.setid_error)
+    {
+        log_warn("forker: failed to set user/group of watch '%s': %s",
+                watch->name, strerror(actions.setid_error));
+    }
 
-    if (pid == 0)
+    if (actions.cgroup_error)
     {
-        const char *dir = get_exec_directory(watch, nyx);
-        spawn_exec(watch, dir, false, false, stop_pid);
+        log_warn("forker: failed to put watch '%s' into cgroup '%s': %s",
+                watch->name, context->cgroup, strerror(actions.cgroup_error));
     }
 
-    /* the return value will be written into the process' pid file
-     * that's why the actual 'stop-process-pid' is not of interest here */
-    return 0;
+    if (envp != context->envp)
+        free(envp);
+
+    errno = actions.error;
+    return pid;
 }
 
 static void
@@ -378,90 +991,243 @@ destroy_nyx(nyx_t *nyx)
         nyx->socket_path = NULL;
     }
 
+    if (nyx->cgroup_root)
+    {
+        free((void *)nyx->cgroup_root);
+        nyx->cgroup_root = NULL;
+    }
+
     free(nyx);
 }
 
-static pid_t
-spawn_start(nyx_t *nyx, watch_t *watch)
+static uint64_t
+monotonic_us(void)
 {
-    int32_t pipes[2] = {0};
-    bool double_fork = !nyx->is_init;
+    struct timespec ts;
 
-    /* In 'init-mode' and quiet output we will probably proxy
-     * the service's stdout/stderr instead.
-     * This will be the desired effect if using nyx as the
-     * docker entrypoint for example */
-    bool proxy_output = nyx->is_init && nyx->options.quiet;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
 
-    /* in case of a 'double-fork' we need some way to retrieve the
-     * resulting process' pid */
-    if (double_fork)
+    return (uint64_t)ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+}
+
+/**
+ * @brief Spawn the process of the given start or stop request
+ */
+static void
+spawn_watch(forker_process_t *forker, watch_exec_t *exec, forker_request_t *request,
+        forker_result_t *result)
+{
+    pid_t pid = -1;
+    watch_t *watch = exec->watch;
+    bool start = request->command == FORKER_START;
+    uint64_t started = monotonic_us();
+
+    if (!start && exec->stop == NULL)
+        errno = EINVAL;
+    else if (start)
     {
-        if (pipe(pipes) == -1)
-            log_critical_perror("nyx: pipe");
-    }
+        /* processes of a previous start (e.g. workers of a crashed
+         * master process) must not live on next to the new ones */
+        if (exec->start.cgroup && cgroup_populated(exec->start.cgroup) == 1)
+        {
+            log_info("forker: killing the remaining processes of watch '%s'", watch->name);
 
-    pid_t pid = fork();
-    pid_t outer_pid = pid;
+            if (!cgroup_kill(exec->start.cgroup))
+                log_perror("nyx: cgroup kill");
+        }
+
+        /* in 'init mode' we have to fork only once */
+        pid = spawn_context(forker, watch, &exec->start, 0, !forker->nyx->is_init);
+    }
+    else
+    {
+        /* custom stop commands get the pid of the process to stop */
+        pid = spawn_context(forker, watch, exec->stop, request->pid, false);
+    }
 
-    /* fork failed */
     if (pid == -1)
-        log_critical_perror("nyx: fork");
+        result->error = errno;
+    else
+        result->pid = pid;
 
-    /* child process */
-    if (pid == 0)
+    result->duration = monotonic_us() - started;
+}
+
+/**
+ * @brief Read one frame of the forker protocol
+ * @param fd     file descriptor to read from
+ * @param buffer buffer for at least NYX_FORKER_MAX_BATCH records
+ * @param size   size of one record
+ * @return number of records read, -1 on EOF or an invalid frame
+ */
+int32_t
+forker_read_frame(int32_t fd, void *buffer, size_t size)
+{
+    forker_frame_t frame;
+
+    if (!read_full(fd, &frame, sizeof(frame)))
+        return -1;
+
+    if (frame.magic != NYX_FORKER_MAGIC ||
+            frame.version != NYX_FORKER_VERSION ||
+            frame.count > NYX_FORKER_MAX_BATCH)
     {
-        const char *dir = get_exec_directory(watch, nyx);
+        log_error("Received invalid forker frame (version %u, %u records)",
+                frame.version, frame.count);
+        return -1;
+    }
 
-        /* in 'init mode' we have to fork only once */
-        if (!double_fork)
-        {
-            /* this call won't return */
-            spawn_exec(watch, dir, true, proxy_output, 0);
-        }
-        /* otherwise we want to 'double fork' */
-        else
+    if (!read_full(fd, buffer, frame.count * size))
+        return -1;
+
+    return frame.count;
+}
+
+/**
+ * @brief Write the given records as frames of the forker protocol
+ * @param fd      file descriptor to write to
+ * @param records records to write
+ * @param count   number of records
+ * @param size    size of one record
+ * @return true on success, false otherwise (errno is set)
+ */
+bool
+forker_write_frames(int32_t fd, const void *records, uint32_t count, size_t size)
+{
+    const char *ptr = records;
+    char buffer[sizeof(forker_frame_t) + NYX_FORKER_MAX_BATCH * sizeof(forker_result_t)];
+
+    while (count > 0)
+    {
+        uint32_t chunk = MIN(count, NYX_FORKER_MAX_BATCH);
+        size_t length = sizeof(forker_frame_t) + chunk * size;
+        forker_frame_t frame =
         {
-            pid_t inner_pid = fork();
+            .magic = NYX_FORKER_MAGIC,
+            .version = NYX_FORKER_VERSION,
+            .count = chunk
+        };
 
-            if (inner_pid == -1)
-                log_critical_perror("nyx: fork");
+        /* every frame is written at once so frames of concurrent
+         * writers don't interleave (less than PIPE_BUF) */
+        memcpy(buffer, &frame, sizeof(forker_frame_t));
+        memcpy(buffer + sizeof(forker_frame_t), ptr, chunk * size);
 
-            if (inner_pid == 0)
-            {
-                /* this call won't return */
-                spawn_exec(watch, dir, true, proxy_output, 0);
-            }
+        if (write(fd, buffer, length) != (ssize_t)length)
+            return false;
+
+        ptr += chunk * size;
+        count -= chunk;
+    }
 
-            /* close the read end before */
-            close(pipes[0]);
+    return true;
+}
 
-            /* now we write the child pid into the pipe */
-            write_pipe(pipes[1], inner_pid);
+static bool
+reload_config(forker_process_t *forker)
+{
+    nyx_t *nyx = forker->nyx;
 
-            /* this process will be terminated just now but it's
-             * good practice to clean up after ourselves anyways */
-            destroy_nyx(nyx);
+    log_debug("forker: received reload command");
 
-            exit(EXIT_SUCCESS);
-        }
+    /* the forker's watches refer to the parsed ones */
+    destroy_watches(forker);
+
+    reset_nyx(nyx);
+    nyx->watches = hash_new(_watch_destroy);
+
+    bool success = parse_config(nyx, true);
+
+    build_watches(forker);
+
+    if (success)
+    {
+        log_debug("forker: successfully reloaded config");
+        return true;
     }
 
-    /* in case of a 'double-fork' we have to read the actual
-     * process' pid from the read end of the pipe */
-    if (double_fork)
+    log_warn("forker: failed to reload config");
+    return false;
+}
+
+/**
+ * @brief Send the result of a processed request back to the daemon
+ * @param watch watch of a start or stop request (NULL otherwise)
+ *
+ * The spawns of a batch are processed one after another, so every
+ * result is sent right away instead of after the whole batch. This way
+ * a slow spawn does not delay the results of the requests before it.
+ */
+static void
+reply_result(forker_process_t *forker, forker_result_t *result, watch_t *watch)
+{
+    if (!forker_write_frames(forker->reply_fd, result, 1, sizeof(forker_result_t)))
+        log_perror("nyx: write");
+
+    if (watch == NULL)
+        return;
+
+    /* the pid file is written after the result was sent */
+    if (result->command == FORKER_STOP)
     {
-        /* close the write end before */
-        close(pipes[1]);
+        /* the pid of the stop command is of no interest here */
+        write_pid(0, watch->name, forker->nyx);
+    }
+    else if (!result->error)
+        write_pid(result->pid, watch->name, forker->nyx);
+}
+
+static void
+process_requests(forker_process_t *forker, forker_request_t *requests, uint32_t count)
+{
+    for (uint32_t i = 0; i < count; i++)
+    {
+        forker_request_t *request = &requests[i];
+        forker_result_t result =
+        {
+            .request_id = request->request_id,
+            .watch_id = request->watch_id,
+            .command = request->command
+        };
 
-        pid = read_pipe(pipes[0]);
+        if (request->command == FORKER_RELOAD)
+        {
+            if (!reload_config(forker))
+                result.error = EINVAL;
+
+            reply_result(forker, &result, NULL);
+            continue;
+        }
+
+        log_debug("forker: received request %u of watch id %d",
+                request->request_id, request->watch_id);
+
+        watch_t *watch = NULL;
+        watch_exec_t *exec = find_watch(forker, request->watch_id);
+
+        if (exec == NULL)
+        {
+            log_warn("forker: no watch with id %d found!", request->watch_id);
+            result.error = ESRCH;
+        }
+        else if (request->command != FORKER_START && request->command != FORKER_STOP)
+            result.error = EINVAL;
+        else
+        {
+            watch = exec->watch;
+            spawn_watch(forker, exec, request, &result);
+        }
 
-        /* wait for the intermediate forked process
-         * to terminate */
-        waitpid(outer_pid, NULL, 0);
+        reply_result(forker, &result, watch);
     }
+}
 
-    return pid;
+static bool
+is_readable(int32_t fd)
+{
+    struct pollfd pfd = { .fd = fd, .events = POLLIN };
+
+    return poll(&pfd, 1, 0) > 0 && (pfd.revents & POLLIN);
 }
 
 /**
@@ -485,9 +1251,18 @@ handle_child_stop(UNUSED int32_t signum)
 }
 
 static void
-forker(nyx_t *nyx, int32_t pipe_fd)
+forker(nyx_t *nyx, int32_t pipe_fd, int32_t reply_fd)
 {
-    fork_info_t info = {0, 0, 0};
+    int32_t count = 0;
+    forker_request_t requests[NYX_FORKER_MAX_PENDING];
+    forker_process_t forker = { .nyx = nyx, .reply_fd = reply_fd };
+
+    cloexec_inherited_fds();
+
+    if ((forker.null_fd = open("/dev/null", O_RDWR | O_CLOEXEC)) == -1)
+        log_critical_perror("nyx: open /dev/null");
+
+    build_watches(&forker);
 
     /* register SIGCHLD handler */
     if (nyx->is_init)
@@ -504,89 +1279,321 @@ forker(nyx_t *nyx, int32_t pipe_fd)
         sigaction(SIGCHLD, &action, NULL);
     }
 
-    while (read(pipe_fd, &info, sizeof(fork_info_t)) != 0)
+    while ((count = forker_read_frame(pipe_fd, requests, sizeof(forker_request_t))) >= 0)
     {
-        if (info.id == NYX_FORKER_RELOAD)
+        /* pick up all further requests that are available already
+         * so they are processed as one batch */
+        while (count + NYX_FORKER_MAX_BATCH <= NYX_FORKER_MAX_PENDING && is_readable(pipe_fd))
         {
-            log_debug("forker: received reload command");
+            int32_t more = forker_read_frame(pipe_fd, requests + count, sizeof(forker_request_t));
 
-            reset_nyx(nyx);
-            nyx->watches = hash_new(_watch_destroy);
-
-            if (parse_config(nyx, true))
-            {
-                log_debug("forker: successfully reloaded config");
-            }
-            else
-            {
-                log_warn("forker: failed to reload config");
-            }
+            if (more < 0)
+                break;
 
-            continue;
+            count += more;
         }
 
-        log_debug("forker: received watch id %d", info.id);
+        process_requests(&forker, requests, count);
+    }
+
+    close(reply_fd);
+    close(pipe_fd);
+    close(forker.null_fd);
+
+    destroy_watches(&forker);
+
+    destroy_nyx(nyx);
+
+    log_debug("forker: terminated");
+}
+
+/** a request whose result is waited for */
+typedef struct
+{
+    uint32_t request_id;
+    state_t *waiter;
+} forker_inflight_t;
+
+/**
+ * @brief Hand the given result to the state waiting for it
+ * @param nyx    nyx instance
+ * @param result result of a forker request
+ *
+ * The state is notified with the client lock held so it cannot be
+ * destroyed in the meantime (see 'forker_cancel').
+ */
+static void
+forker_complete(nyx_t *nyx, forker_result_t *result)
+{
+    forker_client_t *client = nyx->forker;
+    list_node_t *node = NULL;
+
+    pthread_mutex_lock(&client->lock);
 
-        watch_t *watch = find_watch(nyx, info.id);
+    for (node = client->inflight->head; node; node = node->next)
+    {
+        forker_inflight_t *inflight = node->data;
 
-        if (watch == NULL)
+        if (inflight->request_id == result->request_id)
         {
-            log_warn("forker: no watch with id %d found!", info.id);
-            continue;
+            state_fork_result(inflight->waiter, result);
+            list_remove(client->inflight, node);
+            break;
         }
+    }
+
+    pthread_mutex_unlock(&client->lock);
+}
 
-        pid_t pid = (info.start)
-            ? spawn_start(nyx, watch)
-            : spawn_stop(nyx, watch, info.pid);
+/**
+ * @brief Report the failure of the given requests to the waiting
+ *        states as if the forker replied
+ */
+static void
+fail_requests(nyx_t *nyx, forker_request_t *requests, uint32_t count, int32_t error)
+{
+    for (uint32_t i = 0; i < count; i++)
+    {
+        forker_result_t result =
+        {
+            .request_id = requests[i].request_id,
+            .watch_id = requests[i].watch_id,
+            .command = requests[i].command,
+            .error = error
+        };
 
-        write_pid(pid, watch->name, nyx);
+        forker_complete(nyx, &result);
     }
+}
 
-    close(pipe_fd);
+/**
+ * @brief Send a request to the forker process
+ * @param nyx     nyx instance
+ * @param request request to send
+ * @param waiter  state to notify with the result (optional)
+ * @return true if the request was queued, false otherwise
+ *
+ * Requests of concurrent callers are written as one frame by
+ * whichever thread is writing at that time. If the request cannot be
+ * written, a failed result is reported instead of the forker's.
+ */
+static bool
+forker_submit(nyx_t *nyx, forker_request_t *request, state_t *waiter)
+{
+    forker_client_t *client = nyx->forker;
+    forker_request_t batch[NYX_FORKER_MAX_BATCH];
 
-    destroy_nyx(nyx);
+    if (client == NULL)
+        return false;
 
-    log_debug("forker: terminated");
+    pthread_mutex_lock(&client->lock);
+
+    while (client->count >= NYX_FORKER_MAX_BATCH)
+        pthread_cond_wait(&client->drained, &client->lock);
+
+    /* request id 0 is never used */
+    if (++client->next_id == 0)
+        client->next_id = 1;
+
+    request->request_id = client->next_id;
+
+    if (waiter != NULL)
+    {
+        forker_inflight_t *inflight = xcalloc1(sizeof(forker_inflight_t));
+
+        inflight->request_id = request->request_id;
+        inflight->waiter = waiter;
+
+        list_add(client->inflight, inflight);
+    }
+
+    client->pending[client->count++] = *request;
+
+    /* some other thread is writing right now and will pick
+     * up this request as well */
+    if (client->flushing)
+    {
+        pthread_mutex_unlock(&client->lock);
+        return true;
+    }
+
+    client->flushing = true;
+
+    while (client->count > 0)
+    {
+        uint32_t count = client->count;
+        int32_t fd = client->fd;
+
+        memcpy(batch, client->pending, count * sizeof(forker_request_t));
+        client->count = 0;
+
+        pthread_cond_broadcast(&client->drained);
+        pthread_mutex_unlock(&client->lock);
+
+        if (fd < 0)
+            errno = EBADF;
+
+        if (fd < 0 || !forker_write_frames(fd, batch, count, sizeof(forker_request_t)))
+        {
+            log_perror("nyx: write");
+            fail_requests(nyx, batch, count, errno);
+        }
+
+        pthread_mutex_lock(&client->lock);
+    }
+
+    client->flushing = false;
+
+    pthread_mutex_unlock(&client->lock);
+
+    return true;
+}
+
+bool
+forker_stop(nyx_t *nyx, int32_t id, pid_t pid, state_t *waiter)
+{
+    forker_request_t request = { .watch_id = id, .command = FORKER_STOP, .pid = pid };
+
+    return forker_submit(nyx, &request, waiter);
+}
+
+bool
+forker_start(nyx_t *nyx, int32_t id, state_t *waiter)
+{
+    forker_request_t request = { .watch_id = id, .command = FORKER_START };
+
+    return forker_submit(nyx, &request, waiter);
+}
+
+bool
+forker_reload(nyx_t *nyx)
+{
+    forker_request_t request = { .watch_id = -1, .command = FORKER_RELOAD };
+
+    return forker_submit(nyx, &request, NULL);
+}
+
+/**
+ * @brief Drop all pending results the given state is waiting for
+ * @param nyx    nyx instance
+ * @param waiter state that won't wait for its results anymore
+ */
+void
+forker_cancel(nyx_t *nyx, state_t *waiter)
+{
+    forker_client_t *client = nyx->forker;
+    list_node_t *node = NULL;
+
+    if (client == NULL)
+        return;
+
+    pthread_mutex_lock(&client->lock);
+
+    node = client->inflight->head;
+
+    while (node)
+    {
+        list_node_t *next = node->next;
+        forker_inflight_t *inflight = node->data;
+
+        if (inflight->waiter == waiter)
+            list_remove(client->inflight, node);
+
+        node = next;
+    }
+
+    pthread_mutex_unlock(&client->lock);
 }
 
-static fork_info_t *
-forker_new(int32_t id, bool start, pid_t pid)
+/**
+ * @brief Thread receiving the results of the forker's requests
+ * @param state nyx instance
+ */
+void *
+forker_reader_start(void *state)
 {
-    fork_info_t *info = xcalloc1(sizeof(fork_info_t));
+    int32_t count = 0;
+    nyx_t *nyx = state;
+    forker_result_t results[NYX_FORKER_MAX_BATCH];
+
+    while ((count = forker_read_frame(nyx->forker_reply, results, sizeof(forker_result_t))) >= 0)
+    {
+        for (int32_t i = 0; i < count; i++)
+        {
+            forker_result_t *result = &results[i];
+
+            log_debug("Received result of request %u (watch id %d): "
+                    "PID %d, error %d, took %u us",
+                    result->request_id, result->watch_id,
+                    result->pid, result->error, result->duration);
+
+            forker_complete(nyx, result);
+        }
+    }
 
-    info->id = id;
-    info->start = start;
-    info->pid = pid;
+    log_debug("Forker reader: terminated");
 
-    return info;
+    return NULL;
 }
 
-fork_info_t *
-forker_stop(int32_t idx, pid_t pid)
+static forker_client_t *
+forker_client_new(int32_t fd)
 {
-    return forker_new(idx, false, pid);
+    forker_client_t *client = xcalloc1(sizeof(forker_client_t));
+
+    pthread_mutex_init(&client->lock, NULL);
+    pthread_cond_init(&client->drained, NULL);
+    client->fd = fd;
+    client->inflight = list_new(free);
+
+    return client;
 }
 
-fork_info_t *
-forker_start(int32_t idx)
+/**
+ * @brief Close the request pipe which terminates the forker process
+ * @param client forker client
+ */
+void
+forker_client_close(forker_client_t *client)
 {
-    return forker_new(idx, true, 0);
+    pthread_mutex_lock(&client->lock);
+
+    if (client->fd >= 0)
+    {
+        close(client->fd);
+        client->fd = -1;
+    }
+
+    pthread_mutex_unlock(&client->lock);
 }
 
-fork_info_t *
-forker_reload(void)
+void
+forker_client_destroy(forker_client_t *client)
 {
-    return forker_new(NYX_FORKER_RELOAD, true, 0);
+    list_destroy(client->inflight);
+
+    pthread_cond_destroy(&client->drained);
+    pthread_mutex_destroy(&client->lock);
+
+    free(client);
 }
 
 int32_t
 forker_init(nyx_t *nyx)
 {
     int32_t pipes[2] = {0};
+    int32_t replies[2] = {0};
 
     /* open pipes -> bail out if failed */
-    if (pipe(pipes) == -1)
+    if (!pipe_cloexec(pipes))
+        return 0;
+
+    if (!pipe_cloexec(replies))
+    {
+        close(pipes[0]);
+        close(pipes[1]);
         return 0;
+    }
 
     /* here we are still in the main nyx thread
      * we will fork now so both threads have access to both the read
@@ -601,23 +1608,28 @@ forker_init(nyx_t *nyx)
     /* here we are in the child/forker thread */
     if (pid == 0)
     {
-        /* close the write end of the pipes first */
+        /* close the write end of the request pipe and
+         * the read end of the reply pipe first */
         close(pipes[1]);
+        close(replies[0]);
 
         /* ignore SIGINT - we are terminated by the main thread */
         signal(SIGINT, SIG_IGN);
 
         /* enter the real fork processing logic now */
-        forker(nyx, pipes[0]);
+        forker(nyx, pipes[0], replies[1]);
         exit(EXIT_SUCCESS);
     }
 
     /* parent/main thread here:
      * close the read end of the pipes */
     close(pipes[0]);
+    close(replies[1]);
 
     /* set/refresh forker's pid */
     nyx->forker_pid = pid;
+    nyx->forker_reply = replies[0];
+    nyx->forker = forker_client_new(pipes[1]);
 
     /* return the write pipe descriptor */
     return pipes[1];
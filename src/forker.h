@@ -15,31 +15,112 @@
 
 #pragma once
 
+#include "list.h"
 #include "nyx.h"
 
+#include <pthread.h>
 #include <stdbool.h>
 #include <stdint.h>
 
-/** magic number to trigger forker thread reload */
-#define NYX_FORKER_RELOAD -101
+/* Protocol between the nyx daemon and its forker process
+ *
+ * Both directions consist of frames: a 'forker_frame_t' header
+ * followed by 'count' requests (daemon -> forker) or results
+ * (forker -> daemon). Every frame fits into PIPE_BUF so frames written
+ * by multiple threads are never interleaved. Requests are identified
+ * by a request ID that is echoed in the matching result, so any
+ * number of requests may be in flight at the same time. */
+
+#define NYX_FORKER_MAGIC     0x4e59
+#define NYX_FORKER_VERSION   1
+#define NYX_FORKER_MAX_BATCH 64
+
+typedef enum
+{
+    FORKER_START = 1,
+    FORKER_STOP,
+    FORKER_RELOAD
+} forker_command_e;
+
+typedef struct
+{
+    uint16_t magic;
+    uint16_t version;
+    uint32_t count;
+} forker_frame_t;
+
+typedef struct
+{
+    uint32_t request_id;
+    int32_t watch_id;
+    /** one of 'forker_command_e' */
+    int32_t command;
+    /** process to stop (FORKER_STOP) */
+    pid_t pid;
+} forker_request_t;
 
 typedef struct
 {
-    int32_t id;
-    bool start;
+    uint32_t request_id;
+    int32_t watch_id;
+    /** one of 'forker_command_e' */
+    int32_t command;
+    /** pid of the spawned process, 0 if the spawn failed */
     pid_t pid;
-} fork_info_t;
+    /** errno of the failed request, 0 on success */
+    int32_t error;
+    /** time in microseconds until the process reached 'execvp' */
+    uint32_t duration;
+} forker_result_t;
+
+struct state_t;
+
+typedef struct forker_client_t
+{
+    /** lock guarding all of the fields below */
+    pthread_mutex_t lock;
+    /** signaled whenever the pending requests were taken for writing */
+    pthread_cond_t drained;
+    /** write end of the request pipe */
+    int32_t fd;
+    uint32_t next_id;
+    /** whether a thread is writing the pending requests right now */
+    bool flushing;
+    uint32_t count;
+    /** requests that are written with the next frame */
+    forker_request_t pending[NYX_FORKER_MAX_BATCH];
+    /** requests whose result is waited for */
+    list_t *inflight;
+} forker_client_t;
 
 int32_t
 forker_init(nyx_t *nyx);
 
-fork_info_t *
-forker_reload(void);
+void
+forker_client_close(forker_client_t *client);
+
+void
+forker_client_destroy(forker_client_t *client);
+
+void *
+forker_reader_start(void *state);
 
-fork_info_t *
-forker_start(int32_t id);
+bool
+forker_reload(nyx_t *nyx);
+
+bool
+forker_start(nyx_t *nyx, int32_t id, struct state_t *waiter);
+
+bool
+forker_stop(nyx_t *nyx, int32_t id, pid_t pid, struct state_t *waiter);
+
+void
+forker_cancel(nyx_t *nyx, struct state_t *waiter);
+
+int32_t
+forker_read_frame(int32_t fd, void *buffer, size_t size);
 
-fork_info_t *
-forker_stop(int32_t id, pid_t pid);
+bool
+forker_write_frames(int32_t fd, const void *records, uint32_t count, size_t size);
 
 /* vim: set et sw=4 sts=4 tw=80: */
@@ -23,6 +23,7 @@
 
 #include <dirent.h>
 #include <errno.h>
+#include <fcntl.h>
 #include <grp.h>
 #include <libgen.h>
 #include <pwd.h>
@@ -515,4 +516,40 @@ dir_writable(const char *directory)
     return writable;
 }
 
+bool
+set_cloexec(int32_t fd)
+{
+    int32_t flags = fcntl(fd, F_GETFD, 0);
+
+    if (flags == -1 || fcntl(fd, F_SETFD, flags | FD_CLOEXEC) == -1)
+    {
+        log_perror("nyx: fcntl");
+        return false;
+    }
+
+    return true;
+}
+
+bool
+pipe_cloexec(int32_t fds[2])
+{
+#ifndef OSX
+    return pipe2(fds, O_CLOEXEC) == 0;
+#else
+    if (pipe(fds) == -1)
+        return false;
+
+    /* there is a race with concurrent forks here but OSX
+     * does not provide an atomic alternative */
+    if (!set_cloexec(fds[0]) || !set_cloexec(fds[1]))
+    {
+        close(fds[0]);
+        close(fds[1]);
+        return false;
+    }
+
+    return true;
+#endif
+}
+
 /* vim: set et sw=4 sts=4 tw=80: */
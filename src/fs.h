@@ -16,6 +16,7 @@
 #pragma once
 
 #include <stdbool.h>
+#include <stdint.h>
 #include <stdio.h>
 #include <sys/types.h>
 
@@ -70,4 +71,10 @@ get_user(const char *name, uid_t *uid, gid_t *gid);
 bool
 get_group(const char *name, gid_t *gid);
 
+bool
+set_cloexec(int32_t fd);
+
+bool
+pipe_cloexec(int32_t fds[2]);
+
 /* vim: set et sw=4 sts=4 tw=80: */
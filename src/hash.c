@@ -287,7 +287,9 @@ hash_remove(hash_t *hash, const char *key)
 
     /* free key and value memory */
     free((char *)pair->key);
-    hash->free_value(pair->data);
+
+    if (hash->free_value != NULL && pair->data != NULL)
+        hash->free_value(pair->data);
 
     hash->count--;
     bucket->count--;
@@ -0,0 +1,168 @@
+/* Copyright 2014-2019 Gregor Uhlenheuer
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "def.h"
+#include "heap.h"
+#include "log.h"
+
+#include <stdlib.h>
+
+heap_t *
+heap_new(uint32_t capacity)
+{
+    heap_t *heap = xcalloc1(sizeof(heap_t));
+
+    heap->capacity = MAX(16, capacity);
+    heap->nodes = xcalloc(heap->capacity, sizeof(heap_node_t *));
+
+    return heap;
+}
+
+void
+heap_destroy(heap_t *heap)
+{
+    free(heap->nodes);
+    free(heap);
+}
+
+void
+heap_init_node(heap_node_t *node)
+{
+    node->key = 0;
+    node->index = HEAP_NOT_QUEUED;
+}
+
+static void
+heap_set(heap_t *heap, uint32_t index, heap_node_t *node)
+{
+    heap->nodes[index] = node;
+    node->index = index;
+}
+
+static void
+sift_up(heap_t *heap, uint32_t index)
+{
+    heap_node_t *node = heap->nodes[index];
+
+    while (index > 0)
+    {
+        uint32_t parent = (index - 1) / 2;
+
+        if (heap->nodes[parent]->key <= node->key)
+            break;
+
+        heap_set(heap, index, heap->nodes[parent]);
+        index = parent;
+    }
+
+    heap_set(heap, index, node);
+}
+
+static void
+sift_down(heap_t *heap, uint32_t index)
+{
+    heap_node_t *node = heap->nodes[index];
+
+    while (true)
+    {
+        uint32_t child = index * 2 + 1;
+
+        if (child >= heap->count)
+            break;
+
+        /* pick the smaller one of both children */
+        if (child + 1 < heap->count && heap->nodes[child + 1]->key < heap->nodes[child]->key)
+            child++;
+
+        if (node->key <= heap->nodes[child]->key)
+            break;
+
+        heap_set(heap, index, heap->nodes[child]);
+        index = child;
+    }
+
+    heap_set(heap, index, node);
+}
+
+/**
+ * @brief Queue the given node with the given key
+ *
+ * A node that is queued already is moved to its new position.
+ */
+void
+heap_push(heap_t *heap, heap_node_t *node, uint64_t key)
+{
+    if (node->index != HEAP_NOT_QUEUED)
+        heap_remove(heap, node);
+
+    if (heap->count == heap->capacity)
+    {
+        heap->capacity *= 2;
+
+        void *nodes = realloc(heap->nodes, heap->capacity * sizeof(heap_node_t *));
+
+        if (nodes == NULL)
+            log_critical_perror("nyx: realloc");
+
+        heap->nodes = nodes;
+    }
+
+    node->key = key;
+    heap_set(heap, heap->count++, node);
+    sift_up(heap, node->index);
+}
+
+heap_node_t *
+heap_peek(heap_t *heap)
+{
+    return heap->count > 0 ? heap->nodes[0] : NULL;
+}
+
+heap_node_t *
+heap_pop(heap_t *heap)
+{
+    heap_node_t *node = heap_peek(heap);
+
+    if (node != NULL)
+        heap_remove(heap, node);
+
+    return node;
+}
+
+void
+heap_remove(heap_t *heap, heap_node_t *node)
+{
+    uint32_t index = node->index;
+
+    if (index == HEAP_NOT_QUEUED || index >= heap->count || heap->nodes[index] != node)
+        return;
+
+    node->index = HEAP_NOT_QUEUED;
+
+    /* move the last node into the gap */
+    heap_node_t *last = heap->nodes[--heap->count];
+
+    if (last == node)
+        return;
+
+    heap_set(heap, index, last);
+
+    if (index > 0 && heap->nodes[(index - 1) / 2]->key > last->key)
+        sift_up(heap, index);
+    else
+        sift_down(heap, index);
+}
+
+/* vim: set et sw=4 sts=4 tw=80: */
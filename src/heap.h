@@ -0,0 +1,64 @@
+/* Copyright 2014-2019 Gregor Uhlenheuer
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#pragma once
+
+#include <stdbool.h>
+#include <stdint.h>
+
+/* Intrusive binary min-heap ordered by a 64 bit key
+ *
+ * The heap nodes are embedded into the queued objects and remember
+ * their position in the heap so arbitrary nodes can be removed in
+ * O(log n) as well. The heap is not synchronized. */
+
+#define HEAP_NOT_QUEUED UINT32_MAX
+
+typedef struct
+{
+    uint64_t key;
+    /** position in the heap (HEAP_NOT_QUEUED if not queued) */
+    uint32_t index;
+} heap_node_t;
+
+typedef struct heap_t
+{
+    uint32_t count;
+    uint32_t capacity;
+    heap_node_t **nodes;
+} heap_t;
+
+heap_t *
+heap_new(uint32_t capacity);
+
+void
+heap_destroy(heap_t *heap);
+
+void
+heap_init_node(heap_node_t *node);
+
+void
+heap_push(heap_t *heap, heap_node_t *node, uint64_t key);
+
+heap_node_t *
+heap_peek(heap_t *heap);
+
+heap_node_t *
+heap_pop(heap_t *heap);
+
+void
+heap_remove(heap_t *heap, heap_node_t *node);
+
+/* vim: set et sw=4 sts=4 tw=80: */
@@ -267,7 +267,7 @@ http_init(uint32_t port)
     /* bind to the first working address */
     for (addr = res; addr != NULL; addr = addr->ai_next)
     {
-        sock_fd = socket(addr->ai_family, addr->ai_socktype, 0);
+        sock_fd = socket(addr->ai_family, addr->ai_socktype | NYX_SOCK_CLOEXEC, 0);
 
         if (sock_fd == -1)
             continue;
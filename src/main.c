@@ -19,6 +19,7 @@
 #include "fs.h"
 #include "log.h"
 #include "nyx.h"
+#include "pidfd.h"
 #include "poll.h"
 #include "state.h"
 #include "utils.h"
@@ -37,21 +38,44 @@ daemon_mode(nyx_t *nyx)
 
     /* start the event handler loop (not supported on OSX)*/
 #ifndef OSX
-    if (!event_loop(nyx, dispatch_event))
+    /* as subreaper the exits of all started processes are received
+     * via SIGCHLD - no process connector necessary */
+    if (nyx->reaper_fd > 0)
+    {
+        if (!pidfd_loop(nyx, dispatch_event))
+        {
+            log_warn("Failed to start subreaper loop "
+                     "- trying polling mechanism next");
+
+            if (!poll_loop(nyx, dispatch_poll_result))
+            {
+                log_error("Failed to start loop manager as well - terminating");
+                return NYX_FAILURE;
+            }
+        }
+    }
+    else if (!event_loop(nyx, dispatch_event))
     {
         log_warn("Failed to initialize event manager "
-                  "- trying polling mechanism next");
+                  "- trying pidfd mechanism next");
 
         log_warn("Try enabling CONFIG_CONNECTOR in your kernel config "
                  "and run nyx with root privileges");
-#endif
 
-        if (!poll_loop(nyx, dispatch_poll_result))
+        /* pidfds notify about process exits without root privileges */
+        if (!pidfd_loop(nyx, dispatch_event))
         {
-            log_error("Failed to start loop manager as well - terminating");
-            return NYX_FAILURE;
-        }
+            log_warn("Failed to initialize pidfd manager "
+                     "- trying polling mechanism next");
+#endif
+
+            if (!poll_loop(nyx, dispatch_poll_result))
+            {
+                log_error("Failed to start loop manager as well - terminating");
+                return NYX_FAILURE;
+            }
 #ifndef OSX
+        }
     }
 #endif
 
@@ -18,12 +18,17 @@
 #include "config.h"
 #include "connector.h"
 #include "command.h"
+#include "cgroup.h"
 #include "def.h"
 #include "forker.h"
 #include "fs.h"
 #include "log.h"
 #include "nyx.h"
+#include "pidfile.h"
+#include "pidmap.h"
 #include "process.h"
+#include "runner.h"
+#include "scheduler.h"
 #include "state.h"
 #include "watch.h"
 #include "utils.h"
@@ -39,6 +44,7 @@
 #include <signal.h>
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
 #include <sys/stat.h>
 #include <sys/wait.h>
 #include <time.h>
@@ -89,6 +95,7 @@ print_help(void)
          "       --local            (run in the current directory)\n"
          "       --socket <file>    (domain socket location - default: /tmp/nyx.sock)\n"
          "   -p  --passive          (don't automatically start services)\n"
+         "       --subreaper        (adopt the orphaned processes of watches)\n"
          "   -s  --syslog           (log into syslog)\n"
          "   -q  --quiet            (output error messages only)\n"
          "   -C  --no-color         (no terminal coloring)\n"
@@ -122,6 +129,7 @@ static const struct option long_options[] =
     { .name = "local",     .has_arg = 0, .flag = NULL, .val = 'l'},
     { .name = "socket",    .has_arg = 1, .flag = NULL, .val = 'S'},
     { .name = "passive",   .has_arg = 0, .flag = NULL, .val = 'p'},
+    { .name = "subreaper", .has_arg = 0, .flag = NULL, .val = 'R'},
     { .name = "version",   .has_arg = 0, .flag = NULL, .val = 'V'},
     { NULL, 0, NULL, 0 }
 };
@@ -290,7 +298,11 @@ static void
 init_event_interface(nyx_t *nyx)
 {
 #ifndef OSX
-    nyx->event = eventfd(0, 0);
+    /* the eventfd is shared by several loops (connector, event and pidfd
+     * manager): in semaphore mode every read consumes one count only
+     * so a notification wakes as many loops as it counts (see
+     * signal_eventfd) */
+    nyx->event = eventfd(0, EFD_CLOEXEC | EFD_SEMAPHORE);
 
     if (nyx->event > 0)
         return;
@@ -300,7 +312,7 @@ init_event_interface(nyx_t *nyx)
 
     /* OSX does not support the eventfd interface
      * that's why we are going to use pipes in that case */
-    if (pipe(nyx->event_pipe) == -1)
+    if (!pipe_cloexec(nyx->event_pipe))
         log_perror("nyx: pipe");
     else
     {
@@ -326,6 +338,7 @@ initialize_daemon(nyx_t *nyx)
     nyx->options.check_interval = 30;
     nyx->options.startup_delay = 30;
     nyx->options.history_size = 20;
+    nyx->options.check_runners = NYX_RUNNER_DEFAULT_COUNT;
     nyx->options.http_port = 0;
 
     nyx->pid_dir = nyx->options.local_mode
@@ -383,6 +396,31 @@ initialize_daemon(nyx_t *nyx)
         }
     }
 
+    /* as subreaper nyx receives the exits of all watched processes
+     * directly - in init-mode nyx is the reaper of all processes anyway */
+    if (nyx->options.subreaper && !nyx->is_init)
+    {
+        int32_t reaper_fd = process_subreaper();
+
+        if (reaper_fd == -1)
+        {
+            log_perror("nyx: subreaper");
+            log_warn("Failed to become subreaper of the watched processes");
+        }
+        else
+            nyx->reaper_fd = reaper_fd;
+    }
+
+    /* the cgroup root is set up once before the forker is started
+     * so both processes use the same one until nyx is restarted */
+    if (nyx->options.cgroup_root)
+    {
+        if (cgroup_init(nyx->options.cgroup_root))
+            nyx->cgroup_root = strdup(nyx->options.cgroup_root);
+        else
+            log_warn("Failed to set up cgroup root - watches are not put into cgroups");
+    }
+
     /* start the forker thread as soon as possible */
     nyx->forker_pipe = forker_init(nyx);
     if (nyx->forker_pipe < 1)
@@ -391,6 +429,22 @@ initialize_daemon(nyx_t *nyx)
         return NYX_FAILED_DAEMONIZE;
     }
 
+    /* the check runners are forked while nyx is still
+     * small and single threaded as well */
+    nyx->runners = runner_pool_new(nyx->options.check_runners);
+
+    /* start receiving the forker's start results */
+    nyx->forker_thread = xcalloc1(sizeof(pthread_t));
+
+    if (pthread_create(nyx->forker_thread, NULL, forker_reader_start, nyx) != 0)
+    {
+        log_perror("nyx: pthread_create");
+        log_error("Failed to initialize forker reader thread");
+
+        free(nyx->forker_thread);
+        nyx->forker_thread = NULL;
+    }
+
     /* initialize eventfd with an initial value of '0' */
     init_event_interface(nyx);
 
@@ -438,6 +492,9 @@ nyx_initialize(int32_t argc, char **args, nyx_error_e *error)
         exit(EXIT_FAILURE);
     }
 
+    nyx->state_pids = pidmap_new(0);
+    pthread_mutex_init(&nyx->state_pids_lock, NULL);
+
     /* parse command line arguments */
     while ((arg = getopt_long(argc, args, "hqsCDVpc:", long_options, NULL)) != -1)
     {
@@ -461,6 +518,9 @@ nyx_initialize(int32_t argc, char **args, nyx_error_e *error)
             case 'p':
                 nyx->options.passive_mode = true;
                 break;
+            case 'R':
+                nyx->options.subreaper = true;
+                break;
             case 'c':
                 nyx->options.config_file = optarg;
                 break;
@@ -583,13 +643,15 @@ handle_proc_event(proc_event_e event, proc_stat_t *proc, void *data)
     {
         /* port and HTTP check should only be taken into account
          * if the state is running at least for some time */
-        if (event == PROC_HTTP_CHECK_FAILED || event == PROC_PORT_NOT_OPEN)
+        if (event == PROC_HTTP_CHECK_FAILED ||
+            event == PROC_PORT_NOT_OPEN ||
+            event == PROC_EXEC_CHECK_FAILED)
         {
             if (state->history == NULL || state->history->count < 1)
                 return true;
 
             time_t now = time(NULL);
-            timestack_elem_t *newest = &state->history->elements[0];
+            timestack_elem_t *newest = timestack_get(state->history, 0);
             double last_state_ago = difftime(now, newest->time);
 
             uint32_t startup_delay = state->watch->startup_delay;
@@ -636,6 +698,7 @@ nyx_proc_initialize(nyx_t *nyx)
     if (nyx->proc != NULL)
     {
         nyx->proc->event_handler = handle_proc_event;
+        nyx->proc->cgroup_root = nyx->cgroup_root;
 
         nyx->proc_thread = xcalloc1(sizeof(pthread_t));
 
@@ -672,7 +735,8 @@ proc_required(nyx_t *nyx)
         if (watch->max_cpu > 0 ||
             watch->max_memory > 0 ||
             watch->port_check != NULL ||
-            watch->http_check != NULL)
+            watch->http_check != NULL ||
+            watch->exec_check != NULL)
         {
             required = true;
             break;
@@ -684,6 +748,28 @@ proc_required(nyx_t *nyx)
     return required;
 }
 
+/**
+ * @brief Register the pid file of a watch in the pid file cache
+ * @param watch watch to register
+ * @param nyx   nyx instance
+ */
+static void
+register_pid_file(watch_t *watch, nyx_t *nyx)
+{
+    char path[512];
+
+    /* a configured pid file is written by the process itself */
+    if (watch->pid_file)
+    {
+        pidfile_cache_add(nyx->pid_files, watch->name, watch->pid_file, true);
+        return;
+    }
+
+    snprintf(path, sizeof(path), "%s/%s", nyx->pid_dir, watch->name);
+
+    pidfile_cache_add(nyx->pid_files, watch->name, path, false);
+}
+
 /**
  * @brief Initialize watches
  * @param nyx nyx instance
@@ -692,7 +778,7 @@ proc_required(nyx_t *nyx)
 bool
 nyx_watches_init(nyx_t *nyx)
 {
-    int32_t rc = 1, init = 0;
+    int32_t init = 0;
     const char *key = NULL;
     void *data = NULL;
     hash_iter_t *iter = hash_iter_start(nyx->watches);
@@ -710,6 +796,15 @@ nyx_watches_init(nyx_t *nyx)
         log_debug("No watch requiring proc system - skip initialization");
     }
 
+    /* all states are driven by a fixed pool of worker threads
+     * that is kept alive across reloads */
+    if (nyx->scheduler == NULL)
+        nyx->scheduler = scheduler_new(num_cpus());
+
+    /* the pid file cache is kept alive across reloads as well */
+    if (nyx->pid_files == NULL)
+        nyx->pid_files = pidfile_cache_new();
+
     while (hash_iter(iter, &key, &data))
     {
         state_t *state = NULL;
@@ -717,18 +812,15 @@ nyx_watches_init(nyx_t *nyx)
 
         log_debug("Initialize watch '%s'", watch->name);
 
+        register_pid_file(watch, nyx);
+
         /* create new state instance */
         state = state_new(watch, nyx);
         list_add(nyx->states, state);
         hash_add(nyx->state_map, watch->name, state);
 
-        /* start a new thread for each state */
-        state->thread = xcalloc(1, sizeof(pthread_t));
-
-        /* create with default thread attributes */
-        rc = pthread_create(state->thread, NULL, state_loop_start, state);
-        if (rc != 0)
-            log_critical_perror("Failed to create thread, error: %d", rc);
+        /* schedule processing of the initial state */
+        state_notify(state);
 
         init++;
     }
@@ -743,6 +835,11 @@ nyx_watches_init(nyx_t *nyx)
  * @param signum signal to send
  * @param nyx    nyx instance
  * @return 'true' on success, 'false' otherwise
+ *
+ * Every loop reading the event interface consumes one count of the
+ * signal, so 'signum' has to be at least the number of loops sharing
+ * it (NYX_EVENT_LOOPS) for all of them to be woken. The event pipe
+ * receives one message per count for the same reason.
  */
 bool
 signal_eventfd(uint64_t signum, nyx_t *nyx)
@@ -756,7 +853,8 @@ signal_eventfd(uint64_t signum, nyx_t *nyx)
         if (!nyx->event_pipe[1])
             return false;
 
-        rc = write(nyx->event_pipe[1], &signum, sizeof(signum));
+        for (uint64_t i = 0; i < signum && rc != -1; i++)
+            rc = write(nyx->event_pipe[1], &signum, sizeof(signum));
     }
     else
     {
@@ -873,6 +971,12 @@ destroy_options(nyx_t *nyx)
         free((void *)nyx->options.log_file);
         nyx->options.log_file = NULL;
     }
+
+    if (nyx->options.cgroup_root)
+    {
+        free((void *)nyx->options.cgroup_root);
+        nyx->options.cgroup_root = NULL;
+    }
 }
 
 /**
@@ -900,12 +1004,7 @@ nyx_reload(nyx_t *nyx)
          * to reload its config as well otherwise it will still
          * launch the watches with its old run config */
 
-        fork_info_t *reload_info = forker_reload();
-
-        if (write(nyx->forker_pipe, reload_info, sizeof(fork_info_t)) == -1)
-            log_perror("nyx: write");
-
-        free(reload_info);
+        forker_reload(nyx);
 
         if (nyx_watches_init(nyx))
         {
@@ -936,11 +1035,11 @@ nyx_destroy(nyx_t *nyx)
         return;
 
     /* close forker pipe end */
-    if (nyx->forker_pipe)
-        close(nyx->forker_pipe);
+    if (nyx->forker)
+        forker_client_close(nyx->forker);
 
     /* signal termination via eventfd (if existing) */
-    bool signal_sent = signal_eventfd(4, nyx);
+    bool signal_sent = signal_eventfd(NYX_EVENT_LOOPS, nyx);
 
     /* tear down connector first */
     if (nyx->connector_thread)
@@ -962,6 +1061,45 @@ nyx_destroy(nyx_t *nyx)
 
     clear_watches(nyx);
 
+    if (nyx->runners)
+    {
+        runner_pool_destroy(nyx->runners);
+        nyx->runners = NULL;
+    }
+
+    /* the reader terminates as soon as the forker exited */
+    if (nyx->forker_thread)
+    {
+        pthread_join(*nyx->forker_thread, NULL);
+
+        free(nyx->forker_thread);
+        nyx->forker_thread = NULL;
+    }
+
+    if (nyx->forker_reply > 0)
+        close(nyx->forker_reply);
+
+    if (nyx->reaper_fd > 0)
+        close(nyx->reaper_fd);
+
+    if (nyx->forker)
+    {
+        forker_client_destroy(nyx->forker);
+        nyx->forker = NULL;
+    }
+
+    if (nyx->scheduler)
+    {
+        scheduler_destroy(nyx->scheduler);
+        nyx->scheduler = NULL;
+    }
+
+    if (nyx->pid_files)
+    {
+        pidfile_cache_destroy(nyx->pid_files);
+        nyx->pid_files = NULL;
+    }
+
     destroy_plugins(nyx);
 
     if (nyx->options.commands)
@@ -1002,6 +1140,15 @@ nyx_destroy(nyx_t *nyx)
         nyx->socket_path = NULL;
     }
 
+    if (nyx->cgroup_root)
+    {
+        free((void *)nyx->cgroup_root);
+        nyx->cgroup_root = NULL;
+    }
+
+    pidmap_destroy(nyx->state_pids);
+    pthread_mutex_destroy(&nyx->state_pids_lock);
+
     free(nyx);
 }
 
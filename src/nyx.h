@@ -28,6 +28,10 @@
 #include <stdint.h>
 #include <sys/types.h>
 
+/* upper bound of loops sharing the event interface: the connector and
+ * the event/pidfd manager read it, the polling manager only selects */
+#define NYX_EVENT_LOOPS 4
+
 typedef struct
 {
     bool quiet;
@@ -36,6 +40,7 @@ typedef struct
     bool syslog;
     bool local_mode;
     bool passive_mode;
+    bool subreaper;
     int32_t http_port;
     uint32_t def_start_timeout;
     uint32_t def_stop_timeout;
@@ -43,8 +48,12 @@ typedef struct
     uint32_t check_interval;
     uint32_t startup_delay;
     uint32_t history_size;
+    /** number of processes running the exec checks */
+    uint32_t check_runners;
     const char *config_file;
     const char *log_file;
+    /** cgroup (v2) the watches' cgroups are created in */
+    const char *cgroup_root;
     const char **commands;
 #ifdef USE_PLUGINS
     const char *plugins;
@@ -60,18 +69,33 @@ typedef struct
     const char *pid_dir;
     const char *nyx_dir;
     const char *socket_path;
+    /** cgroup root in use (NULL if the watches are not put into cgroups) */
+    const char *cgroup_root;
     int32_t event;
     int32_t event_pipe[2];
     void (*terminate_handler)(int32_t);
     pthread_t *connector_thread;
     pthread_t *proc_thread;
+    pthread_t *forker_thread;
     nyx_proc_t *proc;
     nyx_options_t options;
     hash_t *watches;
     list_t *states;
     hash_t *state_map;
+    /** states by the PID of their process */
+    struct pidmap_t *state_pids;
+    /** lock guarding 'state_pids' */
+    pthread_mutex_t state_pids_lock;
     pid_t forker_pid;
     int32_t forker_pipe;
+    int32_t forker_reply;
+    /** signalfd receiving SIGCHLD in subreaper mode */
+    int32_t reaper_fd;
+    struct forker_client_t *forker;
+    /** pre-forked processes running the exec checks */
+    struct runner_pool_t *runners;
+    struct scheduler_t *scheduler;
+    struct pidfile_cache_t *pid_files;
 #ifdef USE_PLUGINS
     plugin_repository_t *plugins;
 #endif
@@ -0,0 +1,469 @@
+/* Copyright 2014-2019 Gregor Uhlenheuer
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#define _GNU_SOURCE
+
+#include "def.h"
+#include "log.h"
+#include "pidfd.h"
+#include "pidmap.h"
+#include "process.h"
+#include "runner.h"
+#include "state.h"
+
+#include <errno.h>
+#include <pthread.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <sys/signalfd.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+/* Process exit notification via pidfds
+ *
+ * This backend is used if the netlink process connector is not
+ * available (no root privileges or no CONFIG_CONNECTOR). Every watched
+ * process is referenced by a pidfd that becomes readable as soon as the
+ * process terminated. All pidfds are waited for in one epoll set.
+ *
+ * The pidfds are owned by the loop's thread exclusively. Other threads
+ * only signal that some watch's PID changed (see 'pidfd_update') and
+ * the loop synchronizes its pidfds with the watches' PIDs.
+ *
+ * In subreaper mode the loop reaps nyx's children on SIGCHLD as well.
+ * Those exits are dispatched with their exit status and the pidfds
+ * are needed for processes that are not descendants of nyx only. */
+
+#define NYX_MAX_EVENTS 16
+
+/** epoll data of the eventfd that terminates the loop */
+#define NYX_PIDFD_EXIT   0
+
+/** epoll data of the eventfd signaling PID changes */
+#define NYX_PIDFD_UPDATE UINT64_MAX
+
+/** epoll data of the signalfd receiving SIGCHLD */
+#define NYX_PIDFD_REAP   (UINT64_MAX - 1)
+
+static volatile bool need_exit = false;
+
+/** lock guarding 'update_fd' */
+static pthread_mutex_t update_lock = PTHREAD_MUTEX_INITIALIZER;
+
+/** eventfd the loop is woken up by after a PID changed (or -1) */
+static int32_t update_fd = -1;
+
+typedef struct
+{
+    pid_t pid;
+    int32_t fd;
+    /** synchronization round the process was last watched in */
+    uint64_t round;
+} pidfd_watch_t;
+
+typedef struct
+{
+    nyx_t *nyx;
+    process_handler_t handler;
+    process_event_data_t event_data;
+    int32_t epfd;
+    /** watched processes by their PID */
+    pidmap_t *watches;
+    uint64_t round;
+    /** whether pidfds are supported at all */
+    bool pidfds;
+} pidfd_loop_t;
+
+static bool
+epoll_add(int32_t epfd, int32_t fd, uint64_t data)
+{
+    struct epoll_event event;
+
+    memset(&event, 0, sizeof(struct epoll_event));
+
+    event.events = EPOLLIN;
+    event.data.u64 = data;
+
+    if (epoll_ctl(epfd, EPOLL_CTL_ADD, fd, &event) == -1)
+    {
+        log_perror("nyx: epoll_ctl");
+        return false;
+    }
+
+    return true;
+}
+
+static void
+dispatch_exit(pidfd_loop_t *loop, pid_t pid, int32_t exit_code, int32_t exit_signal)
+{
+    process_event_data_t *event_data = &loop->event_data;
+
+    memset(event_data, 0, sizeof(process_event_data_t));
+
+    event_data->type = EVENT_EXIT;
+    event_data->data.exit.pid = pid;
+    event_data->data.exit.exit_code = exit_code;
+    event_data->data.exit.exit_signal = exit_signal;
+    event_data->data.exit.thread_group_id = pid;
+
+    loop->handler(pid, event_data, loop->nyx);
+}
+
+static void
+unwatch(pidfd_loop_t *loop, pid_t pid)
+{
+    pidfd_watch_t *watch = pidmap_remove(loop->watches, pid);
+
+    if (watch == NULL)
+        return;
+
+    /* closing the pidfd removes it from the epoll set as well */
+    close(watch->fd);
+    free(watch);
+}
+
+static void
+watch(pidfd_loop_t *loop, pid_t pid)
+{
+    pidfd_watch_t *watch = pidmap_get(loop->watches, pid);
+
+    if (watch != NULL)
+    {
+        watch->round = loop->round;
+        return;
+    }
+
+    if (!loop->pidfds)
+        return;
+
+    int32_t fd = process_open_fd(pid);
+
+    if (fd == -1)
+    {
+        /* the process exited before we could watch it */
+        if (errno == ESRCH)
+        {
+            log_debug("Process %d is already gone", pid);
+            dispatch_exit(loop, pid, 0, 0);
+        }
+        else
+            log_perror("nyx: pidfd_open");
+
+        return;
+    }
+
+    if (!epoll_add(loop->epfd, fd, (uint64_t)pid))
+    {
+        close(fd);
+        return;
+    }
+
+    watch = xcalloc1(sizeof(pidfd_watch_t));
+    watch->pid = pid;
+    watch->fd = fd;
+    watch->round = loop->round;
+
+    pidmap_put(loop->watches, pid, watch);
+}
+
+/**
+ * @brief Reap all terminated children (subreaper mode)
+ */
+static void
+reap_children(pidfd_loop_t *loop)
+{
+    nyx_t *nyx = loop->nyx;
+    struct signalfd_siginfo signals[16];
+
+    /* the signals only tell that some children exited */
+    while (read(nyx->reaper_fd, signals, sizeof(signals)) > 0)
+    {
+        /* drain */
+    }
+
+    for (;;)
+    {
+        siginfo_t info;
+        info.si_pid = 0;
+
+        if (waitid(P_ALL, 0, &info, WEXITED | WNOHANG) == -1 || info.si_pid == 0)
+            break;
+
+        pid_t pid = info.si_pid;
+        bool killed = info.si_code == CLD_KILLED || info.si_code == CLD_DUMPED;
+
+        log_debug("Reaped process %d (%s %d)", pid,
+                killed ? "signal" : "exit code", info.si_status);
+
+        /* neither the forker nor the check runners are watched */
+        if (pid == nyx->forker_pid || runner_pool_owns(nyx->runners, pid))
+            continue;
+
+        unwatch(loop, pid);
+        dispatch_exit(loop, pid,
+                killed ? 0 : info.si_status,
+                killed ? info.si_status : 0);
+    }
+}
+
+/**
+ * @brief Synchronize the watched pidfds with the PIDs of all watches
+ */
+static void
+sync_watches(pidfd_loop_t *loop)
+{
+    uint32_t num_pids = 0;
+    pidmap_t *watches = loop->watches;
+    pid_t *pids = state_collect_pids(loop->nyx, &num_pids);
+
+    loop->round++;
+
+    for (uint32_t i = 0; i < num_pids; i++)
+        watch(loop, pids[i]);
+
+    free(pids);
+
+    if (watches->count < 1)
+        return;
+
+    /* collect the processes that are not watched anymore first
+     * because removing entries reorders the map */
+    uint32_t count = 0;
+    pid_t *stale = xcalloc(watches->count, sizeof(pid_t));
+
+    for (uint32_t i = 0; i <= watches->mask; i++)
+    {
+        pidfd_watch_t *watch = watches->entries[i].value;
+
+        if (watch != NULL && watch->round != loop->round)
+            stale[count++] = watch->pid;
+    }
+
+    for (uint32_t i = 0; i < count; i++)
+        unwatch(loop, stale[i]);
+
+    log_debug("Watching %u processes via pidfds", watches->count);
+
+    free(stale);
+}
+
+static void
+drain_eventfd(int32_t fd)
+{
+    uint64_t value = 0;
+
+    if (read(fd, &value, sizeof(value)) == -1 && errno != EAGAIN)
+        log_perror("nyx: read");
+}
+
+static void
+set_update_fd(int32_t fd)
+{
+    pthread_mutex_lock(&update_lock);
+    update_fd = fd;
+    pthread_mutex_unlock(&update_lock);
+}
+
+/**
+ * @brief Notify the pidfd loop that the PID of some watch changed
+ *
+ * The loop synchronizes its pidfds asynchronously. Multiple
+ * notifications are coalesced into one.
+ */
+void
+pidfd_update(void)
+{
+    uint64_t value = 1;
+
+    pthread_mutex_lock(&update_lock);
+
+    if (update_fd >= 0 && write(update_fd, &value, sizeof(value)) == -1)
+        log_perror("nyx: write");
+
+    pthread_mutex_unlock(&update_lock);
+}
+
+static bool
+run_loop(pidfd_loop_t *loop)
+{
+    nyx_t *nyx = loop->nyx;
+    struct epoll_event events[NYX_MAX_EVENTS];
+
+    if (nyx->event > 0 && !epoll_add(loop->epfd, nyx->event, NYX_PIDFD_EXIT))
+        return false;
+
+    if (!epoll_add(loop->epfd, update_fd, NYX_PIDFD_UPDATE))
+        return false;
+
+    if (nyx->reaper_fd > 0)
+    {
+        if (!epoll_add(loop->epfd, nyx->reaper_fd, NYX_PIDFD_REAP))
+            return false;
+
+        /* children might have exited before the loop started */
+        reap_children(loop);
+    }
+
+    log_debug("Starting pidfd manager loop");
+
+    sync_watches(loop);
+
+    while (!need_exit)
+    {
+        bool sync = false;
+        int32_t n = epoll_wait(loop->epfd, events, NYX_MAX_EVENTS, -1);
+
+        if (n == -1)
+        {
+            if (errno == EINTR)
+                continue;
+
+            log_perror("nyx: epoll_wait");
+            return false;
+        }
+
+        for (int32_t i = 0; i < n; i++)
+        {
+            uint64_t data = events[i].data.u64;
+
+            if (data == NYX_PIDFD_EXIT)
+            {
+                log_debug("Received epoll event on eventfd interface (%d)", nyx->event);
+
+                drain_eventfd(nyx->event);
+                need_exit = true;
+            }
+            else if (data == NYX_PIDFD_UPDATE)
+            {
+                drain_eventfd(update_fd);
+                sync = true;
+            }
+            else if (data == NYX_PIDFD_REAP)
+                reap_children(loop);
+            else
+            {
+                pid_t pid = (pid_t)data;
+
+                /* our own children are reaped with their exit status */
+                if (nyx->reaper_fd > 0)
+                    reap_children(loop);
+
+                if (pidmap_get(loop->watches, pid) != NULL)
+                {
+                    log_debug("Process %d exited (pidfd)", pid);
+
+                    unwatch(loop, pid);
+                    dispatch_exit(loop, pid, 0, 0);
+                }
+            }
+        }
+
+        /* all PID changes of this round are handled at once */
+        if (sync && !need_exit)
+            sync_watches(loop);
+    }
+
+    return true;
+}
+
+static void
+on_terminate(UNUSED int signum)
+{
+    log_debug("Caught termination signal - exiting pidfd manager loop");
+
+    need_exit = true;
+}
+
+bool
+pidfd_loop(nyx_t *nyx, process_handler_t handler)
+{
+    bool success = false;
+
+    /* reset exit state in case this is a restart */
+    need_exit = false;
+
+    /* pidfds are supported since linux 5.3 */
+    int32_t probe = process_open_fd(getpid());
+
+    if (probe == -1)
+    {
+        log_perror("nyx: pidfd_open");
+
+        /* as subreaper we are notified about our children's exits anyway */
+        if (nyx->reaper_fd < 1)
+            return false;
+
+        log_warn("Exits of processes that were not started by nyx "
+                 "are not noticed without pidfd support");
+    }
+    else
+        close(probe);
+
+    pidfd_loop_t loop =
+    {
+        .nyx = nyx,
+        .handler = handler,
+        .epfd = epoll_create1(EPOLL_CLOEXEC),
+        .watches = pidmap_new(0),
+        .round = 0,
+        .pidfds = probe != -1
+    };
+
+    int32_t fd = eventfd(0, EFD_CLOEXEC | EFD_NONBLOCK);
+
+    if (loop.epfd == -1)
+        log_perror("nyx: epoll_create1");
+    else if (fd == -1)
+        log_perror("nyx: eventfd");
+    else
+    {
+        set_update_fd(fd);
+
+        /* register termination handler */
+        setup_signals(nyx, on_terminate);
+
+        success = run_loop(&loop);
+
+        set_update_fd(-1);
+    }
+
+    /* close all remaining pidfds */
+    for (uint32_t i = 0; i <= loop.watches->mask; i++)
+    {
+        pidfd_watch_t *watch = loop.watches->entries[i].value;
+
+        if (watch != NULL)
+        {
+            close(watch->fd);
+            free(watch);
+        }
+    }
+
+    pidmap_destroy(loop.watches);
+
+    if (fd != -1)
+        close(fd);
+
+    if (loop.epfd != -1)
+        close(loop.epfd);
+
+    log_debug("pidfd manager: terminated");
+
+    return success;
+}
+
+/* vim: set et sw=4 sts=4 tw=80: */
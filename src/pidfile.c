@@ -0,0 +1,503 @@
+/* Copyright 2014-2019 Gregor Uhlenheuer
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#define _GNU_SOURCE
+
+#include "def.h"
+#include "fs.h"
+#include "log.h"
+#include "pidfile.h"
+
+#include <errno.h>
+#include <poll.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#ifndef OSX
+#include <sys/eventfd.h>
+#include <sys/inotify.h>
+#endif
+
+/** size of the buffer inotify events are read into */
+#define NYX_PIDFILE_EVENTS_SIZE 4096
+
+typedef struct
+{
+    char *path;
+    /** file name part of 'path' */
+    const char *name;
+    /** the pid file's directory is watched (so 'pid' is up to date) */
+    bool watched;
+    /** inotify watch descriptor of the pid file's directory */
+    int32_t wd;
+    /** the pid file is not written by nyx itself */
+    bool external;
+    pid_t pid;
+} pidfile_t;
+
+typedef struct
+{
+    char *path;
+    int32_t wd;
+} pidfile_dir_t;
+
+static pid_t
+read_pid_file(const char *path)
+{
+    int32_t matched = 0;
+    pid_t pid = 0;
+    FILE *file = fopen(path, "re");
+
+    if (file != NULL)
+    {
+        matched = fscanf(file, "%d", &pid);
+        fclose(file);
+    }
+
+    return matched == 1 ? pid : 0;
+}
+
+static void
+pidfile_destroy(void *data)
+{
+    pidfile_t *file = data;
+
+    free(file->path);
+    free(file);
+}
+
+static void
+pidfile_dir_destroy(void *data)
+{
+    pidfile_dir_t *dir = data;
+
+    free(dir->path);
+    free(dir);
+}
+
+/**
+ * @brief Find the registered pid file of the given path
+ *
+ * The paths are compared in full - hash keys are truncated
+ * (see NYX_HASH_KEY_MAXLEN) so long paths might collide otherwise.
+ */
+static pidfile_t *
+find_file(pidfile_cache_t *cache, const char *path)
+{
+    for (list_node_t *node = cache->files->head; node; node = node->next)
+    {
+        pidfile_t *file = node->data;
+
+        if (strcmp(file->path, path) == 0)
+            return file;
+    }
+
+    return NULL;
+}
+
+#ifndef OSX
+static pidfile_dir_t *
+find_dir(pidfile_cache_t *cache, int32_t wd)
+{
+    for (list_node_t *node = cache->dirs->head; node; node = node->next)
+    {
+        pidfile_dir_t *dir = node->data;
+
+        if (dir->wd == wd)
+            return dir;
+    }
+
+    return NULL;
+}
+
+/**
+ * @brief Re-read all cached pid files (the inotify queue overflowed)
+ */
+static void
+refresh_all(pidfile_cache_t *cache)
+{
+    for (list_node_t *node = cache->files->head; node; node = node->next)
+    {
+        pidfile_t *file = node->data;
+
+        if (file->watched)
+            file->pid = read_pid_file(file->path);
+    }
+}
+
+/**
+ * @brief Forget the given directory whose watch was removed
+ *
+ * The pid files of the directory are read from disk on lookup until
+ * the directory is watched again.
+ */
+static void
+unwatch_dir(pidfile_cache_t *cache, pidfile_dir_t *dir)
+{
+    for (list_node_t *node = cache->files->head; node; node = node->next)
+    {
+        pidfile_t *file = node->data;
+
+        if (file->watched && file->wd == dir->wd)
+            file->watched = false;
+    }
+
+    log_debug("Stopped watching pid file directory '%s'", dir->path);
+
+    for (list_node_t *node = cache->dirs->head; node; node = node->next)
+    {
+        if (node->data == dir)
+        {
+            list_remove(cache->dirs, node);
+            break;
+        }
+    }
+}
+
+static void
+handle_event(pidfile_cache_t *cache, const struct inotify_event *event)
+{
+    if (event->mask & IN_Q_OVERFLOW)
+    {
+        log_warn("Pid file events were lost - re-reading all pid files");
+        refresh_all(cache);
+        return;
+    }
+
+    pidfile_dir_t *dir = find_dir(cache, event->wd);
+
+    if (dir == NULL)
+        return;
+
+    /* a moved directory is not the pid files' directory anymore - its
+     * watch is removed explicitly which is reported by IN_IGNORED */
+    if (event->mask & IN_MOVE_SELF)
+    {
+        inotify_rm_watch(cache->inotify_fd, event->wd);
+        return;
+    }
+
+    /* the directory was removed (e.g. a /run directory the service
+     * creates on its own) */
+    if (event->mask & IN_IGNORED)
+    {
+        unwatch_dir(cache, dir);
+        return;
+    }
+
+    if (event->len < 1)
+        return;
+
+    /* the pid files are identified by their directory's watch
+     * and their file name */
+    for (list_node_t *node = cache->files->head; node; node = node->next)
+    {
+        pidfile_t *file = node->data;
+
+        if (!file->watched || file->wd != event->wd || strcmp(file->name, event->name))
+            continue;
+
+        file->pid = event->mask & (IN_DELETE | IN_MOVED_FROM)
+            ? 0
+            : read_pid_file(file->path);
+
+        log_debug("Pid file '%s' changed: PID %d", file->path, file->pid);
+    }
+}
+
+static void *
+pidfile_watcher(void *data)
+{
+    pidfile_cache_t *cache = data;
+    char buffer[NYX_PIDFILE_EVENTS_SIZE]
+        __attribute__ ((aligned(__alignof__(struct inotify_event))));
+
+    struct pollfd fds[2] =
+    {
+        { .fd = cache->inotify_fd, .events = POLLIN },
+        { .fd = cache->exit_fd, .events = POLLIN }
+    };
+
+    for (;;)
+    {
+        if (poll(fds, 2, -1) == -1)
+        {
+            if (errno == EINTR)
+                continue;
+
+            log_perror("nyx: poll");
+            break;
+        }
+
+        if (fds[1].revents & POLLIN)
+            break;
+
+        ssize_t length = read(cache->inotify_fd, buffer, sizeof(buffer));
+
+        if (length < 1)
+            continue;
+
+        pthread_mutex_lock(&cache->lock);
+
+        for (char *ptr = buffer; ptr < buffer + length; )
+        {
+            const struct inotify_event *event = (const struct inotify_event *)ptr;
+
+            handle_event(cache, event);
+
+            ptr += sizeof(struct inotify_event) + event->len;
+        }
+
+        pthread_mutex_unlock(&cache->lock);
+    }
+
+    return NULL;
+}
+
+static void
+init_watcher(pidfile_cache_t *cache)
+{
+    cache->exit_fd = -1;
+
+    if ((cache->inotify_fd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC)) == -1)
+    {
+        log_perror("nyx: inotify_init1");
+        return;
+    }
+
+    if ((cache->exit_fd = eventfd(0, EFD_CLOEXEC)) == -1 ||
+            pthread_create(&cache->watcher, NULL, pidfile_watcher, cache) != 0)
+    {
+        log_perror("nyx: failed to initialize pid file watcher");
+
+        if (cache->exit_fd >= 0)
+            close(cache->exit_fd);
+
+        close(cache->inotify_fd);
+        cache->inotify_fd = -1;
+    }
+}
+
+/**
+ * @brief Watch the directory of the given pid file
+ * @return true if the directory is watched
+ *
+ * Besides complete writes and renames the creation and modification
+ * of pid files are watched as well because many daemons keep their
+ * (locked) pid file open.
+ */
+static bool
+watch_dir(pidfile_cache_t *cache, pidfile_t *file)
+{
+    if (cache->inotify_fd < 0)
+        return false;
+
+    char *directory = (char *)parent_dir(file->path);
+
+    if (directory == NULL)
+        return false;
+
+    int32_t wd = inotify_add_watch(cache->inotify_fd, directory,
+            IN_CREATE | IN_MODIFY | IN_CLOSE_WRITE |
+            IN_MOVED_TO | IN_MOVED_FROM | IN_DELETE | IN_MOVE_SELF);
+
+    if (wd == -1)
+    {
+        /* the directory might be created later on */
+        if (errno != ENOENT)
+            log_perror("nyx: inotify_add_watch");
+
+        free(directory);
+        return false;
+    }
+
+    file->wd = wd;
+
+    /* the same directory is reported with the same descriptor */
+    if (find_dir(cache, wd) != NULL)
+    {
+        free(directory);
+        return true;
+    }
+
+    pidfile_dir_t *dir = xcalloc1(sizeof(pidfile_dir_t));
+
+    dir->path = directory;
+    dir->wd = wd;
+
+    list_add(cache->dirs, dir);
+
+    log_debug("Watching pid file directory '%s'", directory);
+
+    return true;
+}
+#endif
+
+/**
+ * @brief Watch the directory of the given pid file unless it
+ *        is watched already
+ *
+ * The directory is watched before the file is read so no update
+ * can get lost.
+ */
+static void
+ensure_watched(UNUSED pidfile_cache_t *cache, pidfile_t *file)
+{
+#ifndef OSX
+    if (!file->watched && (file->watched = watch_dir(cache, file)))
+        file->pid = read_pid_file(file->path);
+#endif
+}
+
+pidfile_cache_t *
+pidfile_cache_new(void)
+{
+    pidfile_cache_t *cache = xcalloc1(sizeof(pidfile_cache_t));
+
+    pthread_mutex_init(&cache->lock, NULL);
+
+    cache->names = hash_new(NULL);
+    cache->files = list_new(pidfile_destroy);
+    cache->dirs = list_new(pidfile_dir_destroy);
+
+#ifndef OSX
+    init_watcher(cache);
+#endif
+
+    return cache;
+}
+
+/**
+ * @brief Register the pid file of a watch
+ * @param cache    pid file cache
+ * @param name     watch name
+ * @param path     absolute path of the pid file
+ * @param external whether the pid file is written by the watched
+ *                 process instead of nyx itself
+ */
+void
+pidfile_cache_add(pidfile_cache_t *cache, const char *name, const char *path,
+        bool external)
+{
+    pthread_mutex_lock(&cache->lock);
+
+    pidfile_t *file = find_file(cache, path);
+
+    if (file == NULL)
+    {
+        file = xcalloc1(sizeof(pidfile_t));
+        file->path = strdup(path);
+
+        if (file->path == NULL)
+            log_critical_perror("nyx: strdup");
+
+        const char *slash = strrchr(file->path, '/');
+        file->name = slash ? slash + 1 : file->path;
+
+        list_add(cache->files, file);
+    }
+
+    /* the directory might have been removed in the meantime */
+    ensure_watched(cache, file);
+
+    file->external = external;
+
+    /* the watch's pid file might have been changed by a reload */
+    hash_remove(cache->names, name);
+    hash_add(cache->names, name, file);
+
+    pthread_mutex_unlock(&cache->lock);
+}
+
+/**
+ * @brief Look up the PID stored in the pid file of a watch
+ * @param cache pid file cache
+ * @param name  watch name
+ * @param pid   PID of the pid file (0 if not existing)
+ * @return false if no pid file is registered for the watch
+ */
+bool
+pidfile_cache_get(pidfile_cache_t *cache, const char *name, pid_t *pid)
+{
+    bool found = false;
+
+    pthread_mutex_lock(&cache->lock);
+
+    pidfile_t *file = hash_get(cache->names, name);
+
+    if (file != NULL)
+    {
+        ensure_watched(cache, file);
+
+        *pid = file->watched ? file->pid : read_pid_file(file->path);
+        found = true;
+    }
+
+    pthread_mutex_unlock(&cache->lock);
+
+    return found;
+}
+
+/**
+ * @brief Update the cached PID after nyx wrote or removed
+ *        the pid file of a watch
+ */
+void
+pidfile_cache_set(pidfile_cache_t *cache, const char *name, pid_t pid)
+{
+    pthread_mutex_lock(&cache->lock);
+
+    pidfile_t *file = hash_get(cache->names, name);
+
+    /* external pid files are not touched by nyx */
+    if (file != NULL && !file->external)
+        file->pid = pid;
+
+    pthread_mutex_unlock(&cache->lock);
+}
+
+void
+pidfile_cache_destroy(pidfile_cache_t *cache)
+{
+    if (cache == NULL)
+        return;
+
+#ifndef OSX
+    if (cache->inotify_fd >= 0)
+    {
+        uint64_t value = 1;
+
+        if (write(cache->exit_fd, &value, sizeof(value)) == -1)
+            log_perror("nyx: write");
+        else
+            pthread_join(cache->watcher, NULL);
+
+        close(cache->exit_fd);
+        close(cache->inotify_fd);
+    }
+#endif
+
+    hash_destroy(cache->names);
+    list_destroy(cache->files);
+    list_destroy(cache->dirs);
+
+    pthread_mutex_destroy(&cache->lock);
+
+    free(cache);
+}
+
+/* vim: set et sw=4 sts=4 tw=80: */
@@ -0,0 +1,70 @@
+/* Copyright 2014-2019 Gregor Uhlenheuer
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#pragma once
+
+#include "hash.h"
+#include "list.h"
+
+#include <pthread.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <sys/types.h>
+
+/* In-memory cache of the watches' pid files
+ *
+ * The directories of all registered pid files are watched via inotify
+ * so that lookups are plain memory reads while pid files that are
+ * rewritten or removed by other processes are picked up right away.
+ * Pid files that cannot be watched are read from disk on every
+ * lookup instead. */
+
+typedef struct pidfile_cache_t
+{
+    /** lock guarding all of the fields below */
+    pthread_mutex_t lock;
+    /** registered pid files by watch name */
+    hash_t *names;
+    /** registered pid files (unique by path) */
+    list_t *files;
+    /** watched directories */
+    list_t *dirs;
+#ifndef OSX
+    /** inotify instance watching the directories in 'dirs' */
+    int32_t inotify_fd;
+    /** eventfd to terminate the watcher thread */
+    int32_t exit_fd;
+    /** thread receiving the inotify events */
+    pthread_t watcher;
+#endif
+} pidfile_cache_t;
+
+pidfile_cache_t *
+pidfile_cache_new(void);
+
+void
+pidfile_cache_add(pidfile_cache_t *cache, const char *name, const char *path,
+        bool external);
+
+bool
+pidfile_cache_get(pidfile_cache_t *cache, const char *name, pid_t *pid);
+
+void
+pidfile_cache_set(pidfile_cache_t *cache, const char *name, pid_t pid);
+
+void
+pidfile_cache_destroy(pidfile_cache_t *cache);
+
+/* vim: set et sw=4 sts=4 tw=80: */
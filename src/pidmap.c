@@ -0,0 +1,170 @@
+/* Copyright 2014-2019 Gregor Uhlenheuer
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "def.h"
+#include "pidmap.h"
+
+#include <stdlib.h>
+
+/** minimum number of slots */
+#define NYX_PIDMAP_MIN_SIZE 16
+
+static uint32_t
+pid_slot(const pidmap_t *map, pid_t pid)
+{
+    /* PIDs are mostly sequential - spread them over the table */
+    uint32_t hash = (uint32_t)pid * 0x9e3779b1u;
+
+    return (hash ^ (hash >> 16)) & map->mask;
+}
+
+static void
+pidmap_insert(pidmap_t *map, pid_t pid, void *value)
+{
+    uint32_t idx = pid_slot(map, pid);
+
+    while (map->entries[idx].pid && map->entries[idx].pid != pid)
+        idx = (idx + 1) & map->mask;
+
+    if (map->entries[idx].pid == 0)
+        map->count++;
+
+    map->entries[idx].pid = pid;
+    map->entries[idx].value = value;
+}
+
+static void
+pidmap_resize(pidmap_t *map, uint32_t capacity)
+{
+    pidmap_entry_t *entries = map->entries;
+    uint32_t old_capacity = map->mask + 1;
+
+    map->entries = xcalloc(capacity, sizeof(pidmap_entry_t));
+    map->mask = capacity - 1;
+    map->count = 0;
+
+    for (uint32_t i = 0; i < old_capacity; i++)
+    {
+        if (entries[i].pid)
+            pidmap_insert(map, entries[i].pid, entries[i].value);
+    }
+
+    free(entries);
+}
+
+pidmap_t *
+pidmap_new(uint32_t size)
+{
+    uint32_t capacity = NYX_PIDMAP_MIN_SIZE;
+    pidmap_t *map = xcalloc1(sizeof(pidmap_t));
+
+    /* keep the load factor below 3/4 */
+    while (capacity * 3 / 4 <= size)
+        capacity <<= 1;
+
+    map->mask = capacity - 1;
+    map->entries = xcalloc(capacity, sizeof(pidmap_entry_t));
+
+    return map;
+}
+
+void
+pidmap_destroy(pidmap_t *map)
+{
+    if (map == NULL)
+        return;
+
+    free(map->entries);
+    free(map);
+}
+
+void
+pidmap_put(pidmap_t *map, pid_t pid, void *value)
+{
+    if (pid < 1)
+        return;
+
+    if ((map->count + 1) * 4 > (map->mask + 1) * 3)
+        pidmap_resize(map, (map->mask + 1) * 2);
+
+    pidmap_insert(map, pid, value);
+}
+
+void *
+pidmap_get(pidmap_t *map, pid_t pid)
+{
+    if (pid < 1)
+        return NULL;
+
+    uint32_t idx = pid_slot(map, pid);
+
+    while (map->entries[idx].pid)
+    {
+        if (map->entries[idx].pid == pid)
+            return map->entries[idx].value;
+
+        idx = (idx + 1) & map->mask;
+    }
+
+    return NULL;
+}
+
+void *
+pidmap_remove(pidmap_t *map, pid_t pid)
+{
+    if (pid < 1)
+        return NULL;
+
+    uint32_t idx = pid_slot(map, pid);
+
+    while (map->entries[idx].pid != pid)
+    {
+        if (map->entries[idx].pid == 0)
+            return NULL;
+
+        idx = (idx + 1) & map->mask;
+    }
+
+    void *value = map->entries[idx].value;
+    uint32_t next = idx;
+
+    /* shift back all following entries that are not
+     * in their home slot already */
+    for (;;)
+    {
+        next = (next + 1) & map->mask;
+
+        if (map->entries[next].pid == 0)
+            break;
+
+        uint32_t home = pid_slot(map, map->entries[next].pid);
+
+        /* the entry may move into the hole if its home slot
+         * is not between the hole and its current position */
+        if (((next - home) & map->mask) >= ((next - idx) & map->mask))
+        {
+            map->entries[idx] = map->entries[next];
+            idx = next;
+        }
+    }
+
+    map->entries[idx].pid = 0;
+    map->entries[idx].value = NULL;
+    map->count--;
+
+    return value;
+}
+
+/* vim: set et sw=4 sts=4 tw=80: */
@@ -0,0 +1,56 @@
+/* Copyright 2014-2019 Gregor Uhlenheuer
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#pragma once
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <sys/types.h>
+
+/* Open-addressing hash map from PIDs to arbitrary pointers
+ *
+ * PIDs are stored inline with linear probing - a PID of 0 marks an
+ * empty slot. Removals shift the following entries back so no
+ * tombstones are needed. The map is not synchronized. */
+
+typedef struct
+{
+    pid_t pid;
+    void *value;
+} pidmap_entry_t;
+
+typedef struct pidmap_t
+{
+    uint32_t count;
+    uint32_t mask;
+    pidmap_entry_t *entries;
+} pidmap_t;
+
+pidmap_t *
+pidmap_new(uint32_t size);
+
+void
+pidmap_destroy(pidmap_t *map);
+
+void
+pidmap_put(pidmap_t *map, pid_t pid, void *value);
+
+void *
+pidmap_get(pidmap_t *map, pid_t pid);
+
+void *
+pidmap_remove(pidmap_t *map, pid_t pid);
+
+/* vim: set et sw=4 sts=4 tw=80: */
@@ -20,6 +20,7 @@
 #include "state.h"
 #include "utils.h"
 
+#include <sys/wait.h>
 #include <unistd.h>
 
 static volatile bool need_exit = false;
@@ -31,6 +32,29 @@ on_terminate(UNUSED int signum)
     need_exit = true;
 }
 
+/**
+ * @brief Reap all terminated children (subreaper mode)
+ *
+ * SIGCHLD is blocked as subreaper so the reparented processes would
+ * stay zombies otherwise - and zombies are considered as running.
+ */
+static void
+reap_children(nyx_t *nyx)
+{
+    char signals[128];
+
+    /* the signals only tell that some children exited */
+    while (read(nyx->reaper_fd, signals, sizeof(signals)) > 0)
+    {
+        /* drain */
+    }
+
+    while (waitpid(-1, NULL, WNOHANG) > 0)
+    {
+        /* the exits are noticed by polling the PIDs */
+    }
+}
+
 bool
 poll_loop(nyx_t *nyx, poll_handler_t handler)
 {
@@ -47,6 +71,9 @@ poll_loop(nyx_t *nyx, poll_handler_t handler)
     {
         list_t *states = nyx->states;
 
+        if (nyx->reaper_fd > 0)
+            reap_children(nyx);
+
         if (!states)
         {
             wait_interval_fd(nyx->event, interval);
@@ -63,7 +90,7 @@ poll_loop(nyx_t *nyx, poll_handler_t handler)
             if (pid < 1)
             {
                 pid = determine_pid(state->watch->name, nyx);
-                state->pid = pid;
+                set_pid(state, pid);
             }
 
             if (pid > 0)
@@ -15,23 +15,38 @@
 
 #define _GNU_SOURCE
 
+#include "check.h"
 #include "def.h"
 #include "log.h"
+#include "pidmap.h"
 #include "proc.h"
 #include "socket.h"
 #include "utils.h"
 
+#include <dirent.h>
+#include <errno.h>
+#include <fcntl.h>
 #include <inttypes.h>
 #include <signal.h>
 #include <stdio.h>
+#include <string.h>
+#include <sys/select.h>
 #include <unistd.h>
 
-#define PROC_STAT_STACK_SIZE 10
-#define PROC_STAT_STACK_LIMIT 8
+#ifndef OSX
+#include <sys/eventfd.h>
+#endif
+
+/* large enough for the first 24 fields of /proc/<pid>/stat
+ * and the first line of /proc/stat */
+#define PROC_STAT_BUFFER_SIZE 1024
+
+/* upper limit of descendants accounted per watched process */
+#define PROC_MAX_DESCENDANTS 1024
 
 static volatile bool need_exit = false;
 
-static void
+void
 proc_stat_destroy(void *obj)
 {
     proc_stat_t *stat = obj;
@@ -48,6 +63,15 @@ proc_stat_destroy(void *obj)
         stat->cpu_usage = NULL;
     }
 
+    if (stat->fd >= 0)
+    {
+        close(stat->fd);
+        stat->fd = -1;
+    }
+
+    cgroup_destroy(stat->cgroup);
+
+    free(stat->children);
     free(stat);
 }
 
@@ -57,9 +81,32 @@ nyx_proc_new(void)
     nyx_proc_t *proc = xcalloc1(sizeof(nyx_proc_t));
 
     proc->processes = list_new(proc_stat_destroy);
+    proc->index = pidmap_new(0);
+    proc->checks = check_engine_new(NYX_CHECK_MAX_CONCURRENT);
+    proc->schedule = heap_new(0);
     proc->total_memory = total_memory_size();
     proc->page_size = get_page_size();
+    proc->clock_ticks = sysconf(_SC_CLK_TCK);
     proc->num_cpus = num_cpus();
+    proc->stat_fd = -1;
+    proc->seed = (time_ms() << 16) ^ getpid() ^ 0x9e3779b97f4a7c15ULL;
+
+#ifndef OSX
+    /* the children of a process are listed only if the kernel
+     * is built with CONFIG_PROC_CHILDREN */
+    char path[64] = {0};
+    snprintf(path, sizeof(path), "/proc/self/task/%d/children", getpid());
+
+    proc->track_children = access(path, R_OK) == 0;
+#endif
+
+    pthread_mutex_init(&proc->lock, NULL);
+
+#ifndef OSX
+    proc->wake_fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+#else
+    proc->wake_fd = -1;
+#endif
 
     return proc;
 }
@@ -72,60 +119,420 @@ proc_stat_new(pid_t pid, const char *name, watch_t *watch)
     stat->pid = pid;
     stat->name = name;
     stat->watch = watch;
+    stat->fd = -1;
+    stat->check_limit = watch_check_limit(watch);
+
+    heap_init_node(&stat->schedule);
 
-    /* TODO: configurable stack size */
-    stat->mem_usage = stack_long_new(PROC_STAT_STACK_SIZE);
-    stat->cpu_usage = stack_double_new(PROC_STAT_STACK_SIZE);
+    uint32_t window = watch_check_window(watch);
+
+    stat->mem_usage = stack_long_new(window, watch ? watch->max_memory : 0);
+    stat->cpu_usage = stack_double_new(window, watch ? watch->max_cpu : 0);
 
     return stat;
 }
 
-static uint64_t
-calculate_sys_period(sys_proc_stat_t *stat)
+#ifndef OSX
+static int32_t
+open_proc_stat(pid_t pid)
 {
-    /* read current statistics */
-    sys_proc_stat_t current;
-    memset(&current, 0, sizeof(sys_proc_stat_t));
+    char path[64] = {0};
+    snprintf(path, sizeof(path), "/proc/%d/stat", pid);
 
-    if (!sys_proc_read(&current))
-        return 0;
+    return open(path, O_RDONLY | O_CLOEXEC);
+}
+
+static bool
+sys_info_read_fd(sys_info_t *sys, int32_t fd, int64_t page_size)
+{
+    char buffer[PROC_STAT_BUFFER_SIZE];
+    ssize_t bytes = pread(fd, buffer, sizeof(buffer), 0);
+
+    if (bytes <= 0)
+        return false;
+
+    return sys_info_parse(sys, buffer, bytes, page_size);
+}
+
+static bool
+sys_proc_read_fd(sys_proc_stat_t *stat, int32_t fd)
+{
+    char buffer[PROC_STAT_BUFFER_SIZE];
+    ssize_t bytes = pread(fd, buffer, sizeof(buffer), 0);
+
+    if (bytes <= 0)
+        return false;
+
+    return sys_proc_parse(stat, buffer, bytes);
+}
+#endif
+
+/**
+ * @brief Read the current system statistics via the persistent
+ *        file descriptor of /proc/stat
+ */
+static bool
+sys_proc_sample(nyx_proc_t *sys, sys_proc_stat_t *stat)
+{
+#ifndef OSX
+    if (sys->stat_fd < 0 &&
+            (sys->stat_fd = open("/proc/stat", O_RDONLY | O_CLOEXEC)) < 0)
+    {
+        log_perror("nyx: open");
+        return false;
+    }
+
+    if (!sys_proc_read_fd(stat, sys->stat_fd))
+    {
+        log_error("Failed to parse /proc/stat");
+        return false;
+    }
+
+    return true;
+#else
+    return sys_proc_read(stat);
+#endif
+}
+
+/**
+ * @brief Read the current process statistics via the persistent
+ *        file descriptor of /proc/<pid>/stat
+ *
+ * The file descriptor is opened on first use and kept open as long as
+ * the process is watched. Once it refers to a process that is gone it
+ * is reopened in case the PID was reused in the meantime.
+ */
+static bool
+proc_stat_sample(proc_stat_t *proc, sys_info_t *info, int64_t page_size)
+{
+#ifndef OSX
+    if (proc->fd >= 0)
+    {
+        if (sys_info_read_fd(info, proc->fd, page_size))
+            return true;
+
+        close(proc->fd);
+        proc->fd = -1;
+    }
+
+    if ((proc->fd = open_proc_stat(proc->pid)) < 0)
+    {
+        log_perror("nyx: open");
+        return false;
+    }
+
+    return sys_info_read_fd(info, proc->fd, page_size);
+#else
+    return sys_info_read_proc(info, proc->pid, page_size);
+#endif
+}
+
+#ifndef OSX
+typedef struct
+{
+    proc_child_t *children;
+    uint32_t count;
+    uint32_t capacity;
+} proc_tree_t;
+
+static void
+proc_tree_add(proc_tree_t *tree, pid_t pid)
+{
+    if (tree->count == tree->capacity)
+    {
+        tree->capacity = MAX(16, tree->capacity * 2);
+
+        void *children = realloc(tree->children, tree->capacity * sizeof(proc_child_t));
+
+        if (children == NULL)
+            log_critical_perror("nyx: realloc");
+
+        tree->children = children;
+    }
+
+    proc_child_t *child = &tree->children[tree->count++];
+
+    child->pid = pid;
+    child->start_time = 0;
+    child->total_time = 0;
+}
+
+static void
+proc_tree_read_children(proc_tree_t *tree, const char *path)
+{
+    FILE *file = fopen(path, "re");
+
+    if (file == NULL)
+        return;
+
+    int32_t pid = 0;
+
+    while (tree->count < PROC_MAX_DESCENDANTS && fscanf(file, "%d", &pid) == 1)
+        proc_tree_add(tree, pid);
+
+    fclose(file);
+}
+
+/**
+ * @brief Add the children of all threads of the given process to the tree
+ */
+static void
+proc_tree_add_children(proc_tree_t *tree, pid_t pid, int64_t num_threads)
+{
+    char path[320] = {0};
+
+    /* most processes are single-threaded so we can spare
+     * listing the process' threads */
+    if (num_threads == 1)
+    {
+        snprintf(path, sizeof(path), "/proc/%d/task/%d/children", pid, pid);
+        proc_tree_read_children(tree, path);
+        return;
+    }
+
+    snprintf(path, sizeof(path), "/proc/%d/task", pid);
+
+    DIR *dir = opendir(path);
+
+    if (dir == NULL)
+        return;
+
+    struct dirent *entry = NULL;
+
+    while ((entry = readdir(dir)) != NULL)
+    {
+        if (entry->d_name[0] < '0' || entry->d_name[0] > '9')
+            continue;
+
+        snprintf(path, sizeof(path), "/proc/%d/task/%s/children", pid, entry->d_name);
+        proc_tree_read_children(tree, path);
+    }
+
+    closedir(dir);
+}
+
+/**
+ * @brief Read the statistics of a process that might be gone already
+ */
+static bool
+proc_child_read(pid_t pid, sys_info_t *info, int64_t page_size)
+{
+    int32_t fd = open_proc_stat(pid);
+
+    if (fd < 0)
+        return false;
+
+    bool success = sys_info_read_fd(info, fd, page_size);
 
-    /* calculate diff */
-    current.period = current.total - stat->total;
+    close(fd);
+    return success;
+}
+
+static int
+compare_child(const void *a, const void *b)
+{
+    pid_t pid_a = ((const proc_child_t *)a)->pid;
+    pid_t pid_b = ((const proc_child_t *)b)->pid;
+
+    return (pid_a > pid_b) - (pid_a < pid_b);
+}
+
+static proc_child_t *
+proc_child_find(proc_child_t *children, uint32_t count, const proc_child_t *child)
+{
+    if (count < 1)
+        return NULL;
+
+    proc_child_t *found = bsearch(child, children, count, sizeof(proc_child_t), compare_child);
+
+    /* the PID might have been reused in the meantime */
+    if (found && found->start_time != child->start_time)
+        return NULL;
+
+    return found;
+}
+
+/**
+ * @brief Sample all descendants of the given process
+ * @param proc         watched process
+ * @param num_threads  number of threads of the watched process
+ * @param page_size    system page size (in bytes)
+ * @param rss          resident set size the descendants' one is added to
+ * @return CPU time the descendants used since the last snapshot
+ *
+ * The descendants are enumerated via /proc/<pid>/task/<tid>/children
+ * on every snapshot. Descendants that exited since the last snapshot
+ * were reaped by their parent whose children's CPU time includes
+ * theirs from now on - so their known CPU time is subtracted in order
+ * not to count it twice.
+ */
+int64_t
+proc_tree_sample(proc_stat_t *proc, int64_t num_threads, int64_t page_size, int64_t *rss)
+{
+    int64_t diff = 0;
+    proc_tree_t tree = {NULL, 0, 0};
+
+    proc_tree_add_children(&tree, proc->pid, num_threads);
+
+    /* the tree is traversed breadth-first while it is growing */
+    for (uint32_t i = 0; i < tree.count; i++)
+    {
+        proc_child_t *child = &tree.children[i];
+
+        sys_info_t info;
+        memset(&info, 0, sizeof(sys_info_t));
+
+        if (!proc_child_read(child->pid, &info, page_size))
+        {
+            child->pid = 0;
+            continue;
+        }
+
+        child->start_time = info.start_time;
+        child->total_time = info.total_time;
+
+        proc_child_t *last = proc_child_find(proc->children, proc->num_children, child);
+
+        /* descendants started since the last snapshot
+         * are accounted with their whole CPU time */
+        diff += child->total_time - (last ? last->total_time : 0);
+        *rss += info.resident_set_size;
+
+        proc_tree_add_children(&tree, child->pid, info.num_threads);
+    }
+
+    /* drop the descendants that were gone already */
+    uint32_t count = 0;
 
-    memcpy(stat, &current, sizeof(sys_proc_stat_t));
+    for (uint32_t i = 0; i < tree.count; i++)
+    {
+        if (tree.children[i].pid > 0)
+            tree.children[count++] = tree.children[i];
+    }
+
+    if (count > 1)
+        qsort(tree.children, count, sizeof(proc_child_t), compare_child);
+
+    for (uint32_t i = 0; i < proc->num_children; i++)
+    {
+        proc_child_t *last = &proc->children[i];
+
+        if (proc_child_find(tree.children, count, last))
+            continue;
+
+        /* a descendant that left the tree while still running
+         * (e.g. reparented to init) is not accounted anymore */
+        sys_info_t info;
+        memset(&info, 0, sizeof(sys_info_t));
+
+        if (proc_child_read(last->pid, &info, page_size) &&
+                info.start_time == last->start_time)
+            continue;
 
-    return current.period;
+        diff -= last->total_time;
+    }
+
+    free(proc->children);
+
+    proc->children = tree.children;
+    proc->num_children = count;
+
+    return diff;
+}
+#else
+int64_t
+proc_tree_sample(UNUSED proc_stat_t *proc, UNUSED int64_t num_threads,
+        UNUSED int64_t page_size, UNUSED int64_t *rss)
+{
+    return 0;
+}
+#endif
+
+/**
+ * @brief Sample the CPU/memory usage of the watch's cgroup
+ * @param proc  watched process
+ * @param sys   proc watch
+ * @param diff  CPU time (in clock ticks) used since the last snapshot
+ * @param rss   memory usage (in kb)
+ * @return false if the cgroup's statistics are not available
+ */
+static bool
+proc_cgroup_sample(proc_stat_t *proc, nyx_proc_t *sys, int64_t *diff, int64_t *rss)
+{
+    cgroup_stat_t current;
+    cgroup_t *cgroup = proc->cgroup;
+
+    if (!cgroup_sample(cgroup, &current))
+        return false;
+
+    /* the cgroup outlives the processes of previous starts
+     * so the first snapshot serves as the baseline only */
+    *diff = 0;
+
+    if (cgroup->sampled)
+    {
+        *diff = (current.usage_usec - cgroup->last.usage_usec) * sys->clock_ticks / 1000000;
+
+        if (current.oom_kills > cgroup->last.oom_kills)
+        {
+            log_warn("Process '%s' (%d): %" PRIu64 " process(es) killed by the OOM killer",
+                    proc->name, proc->pid, current.oom_kills - cgroup->last.oom_kills);
+        }
+    }
+
+    *rss = current.memory / 1024;
+
+    cgroup->last = current;
+    cgroup->sampled = true;
+
+    return true;
 }
 
 static uint64_t
-calculate_proc_diff(proc_stat_t *proc, int64_t page_size)
+calculate_proc_diff(proc_stat_t *proc, nyx_proc_t *sys)
 {
-    uint64_t diff = 0;
+    int64_t diff = 0, rss = 0;
+
+    /* the cgroup covers the whole process tree without
+     * reading any of the processes' statistics */
+    if (proc->cgroup && proc_cgroup_sample(proc, sys, &diff, &rss))
+    {
+        if (rss)
+            stack_long_add(proc->mem_usage, rss);
+
+        return MAX(0, diff);
+    }
 
     /* read current process statistics */
     sys_info_t current;
     memset(&current, 0, sizeof(sys_info_t));
 
-    if (!sys_info_read_proc(&current, proc->pid, page_size))
+    if (!proc_stat_sample(proc, &current, sys->page_size))
         return 0;
 
-    if (current.resident_set_size)
-        stack_long_add(proc->mem_usage, current.resident_set_size);
+    rss = current.resident_set_size;
 
     /* calculate cpu diff/usage */
     diff = current.total_time - proc->info.total_time;
 
+    /* the watched processes are accounted including their descendants
+     * (except for nyx itself whose descendants are the watched processes) */
+    if (proc->watch && sys->track_children)
+        diff += proc_tree_sample(proc, current.num_threads, sys->page_size, &rss);
+
+    if (rss)
+        stack_long_add(proc->mem_usage, rss);
+
     memcpy(&proc->info, &current, sizeof(sys_info_t));
 
-    return diff;
+    return MAX(0, diff);
 }
 
 static void
 calculate_proc_stats(proc_stat_t *stat, nyx_proc_t *sys, uint64_t period)
 {
     uint32_t max = sys->num_cpus * 100;
-    uint64_t diff = calculate_proc_diff(stat, sys->page_size);
+    uint64_t diff = calculate_proc_diff(stat, sys);
 
     if (period > 0)
     {
@@ -136,6 +543,105 @@ calculate_proc_stats(proc_stat_t *stat, nyx_proc_t *sys, uint64_t period)
         stack_double_add(stat->cpu_usage, 0);
 }
 
+static uint64_t
+proc_random(nyx_proc_t *sys)
+{
+    /* xorshift64 */
+    uint64_t x = sys->seed;
+
+    x ^= x << 13;
+    x ^= x >> 7;
+    x ^= x << 17;
+
+    return sys->seed = x;
+}
+
+static uint32_t
+sample_interval(nyx_proc_t *sys, proc_stat_t *proc)
+{
+    if (proc->watch && proc->watch->sample_interval)
+        return proc->watch->sample_interval;
+
+    return MAX(1, sys->interval);
+}
+
+static uint32_t
+check_interval(nyx_proc_t *sys, proc_stat_t *proc)
+{
+    if (proc->watch && proc->watch->check_interval)
+        return proc->watch->check_interval;
+
+    return MAX(1, sys->interval);
+}
+
+static bool
+has_checks(proc_stat_t *proc)
+{
+    return proc->watch &&
+        (proc->watch->port_check || proc->watch->http_check || proc->watch->exec_check);
+}
+
+/**
+ * @brief Determine the next due time of a periodic snapshot/check
+ * @param sys       proc system instance
+ * @param due       time in ms the snapshot/check was due at
+ * @param interval  interval in seconds
+ * @param now       current time in ms
+ * @return next due time in ms
+ *
+ * The interval is varied randomly by +/- 10% so processes with the same
+ * interval drift apart instead of being processed in lockstep.
+ */
+static uint64_t
+next_due(nyx_proc_t *sys, uint64_t due, uint32_t interval, uint64_t now)
+{
+    uint64_t millis = interval * 1000ULL;
+    uint64_t spread = millis / 5;
+    uint64_t next = due + millis - millis / 10 + proc_random(sys) % spread;
+
+    /* do not try to catch up on missed intervals */
+    return MAX(next, now);
+}
+
+static void
+proc_reschedule(nyx_proc_t *sys, proc_stat_t *proc)
+{
+    heap_push(sys->schedule, &proc->schedule, MIN(proc->next_sample, proc->next_check));
+}
+
+/**
+ * @brief Schedule a newly watched process
+ *
+ * The first snapshot and checks are spread randomly over the respective
+ * interval so processes that are started at once are not sampled at
+ * the very same time either.
+ */
+static void
+proc_schedule(nyx_proc_t *sys, proc_stat_t *proc, uint64_t now)
+{
+    uint64_t sample = sample_interval(sys, proc) * 1000ULL;
+    uint64_t check = check_interval(sys, proc) * 1000ULL;
+
+    proc->sys_total = sys->sys_proc.total;
+    proc->next_sample = now + proc_random(sys) % sample;
+    proc->next_check = has_checks(proc)
+        ? now + proc_random(sys) % check
+        : UINT64_MAX;
+
+    proc_reschedule(sys, proc);
+}
+
+static void
+proc_wake(nyx_proc_t *sys)
+{
+#ifndef OSX
+    uint64_t value = 1;
+
+    if (sys->wake_fd >= 0 && write(sys->wake_fd, &value, sizeof(value)) < 0 && errno != EAGAIN)
+        log_perror("nyx: write");
+#endif
+}
+
 nyx_proc_t *
 nyx_proc_init(pid_t pid)
 {
@@ -166,6 +672,12 @@ nyx_proc_init(pid_t pid)
         log_debug("Number of CPUs: %d", proc->num_cpus);
     }
 
+#ifndef OSX
+    if (!proc->track_children)
+        log_warn("Process children cannot be listed - the CPU/memory usage "
+                 "of the watched processes' descendants is not accounted");
+#endif
+
 
     if (proc->page_size < 1)
     {
@@ -175,7 +687,7 @@ nyx_proc_init(pid_t pid)
         return NULL;
     }
 
-    bool success = sys_proc_read(&proc->sys_proc);
+    bool success = sys_proc_sample(proc, &proc->sys_proc);
 
     if (!success)
     {
@@ -188,9 +700,11 @@ nyx_proc_init(pid_t pid)
     /* add myself to watched processes */
     proc_stat_t *me = proc_stat_new(pid, "nyx", NULL);
     list_add(proc->processes, me);
+    pidmap_put(proc->index, pid, proc->processes->tail);
+    proc_schedule(proc, me, time_ms());
 
     /* get current nyx process statistics */
-    success = sys_info_read_proc(&me->info, me->pid, proc->page_size);
+    success = proc_stat_sample(me, &me->info, proc->page_size);
 
     if (!success)
     {
@@ -209,52 +723,60 @@ nyx_proc_init(pid_t pid)
 void
 nyx_proc_remove(nyx_proc_t *proc, pid_t pid)
 {
-    list_node_t *node = proc->processes->head;
-
-    while (node)
-    {
-        proc_stat_t *stat = node->data;
-
-        if (stat->pid == pid)
-        {
-            list_remove(proc->processes, node);
-            break;
-        }
-
-        node = node->next;
-    }
-}
-
-static bool
-nyx_proc_exists(nyx_proc_t *proc, pid_t pid)
-{
-    if (!proc->processes)
-        return false;
+    pthread_mutex_lock(&proc->lock);
 
-    list_node_t *node = proc->processes->head;
+    list_node_t *node = pidmap_remove(proc->index, pid);
 
-    while (node)
+    if (node)
     {
         proc_stat_t *stat = node->data;
 
-        if (stat->pid == pid)
-            return true;
-
-        node = node->next;
+        heap_remove(proc->schedule, &stat->schedule);
+        list_remove(proc->processes, node);
     }
 
-    return false;
+    pthread_mutex_unlock(&proc->lock);
 }
 
 void
 nyx_proc_add(nyx_proc_t *proc, pid_t pid, watch_t *watch)
 {
-    if (!nyx_proc_exists(proc, pid))
+    pthread_mutex_lock(&proc->lock);
+
+    if (pidmap_get(proc->index, pid) == NULL)
     {
         proc_stat_t *stat = proc_stat_new(pid, watch->name, watch);
 
+        /* processes that did not join the watch's cgroup (e.g. adopted
+         * after a restart) are accounted via /proc instead - the empty
+         * cgroup would report no usage at all */
+        if (proc->cgroup_root)
+        {
+            stat->cgroup = cgroup_new(proc->cgroup_root, watch->name);
+
+            if (stat->cgroup && !cgroup_contains(stat->cgroup->path, pid))
+            {
+                log_debug("Process '%s' (%d) is not part of cgroup '%s'",
+                        watch->name, pid, stat->cgroup->path);
+
+                cgroup_destroy(stat->cgroup);
+                stat->cgroup = NULL;
+            }
+        }
+
         list_add(proc->processes, stat);
+        pidmap_put(proc->index, pid, proc->processes->tail);
+        proc_schedule(proc, stat, time_ms());
+
+        /* resolve the port check's host ahead of the first check */
+        endpoint_refresh(watch->port_check);
+
+        /* the new process might be due before
+         * the proc watch wakes up next */
+        proc_wake(proc);
     }
+
+    pthread_mutex_unlock(&proc->lock);
 }
 
 void
@@ -264,72 +786,167 @@ nyx_proc_terminate(void)
 }
 
 static bool
-exceeds_cpu(double value, void *obj)
+exceeds_cpu(proc_stat_t *proc)
 {
-    proc_stat_t *proc = obj;
+    stack_double_t *window = proc->cpu_usage;
+    double threshold = proc->watch->max_cpu;
+
+    /* the watch's configuration may have changed in the meantime */
+    if (window->threshold != threshold)
+        stack_double_set_threshold(window, threshold);
 
-    return proc->watch && proc->watch->max_cpu && value >= proc->watch->max_cpu;
+    return window->exceeding >= proc->check_limit;
 }
 
 static bool
-exceeds_mem(uint64_t value, void *obj)
+exceeds_mem(proc_stat_t *proc)
 {
-    proc_stat_t *proc = obj;
+    stack_long_t *window = proc->mem_usage;
+    uint64_t threshold = proc->watch->max_memory;
 
-    return proc->watch && proc->watch->max_memory && value >= proc->watch->max_memory;
+    /* the watch's configuration may have changed in the meantime */
+    if (window->threshold != threshold)
+        stack_long_set_threshold(window, threshold);
+
+    return window->exceeding >= proc->check_limit;
 }
 
-static bool
-proc_port_check(proc_stat_t *proc, nyx_t *nyx)
+/**
+ * @brief Add the port and HTTP checks of the given process
+ *        to the check engine
+ */
+static void
+proc_add_checks(proc_stat_t *proc, check_engine_t *engine)
 {
     watch_t *watch = proc->watch;
 
-    if (!watch->port_check)
-        return true;
+    if (watch->port_check)
+    {
+        endpoint_t *endpoint = watch->port_check;
+        uint32_t timeout = endpoint->host
+            ? NYX_CHECK_PORT_TIMEOUT_MS
+            : NYX_CHECK_LOCAL_TIMEOUT_MS;
+
+        check_t *check = check_engine_add(engine, CHECK_PORT, endpoint->port, timeout);
+
+        check->endpoint = endpoint->host ? endpoint : NULL;
+        check->data = proc;
+        check->id = proc->pid;
+    }
 
-    if (watch->port_check->host)
+    if (watch->http_check)
     {
-        if (!check_port(watch->port_check->host, watch->port_check->port))
-        {
-            log_warn("Process '%s': %s:%u is not available",
-                    proc->name, watch->port_check->host, watch->port_check->port);
+        check_t *check = check_engine_add(engine, CHECK_HTTP,
+                watch->http_check_port ? watch->http_check_port : 80,
+                NYX_CHECK_HTTP_TIMEOUT_MS);
+
+        check->url = watch->http_check;
+        check->method = watch->http_check_method;
+        check->data = proc;
+        check->id = proc->pid;
+    }
 
-            return nyx->proc->event_handler(PROC_PORT_NOT_OPEN, proc, nyx);
-        }
+    if (watch->exec_check)
+    {
+        uint32_t timeout = watch->exec_check_timeout
+            ? watch->exec_check_timeout
+            : WATCH_DEFAULT_EXEC_CHECK_TIMEOUT;
+
+        check_t *check = check_engine_add(engine, CHECK_EXEC, 0, timeout * 1000);
+
+        check->watch = watch;
+        check->data = proc;
+        check->id = proc->pid;
     }
-    else
+}
+
+/**
+ * @brief Pass the failed checks of the last check run
+ *        to the event handler
+ *
+ * The proc lock has to be held so the processes of the checks are
+ * not removed in the meantime.
+ */
+static void
+proc_handle_checks(nyx_proc_t *sys, nyx_t *nyx)
+{
+    check_engine_t *engine = sys->checks;
+    proc_stat_t *skip = NULL;
+
+    for (uint32_t i = 0; i < engine->count; i++)
     {
-        if (!check_local_port(watch->port_check->port))
+        check_t *check = &engine->checks[i];
+        proc_stat_t *proc = check->data;
+
+        /* the process might not be watched anymore */
+        list_node_t *node = pidmap_get(sys->index, check->id);
+
+        if (node == NULL || node->data != proc)
+            continue;
+
+        if (check->type == CHECK_HTTP)
         {
-            log_warn("Process '%s': port %u is not available",
-                    proc->name, watch->port_check->port);
+            proc->http_latency = check->latency;
 
-            return nyx->proc->event_handler(PROC_PORT_NOT_OPEN, proc, nyx);
+            log_debug("Process '%s': HTTP check took %.2f ms",
+                    proc->name, check->latency / 1000.0);
         }
-    }
 
-    return true;
-}
+        /* the event handler of a previous check of the same process
+         * asked to not handle any further events */
+        if (check->success || check->skipped || proc == skip)
+            continue;
 
-static bool
-proc_http_check(proc_stat_t *proc, nyx_t *nyx)
-{
-    watch_t *watch = proc->watch;
+        bool handle_events = true;
 
-    if (watch->http_check == NULL)
-        return true;
+        if (check->type == CHECK_PORT)
+        {
+            if (check->endpoint)
+            {
+                log_warn("Process '%s': %s:%u is not available",
+                        proc->name, check->endpoint->host, check->port);
+            }
+            else
+            {
+                log_warn("Process '%s': port %u is not available",
+                        proc->name, check->port);
+            }
 
-    if (!check_http(watch->http_check, watch->http_check_port, watch->http_check_method))
-    {
-        log_warn("Process '%s': HTTP check failed - %s %s",
-                proc->name,
-                http_method_to_string(watch->http_check_method),
-                watch->http_check);
+            handle_events = sys->event_handler(PROC_PORT_NOT_OPEN, proc, nyx);
+        }
+        else if (check->type == CHECK_EXEC)
+        {
+            if (check->error == ETIMEDOUT)
+            {
+                log_warn("Process '%s': exec check '%s' timed out",
+                        proc->name, *check->watch->exec_check);
+            }
+            else if (check->error)
+            {
+                log_warn("Process '%s': exec check '%s' failed: %s",
+                        proc->name, *check->watch->exec_check, strerror(check->error));
+            }
+            else
+            {
+                log_warn("Process '%s': exec check '%s' failed with exit code %d",
+                        proc->name, *check->watch->exec_check, check->status);
+            }
 
-        return nyx->proc->event_handler(PROC_HTTP_CHECK_FAILED, proc, nyx);
-    }
+            handle_events = sys->event_handler(PROC_EXEC_CHECK_FAILED, proc, nyx);
+        }
+        else
+        {
+            log_warn("Process '%s': HTTP check failed - %s %s",
+                    proc->name,
+                    http_method_to_string(check->method),
+                    check->url);
 
-    return true;
+            handle_events = sys->event_handler(PROC_HTTP_CHECK_FAILED, proc, nyx);
+        }
+
+        if (!handle_events)
+            skip = proc;
+    }
 }
 
 static void
@@ -354,91 +971,202 @@ setup_proc_signals(void)
     sigaction(SIGUSR1, &action, NULL);
 }
 
-void *
-nyx_proc_start(void *state)
+/**
+ * @brief Take a CPU/memory snapshot of the given process
+ * @return false if no further events of the process should be handled
+ */
+static bool
+proc_sample(nyx_proc_t *sys, proc_stat_t *proc, nyx_t *nyx)
 {
-    nyx_t *nyx = state;
-    nyx_proc_t *sys = nyx->proc;
+    uint64_t total = sys->sys_proc.total;
+    uint64_t period = total > proc->sys_total ? total - proc->sys_total : 0;
 
-    setup_proc_signals();
+    proc->sys_total = total;
 
-    uint32_t interval = nyx->options.check_interval;
+    /* calculate process' statistics */
+    calculate_proc_stats(proc, sys, period);
 
-    log_debug("Starting proc watch - check interval %us", interval);
+#ifndef NDEBUG
+    uint64_t mem_usage = stack_long_newest(proc->mem_usage);
+    double cpu_usage = stack_double_newest(proc->cpu_usage);
 
-    /* reset need_exit in case of a restart */
-    need_exit = false;
+    uint64_t out_mem = 0;
+    char mem_unit = get_size_unit(mem_usage, &out_mem);
 
-    while (!need_exit)
+    log_debug("Process '%s' (%d, %u descendants): CPU %4.1f%% MEM (%" PRIu64 "%c) %5.2f%%",
+            proc->name, proc->pid, proc->num_children, cpu_usage,
+            out_mem, mem_unit,
+            ((double)mem_usage / sys->total_memory * 100.0));
+#endif
+
+    /* no event handler registered
+     * -> nothing to be done anyways */
+    bool handle_events = sys->event_handler != NULL && proc->watch != NULL;
+
+    /* handle CPU events? */
+    if (handle_events && proc->watch->max_cpu && exceeds_cpu(proc))
     {
-        uint64_t period = calculate_sys_period(&sys->sys_proc);
-        list_node_t *node = sys->processes->head;
+        log_warn("Process '%s' (%d) exceeds its CPU usage maximum of %u%%"
+                 " in at least %u of the last %u tests",
+                 proc->name, proc->pid, proc->watch->max_cpu,
+                 proc->check_limit, proc->cpu_usage->size);
 
-        while (node)
-        {
-            proc_stat_t *proc = node->data;
+        handle_events = sys->event_handler(PROC_MAX_CPU, proc, nyx);
+    }
 
-            /* calculate process' statistics */
-            calculate_proc_stats(proc, sys, period);
+    /* handle memory events? */
+    if (handle_events && proc->watch->max_memory && exceeds_mem(proc))
+    {
+        uint64_t bytes;
+        char unit = get_size_unit(proc->watch->max_memory, &bytes);
 
-#ifndef NDEBUG
-            uint64_t mem_usage = stack_long_newest(proc->mem_usage);
-            double cpu_usage = stack_double_newest(proc->cpu_usage);
+        log_warn("Process '%s' (%d) exceeds its memory usage maximum of %" PRIu64 "%c"
+                 " in at least %u of the last %u tests",
+                 proc->name, proc->pid, bytes, unit,
+                 proc->check_limit, proc->mem_usage->size);
 
-            uint64_t out_mem = 0;
-            char mem_unit = get_size_unit(mem_usage, &out_mem);
+        handle_events = sys->event_handler(PROC_MAX_MEMORY, proc, nyx);
+    }
 
-            log_debug("Process '%s' (%d): CPU %4.1f%% MEM (%" PRIu64 "%c) %5.2f%%",
-                    proc->name, proc->pid, cpu_usage,
-                    out_mem, mem_unit,
-                    ((double)mem_usage / sys->total_memory * 100.0));
-#endif
+    return handle_events;
+}
 
-            /* no event handler registered
-             * -> nothing to be done anyways */
-            bool handle_events = sys->event_handler != NULL && proc->watch != NULL;
+/**
+ * @brief Take the snapshots and queue the checks of all due processes
+ *
+ * The proc lock has to be held.
+ */
+static void
+proc_run_due(nyx_proc_t *sys, nyx_t *nyx, uint64_t now)
+{
+    bool sampled = false;
+    heap_node_t *node = NULL;
 
-            /* handle CPU events? */
-            if (handle_events &&
-                    proc->watch->max_cpu &&
-                    stack_double_satisfy(proc->cpu_usage, exceeds_cpu, proc) >= PROC_STAT_STACK_LIMIT)
-            {
-                log_warn("Process '%s' (%d) exceeds its CPU usage maximum of %u%%"
-                         " in at least %d of the last %d tests",
-                         proc->name, proc->pid, proc->watch->max_cpu,
-                         PROC_STAT_STACK_LIMIT, PROC_STAT_STACK_SIZE);
+    while ((node = heap_peek(sys->schedule)) != NULL && node->key <= now)
+    {
+        /* the schedule node is the first member of the process */
+        proc_stat_t *proc = (proc_stat_t *)node;
+        bool handle_events = sys->event_handler != NULL && proc->watch != NULL;
 
-                handle_events = sys->event_handler(PROC_MAX_CPU, proc, nyx);
+        if (proc->next_sample <= now)
+        {
+            /* read the system statistics once for all due processes */
+            if (!sampled)
+            {
+                sys_proc_sample(sys, &sys->sys_proc);
+                sampled = true;
             }
 
-            /* handle memory events? */
-            if (handle_events &&
-                    proc->watch->max_memory &&
-                    stack_long_satisfy(proc->mem_usage, exceeds_mem, proc) >= PROC_STAT_STACK_LIMIT)
-            {
-                uint64_t bytes;
-                char unit = get_size_unit(proc->watch->max_memory, &bytes);
+            if (!proc_sample(sys, proc, nyx))
+                handle_events = false;
 
-                log_warn("Process '%s' (%d) exceeds its memory usage maximum of %" PRIu64 "%c"
-                         " in at least %d of the last %d tests",
-                         proc->name, proc->pid, bytes, unit,
-                         PROC_STAT_STACK_LIMIT, PROC_STAT_STACK_SIZE);
+            proc->next_sample = next_due(sys, proc->next_sample, sample_interval(sys, proc), now);
+        }
 
-                handle_events = sys->event_handler(PROC_MAX_MEMORY, proc, nyx);
-            }
+        if (proc->next_check <= now)
+        {
+            /* port and HTTP checks are run all at once afterwards */
+            if (handle_events && sys->checks)
+                proc_add_checks(proc, sys->checks);
+
+            proc->next_check = has_checks(proc)
+                ? next_due(sys, proc->next_check, check_interval(sys, proc), now)
+                : UINT64_MAX;
+        }
+        else if (proc->next_check == UINT64_MAX && has_checks(proc))
+        {
+            /* checks were configured in the meantime */
+            proc->next_check = next_due(sys, now, check_interval(sys, proc), now);
+        }
+
+        proc_reschedule(sys, proc);
+    }
+}
+
+/**
+ * @brief Wait until the next process is due or the schedule changed
+ */
+static void
+proc_wait(nyx_proc_t *sys)
+{
+    uint64_t timeout = sys->interval * 1000ULL;
+
+    pthread_mutex_lock(&sys->lock);
 
-            /* check port if specified */
-            if (handle_events)
-                handle_events = proc_port_check(proc, nyx);
+    heap_node_t *next = heap_peek(sys->schedule);
+    uint64_t now = time_ms();
 
-            /* check HTTP endpoint if specified */
-            if (handle_events)
-                proc_http_check(proc, nyx);
+    if (next != NULL)
+        timeout = next->key > now ? next->key - now : 0;
 
-            node = node->next;
+    pthread_mutex_unlock(&sys->lock);
+
+    if (timeout < 1)
+        return;
+
+    fd_set set;
+    struct timeval tv;
+
+    FD_ZERO(&set);
+
+    if (sys->wake_fd >= 0)
+        FD_SET(sys->wake_fd, &set);
+    else
+    {
+        /* without a wake fd new processes are
+         * picked up every second at least */
+        timeout = MIN(timeout, 1000);
+    }
+
+    tv.tv_sec = timeout / 1000;
+    tv.tv_usec = (timeout % 1000) * 1000;
+
+    if (select(sys->wake_fd + 1, &set, NULL, NULL, &tv) > 0)
+    {
+        uint64_t value = 0;
+
+        if (read(sys->wake_fd, &value, sizeof(value)) < 0 && errno != EAGAIN)
+            log_perror("nyx: read");
+    }
+}
+
+void *
+nyx_proc_start(void *state)
+{
+    nyx_t *nyx = state;
+    nyx_proc_t *sys = nyx->proc;
+
+    setup_proc_signals();
+
+    sys->interval = MAX(1, nyx->options.check_interval);
+
+    if (sys->checks)
+        sys->checks->runners = nyx->runners;
+
+    log_debug("Starting proc watch - check interval %us", sys->interval);
+
+    /* reset need_exit in case of a restart */
+    need_exit = false;
+
+    while (!need_exit)
+    {
+        pthread_mutex_lock(&sys->lock);
+        proc_run_due(sys, nyx, time_ms());
+        pthread_mutex_unlock(&sys->lock);
+
+        if (sys->checks && sys->checks->count > 0)
+        {
+            if (check_engine_run(sys->checks, &need_exit))
+            {
+                pthread_mutex_lock(&sys->lock);
+                proc_handle_checks(sys, nyx);
+                pthread_mutex_unlock(&sys->lock);
+            }
+
+            check_engine_reset(sys->checks);
         }
 
-        wait_interval(interval);
+        proc_wait(sys);
     }
 
     log_debug("Stopped proc watch");
@@ -450,6 +1178,19 @@ void
 nyx_proc_destroy(nyx_proc_t *proc)
 {
     list_destroy(proc->processes);
+    pidmap_destroy(proc->index);
+    heap_destroy(proc->schedule);
+    pthread_mutex_destroy(&proc->lock);
+
+    if (proc->wake_fd >= 0)
+        close(proc->wake_fd);
+
+    if (proc->checks)
+        check_engine_destroy(proc->checks);
+
+    if (proc->stat_fd >= 0)
+        close(proc->stat_fd);
+
     free(proc);
 }
 
@@ -477,39 +1218,21 @@ sys_proc_dump(sys_proc_stat_t *stat)
 static bool
 sys_proc_read_proc(sys_proc_stat_t *stat)
 {
-    FILE *proc = fopen("/proc/stat", "r");
+    int32_t fd = open("/proc/stat", O_RDONLY | O_CLOEXEC);
 
-    if (proc == NULL)
+    if (fd < 0)
     {
-        log_perror("nyx: fopen");
+        log_perror("nyx: open");
         return false;
     }
 
-    /* right now we are interested in the first line (cpu ...)
-     * only which represents the overall cpu usage */
-    if (fscanf(proc, "%*8s %" PRIu64 " %" PRIu64 " %" PRIu64 " %" PRIu64 " %" PRIu64 "",
-                &stat->user_time,
-                &stat->nice_time,
-                &stat->system_time,
-                &stat->idle_time,
-                &stat->iowait_time) != 5)
-    {
-        log_error("Failed to parse /proc/stat");
-        fclose(proc);
-
-        return false;
-    }
+    bool success = sys_proc_read_fd(stat, fd);
 
-    /* calculate sum */
-    stat->total =
-        stat->user_time +
-        stat->nice_time +
-        stat->system_time +
-        stat->idle_time +
-        stat->iowait_time;
+    if (!success)
+        log_error("Failed to parse /proc/stat");
 
-    fclose(proc);
-    return true;
+    close(fd);
+    return success;
 }
 #else
 #include <sys/resource.h>
@@ -551,6 +1274,93 @@ sys_proc_read_osx(sys_proc_stat_t *stat)
 }
 #endif
 
+/**
+ * @brief Skip the next space separated field
+ * @return position behind the field or NULL if there is none
+ */
+static const char *
+skip_field(const char *pos, const char *end)
+{
+    while (pos < end && *pos == ' ')
+        pos++;
+
+    if (pos >= end || *pos == '\n')
+        return NULL;
+
+    while (pos < end && *pos != ' ' && *pos != '\n')
+        pos++;
+
+    return pos;
+}
+
+/**
+ * @brief Parse the next space separated (signed) decimal number
+ * @return position behind the number or NULL if there is none
+ */
+static const char *
+parse_number(const char *pos, const char *end, int64_t *value)
+{
+    bool negative = false;
+    uint64_t result = 0;
+
+    while (pos < end && *pos == ' ')
+        pos++;
+
+    if (pos < end && *pos == '-')
+    {
+        negative = true;
+        pos++;
+    }
+
+    if (pos >= end || *pos < '0' || *pos > '9')
+        return NULL;
+
+    while (pos < end && *pos >= '0' && *pos <= '9')
+        result = result * 10 + (*pos++ - '0');
+
+    *value = negative ? -(int64_t)result : (int64_t)result;
+    return pos;
+}
+
+/**
+ * @brief Parse the first line of /proc/stat (overall CPU usage)
+ * @param stat    system statistics to fill
+ * @param buffer  contents of /proc/stat (not necessarily terminated)
+ * @param length  number of bytes in the buffer
+ * @return true on success, false otherwise
+ */
+bool
+sys_proc_parse(sys_proc_stat_t *stat, const char *buffer, size_t length)
+{
+    int64_t fields[5];
+    const char *end = buffer + length;
+
+    /* skip the leading 'cpu' label */
+    const char *pos = skip_field(buffer, end);
+
+    for (int32_t i = 0; i < 5 && pos; i++)
+        pos = parse_number(pos, end, &fields[i]);
+
+    if (pos == NULL)
+        return false;
+
+    stat->user_time = fields[0];
+    stat->nice_time = fields[1];
+    stat->system_time = fields[2];
+    stat->idle_time = fields[3];
+    stat->iowait_time = fields[4];
+
+    /* calculate sum */
+    stat->total =
+        stat->user_time +
+        stat->nice_time +
+        stat->system_time +
+        stat->idle_time +
+        stat->iowait_time;
+
+    return true;
+}
+
 bool
 sys_proc_read(sys_proc_stat_t *stat)
 {
@@ -569,46 +1379,78 @@ sys_info_new(void)
     return sys;
 }
 
-#ifndef OSX
+/**
+ * @brief Parse the contents of /proc/<pid>/stat
+ * @param sys        process statistics to fill
+ * @param buffer     contents of /proc/<pid>/stat (not necessarily terminated)
+ * @param length     number of bytes in the buffer
+ * @param page_size  system page size (in bytes)
+ * @return true on success, false otherwise
+ */
 bool
-sys_info_read_proc(sys_info_t *sys, pid_t pid, int64_t page_size)
+sys_info_parse(sys_info_t *sys, const char *buffer, size_t length, int64_t page_size)
 {
-    char buffer[64] = {0};
-    sprintf(buffer, "/proc/%d/stat", pid);
-    FILE *proc = NULL;
+    /* we are interested in fields 14-17, 20 and 22-24 only */
+    int64_t fields[25];
+    const char *end = buffer + length;
+    const char *pos = end;
 
-    if ((proc = fopen(buffer, "r")) == NULL)
-    {
-        log_perror("nyx: fopen");
+    /* the process name (field 2) may contain spaces and parentheses
+     * itself so we continue behind the last closing parenthesis */
+    while (pos > buffer && *(pos - 1) != ')')
+        pos--;
+
+    if (pos == buffer)
         return false;
-    }
 
-    if (fscanf(proc, "%*d %*256s %*c %*d %*d %*d %*d %*d %*u %*u %*u %*u %*u %" PRIu64
-               "%" PRIu64 " %" PRId64 " %" PRId64 " %*d %*d %*d %*d %*u %" PRIu64 " %" PRId64,
-               &sys->user_time,
-               &sys->system_time,
-               &sys->child_user_time,
-               &sys->child_system_time,
-               &sys->virtual_size,
-               &sys->resident_set_size) != 6)
-    {
-        log_error("Failed to parse %s", buffer);
-        fclose(proc);
+    /* skip the process state (field 3) */
+    pos = skip_field(pos, end);
 
+    for (int32_t field = 4; field <= 24 && pos; field++)
+        pos = parse_number(pos, end, &fields[field]);
+
+    if (pos == NULL)
         return false;
-    }
+
+    sys->user_time = fields[14];
+    sys->system_time = fields[15];
+    sys->child_user_time = fields[16];
+    sys->child_system_time = fields[17];
+    sys->num_threads = fields[20];
+    sys->start_time = fields[22];
+    sys->virtual_size = fields[23];
 
     /* correct RSS from 'number of pages' to 'in kilobytes' unit */
-    sys->resident_set_size *= page_size / 1024;
+    sys->resident_set_size = fields[24] * (page_size / 1024);
 
     sys->total_time = sys->user_time +
         sys->system_time +
         sys->child_user_time +
         sys->child_system_time;
 
-    fclose(proc);
     return true;
 }
+
+#ifndef OSX
+bool
+sys_info_read_proc(sys_info_t *sys, pid_t pid, int64_t page_size)
+{
+    int32_t fd = open_proc_stat(pid);
+
+    if (fd < 0)
+    {
+        log_perror("nyx: open");
+        return false;
+    }
+
+    bool success = sys_info_read_fd(sys, fd, page_size);
+
+    if (!success)
+        log_error("Failed to parse /proc/%d/stat", pid);
+
+    close(fd);
+    return success;
+}
 #else
 bool
 sys_info_read_proc(sys_info_t *sys, pid_t pid, UNUSED int64_t page_size)
@@ -665,7 +1507,7 @@ total_memory_size_proc(void)
     uint64_t mem_size = 0;
 
 #ifndef OSX
-    FILE *proc = fopen("/proc/meminfo", "r");
+    FILE *proc = fopen("/proc/meminfo", "re");
 
     if (proc == NULL)
     {
@@ -702,7 +1544,7 @@ num_cpus_proc(void)
     int32_t cpus = -1;
 
 #ifndef OSX
-    FILE *proc = fopen("/proc/stat", "r");
+    FILE *proc = fopen("/proc/stat", "re");
     char buffer[256] = {0};
 
     if (proc == NULL)
@@ -15,10 +15,13 @@
 
 #pragma once
 
+#include "cgroup.h"
+#include "heap.h"
 #include "list.h"
 #include "stack.h"
 #include "watch.h"
 
+#include <pthread.h>
 #include <stdbool.h>
 #include <stdint.h>
 #include <stdlib.h>
@@ -28,7 +31,8 @@ typedef enum
     PROC_MAX_CPU,
     PROC_MAX_MEMORY,
     PROC_PORT_NOT_OPEN,
-    PROC_HTTP_CHECK_FAILED
+    PROC_HTTP_CHECK_FAILED,
+    PROC_EXEC_CHECK_FAILED
 } proc_event_e;
 
 typedef struct
@@ -37,6 +41,8 @@ typedef struct
     uint64_t system_time;      /* 15 */
     int64_t child_user_time;   /* 16 */
     int64_t child_system_time; /* 17 */
+    int64_t num_threads;       /* 20 */
+    uint64_t start_time;       /* 22 */
     uint64_t virtual_size;     /* 23 */
     int64_t resident_set_size; /* 24 */
 
@@ -44,11 +50,28 @@ typedef struct
 
 } sys_info_t;
 
+typedef struct
+{
+    pid_t pid;
+    /** start time (in clock ticks after boot) to detect reused PIDs */
+    uint64_t start_time;
+    /** CPU time including the one of its reaped children */
+    uint64_t total_time;
+} proc_child_t;
+
 DECLARE_STACK(uint64_t, long)
 DECLARE_STACK(double, double)
 
 typedef struct
 {
+    /** position in the proc watch's schedule (has to be the first member) */
+    heap_node_t schedule;
+    /** time in ms the next CPU/memory snapshot is due at */
+    uint64_t next_sample;
+    /** time in ms the next port/HTTP checks are due at */
+    uint64_t next_check;
+    /** total system time at the last snapshot */
+    uint64_t sys_total;
     /** process ID */
     pid_t pid;
     /** process statistics */
@@ -57,10 +80,22 @@ typedef struct
     stack_double_t *cpu_usage;
     /** process memory usage (in kb) */
     stack_long_t *mem_usage;
+    /** number of snapshots that have to exceed max_cpu/max_memory */
+    uint32_t check_limit;
+    /** time in us the last HTTP check took */
+    uint64_t http_latency;
     /** process name */
     const char *name;
     /** associated watch */
     watch_t *watch;
+    /** persistent file descriptor of /proc/<pid>/stat (-1 if not open) */
+    int32_t fd;
+    /** descendants at the last snapshot (ordered by PID) */
+    proc_child_t *children;
+    /** number of descendants at the last snapshot */
+    uint32_t num_children;
+    /** cgroup of the watch (NULL if not put into a cgroup) */
+    cgroup_t *cgroup;
 } proc_stat_t;
 
 typedef struct
@@ -81,12 +116,34 @@ typedef struct
     uint64_t total_memory;
     /** system page size (in bytes) */
     int64_t page_size;
+    /** clock ticks per second */
+    int64_t clock_ticks;
     /** number of CPUs */
     int32_t num_cpus;
     /** current system statistics */
     sys_proc_stat_t sys_proc;
+    /** persistent file descriptor of /proc/stat (-1 if not open) */
+    int32_t stat_fd;
+    /** whether the descendants of the watched processes are accounted */
+    bool track_children;
+    /** cgroup root of the watches' cgroups (NULL if disabled) */
+    const char *cgroup_root;
     /** list of watched processes */
     list_t *processes;
+    /** list nodes of the watched processes by their PID */
+    struct pidmap_t *index;
+    /** engine running the port/HTTP checks */
+    struct check_engine_t *checks;
+    /** watched processes ordered by the time they are due next */
+    heap_t *schedule;
+    /** lock guarding the processes, their index and the schedule */
+    pthread_mutex_t lock;
+    /** eventfd to wake the proc watch on schedule changes */
+    int32_t wake_fd;
+    /** default snapshot/check interval (in seconds) */
+    uint32_t interval;
+    /** state of the jitter's pseudo random generator */
+    uint64_t seed;
     /** process event handler */
     bool (*event_handler)(proc_event_e, proc_stat_t *, void *);
 } nyx_proc_t;
@@ -106,6 +163,12 @@ nyx_proc_start(void *state);
 proc_stat_t *
 proc_stat_new(pid_t pid, const char *name, watch_t *watch);
 
+void
+proc_stat_destroy(void *obj);
+
+int64_t
+proc_tree_sample(proc_stat_t *proc, int64_t num_threads, int64_t page_size, int64_t *rss);
+
 void
 nyx_proc_remove(nyx_proc_t *proc, pid_t pid);
 
@@ -124,6 +187,9 @@ sys_proc_dump(sys_proc_stat_t *stat);
 bool
 sys_proc_read(sys_proc_stat_t *stat);
 
+bool
+sys_proc_parse(sys_proc_stat_t *stat, const char *buffer, size_t length);
+
 sys_info_t *
 sys_info_new(void);
 
@@ -133,6 +199,9 @@ sys_info_dump(sys_info_t *sys);
 bool
 sys_info_read_proc(sys_info_t *sys, pid_t pid, int64_t page_size);
 
+bool
+sys_info_parse(sys_info_t *sys, const char *buffer, size_t length, int64_t page_size);
+
 uint64_t
 total_memory_size(void);
 
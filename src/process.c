@@ -16,13 +16,27 @@
 #define _GNU_SOURCE
 
 #include "fs.h"
+#include "pidfile.h"
 #include "process.h"
 
+#include <errno.h>
+#include <poll.h>
 #include <signal.h>
+#include <sys/syscall.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+#ifndef OSX
+#include <sys/prctl.h>
+#include <sys/signalfd.h>
+#endif
 
 bool
 clear_pid(const char *name, nyx_t *nyx)
 {
+    if (nyx->pid_files)
+        pidfile_cache_set(nyx->pid_files, name, 0);
+
     return remove_pid_file(nyx->pid_dir, name);
 }
 
@@ -44,6 +58,10 @@ determine_pid(const char *name, nyx_t *nyx)
     if (name == NULL)
         return 0;
 
+    /* the pid files of all watches are cached */
+    if (nyx->pid_files && pidfile_cache_get(nyx->pid_files, name, &pid))
+        return pid;
+
     if ((file = open_pid_file(nyx->pid_dir, name, "re")) != NULL)
     {
         matched = fscanf(file, "%d", &pid);
@@ -70,6 +88,82 @@ check_process_running(pid_t pid)
     return false;
 }
 
+/**
+ * @brief Open a process file descriptor (pidfd) for the given process
+ * @param pid process ID
+ * @return file descriptor that becomes readable as soon as the
+ *         process terminated, -1 on error (errno is set)
+ */
+int32_t
+process_open_fd(pid_t pid)
+{
+#ifdef SYS_pidfd_open
+    /* pidfds are always opened with O_CLOEXEC */
+    return syscall(SYS_pidfd_open, pid, 0);
+#else
+    errno = ENOSYS;
+    return -1;
+#endif
+}
+
+/**
+ * @brief Become the subreaper of all descendant processes
+ * @return signalfd that becomes readable on SIGCHLD, -1 on error
+ *
+ * Orphaned descendants (e.g. of double-forked watches) are reparented
+ * to nyx instead of init. SIGCHLD is blocked so it is received via
+ * the returned signalfd only - therefore this has to be called before
+ * any thread is started.
+ */
+int32_t
+process_subreaper(void)
+{
+#ifdef OSX
+    errno = ENOSYS;
+    return -1;
+#else
+    sigset_t mask;
+
+    if (prctl(PR_SET_CHILD_SUBREAPER, 1, 0, 0, 0) == -1)
+        return -1;
+
+    sigemptyset(&mask);
+    sigaddset(&mask, SIGCHLD);
+
+    if (sigprocmask(SIG_BLOCK, &mask, NULL) == -1)
+        return -1;
+
+    return signalfd(-1, &mask, SFD_NONBLOCK | SFD_CLOEXEC);
+#endif
+}
+
+/**
+ * @brief Check whether the given process terminated
+ * @param pid process ID
+ * @param fd  pidfd of the process or -1 if not available
+ * @return true if the process is not running anymore
+ */
+bool
+process_exited(pid_t pid, int32_t fd)
+{
+    if (fd >= 0)
+    {
+        struct pollfd pfd = { .fd = fd, .events = POLLIN };
+
+        return poll(&pfd, 1, 0) > 0;
+    }
+
+    /* our own children are checked via waitid without reaping them
+     * so that zombies are not mistaken for running processes */
+    siginfo_t info;
+    info.si_pid = 0;
+
+    if (waitid(P_PID, pid, &info, WEXITED | WNOHANG | WNOWAIT) == 0)
+        return info.si_pid == pid;
+
+    return !check_process_running(pid);
+}
+
 bool
 write_pid(pid_t pid, const char *name, nyx_t *nyx)
 {
@@ -85,6 +179,9 @@ write_pid(pid_t pid, const char *name, nyx_t *nyx)
         fclose(file);
     }
 
+    if (written > 0 && nyx->pid_files)
+        pidfile_cache_set(nyx->pid_files, name, pid);
+
     return written > 0;
 }
 
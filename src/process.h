@@ -29,6 +29,15 @@ write_pid(pid_t pid, const char *name, nyx_t *nyx);
 bool
 check_process_running(pid_t pid);
 
+int32_t
+process_open_fd(pid_t pid);
+
+int32_t
+process_subreaper(void);
+
+bool
+process_exited(pid_t pid, int32_t fd);
+
 bool
 clear_pid(const char *name, nyx_t *nyx);
 
@@ -0,0 +1,152 @@
+/* Copyright 2014-2019 Gregor Uhlenheuer
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#pragma once
+
+#include <stdbool.h>
+#include <stdint.h>
+
+/* Bounded lock-free multi-producer/single-consumer queue
+ *
+ * All slots are allocated up front. Every slot carries a sequence
+ * number that tells whether the slot may be written by a producer
+ * (seq == position) or read by the consumer (seq == position + 1).
+ * Producers reserve a position by advancing 'tail' via CAS, the
+ * single consumer owns 'head' exclusively.
+ *
+ * 'push' and 'last' may be called from any thread, 'pop' and 'empty'
+ * from the consumer thread only.
+ *
+ * 'last' returns the most recently pushed value as long as it is not
+ * popped yet. The slot's sequence number is checked before and after
+ * the value is copied so a concurrently reused slot is not mistaken
+ * for the last value. */
+
+#define DECLARE_QUEUE(type_, name_) \
+    typedef struct \
+    { \
+        uint32_t seq; \
+        type_ value; \
+    } queue_##name_##_slot_t; \
+    \
+    typedef struct \
+    { \
+        uint32_t mask; \
+        uint32_t head; \
+        uint32_t tail; \
+        queue_##name_##_slot_t *slots; \
+    } queue_##name_##_t; \
+    \
+    queue_##name_##_t * \
+    queue_##name_##_new(uint32_t size); \
+    \
+    void \
+    queue_##name_##_destroy(queue_##name_##_t *queue); \
+    \
+    bool \
+    queue_##name_##_push(queue_##name_##_t *queue, type_ value); \
+    \
+    bool \
+    queue_##name_##_pop(queue_##name_##_t *queue, type_ *value); \
+    \
+    bool \
+    queue_##name_##_last(queue_##name_##_t *queue, type_ *value); \
+    \
+    bool \
+    queue_##name_##_empty(queue_##name_##_t *queue);
+
+#define IMPLEMENT_QUEUE(type_, name_) \
+    queue_##name_##_t * \
+    queue_##name_##_new(uint32_t size) \
+    { \
+        uint32_t capacity = 2; \
+        while (capacity < size) \
+            capacity <<= 1; \
+        queue_##name_##_t *queue = xcalloc1(sizeof(queue_##name_##_t)); \
+        queue->mask = capacity - 1; \
+        queue->slots = xcalloc(capacity, sizeof(queue_##name_##_slot_t)); \
+        for (uint32_t i = 0; i < capacity; i++) \
+            queue->slots[i].seq = i; \
+        return queue; \
+    } \
+    \
+    void \
+    queue_##name_##_destroy(queue_##name_##_t *queue) \
+    { \
+        free(queue->slots); \
+        free(queue); \
+    } \
+    \
+    bool \
+    queue_##name_##_push(queue_##name_##_t *queue, type_ value) \
+    { \
+        queue_##name_##_slot_t *slot; \
+        uint32_t pos = __atomic_load_n(&queue->tail, __ATOMIC_RELAXED); \
+        for (;;) \
+        { \
+            slot = &queue->slots[pos & queue->mask]; \
+            uint32_t seq = __atomic_load_n(&slot->seq, __ATOMIC_ACQUIRE); \
+            int32_t diff = (int32_t)(seq - pos); \
+            if (diff == 0) \
+            { \
+                if (__atomic_compare_exchange_n(&queue->tail, &pos, pos + 1, \
+                        true, __ATOMIC_RELAXED, __ATOMIC_RELAXED)) \
+                    break; \
+            } \
+            else if (diff < 0) \
+                return false; \
+            else \
+                pos = __atomic_load_n(&queue->tail, __ATOMIC_RELAXED); \
+        } \
+        slot->value = value; \
+        __atomic_store_n(&slot->seq, pos + 1, __ATOMIC_RELEASE); \
+        return true; \
+    } \
+    \
+    bool \
+    queue_##name_##_pop(queue_##name_##_t *queue, type_ *value) \
+    { \
+        uint32_t pos = queue->head; \
+        queue_##name_##_slot_t *slot = &queue->slots[pos & queue->mask]; \
+        uint32_t seq = __atomic_load_n(&slot->seq, __ATOMIC_ACQUIRE); \
+        if (seq != pos + 1) \
+            return false; \
+        *value = slot->value; \
+        __atomic_store_n(&slot->seq, pos + queue->mask + 1, __ATOMIC_RELEASE); \
+        queue->head = pos + 1; \
+        return true; \
+    } \
+    \
+    bool \
+    queue_##name_##_last(queue_##name_##_t *queue, type_ *value) \
+    { \
+        uint32_t pos = __atomic_load_n(&queue->tail, __ATOMIC_ACQUIRE) - 1; \
+        queue_##name_##_slot_t *slot = &queue->slots[pos & queue->mask]; \
+        if (__atomic_load_n(&slot->seq, __ATOMIC_ACQUIRE) != pos + 1) \
+            return false; \
+        *value = slot->value; \
+        __atomic_thread_fence(__ATOMIC_ACQUIRE); \
+        return __atomic_load_n(&slot->seq, __ATOMIC_RELAXED) == pos + 1; \
+    } \
+    \
+    bool \
+    queue_##name_##_empty(queue_##name_##_t *queue) \
+    { \
+        uint32_t pos = queue->head; \
+        queue_##name_##_slot_t *slot = &queue->slots[pos & queue->mask]; \
+        return __atomic_load_n(&slot->seq, __ATOMIC_ACQUIRE) != pos + 1; \
+    }
+
+/* vim: set et sw=4 sts=4 tw=80: */
@@ -0,0 +1,1029 @@
+/* Copyright 2014-2019 Gregor Uhlenheuer
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#define _GNU_SOURCE
+
+#include "def.h"
+#include "fs.h"
+#include "log.h"
+#include "runner.h"
+#include "socket.h"
+#include "utils.h"
+
+#include <dirent.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <grp.h>
+#include <poll.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <sys/wait.h>
+#include <time.h>
+#include <unistd.h>
+
+static uint64_t
+monotonic_us(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+
+    return (uint64_t)ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+}
+
+static bool
+read_full(int32_t fd, void *buffer, size_t length)
+{
+    char *ptr = buffer;
+
+    while (length > 0)
+    {
+        ssize_t bytes = read(fd, ptr, length);
+
+        if (bytes == -1 && errno == EINTR)
+            continue;
+
+        if (bytes < 1)
+            return false;
+
+        ptr += bytes;
+        length -= bytes;
+    }
+
+    return true;
+}
+
+static bool
+write_full(int32_t fd, const void *buffer, size_t length)
+{
+    const char *ptr = buffer;
+
+    while (length > 0)
+    {
+        ssize_t bytes = write(fd, ptr, length);
+
+        if (bytes == -1 && errno == EINTR)
+            continue;
+
+        if (bytes < 1)
+            return false;
+
+        ptr += bytes;
+        length -= bytes;
+    }
+
+    return true;
+}
+
+/**
+ * @brief Send the whole buffer on the given socket without raising
+ *        SIGPIPE if the peer is gone
+ */
+static bool
+send_full(int32_t sock, const void *buffer, size_t length)
+{
+    const char *ptr = buffer;
+
+    while (length > 0)
+    {
+        ssize_t bytes = send_safe(sock, ptr, length);
+
+        if (bytes == -1 && errno == EINTR)
+            continue;
+
+        if (bytes < 1)
+            return false;
+
+        ptr += bytes;
+        length -= bytes;
+    }
+
+    return true;
+}
+
+/**
+ * @brief Close all file descriptors of the runner process
+ *        except the standard streams and its pipes
+ *
+ * The runner must not keep any of the daemon's descriptors open -
+ * e.g. the forker waits for the end of its request pipe.
+ */
+static void
+close_fds(int32_t request_fd, int32_t reply_fd)
+{
+    DIR *dir = opendir("/proc/self/fd");
+
+    if (dir)
+    {
+        int32_t dir_fd = dirfd(dir);
+        struct dirent *entry = NULL;
+
+        while ((entry = readdir(dir)) != NULL)
+        {
+            int32_t fd = atoi(entry->d_name);
+
+            if (fd >= 3 && fd != dir_fd && fd != request_fd && fd != reply_fd)
+                close(fd);
+        }
+
+        closedir(dir);
+        return;
+    }
+
+    int32_t max;
+    if ((max = getdtablesize()) == -1)
+        max = 256;
+
+    for (int32_t fd = 3 /* stderr + 1 */; fd < max; fd++)
+    {
+        if (fd != request_fd && fd != reply_fd)
+            close(fd);
+    }
+}
+
+static char *
+next_string(char **ptr, const char *end)
+{
+    char *value = *ptr;
+
+    if (value >= end)
+        return NULL;
+
+    *ptr += strlen(value) + 1;
+
+    return value;
+}
+
+/**
+ * @brief Execute the check command in the forked process
+ *
+ * The command runs in a session of its own so it can be killed
+ * including all of its children on timeout.
+ */
+static void __attribute__((noreturn))
+runner_child(char *user, char *group, char *dir, char **argv, char **env,
+        int32_t error_fd)
+{
+    sigset_t empty;
+    uid_t uid = 0;
+    gid_t gid = 0;
+
+    setsid();
+
+    int32_t null_fd = open("/dev/null", O_RDWR | O_CLOEXEC);
+
+    if (null_fd == -1 ||
+            dup2(null_fd, STDIN_FILENO) == -1 ||
+            dup2(null_fd, STDOUT_FILENO) == -1 ||
+            dup2(null_fd, STDERR_FILENO) == -1)
+        goto error;
+
+    if (*user && !get_user(user, &uid, &gid))
+    {
+        errno = EINVAL;
+        goto error;
+    }
+
+    if (*group && !get_group(group, &gid))
+    {
+        errno = EINVAL;
+        goto error;
+    }
+
+    if (gid && setgid(gid) == -1)
+        goto error;
+
+    if (uid && (initgroups(user, gid) == -1 || setuid(uid) == -1))
+        goto error;
+
+    if (*dir && chdir(dir) == -1)
+        goto error;
+
+    for (char **var = env; *var; var++)
+        putenv(*var);
+
+    sigemptyset(&empty);
+    sigprocmask(SIG_SETMASK, &empty, NULL);
+
+    /* on success this call won't return */
+    execvp(argv[0], argv);
+
+error:
+    {
+        int32_t error = errno;
+
+        if (write(error_fd, &error, sizeof(error)) < 0)
+        {
+            /* nothing we could do about it */
+        }
+    }
+
+    _exit(127);
+}
+
+/**
+ * @brief Wait for the given process to terminate
+ * @return false if the process is still running after 'timeout' ms
+ */
+static bool
+runner_wait(pid_t pid, uint32_t timeout, int32_t *status)
+{
+    uint64_t deadline = time_ms() + timeout;
+#ifndef OSX
+    sigset_t chld;
+
+    sigemptyset(&chld);
+    sigaddset(&chld, SIGCHLD);
+#endif
+
+    while (true)
+    {
+        pid_t res = waitpid(pid, status, WNOHANG);
+
+        if (res == pid)
+            return true;
+
+        if (res == -1 && errno != EINTR)
+        {
+            *status = 0;
+            return true;
+        }
+
+        uint64_t now = time_ms();
+
+        if (now >= deadline)
+            return false;
+
+        uint64_t remaining = deadline - now;
+
+#ifndef OSX
+        /* SIGCHLD is blocked in the runner so it is queued
+         * until picked up right here */
+        struct timespec ts =
+        {
+            .tv_sec = remaining / 1000,
+            .tv_nsec = (remaining % 1000) * 1000000
+        };
+
+        sigtimedwait(&chld, NULL, &ts);
+#else
+        usleep(MIN(remaining, 10) * 1000);
+#endif
+    }
+}
+
+static void
+runner_execute(const runner_request_t *request, char *payload, runner_result_t *result)
+{
+    int32_t fds[2];
+    int32_t status = 0;
+    char *argv[NYX_RUNNER_MAX_ARGS + 1];
+    char *env[NYX_RUNNER_MAX_ARGS + 1];
+    char *ptr = payload;
+    const char *end = payload + request->length;
+    uint64_t started = monotonic_us();
+
+    char *user = next_string(&ptr, end);
+    char *group = next_string(&ptr, end);
+    char *dir = next_string(&ptr, end);
+
+    if (dir == NULL ||
+            request->argc < 1 ||
+            request->argc > NYX_RUNNER_MAX_ARGS ||
+            request->envc > NYX_RUNNER_MAX_ARGS)
+    {
+        result->error = EINVAL;
+        return;
+    }
+
+    for (uint32_t i = 0; i < request->argc; i++)
+        argv[i] = next_string(&ptr, end);
+
+    for (uint32_t i = 0; i < request->envc; i++)
+        env[i] = next_string(&ptr, end);
+
+    argv[request->argc] = NULL;
+    env[request->envc] = NULL;
+
+    if (argv[request->argc - 1] == NULL ||
+            (request->envc > 0 && env[request->envc - 1] == NULL))
+    {
+        result->error = EINVAL;
+        return;
+    }
+
+    /* the child reports a failed 'execvp' via this pipe that
+     * is closed on a successful 'execvp' otherwise */
+    if (!pipe_cloexec(fds))
+    {
+        result->error = errno;
+        return;
+    }
+
+    pid_t pid = fork();
+
+    if (pid == 0)
+    {
+        close(fds[0]);
+        runner_child(user, group, dir, argv, env, fds[1]);
+    }
+
+    close(fds[1]);
+
+    if (pid == -1)
+    {
+        result->error = errno;
+        close(fds[0]);
+        return;
+    }
+
+    if (!read_full(fds[0], &result->error, sizeof(result->error)))
+        result->error = 0;
+
+    close(fds[0]);
+
+    if (!runner_wait(pid, request->timeout, &status))
+    {
+        /* kill the whole session of the command */
+        kill(-pid, SIGKILL);
+        kill(pid, SIGKILL);
+        waitpid(pid, &status, 0);
+
+        result->error = ETIMEDOUT;
+    }
+
+    if (WIFSIGNALED(status))
+        result->status = 128 + WTERMSIG(status);
+    else
+        result->status = WEXITSTATUS(status);
+
+    result->duration = monotonic_us() - started;
+}
+
+/**
+ * @brief Reset the signal handlers inherited from the daemon
+ */
+static void
+reset_signals(void)
+{
+    struct sigaction action = { .sa_handler = SIG_DFL };
+
+    /* handlers of the daemon must not run in here */
+    for (int32_t signum = 1; signum < NSIG; signum++)
+    {
+        struct sigaction current;
+
+        if (sigaction(signum, NULL, &current) == 0 &&
+            current.sa_handler != SIG_DFL && current.sa_handler != SIG_IGN)
+            sigaction(signum, &action, NULL);
+    }
+}
+
+/**
+ * @brief Main loop of a runner process
+ */
+static void __attribute__((noreturn))
+runner_main(int32_t request_fd, int32_t reply_fd)
+{
+    sigset_t chld;
+    runner_request_t request;
+    char payload[NYX_RUNNER_MAX_PAYLOAD + 1];
+
+    close_fds(request_fd, reply_fd);
+    reset_signals();
+
+    /* the runner terminates once the daemon closed the request pipe */
+    signal(SIGINT, SIG_IGN);
+    signal(SIGCHLD, SIG_DFL);
+
+    sigemptyset(&chld);
+    sigaddset(&chld, SIGCHLD);
+    sigprocmask(SIG_BLOCK, &chld, NULL);
+
+    while (read_full(request_fd, &request, sizeof(request)))
+    {
+        runner_result_t result = { .id = request.id };
+
+        if (request.length > NYX_RUNNER_MAX_PAYLOAD ||
+                !read_full(request_fd, payload, request.length))
+            break;
+
+        payload[request.length] = '\0';
+
+        runner_execute(&request, payload, &result);
+
+        if (!write_full(reply_fd, &result, sizeof(result)))
+            break;
+    }
+
+    _exit(EXIT_SUCCESS);
+}
+
+static bool
+request_socket(int32_t fds[2])
+{
+    if (socketpair(AF_UNIX, SOCK_STREAM, 0, fds) == -1)
+    {
+        fds[0] = fds[1] = -1;
+        return false;
+    }
+
+    set_cloexec(fds[0]);
+    set_cloexec(fds[1]);
+
+    /* ignore SIGPIPE signals (on OSX) */
+#if defined(SO_NOSIGPIPE)
+    int32_t on = 1;
+    setsockopt(fds[1], SOL_SOCKET, SO_NOSIGPIPE, &on, sizeof(on));
+#endif
+
+    return true;
+}
+
+/**
+ * @brief Fork a new runner and send its pipes to the daemon
+ *
+ * The reply consists of the runner's PID (or the negative errno of
+ * the failed fork) and the runner's request and reply pipes. The
+ * request "pipe" is a socket pair so the daemon can send to runners
+ * that terminated in the meantime without raising SIGPIPE.
+ */
+static void
+spawner_fork(int32_t sock)
+{
+    pid_t pid = -1;
+    int32_t requests[2] = { -1, -1 }, replies[2] = { -1, -1 };
+
+    if (request_socket(requests) && pipe_cloexec(replies) && (pid = fork()) == 0)
+        runner_main(requests[0], replies[1]);
+
+    if (pid == -1)
+        pid = -errno;
+
+    int32_t fds[2] = { requests[1], replies[0] };
+    char control[CMSG_SPACE(sizeof(fds))];
+    struct iovec iov = { .iov_base = &pid, .iov_len = sizeof(pid) };
+    struct msghdr msg =
+    {
+        .msg_iov = &iov,
+        .msg_iovlen = 1
+    };
+
+    if (pid > 0)
+    {
+        memset(control, 0, sizeof(control));
+
+        msg.msg_control = control;
+        msg.msg_controllen = sizeof(control);
+
+        struct cmsghdr *cmsg = CMSG_FIRSTHDR(&msg);
+
+        cmsg->cmsg_level = SOL_SOCKET;
+        cmsg->cmsg_type = SCM_RIGHTS;
+        cmsg->cmsg_len = CMSG_LEN(sizeof(fds));
+        memcpy(CMSG_DATA(cmsg), fds, sizeof(fds));
+    }
+
+    if (sendmsg(sock, &msg, 0) == -1)
+    {
+        /* the daemon is gone - the runner terminates on its own */
+    }
+
+    for (uint32_t i = 0; i < 2; i++)
+    {
+        if (requests[i] >= 0)
+            close(requests[i]);
+
+        if (replies[i] >= 0)
+            close(replies[i]);
+    }
+}
+
+/**
+ * @brief Main loop of the spawner process
+ *
+ * The spawner forks a new runner for every byte written to its
+ * socket and terminates once the daemon closed the socket. The
+ * terminated runners are reaped automatically.
+ */
+static void __attribute__((noreturn))
+spawner_main(int32_t sock)
+{
+    char command = 0;
+
+    close_fds(sock, -1);
+    reset_signals();
+
+    signal(SIGINT, SIG_IGN);
+    signal(SIGCHLD, SIG_IGN);
+
+    while (true)
+    {
+        ssize_t bytes = read(sock, &command, sizeof(command));
+
+        if (bytes == -1 && errno == EINTR)
+            continue;
+
+        if (bytes < 1)
+            break;
+
+        spawner_fork(sock);
+    }
+
+    _exit(EXIT_SUCCESS);
+}
+
+/**
+ * @brief Fork the spawner process the runners are forked by
+ *
+ * This has to be called as long as the daemon is single threaded.
+ */
+static bool
+spawner_start(runner_pool_t *pool)
+{
+    int32_t fds[2];
+
+    if (socketpair(AF_UNIX, SOCK_STREAM, 0, fds) == -1)
+    {
+        log_perror("nyx: socketpair");
+        return false;
+    }
+
+    set_cloexec(fds[0]);
+    set_cloexec(fds[1]);
+
+    pid_t pid = fork();
+
+    if (pid == -1)
+    {
+        log_perror("nyx: fork");
+
+        close(fds[0]);
+        close(fds[1]);
+        return false;
+    }
+
+    if (pid == 0)
+    {
+        /* the daemon's end might be a standard stream
+         * that is not closed by 'close_fds' */
+        close(fds[0]);
+        spawner_main(fds[1]);
+    }
+
+    close(fds[1]);
+
+    pool->spawner_pid = pid;
+    pool->spawner_fd = fds[0];
+
+    return true;
+}
+
+/**
+ * @brief Start a new runner by the spawner process
+ *
+ * The runners are forked by the small spawner process instead of
+ * the (possibly large and multi-threaded) daemon so terminated
+ * runners can be replaced any time.
+ */
+static bool
+runner_spawn(runner_pool_t *pool, runner_t *runner)
+{
+    pid_t pid = 0;
+    char command = 'r';
+    int32_t fds[2] = { -1, -1 };
+    char control[CMSG_SPACE(sizeof(fds))];
+    struct iovec iov = { .iov_base = &pid, .iov_len = sizeof(pid) };
+    struct msghdr msg =
+    {
+        .msg_iov = &iov,
+        .msg_iovlen = 1,
+        .msg_control = control,
+        .msg_controllen = sizeof(control)
+    };
+
+    runner->spawned_at = time_ms();
+
+    if (pool->spawner_fd < 0)
+        return false;
+
+    if (!send_full(pool->spawner_fd, &command, sizeof(command)))
+    {
+        log_perror("nyx: write");
+        return false;
+    }
+
+    ssize_t bytes = 0;
+#ifndef OSX
+    int32_t flags = MSG_CMSG_CLOEXEC;
+#else
+    int32_t flags = 0;
+#endif
+
+    while ((bytes = recvmsg(pool->spawner_fd, &msg, flags)) == -1 && errno == EINTR)
+        ;
+
+    if (bytes != sizeof(pid))
+    {
+        log_warn("Check runner spawner terminated unexpectedly");
+        return false;
+    }
+
+    if (pid < 0)
+    {
+        log_warn("Failed to fork check runner: %s", strerror(-pid));
+        return false;
+    }
+
+    struct cmsghdr *cmsg = CMSG_FIRSTHDR(&msg);
+
+    if (cmsg == NULL || cmsg->cmsg_type != SCM_RIGHTS ||
+            cmsg->cmsg_len != CMSG_LEN(sizeof(fds)))
+    {
+        log_warn("Received invalid reply of the check runner spawner");
+        return false;
+    }
+
+    memcpy(fds, CMSG_DATA(cmsg), sizeof(fds));
+
+#ifdef OSX
+    set_cloexec(fds[0]);
+    set_cloexec(fds[1]);
+#endif
+
+    fcntl(fds[1], F_SETFL, fcntl(fds[1], F_GETFL, 0) | O_NONBLOCK);
+
+    __atomic_store_n(&runner->pid, pid, __ATOMIC_RELAXED);
+    runner->request_fd = fds[0];
+    runner->reply_fd = fds[1];
+    runner->request_id = 0;
+    runner->abandoned = false;
+
+    return true;
+}
+
+/**
+ * @brief Close the pipes of the given runner
+ *
+ * The runner terminates once its request pipe is closed and is
+ * reaped by the spawner process.
+ */
+static void
+runner_close(runner_t *runner)
+{
+    if (runner->pid < 1)
+        return;
+
+    close(runner->request_fd);
+    close(runner->reply_fd);
+
+    /* a busy runner would finish its command first */
+    if (runner->request_id)
+        kill(runner->pid, SIGKILL);
+
+    __atomic_store_n(&runner->pid, 0, __ATOMIC_RELAXED);
+    runner->request_fd = -1;
+    runner->reply_fd = -1;
+    runner->request_id = 0;
+}
+
+/**
+ * @brief Fork the given number of check runners
+ * @param count number of runners
+ * @return new pool (possibly with fewer runners if forking failed)
+ *
+ * This has to be called as long as the daemon is single threaded.
+ */
+runner_pool_t *
+runner_pool_new(uint32_t count)
+{
+    uint32_t started = 0;
+    runner_pool_t *pool = xcalloc1(sizeof(runner_pool_t));
+
+    pool->spawner_fd = -1;
+    pool->count = count;
+    pool->runners = xcalloc(MAX(1, count), sizeof(runner_t));
+
+    if (count > 0 && spawner_start(pool))
+    {
+        while (started < count && runner_spawn(pool, &pool->runners[started]))
+            started++;
+    }
+
+    if (started < count)
+        log_warn("Started %u of %u check runners", started, count);
+
+    return pool;
+}
+
+/**
+ * @brief Terminate all runners by closing their request pipes
+ */
+void
+runner_pool_destroy(runner_pool_t *pool)
+{
+    if (pool == NULL)
+        return;
+
+    for (uint32_t i = 0; i < pool->count; i++)
+        runner_close(&pool->runners[i]);
+
+    /* the spawner terminates once its socket is closed */
+    if (pool->spawner_pid > 0)
+    {
+        close(pool->spawner_fd);
+        waitpid(pool->spawner_pid, NULL, 0);
+    }
+
+    free(pool->runners);
+    free(pool);
+}
+
+/**
+ * @brief Number of runners that are still alive
+ */
+uint32_t
+runner_pool_alive(runner_pool_t *pool)
+{
+    uint32_t alive = 0;
+
+    for (uint32_t i = 0; i < pool->count; i++)
+    {
+        if (pool->runners[i].pid > 0)
+            alive++;
+    }
+
+    return alive;
+}
+
+/**
+ * @brief Whether the given PID belongs to the pool's spawner or runners
+ *
+ * May be called from another thread than the one managing the pool.
+ */
+bool
+runner_pool_owns(runner_pool_t *pool, pid_t pid)
+{
+    if (pool == NULL || pid <= 0)
+        return false;
+
+    if (pid == pool->spawner_pid)
+        return true;
+
+    for (uint32_t i = 0; i < pool->count; i++)
+    {
+        if (__atomic_load_n(&pool->runners[i].pid, __ATOMIC_RELAXED) == pid)
+            return true;
+    }
+
+    return false;
+}
+
+/**
+ * @brief Receive the result of the runner's request in progress
+ * @param runner runner to receive from
+ * @param result result to fill
+ * @return 1 if a result was received, 0 if the result is not
+ *         available yet and -1 if the runner terminated
+ */
+int32_t
+runner_receive(runner_t *runner, runner_result_t *result)
+{
+    while (runner->pid > 0)
+    {
+        ssize_t bytes = read(runner->reply_fd, result, sizeof(runner_result_t));
+
+        /* results are smaller than PIPE_BUF so they are never split */
+        if (bytes == sizeof(runner_result_t))
+        {
+            runner->request_id = 0;
+            runner->abandoned = false;
+            return 1;
+        }
+
+        if (bytes == -1 && errno == EINTR)
+            continue;
+
+        if (bytes == -1 && (errno == EAGAIN || errno == EWOULDBLOCK))
+            return 0;
+
+        log_warn("Check runner %d terminated unexpectedly", runner->pid);
+
+        /* there is no command to kill anymore */
+        runner->request_id = 0;
+        break;
+    }
+
+    runner_close(runner);
+
+    return -1;
+}
+
+/**
+ * @brief Mark the runner's request in progress as abandoned
+ *
+ * The late result is picked up (and dropped) the next time
+ * the runner is acquired.
+ */
+void
+runner_release(runner_t *runner)
+{
+    if (runner->request_id)
+        runner->abandoned = true;
+}
+
+/**
+ * @brief Find an idle runner
+ * @return idle runner or NULL if all runners are busy
+ *
+ * Terminated runners are replaced at most once every
+ * NYX_RUNNER_RESPAWN_MS.
+ */
+runner_t *
+runner_acquire(runner_pool_t *pool)
+{
+    runner_result_t result;
+    uint64_t now = time_ms();
+
+    for (uint32_t i = 0; i < pool->count; i++)
+    {
+        runner_t *runner = &pool->runners[i];
+
+        if (runner->pid < 1)
+        {
+            if (now < runner->spawned_at + NYX_RUNNER_RESPAWN_MS ||
+                    !runner_spawn(pool, runner))
+                continue;
+
+            log_info("Restarted check runner (PID %d)", runner->pid);
+        }
+
+        /* collect the late result of an abandoned request */
+        if (runner->request_id && (!runner->abandoned || runner_receive(runner, &result) < 1))
+            continue;
+
+        return runner;
+    }
+
+    return NULL;
+}
+
+static bool
+payload_append(char *payload, uint32_t *length, const char *key, const char *value)
+{
+    uint32_t available = NYX_RUNNER_MAX_PAYLOAD - *length;
+    int32_t written = value
+        ? snprintf(payload + *length, available, "%s=%s", key, value)
+        : snprintf(payload + *length, available, "%s", key);
+
+    if (written < 0 || (uint32_t)written >= available)
+        return false;
+
+    *length += written + 1;
+
+    return true;
+}
+
+/**
+ * @brief Send the exec check of the given watch to an idle runner
+ * @param pool    runner pool
+ * @param runner  idle runner (see 'runner_acquire')
+ * @param watch   watch whose exec check is run
+ * @param timeout time in ms the command has to finish in
+ * @return request ID or 0 on error (errno is set)
+ */
+uint32_t
+runner_submit(runner_pool_t *pool, runner_t *runner, watch_t *watch, uint32_t timeout)
+{
+    bool valid = true;
+    uint32_t length = 0;
+    char buffer[sizeof(runner_request_t) + NYX_RUNNER_MAX_PAYLOAD];
+    char *payload = buffer + sizeof(runner_request_t);
+    runner_request_t request = { .timeout = timeout };
+
+    valid &= payload_append(payload, &length, watch->uid ? watch->uid : "", NULL);
+    valid &= payload_append(payload, &length, watch->gid ? watch->gid : "", NULL);
+    valid &= payload_append(payload, &length, watch->dir ? watch->dir : "", NULL);
+
+    for (const char **arg = watch->exec_check; valid && arg && *arg; arg++)
+    {
+        valid &= payload_append(payload, &length, *arg, NULL);
+        request.argc++;
+    }
+
+    if (watch->env)
+    {
+        const char *key = NULL;
+        void *data = NULL;
+        hash_iter_t *iter = hash_iter_start(watch->env);
+
+        while (valid && hash_iter(iter, &key, &data))
+        {
+            valid &= payload_append(payload, &length, key, data);
+            request.envc++;
+        }
+
+        free(iter);
+    }
+
+    if (!valid || request.argc < 1 ||
+            request.argc > NYX_RUNNER_MAX_ARGS ||
+            request.envc > NYX_RUNNER_MAX_ARGS)
+    {
+        errno = E2BIG;
+        return 0;
+    }
+
+    /* request id 0 is never used */
+    if (++pool->next_id == 0)
+        pool->next_id = 1;
+
+    request.id = pool->next_id;
+    request.length = length;
+
+    memcpy(buffer, &request, sizeof(runner_request_t));
+
+    if (!send_full(runner->request_fd, buffer, sizeof(runner_request_t) + length))
+    {
+        int32_t error = errno;
+
+        log_warn("Check runner %d terminated unexpectedly", runner->pid);
+        runner_close(runner);
+
+        errno = error;
+        return 0;
+    }
+
+    runner->request_id = request.id;
+    runner->abandoned = false;
+
+    return request.id;
+}
+
+/**
+ * @brief Run the exec check of the given watch and wait for its result
+ * @return true if a result was received, false otherwise (errno is set)
+ */
+bool
+runner_run(runner_pool_t *pool, watch_t *watch, uint32_t timeout, runner_result_t *result)
+{
+    runner_t *runner = runner_acquire(pool);
+
+    if (runner == NULL)
+    {
+        errno = EBUSY;
+        return false;
+    }
+
+    uint32_t id = runner_submit(pool, runner, watch, timeout);
+
+    if (id == 0)
+        return false;
+
+    uint64_t deadline = time_ms() + timeout + NYX_RUNNER_GRACE_MS;
+
+    while (true)
+    {
+        int32_t received = runner_receive(runner, result);
+
+        if (received < 0)
+        {
+            errno = EPIPE;
+            return false;
+        }
+
+        if (received > 0 && result->id == id)
+            return true;
+
+        uint64_t now = time_ms();
+
+        if (now >= deadline)
+        {
+            runner_release(runner);
+
+            errno = ETIMEDOUT;
+            return false;
+        }
+
+        struct pollfd pfd = { .fd = runner->reply_fd, .events = POLLIN };
+
+        poll(&pfd, 1, deadline - now);
+    }
+}
+
+/* vim: set et sw=4 sts=4 tw=80: */
@@ -0,0 +1,126 @@
+/* Copyright 2014-2019 Gregor Uhlenheuer
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#pragma once
+
+#include "watch.h"
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <sys/types.h>
+
+/* Pool of pre-forked check runners
+ *
+ * The runners are forked by a spawner process that is forked right
+ * after the forker while the nyx daemon is still small. Each runner
+ * executes one exec check at a time: it reads a request from its
+ * request pipe, runs the command with the request's timeout and
+ * writes the result back to its reply pipe. This way the frequent
+ * probe executions neither fork the (possibly large) daemon nor queue
+ * up behind the start/stop requests of the forker. Runners that
+ * terminated are replaced by the spawner. */
+
+/* default number of check runners */
+#define NYX_RUNNER_DEFAULT_COUNT 2
+
+/* maximum size of a request's payload (command, environment etc.) */
+#define NYX_RUNNER_MAX_PAYLOAD 4096
+
+/* maximum number of command arguments and environment variables */
+#define NYX_RUNNER_MAX_ARGS 64
+
+/* time in ms a runner may take to report a timed out command */
+#define NYX_RUNNER_GRACE_MS 1000
+
+/* minimum time in ms between two starts of the same runner */
+#define NYX_RUNNER_RESPAWN_MS 1000
+
+typedef struct
+{
+    uint32_t id;
+    /** time in ms the command has to finish in */
+    uint32_t timeout;
+    uint32_t argc;
+    uint32_t envc;
+    /** length of the payload following the request */
+    uint32_t length;
+} runner_request_t;
+
+typedef struct
+{
+    uint32_t id;
+    /** exit code of the command (128 + signal if it was killed) */
+    int32_t status;
+    /** errno of the failed execution (ETIMEDOUT on timeout), 0 otherwise */
+    int32_t error;
+    /** time in microseconds the command took */
+    uint32_t duration;
+} runner_result_t;
+
+typedef struct runner_t
+{
+    /** pid of the runner process (0 if terminated) */
+    pid_t pid;
+    /** write end of the request pipe */
+    int32_t request_fd;
+    /** (non-blocking) read end of the reply pipe */
+    int32_t reply_fd;
+    /** id of the request in progress (0 if idle) */
+    uint32_t request_id;
+    /** nobody waits for the result of the request in progress anymore */
+    bool abandoned;
+    /** time in ms the runner was started at last */
+    uint64_t spawned_at;
+} runner_t;
+
+typedef struct runner_pool_t
+{
+    runner_t *runners;
+    uint32_t count;
+    uint32_t next_id;
+    /** pid of the process the runners are forked by */
+    pid_t spawner_pid;
+    /** socket to request new runners from the spawner */
+    int32_t spawner_fd;
+} runner_pool_t;
+
+runner_pool_t *
+runner_pool_new(uint32_t count);
+
+void
+runner_pool_destroy(runner_pool_t *pool);
+
+uint32_t
+runner_pool_alive(runner_pool_t *pool);
+
+bool
+runner_pool_owns(runner_pool_t *pool, pid_t pid);
+
+runner_t *
+runner_acquire(runner_pool_t *pool);
+
+void
+runner_release(runner_t *runner);
+
+uint32_t
+runner_submit(runner_pool_t *pool, runner_t *runner, watch_t *watch, uint32_t timeout);
+
+int32_t
+runner_receive(runner_t *runner, runner_result_t *result);
+
+bool
+runner_run(runner_pool_t *pool, watch_t *watch, uint32_t timeout, runner_result_t *result);
+
+/* vim: set et sw=4 sts=4 tw=80: */
@@ -0,0 +1,608 @@
+/* Copyright 2014-2019 Gregor Uhlenheuer
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#define _GNU_SOURCE
+
+#include "def.h"
+#include "log.h"
+#include "scheduler.h"
+#include "utils.h"
+
+#include <errno.h>
+#include <time.h>
+#include <unistd.h>
+
+#ifndef OSX
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#else
+#include <sys/time.h>
+#endif
+
+#define NYX_SCHEDULER_MIN_WORKERS 4
+#define NYX_SCHEDULER_MAX_WORKERS 32
+#define NYX_SCHEDULER_MAX_EVENTS  16
+
+static void
+ready_push(scheduler_t *scheduler, state_t *state)
+{
+    state->next_ready = NULL;
+
+    if (scheduler->ready_tail == NULL)
+        scheduler->ready_head = state;
+    else
+        scheduler->ready_tail->next_ready = state;
+
+    scheduler->ready_tail = state;
+}
+
+static state_t *
+ready_pop(scheduler_t *scheduler)
+{
+    state_t *state = scheduler->ready_head;
+
+    if (state == NULL)
+        return NULL;
+
+    scheduler->ready_head = state->next_ready;
+
+    if (scheduler->ready_head == NULL)
+        scheduler->ready_tail = NULL;
+
+    state->next_ready = NULL;
+
+    return state;
+}
+
+static void
+ready_remove(scheduler_t *scheduler, state_t *state)
+{
+    state_t *prev = NULL, *node = scheduler->ready_head;
+
+    while (node)
+    {
+        if (node == state)
+        {
+            if (prev)
+                prev->next_ready = node->next_ready;
+            else
+                scheduler->ready_head = node->next_ready;
+
+            if (scheduler->ready_tail == node)
+                scheduler->ready_tail = prev;
+
+            node->next_ready = NULL;
+            return;
+        }
+
+        prev = node;
+        node = node->next_ready;
+    }
+}
+
+static list_node_t *
+find_state(list_t *states, state_t *state)
+{
+    list_node_t *node = states->head;
+
+    while (node)
+    {
+        if (node->data == state)
+            return node;
+
+        node = node->next;
+    }
+
+    return NULL;
+}
+
+/**
+ * @brief Convert a deadline of 'time_ms' into an absolute timeout
+ *        of the scheduler's condition variables
+ */
+static struct timespec
+cond_deadline(uint64_t deadline)
+{
+#ifdef OSX
+    /* no monotonic condition variables -> shift onto the wall clock */
+    struct timeval tv;
+    uint64_t now = time_ms();
+
+    gettimeofday(&tv, NULL);
+
+    deadline = (uint64_t)tv.tv_sec * 1000 + tv.tv_usec / 1000 +
+        (deadline > now ? deadline - now : 0);
+#endif
+
+    struct timespec ts =
+    {
+        .tv_sec = deadline / 1000,
+        .tv_nsec = (deadline % 1000) * 1000000
+    };
+
+    return ts;
+}
+
+static void
+cond_init(pthread_cond_t *cond)
+{
+    pthread_condattr_t attr;
+
+    pthread_condattr_init(&attr);
+#ifndef OSX
+    pthread_condattr_setclock(&attr, CLOCK_MONOTONIC);
+#endif
+    pthread_cond_init(cond, &attr);
+    pthread_condattr_destroy(&attr);
+}
+
+/**
+ * @brief Move all delayed states whose delay elapsed into the ready queue
+ * @param scheduler scheduler instance (lock has to be held)
+ * @return time (in ms) of the next pending wakeup or 0 if there is none
+ */
+static uint64_t
+wake_delayed(scheduler_t *scheduler)
+{
+    uint64_t next_wakeup = 0;
+    uint64_t now = time_ms();
+    list_node_t *node = scheduler->delayed->head;
+
+    while (node)
+    {
+        list_node_t *next = node->next;
+        state_t *state = node->data;
+        uint64_t until = state->wakeup_at;
+
+        if (until <= now)
+        {
+            list_remove(scheduler->delayed, node);
+
+            /* the state might have been scheduled by a new request already */
+            if (!__atomic_exchange_n(&state->scheduled, true, __ATOMIC_SEQ_CST))
+                ready_push(scheduler, state);
+        }
+        else if (next_wakeup == 0 || until < next_wakeup)
+            next_wakeup = until;
+
+        node = next;
+    }
+
+    return next_wakeup;
+}
+
+/**
+ * @brief Move the given delayed state into the ready queue right away
+ * @param scheduler scheduler instance (lock has to be held)
+ * @param state     state to wake up
+ *
+ * A state that is not parked in the delayed list yet will notice its
+ * 'wakeup_pending' flag in 'release_state' instead.
+ */
+static void
+wake_state(scheduler_t *scheduler, state_t *state)
+{
+    list_node_t *node = NULL;
+
+    __atomic_store_n(&state->wakeup_pending, true, __ATOMIC_SEQ_CST);
+
+    if ((node = find_state(scheduler->delayed, state)) == NULL)
+        return;
+
+    list_remove(scheduler->delayed, node);
+
+    if (!__atomic_exchange_n(&state->scheduled, true, __ATOMIC_SEQ_CST))
+    {
+        ready_push(scheduler, state);
+        pthread_cond_signal(&scheduler->ready_cond);
+    }
+}
+
+/**
+ * @brief Hand the given state back after a worker processed it
+ * @param scheduler scheduler instance (lock has to be held)
+ * @param state     processed state
+ * @param result    outcome of 'state_run'
+ *
+ * The state's 'scheduled' flag is cleared here only, after the worker
+ * left the state, so no other worker can pick up the state while it
+ * is still processed. A parked state is moved into the delayed list
+ * unless it was woken up in the meantime.
+ */
+static void
+release_state(scheduler_t *scheduler, state_t *state, state_run_e result)
+{
+    bool requeue = false;
+
+    if (result == STATE_RUN_PARKED)
+    {
+        list_node_t *node = find_state(scheduler->delayed, state);
+
+        /* the state was woken up while it was processed */
+        if (__atomic_load_n(&state->wakeup_pending, __ATOMIC_SEQ_CST))
+        {
+            if (node)
+                list_remove(scheduler->delayed, node);
+
+            requeue = true;
+        }
+        else if (node == NULL)
+            list_add(scheduler->delayed, state);
+    }
+
+    __atomic_store_n(&state->scheduled, false, __ATOMIC_SEQ_CST);
+
+    /* requests pushed in the meantime did not schedule the state */
+    if (requeue || state_has_requests(state, result))
+    {
+        if (!__atomic_exchange_n(&state->scheduled, true, __ATOMIC_SEQ_CST))
+        {
+            ready_push(scheduler, state);
+            pthread_cond_signal(&scheduler->ready_cond);
+        }
+    }
+}
+
+#ifndef OSX
+static void *
+scheduler_poller(void *data)
+{
+    bool need_exit = false;
+    scheduler_t *scheduler = data;
+    struct epoll_event events[NYX_SCHEDULER_MAX_EVENTS];
+
+    while (!need_exit)
+    {
+        int32_t n = epoll_wait(scheduler->epfd, events, NYX_SCHEDULER_MAX_EVENTS, -1);
+
+        if (n < 0)
+        {
+            if (errno == EINTR)
+                continue;
+
+            log_perror("nyx: epoll_wait");
+            break;
+        }
+
+        pthread_mutex_lock(&scheduler->lock);
+
+        for (int32_t i = 0; i < n; i++)
+        {
+            state_t *state = events[i].data.ptr;
+
+            /* the exit eventfd is registered without a state */
+            if (state == NULL)
+            {
+                need_exit = true;
+                continue;
+            }
+
+            /* the state might have stopped waiting in the meantime */
+            if (find_state(scheduler->watching, state) == NULL)
+                continue;
+
+            wake_state(scheduler, state);
+        }
+
+        pthread_mutex_unlock(&scheduler->lock);
+    }
+
+    return NULL;
+}
+
+static void
+init_poller(scheduler_t *scheduler)
+{
+    struct epoll_event ev = { .events = EPOLLIN, .data.ptr = NULL };
+
+    if ((scheduler->epfd = epoll_create1(EPOLL_CLOEXEC)) == -1)
+    {
+        log_perror("nyx: epoll_create1");
+        return;
+    }
+
+    if ((scheduler->exit_fd = eventfd(0, EFD_CLOEXEC)) == -1 ||
+            epoll_ctl(scheduler->epfd, EPOLL_CTL_ADD, scheduler->exit_fd, &ev) == -1 ||
+            pthread_create(&scheduler->poller, NULL, scheduler_poller, scheduler) != 0)
+    {
+        log_perror("nyx: failed to initialize scheduler poller");
+
+        if (scheduler->exit_fd >= 0)
+            close(scheduler->exit_fd);
+
+        close(scheduler->epfd);
+        scheduler->epfd = -1;
+    }
+}
+#endif
+
+static void *
+scheduler_worker(void *data)
+{
+    scheduler_t *scheduler = data;
+
+    pthread_mutex_lock(&scheduler->lock);
+
+    while (!scheduler->need_exit)
+    {
+        uint64_t next_wakeup = wake_delayed(scheduler);
+        state_t *state = ready_pop(scheduler);
+
+        if (state != NULL)
+        {
+            state->running = true;
+            pthread_mutex_unlock(&scheduler->lock);
+
+            state_run_e result = state_run(state);
+
+            pthread_mutex_lock(&scheduler->lock);
+            state->running = false;
+
+            release_state(scheduler, state, result);
+
+            pthread_cond_broadcast(&scheduler->idle_cond);
+            continue;
+        }
+
+        if (next_wakeup > 0)
+        {
+            struct timespec timeout = cond_deadline(next_wakeup);
+
+            pthread_cond_timedwait(&scheduler->ready_cond, &scheduler->lock, &timeout);
+        }
+        else
+            pthread_cond_wait(&scheduler->ready_cond, &scheduler->lock);
+    }
+
+    pthread_mutex_unlock(&scheduler->lock);
+
+    return NULL;
+}
+
+/**
+ * @brief Create a new state scheduler with a fixed pool of worker threads
+ * @param num_cpus number of available CPUs
+ * @return scheduler instance
+ */
+scheduler_t *
+scheduler_new(int32_t num_cpus)
+{
+    scheduler_t *scheduler = xcalloc1(sizeof(scheduler_t));
+
+    pthread_mutex_init(&scheduler->lock, NULL);
+    cond_init(&scheduler->ready_cond);
+    cond_init(&scheduler->idle_cond);
+
+    scheduler->delayed = list_new(NULL);
+    scheduler->watching = list_new(NULL);
+    scheduler->num_workers = MIN(NYX_SCHEDULER_MAX_WORKERS,
+            MAX(NYX_SCHEDULER_MIN_WORKERS, num_cpus));
+    scheduler->workers = xcalloc(scheduler->num_workers, sizeof(pthread_t));
+
+    log_debug("Starting state scheduler with %u workers", scheduler->num_workers);
+
+#ifndef OSX
+    init_poller(scheduler);
+#endif
+
+    for (uint32_t i = 0; i < scheduler->num_workers; i++)
+    {
+        int32_t rc = pthread_create(&scheduler->workers[i], NULL, scheduler_worker, scheduler);
+
+        if (rc != 0)
+            log_critical_perror("Failed to create thread, error: %d", rc);
+    }
+
+    return scheduler;
+}
+
+/**
+ * @brief Put the given state into the ready queue
+ * @param scheduler scheduler instance
+ * @param state     state to process
+ *
+ * The caller has to own the state's 'scheduled' flag so that a
+ * state is never queued more than once at the same time.
+ */
+void
+scheduler_enqueue(scheduler_t *scheduler, state_t *state)
+{
+    pthread_mutex_lock(&scheduler->lock);
+
+    ready_push(scheduler, state);
+    pthread_cond_signal(&scheduler->ready_cond);
+
+    pthread_mutex_unlock(&scheduler->lock);
+}
+
+/**
+ * @brief Hand the given state back after it was processed by 'state_run'
+ * @param scheduler scheduler instance
+ * @param state     processed state
+ * @param result    outcome of 'state_run'
+ */
+void
+scheduler_release(scheduler_t *scheduler, state_t *state, state_run_e result)
+{
+    pthread_mutex_lock(&scheduler->lock);
+
+    release_state(scheduler, state, result);
+
+    pthread_mutex_unlock(&scheduler->lock);
+}
+
+/**
+ * @brief Resume the pending continuation of the given state right away
+ * @param scheduler scheduler instance
+ * @param state     state to wake up
+ */
+void
+scheduler_wake(scheduler_t *scheduler, state_t *state)
+{
+    pthread_mutex_lock(&scheduler->lock);
+
+    wake_state(scheduler, state);
+
+    pthread_mutex_unlock(&scheduler->lock);
+}
+
+/**
+ * @brief Wake up the given state as soon as the file descriptor
+ *        becomes readable
+ * @param scheduler scheduler instance
+ * @param state     state waiting for the file descriptor
+ * @param fd        file descriptor to watch
+ * @return true if the file descriptor is watched, false if the caller
+ *         has to fall back to polling
+ *
+ * The state's 'wakeup_pending' flag is set once the file descriptor
+ * is readable. The file descriptor is reported only once and has to
+ * be removed via 'scheduler_unwatch_fd' before it is closed.
+ */
+bool
+scheduler_watch_fd(scheduler_t *scheduler, state_t *state, int32_t fd)
+{
+#ifndef OSX
+    bool watched = false;
+    struct epoll_event ev = { .events = EPOLLIN | EPOLLONESHOT, .data.ptr = state };
+
+    pthread_mutex_lock(&scheduler->lock);
+
+    if (scheduler->epfd >= 0)
+    {
+        if (epoll_ctl(scheduler->epfd, EPOLL_CTL_ADD, fd, &ev) == 0)
+        {
+            list_add(scheduler->watching, state);
+            watched = true;
+        }
+        else
+            log_perror("nyx: epoll_ctl");
+    }
+
+    pthread_mutex_unlock(&scheduler->lock);
+
+    return watched;
+#else
+    return false;
+#endif
+}
+
+/**
+ * @brief Stop watching a file descriptor registered via 'scheduler_watch_fd'
+ * @param scheduler scheduler instance
+ * @param state     state waiting for the file descriptor
+ * @param fd        watched file descriptor
+ */
+void
+scheduler_unwatch_fd(scheduler_t *scheduler, state_t *state, int32_t fd)
+{
+    list_node_t *node = NULL;
+
+    pthread_mutex_lock(&scheduler->lock);
+
+#ifndef OSX
+    if (scheduler->epfd >= 0)
+        epoll_ctl(scheduler->epfd, EPOLL_CTL_DEL, fd, NULL);
+#endif
+
+    if ((node = find_state(scheduler->watching, state)) != NULL)
+        list_remove(scheduler->watching, node);
+
+    pthread_mutex_unlock(&scheduler->lock);
+}
+
+/**
+ * @brief Remove the given state from the scheduler
+ * @param scheduler scheduler instance
+ * @param state     state to remove
+ * @param timeout   seconds to wait for the state to terminate
+ * @return true if the state terminated in time, false otherwise
+ *
+ * After this function returned the state won't be touched by any
+ * worker thread anymore and may be safely destroyed.
+ */
+bool
+scheduler_detach(scheduler_t *scheduler, state_t *state, uint32_t timeout)
+{
+    int32_t rc = 0;
+    list_node_t *node = NULL;
+    struct timespec deadline = cond_deadline(time_ms() + timeout * 1000ULL);
+
+    pthread_mutex_lock(&scheduler->lock);
+
+    /* wait for the state to process its QUIT request */
+    while (rc != ETIMEDOUT && (state->state != STATE_QUIT || state->running))
+        rc = pthread_cond_timedwait(&scheduler->idle_cond, &scheduler->lock, &deadline);
+
+    ready_remove(scheduler, state);
+
+    if ((node = find_state(scheduler->delayed, state)) != NULL)
+        list_remove(scheduler->delayed, node);
+
+    if ((node = find_state(scheduler->watching, state)) != NULL)
+        list_remove(scheduler->watching, node);
+
+    /* even if the state did not terminate in time we must not
+     * release it while a worker is still processing it */
+    while (state->running)
+        pthread_cond_wait(&scheduler->idle_cond, &scheduler->lock);
+
+    pthread_mutex_unlock(&scheduler->lock);
+
+    return rc != ETIMEDOUT;
+}
+
+void
+scheduler_destroy(scheduler_t *scheduler)
+{
+    pthread_mutex_lock(&scheduler->lock);
+
+    scheduler->need_exit = true;
+    pthread_cond_broadcast(&scheduler->ready_cond);
+
+    pthread_mutex_unlock(&scheduler->lock);
+
+    for (uint32_t i = 0; i < scheduler->num_workers; i++)
+        pthread_join(scheduler->workers[i], NULL);
+
+#ifndef OSX
+    if (scheduler->epfd >= 0)
+    {
+        uint64_t value = 1;
+
+        if (write(scheduler->exit_fd, &value, sizeof(value)) == -1)
+            log_perror("nyx: write");
+        else
+            pthread_join(scheduler->poller, NULL);
+
+        close(scheduler->exit_fd);
+        close(scheduler->epfd);
+    }
+#endif
+
+    log_debug("Stopped state scheduler");
+
+    list_destroy(scheduler->watching);
+    list_destroy(scheduler->delayed);
+    free(scheduler->workers);
+
+    pthread_cond_destroy(&scheduler->idle_cond);
+    pthread_cond_destroy(&scheduler->ready_cond);
+    pthread_mutex_destroy(&scheduler->lock);
+
+    free(scheduler);
+}
+
+/* vim: set et sw=4 sts=4 tw=80: */
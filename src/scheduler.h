@@ -0,0 +1,82 @@
+/* Copyright 2014-2019 Gregor Uhlenheuer
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#pragma once
+
+#include "list.h"
+#include "state.h"
+
+#include <pthread.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <time.h>
+
+typedef struct scheduler_t
+{
+    /** lock guarding all of the fields below */
+    pthread_mutex_t lock;
+    /** signaled whenever a new state is ready to be processed */
+    pthread_cond_t ready_cond;
+    /** signaled whenever a worker finished processing a state */
+    pthread_cond_t idle_cond;
+    /** head of the (intrusive) queue of states ready to be processed */
+    state_t *ready_head;
+    /** tail of the (intrusive) queue of states ready to be processed */
+    state_t *ready_tail;
+    /** states that are delayed until their 'wakeup_at' time */
+    list_t *delayed;
+    /** number of worker threads */
+    uint32_t num_workers;
+    /** worker threads */
+    pthread_t *workers;
+    /** whether the workers should terminate */
+    bool need_exit;
+    /** states waiting for a file descriptor to become readable */
+    list_t *watching;
+#ifndef OSX
+    /** epoll instance of the file descriptors in 'watching' */
+    int32_t epfd;
+    /** eventfd to terminate the poller thread */
+    int32_t exit_fd;
+    /** thread waiting for file descriptor readiness */
+    pthread_t poller;
+#endif
+} scheduler_t;
+
+scheduler_t *
+scheduler_new(int32_t num_cpus);
+
+void
+scheduler_enqueue(scheduler_t *scheduler, state_t *state);
+
+void
+scheduler_release(scheduler_t *scheduler, state_t *state, state_run_e result);
+
+void
+scheduler_wake(scheduler_t *scheduler, state_t *state);
+
+bool
+scheduler_watch_fd(scheduler_t *scheduler, state_t *state, int32_t fd);
+
+void
+scheduler_unwatch_fd(scheduler_t *scheduler, state_t *state, int32_t fd);
+
+bool
+scheduler_detach(scheduler_t *scheduler, state_t *state, uint32_t timeout);
+
+void
+scheduler_destroy(scheduler_t *scheduler);
+
+/* vim: set et sw=4 sts=4 tw=80: */
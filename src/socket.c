@@ -16,8 +16,10 @@
 #include "log.h"
 #include "socket.h"
 #include "def.h"
+#include "utils.h"
 
 #include <arpa/inet.h>
+#include <errno.h>
 #include <fcntl.h>
 #include <string.h>
 #include <sys/types.h>
@@ -80,6 +82,9 @@ endpoint_new(uint16_t port, const char *host)
 
     endpoint->port = port;
     endpoint->host = host != NULL ? strdup(host) : NULL;
+    endpoint->refs = 1;
+
+    pthread_mutex_init(&endpoint->lock, NULL);
 
     return endpoint;
 }
@@ -90,12 +95,172 @@ endpoint_free(endpoint_t *endpoint)
     if (endpoint == NULL)
         return;
 
+    /* a pending resolution holds a reference of its own */
+    pthread_mutex_lock(&endpoint->lock);
+    bool last = --endpoint->refs == 0;
+    pthread_mutex_unlock(&endpoint->lock);
+
+    if (!last)
+        return;
+
+    pthread_mutex_destroy(&endpoint->lock);
+
     if (endpoint->host)
         free((void *)endpoint->host);
 
     free(endpoint);
 }
 
+static void *
+endpoint_resolve(void *data)
+{
+    endpoint_t *endpoint = data;
+    struct addrinfo hints, *result = NULL;
+
+    memset(&hints, 0, sizeof(struct addrinfo));
+    hints.ai_family = AF_INET;
+    hints.ai_socktype = SOCK_STREAM;
+
+    int32_t err = getaddrinfo(endpoint->host, NULL, &hints, &result);
+
+    pthread_mutex_lock(&endpoint->lock);
+
+    if (err == 0)
+    {
+        uint32_t count = 0;
+
+        for (struct addrinfo *addr = result;
+                addr != NULL && count < NYX_ENDPOINT_MAX_ADDRESSES;
+                addr = addr->ai_next)
+        {
+            struct sockaddr_in *address = &endpoint->addresses[count++];
+
+            memcpy(address, addr->ai_addr, sizeof(struct sockaddr_in));
+            address->sin_port = htons(endpoint->port);
+        }
+
+        if (count > 0)
+        {
+            if (endpoint->preferred >= count)
+                endpoint->preferred = 0;
+
+            endpoint->num_addresses = count;
+            endpoint->expires = time_ms() + NYX_ENDPOINT_TTL_MS;
+        }
+        else
+            err = EAI_NONAME;
+    }
+
+    if (err != 0)
+    {
+        log_warn("Failed to resolve '%s': %s", endpoint->host, gai_strerror(err));
+
+        /* keep serving the previously resolved addresses (if any) */
+        endpoint->expires = time_ms() + NYX_ENDPOINT_RETRY_MS;
+    }
+
+    endpoint->error = err;
+    endpoint->resolving = false;
+
+    pthread_mutex_unlock(&endpoint->lock);
+
+    if (result)
+        freeaddrinfo(result);
+
+    endpoint_free(endpoint);
+
+    return NULL;
+}
+
+/**
+ * @brief Resolve the endpoint's host in the background if the
+ *        cached addresses are missing or expired
+ * @param endpoint  endpoint to refresh
+ */
+void
+endpoint_refresh(endpoint_t *endpoint)
+{
+    pthread_t thread;
+
+    if (endpoint == NULL || endpoint->host == NULL)
+        return;
+
+    pthread_mutex_lock(&endpoint->lock);
+
+    if (!endpoint->resolving && endpoint->expires <= time_ms())
+    {
+        endpoint->resolving = true;
+        endpoint->refs++;
+
+        int32_t err = pthread_create(&thread, NULL, endpoint_resolve, endpoint);
+
+        if (err)
+        {
+            errno = err;
+            log_perror("nyx: pthread_create");
+
+            endpoint->resolving = false;
+            endpoint->refs--;
+        }
+        else
+            pthread_detach(thread);
+    }
+
+    pthread_mutex_unlock(&endpoint->lock);
+}
+
+/**
+ * @brief Get the address to connect to from the endpoint's cache
+ * @param endpoint  endpoint with a host to connect to
+ * @param address   address to fill
+ * @return 1 if an address is available, 0 if the host is not resolved
+ *         yet and -1 if the host cannot be resolved
+ *
+ * The call never blocks on the resolver: expired addresses are served
+ * while they are refreshed in the background.
+ */
+int32_t
+endpoint_address(endpoint_t *endpoint, struct sockaddr_in *address)
+{
+    int32_t result = 0;
+
+    endpoint_refresh(endpoint);
+
+    pthread_mutex_lock(&endpoint->lock);
+
+    if (endpoint->num_addresses > 0)
+    {
+        memcpy(address, &endpoint->addresses[endpoint->preferred], sizeof(struct sockaddr_in));
+        result = 1;
+    }
+    else if (endpoint->expires > 0 && endpoint->error != 0)
+        result = -1;
+
+    pthread_mutex_unlock(&endpoint->lock);
+
+    return result;
+}
+
+/**
+ * @brief Report a failed connection to the given address so the
+ *        next connection is tried on the endpoint's next address
+ */
+void
+endpoint_failed(endpoint_t *endpoint, const struct sockaddr_in *address)
+{
+    pthread_mutex_lock(&endpoint->lock);
+
+    if (endpoint->num_addresses > 0)
+    {
+        struct sockaddr_in *preferred = &endpoint->addresses[endpoint->preferred];
+
+        if (preferred->sin_addr.s_addr == address->sin_addr.s_addr)
+            endpoint->preferred = (endpoint->preferred + 1) % endpoint->num_addresses;
+    }
+
+    pthread_mutex_unlock(&endpoint->lock);
+}
+
 endpoint_t *
 parse_endpoint(const char *input)
 {
@@ -212,7 +377,7 @@ check_http(const char *url, uint16_t port, http_method_e method)
     char *request = NULL;
     struct sockaddr_in srv;
 
-    int32_t sockfd = socket(AF_INET, SOCK_STREAM, IPPROTO_TCP);
+    int32_t sockfd = socket(AF_INET, SOCK_STREAM | NYX_SOCK_CLOEXEC, IPPROTO_TCP);
 
     if (sockfd == -1)
     {
@@ -326,7 +491,7 @@ check_port(const char *host, uint16_t port)
 
     for (rp = result; rp != NULL; rp = rp->ai_next)
     {
-        int32_t sock = socket(rp->ai_family, rp->ai_socktype, rp->ai_protocol);
+        int32_t sock = socket(rp->ai_family, rp->ai_socktype | NYX_SOCK_CLOEXEC, rp->ai_protocol);
         if (sock == -1)
         {
             log_perror("nyx: socket");
@@ -382,7 +547,7 @@ check_local_port(uint16_t port)
     bool success = false;
     struct sockaddr_in srv;
 
-    int32_t sockfd = socket(AF_INET, SOCK_STREAM, 0);
+    int32_t sockfd = socket(AF_INET, SOCK_STREAM | NYX_SOCK_CLOEXEC, 0);
 
     if (sockfd == -1)
     {
@@ -15,7 +15,18 @@
 
 #pragma once
 
+#include <netinet/in.h>
+#include <pthread.h>
 #include <stdbool.h>
+#include <stdint.h>
+#include <sys/socket.h>
+
+/* sockets are created with close-on-exec wherever supported */
+#ifdef SOCK_CLOEXEC
+#define NYX_SOCK_CLOEXEC SOCK_CLOEXEC
+#else
+#define NYX_SOCK_CLOEXEC 0
+#endif
 
 /* epoll or kqueue */
 #ifndef OSX
@@ -52,10 +63,34 @@ typedef struct
     uint32_t length;
 } epoll_extra_data_t;
 
+/* time in ms resolved endpoint addresses are cached */
+#define NYX_ENDPOINT_TTL_MS 60000
+
+/* time in ms a failed endpoint resolution is retried after */
+#define NYX_ENDPOINT_RETRY_MS 5000
+
+/* maximum number of cached addresses per endpoint */
+#define NYX_ENDPOINT_MAX_ADDRESSES 8
+
 typedef struct
 {
     uint16_t port;
     const char *host;
+
+    /* resolved addresses of 'host' (guarded by 'lock') */
+    pthread_mutex_t lock;
+    /** number of references (the owner and a pending resolution) */
+    uint32_t refs;
+    /** whether a resolution is in progress */
+    bool resolving;
+    /** error of the last resolution (0 on success) */
+    int32_t error;
+    /** time in ms the addresses have to be refreshed at (0 if unresolved) */
+    uint64_t expires;
+    /** index of the address to connect to */
+    uint32_t preferred;
+    uint32_t num_addresses;
+    struct sockaddr_in addresses[NYX_ENDPOINT_MAX_ADDRESSES];
 } endpoint_t;
 
 endpoint_t *
@@ -64,6 +99,15 @@ parse_endpoint(const char *input);
 void
 endpoint_free(endpoint_t *endpoint);
 
+void
+endpoint_refresh(endpoint_t *endpoint);
+
+int32_t
+endpoint_address(endpoint_t *endpoint, struct sockaddr_in *address);
+
+void
+endpoint_failed(endpoint_t *endpoint, const struct sockaddr_in *address);
+
 http_method_e
 http_method_from_string(const char *str);
 
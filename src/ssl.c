@@ -17,6 +17,7 @@
 
 #include "def.h"
 #include "log.h"
+#include "socket.h"
 #include "ssl.h"
 
 #include <arpa/inet.h>
@@ -40,7 +41,7 @@ tcp_connect(uint32_t port)
 {
     struct sockaddr_in srv;
 
-    int32_t sockfd = socket(AF_INET, SOCK_STREAM, IPPROTO_TCP);
+    int32_t sockfd = socket(AF_INET, SOCK_STREAM | NYX_SOCK_CLOEXEC, IPPROTO_TCP);
 
     if (sockfd == -1)
     {
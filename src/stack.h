@@ -19,16 +19,33 @@
 #include <stdint.h>
 #include <string.h>
 
+/* Fixed-size window of the most recent values
+ *
+ * The values are stored in a ring buffer so adding a value does not
+ * move any of the other ones. Alongside the values the window keeps
+ * running aggregates: the sum, the minimum and maximum and the number
+ * of values that reach the configured threshold.
+ *
+ * The minimum/maximum are rescanned only if the value leaving the
+ * window was the current extreme. The sum is recalculated every time
+ * the ring wraps around so floating point errors do not accumulate. */
+
 #define DECLARE_STACK(type_, name_) \
     typedef struct  \
     { \
         uint32_t count; \
-        uint32_t max; \
+        uint32_t size; \
+        uint32_t head; \
+        uint32_t exceeding; \
+        type_ threshold; \
+        type_ sum; \
+        type_ min; \
+        type_ max; \
         type_ *elements; \
     } stack_##name_##_t; \
     \
     stack_##name_##_t * \
-    stack_##name_##_new(uint32_t size); \
+    stack_##name_##_new(uint32_t size, type_ threshold); \
     \
     void \
     stack_##name_##_destroy(stack_##name_##_t *stack); \
@@ -39,16 +56,20 @@
     type_ \
     stack_##name_##_newest(stack_##name_##_t *stack); \
     \
-    uint32_t \
-    stack_##name_##_satisfy(stack_##name_##_t *stack, bool (*predicate)(type_, void *), void *obj);
+    type_ \
+    stack_##name_##_get(stack_##name_##_t *stack, uint32_t index); \
+    \
+    void \
+    stack_##name_##_set_threshold(stack_##name_##_t *stack, type_ threshold);
 
 #define IMPLEMENT_STACK(type_, name_) \
     stack_##name_##_t * \
-    stack_##name_##_new(uint32_t size) \
+    stack_##name_##_new(uint32_t size, type_ threshold) \
     { \
         stack_##name_##_t *stack = xcalloc1(sizeof(stack_##name_##_t)); \
-        stack->max = size; \
-        stack->elements = xcalloc(size, sizeof(type_)); \
+        stack->size = MAX(1, size); \
+        stack->threshold = threshold; \
+        stack->elements = xcalloc(stack->size, sizeof(type_)); \
         return stack; \
     } \
     \
@@ -59,35 +80,77 @@
         free(stack); \
     } \
     \
+    static void \
+    stack_##name_##_rescan(stack_##name_##_t *stack) \
+    { \
+        type_ sum = 0; \
+        type_ *elements = stack->elements; \
+        stack->min = stack->max = elements[0]; \
+        for (uint32_t i = 0; i < stack->count; i++) \
+        { \
+            sum += elements[i]; \
+            stack->min = MIN(stack->min, elements[i]); \
+            stack->max = MAX(stack->max, elements[i]); \
+        } \
+        stack->sum = sum; \
+    } \
+    \
     void \
     stack_##name_##_add(stack_##name_##_t *stack, type_ value) \
     { \
-        uint32_t size = stack->max; \
-        uint32_t count = stack->count + 1; \
-        stack->count = MIN(size, count); \
-        type_ *start = stack->elements; \
-        type_ *to = start + 1; \
-        memmove(to, start, sizeof(type_) * (size - 1)); \
-        *start = value; \
+        bool rescan = false; \
+        type_ *slot = &stack->elements[stack->head]; \
+        if (stack->count == stack->size) \
+        { \
+            type_ old = *slot; \
+            stack->sum -= old; \
+            if (old >= stack->threshold) \
+                stack->exceeding--; \
+            rescan = old <= stack->min || old >= stack->max; \
+        } \
+        else \
+        { \
+            if (stack->count++ == 0) \
+                stack->min = stack->max = value; \
+        } \
+        *slot = value; \
+        stack->head = (stack->head + 1) % stack->size; \
+        stack->sum += value; \
+        if (value >= stack->threshold) \
+            stack->exceeding++; \
+        if (rescan || stack->head == 0) \
+            stack_##name_##_rescan(stack); \
+        else \
+        { \
+            stack->min = MIN(stack->min, value); \
+            stack->max = MAX(stack->max, value); \
+        } \
+    } \
+    \
+    type_ \
+    stack_##name_##_get(stack_##name_##_t *stack, uint32_t index) \
+    { \
+        if (index >= stack->count) \
+            return 0; \
+        return stack->elements[(stack->head + stack->size - 1 - index) % stack->size]; \
     } \
     \
     type_ \
     stack_##name_##_newest(stack_##name_##_t *stack) \
     { \
-        return stack->elements[0]; \
+        return stack_##name_##_get(stack, 0); \
     } \
     \
-    uint32_t \
-    stack_##name_##_satisfy(stack_##name_##_t *stack, bool (*predicate)(type_, void *), void *obj) \
+    void \
+    stack_##name_##_set_threshold(stack_##name_##_t *stack, type_ threshold) \
     { \
-        uint32_t i = 0, count = 0; \
-        while (i < stack->count) \
+        stack->threshold = threshold; \
+        stack->exceeding = 0; \
+        for (uint32_t i = 0; i < stack->count; i++) \
         { \
-            if (predicate(stack->elements[i++], obj)) \
-                count++; \
+            if (stack->elements[i] >= threshold) \
+                stack->exceeding++; \
         } \
-        return count; \
     }
 
-
 /* vim: set et sw=4 sts=4 tw=80: */
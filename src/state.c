@@ -15,33 +15,36 @@
 
 #define _GNU_SOURCE
 
+#include "cgroup.h"
 #include "def.h"
 #include "log.h"
 #include "forker.h"
 #include "fs.h"
+#include "pidfd.h"
+#include "pidmap.h"
 #include "process.h"
+#include "scheduler.h"
 #include "state.h"
+#include "utils.h"
 
 #include <errno.h>
 #include <math.h>
-#include <pthread.h>
 #include <signal.h>
 #include <stdlib.h>
 #include <string.h>
 #include <unistd.h>
 
 #define NYX_STATE_JOIN_TIMEOUT 30
+#define NYX_STATE_QUEUE_SIZE   32
+#define NYX_STOP_POLL_INTERVAL 100
+#define NYX_START_TIMEOUT      10000
 #define NYX_MAX_FLAPPING_DELAY 600
 #define NYX_FLAPPING_INTERVAL  60
 #define NYX_FLAPPING_COUNT     5
 
 typedef bool (*transition_func_t)(state_t *, state_e, state_e);
 
-typedef struct
-{
-    state_e value;
-    bool is_command;
-} state_entry_t;
+IMPLEMENT_QUEUE(state_entry_t, state)
 
 #ifndef NDEBUG
 static const char *state_to_str[] =
@@ -89,57 +92,115 @@ state_to_human_string(state_e state)
     return state_to_human_str[state];
 }
 
-static state_entry_t *
-state_entry_new(state_e value, bool is_command)
-{
-    state_entry_t *entry = xcalloc1(sizeof(state_entry_t));
-
-    entry->value = value;
-    entry->is_command = is_command;
-
-    return entry;
-}
-
 static bool
 set_state_internal(state_t *state, state_e value, bool is_command)
 {
-    if (sem_wait(state->states_sem) != 0)
-    {
-        return false;
-    }
-
     /* do not override QUIT signal */
     if (state->state == STATE_QUIT)
     {
         log_debug("state %s is about to quit - skip setting updated state",
                 state->watch->name);
 
-        sem_post(state->states_sem);
-        sem_post(state->notify_sem);
         return false;
     }
 
     /* we don't set the state immediately but rather put
      * the 'requested' state into the states queue for the
-     * state-loop to process those one after the other */
-    state_entry_t *entry = state_entry_new(value, is_command);
-    list_add(state->states, entry);
+     * scheduler to process those one after the other */
+    state_entry_t entry = { .value = value, .is_command = is_command };
+    state_entry_t last;
+
+    /* the very same request is pending already - the scheduler
+     * is notified about that one anyway */
+    if (!is_command &&
+            queue_state_last(state->states, &last) &&
+            !last.is_command && last.value == value)
+    {
+        log_debug("Coalescing pending state request %s of watch '%s'",
+                state_to_string(value), state->watch->name);
+
+        return true;
+    }
+
+    if (is_command)
+        __atomic_add_fetch(&state->pending_commands, 1, __ATOMIC_SEQ_CST);
 
-    /* release states semaphore */
-    sem_post(state->states_sem);
+    if (!queue_state_push(state->states, entry))
+    {
+        if (is_command)
+            __atomic_sub_fetch(&state->pending_commands, 1, __ATOMIC_SEQ_CST);
+
+        /* QUIT must not get lost - it is processed as soon as
+         * the queue is drained instead */
+        if (value == STATE_QUIT)
+            __atomic_store_n(&state->quit_pending, true, __ATOMIC_SEQ_CST);
+        /* process events (e.g. an exit) must not get lost either: the
+         * newest one supersedes all others that did not fit */
+        else if (!is_command)
+        {
+            log_debug("State queue of watch '%s' is full - keeping request %s",
+                    state->watch->name, state_to_string(value));
+
+            __atomic_store_n(&state->overflow_state, value, __ATOMIC_SEQ_CST);
+        }
+        else
+        {
+            log_warn("State queue of watch '%s' is full - dropping request",
+                    state->watch->name);
+
+            return false;
+        }
+    }
 
     /* trigger state change notification */
-    sem_post(state->notify_sem);
+    state_notify(state);
 
     return true;
 }
 
+/**
+ * Receive the result of a request sent to the forker
+ *
+ * This function is called by the forker reader thread (or the thread
+ * that failed to send the request) and wakes up the waiting state.
+ */
+void
+state_fork_result(state_t *state, forker_result_t *result)
+{
+    if (result->command == FORKER_STOP)
+    {
+        if (result->error)
+        {
+            log_warn("Failed to execute stop command of watch '%s': %s",
+                    state->watch->name, strerror(result->error));
+        }
+
+        return;
+    }
+
+    state->start_pid = result->pid;
+    state->start_error = result->error;
+
+    __atomic_store_n(&state->start_replied, true, __ATOMIC_SEQ_CST);
+
+    scheduler_wake(state->nyx->scheduler, state);
+}
+
+/**
+ * Hand the state over to the scheduler unless it is
+ * already queued or being processed right now
+ */
+void
+state_notify(state_t *state)
+{
+    if (!__atomic_exchange_n(&state->scheduled, true, __ATOMIC_SEQ_CST))
+        scheduler_enqueue(state->nyx->scheduler, state);
+}
+
 /**
  * Try to set the state's state to the given value
  *
- * This function is guarded by the state's semaphore
- * meaning this function will wait until the lock
- * is acquired.
+ * This function never blocks and may be called from any thread.
  */
 bool
 set_state(state_t *state, state_e value)
@@ -151,9 +212,7 @@ set_state(state_t *state, state_e value)
  * Try to set the state's state to the given value.
  * This state is based on a user's command.
  *
- * This function is guarded by the state's semaphore
- * meaning this function will wait until the lock
- * is acquired.
+ * This function never blocks and may be called from any thread.
  */
 bool
 set_state_command(state_t *state, state_e value)
@@ -168,6 +227,37 @@ set_state_command(state_t *state, state_e value)
               state_to_string(from),\
               state_to_string(to))
 
+/**
+ * Set the PID of the watch's process
+ *
+ * The process event filter has to be updated before the process'
+ * exit can be noticed (see 'start_wait').
+ */
+void
+set_pid(state_t *state, pid_t pid)
+{
+    nyx_t *nyx = state->nyx;
+
+    if (state->pid == pid)
+        return;
+
+    pthread_mutex_lock(&nyx->state_pids_lock);
+
+    /* the old PID might already be reused by another watch */
+    if (pidmap_get(nyx->state_pids, state->pid) == state)
+        pidmap_remove(nyx->state_pids, state->pid);
+
+    pidmap_put(nyx->state_pids, pid, state);
+    state->pid = pid;
+
+    pthread_mutex_unlock(&nyx->state_pids_lock);
+
+#ifndef OSX
+    event_filter_update(nyx);
+    pidfd_update();
+#endif
+}
+
 static bool
 to_unmonitored(state_t *state, state_e from, state_e to)
 {
@@ -203,7 +293,7 @@ to_unmonitored(state_t *state, state_e from, state_e to)
         if (!is_running)
             clear_pid(watch->name, state->nyx);
 
-        state->pid = is_running ? pid : 0;
+        set_pid(state, is_running ? pid : 0);
     }
 
     set_state(state, is_running
@@ -213,6 +303,96 @@ to_unmonitored(state_t *state, state_e from, state_e to)
     return true;
 }
 
+/**
+ * Postpone the remaining part of the current state transition
+ *
+ * The state won't process any further requests until the
+ * given continuation returned true.
+ */
+static void
+state_continue_at(state_t *state, bool (*continuation)(state_t *), uint64_t at)
+{
+    state->continuation = continuation;
+    state->wakeup_at = at;
+}
+
+/**
+ * @brief Kill the processes the stopped app left behind in its cgroup
+ */
+static void
+kill_remaining(state_t *state)
+{
+    char *path = cgroup_path(state->nyx->cgroup_root, state->watch->name);
+
+    if (path && cgroup_populated(path) == 1)
+    {
+        log_info("Killing the remaining processes of watch '%s'", state->watch->name);
+
+        if (!cgroup_kill(path))
+            log_perror("nyx: cgroup kill");
+    }
+
+    free(path);
+}
+
+static void
+stop_finish(state_t *state)
+{
+    if (state->stop_fd >= 0)
+    {
+        scheduler_unwatch_fd(state->nyx->scheduler, state, state->stop_fd);
+        close(state->stop_fd);
+        state->stop_fd = -1;
+    }
+
+    if (state->nyx->cgroup_root)
+        kill_remaining(state);
+
+    state->stop_pid = 0;
+}
+
+static bool
+stop_wait(state_t *state)
+{
+    nyx_t *nyx = state->nyx;
+    watch_t *watch = state->watch;
+    uint64_t now = 0;
+
+    if (process_exited(state->stop_pid, state->stop_fd))
+        goto end;
+
+    /* without a watched pidfd we have to poll for the process to
+     * terminate, otherwise we are woken up as soon as it exited */
+    if ((now = time_ms()) < state->stop_deadline)
+    {
+        state->wakeup_at = state->stop_fd >= 0
+            ? state->stop_deadline
+            : MIN(now + NYX_STOP_POLL_INTERVAL, state->stop_deadline);
+
+        return false;
+    }
+
+    /* the app failed to terminate in time
+     * -> send a SIGKILL now */
+
+    if (kill(state->stop_pid, SIGKILL) == -1 && errno != ESRCH)
+    {
+        log_perror("nyx: kill");
+    }
+
+    log_warn("Failed to stop watch '%s' after waiting %d seconds - "
+             "sending SIGKILL now",
+             watch->name,
+             (watch->stop_timeout ? watch->stop_timeout : nyx->options.def_stop_timeout));
+
+end:
+    /* we can safely assume we successfully terminated this watch */
+    clear_pid(watch->name, nyx);
+    stop_finish(state);
+
+    return true;
+}
+
 static bool
 stop(state_t *state, state_e from, state_e to)
 {
@@ -239,15 +419,22 @@ stop(state_t *state, state_e from, state_e to)
         return true;
     }
 
+    /* the pidfd is opened before the process is signaled so
+     * its termination cannot be missed */
+    state->stop_pid = pid;
+    state->stop_fd = process_open_fd(pid);
+
+    if (state->stop_fd >= 0 &&
+            !scheduler_watch_fd(nyx->scheduler, state, state->stop_fd))
+    {
+        close(state->stop_fd);
+        state->stop_fd = -1;
+    }
+
     /* in case a custom stop command is specified we use that one */
     if (watch->stop)
     {
-        fork_info_t *stop_info = forker_stop(state->watch->id, pid);
-
-        if (write(nyx->forker_pipe, stop_info, sizeof(fork_info_t)) == -1)
-            log_perror("nyx: write");
-
-        free(stop_info);
+        forker_stop(nyx, state->watch->id, pid, state);
     }
     /* otherwise we try SIGTERM */
     else
@@ -256,42 +443,21 @@ stop(state_t *state, state_e from, state_e to)
         {
             /* process does not exist
              * -> already terminated */
-            if (errno == ESRCH)
-                return true;
+            bool terminated = errno == ESRCH;
 
-            log_perror("nyx: kill");
-            return false;
-        }
-    }
+            if (!terminated)
+                log_perror("nyx: kill");
 
-    while (times-- > 0)
-    {
-        if (kill(pid, 0) == -1)
-        {
-            if (errno == ESRCH)
-                goto end;
+            stop_finish(state);
+            return terminated;
         }
-
-        sleep(1);
     }
 
-    /* the app failed to terminate after several attempts
-     * -> send a SIGKILL now */
-
-    if (kill(pid, SIGKILL) == -1 && errno != ESRCH)
-    {
-        log_perror("nyx: kill");
-    }
+    /* wait for the process to terminate without blocking
+     * a scheduler worker in the meantime */
+    state->stop_deadline = time_ms() + times * 1000;
 
-    log_warn("Failed to stop watch '%s' after waiting %d seconds - "
-             "sending SIGKILL now",
-             watch->name,
-             (watch->stop_timeout ? watch->stop_timeout : nyx->options.def_stop_timeout));
-
-end:
-    /* according to the 'kill -0' above we can safely assume
-     * we successfully terminated this watch */
-    clear_pid(watch->name, nyx);
+    state_continue_at(state, stop_wait, 0);
 
     return true;
 }
@@ -304,42 +470,69 @@ restart(state_t *state, state_e from, state_e to)
     return stop(state, from, to);
 }
 
-
-static pid_t
-start_state(state_t *state)
+static bool
+start_wait(state_t *state)
 {
-    /* start program via forker */
-    fork_info_t *start_info = forker_start(state->watch->id);
+    pid_t pid = 0;
+    int32_t fd = -1;
+    const char *name = state->watch->name;
 
-    if (write(state->nyx->forker_pipe, start_info, sizeof(fork_info_t)) == -1)
-        log_perror("nyx: write");
+    if (__atomic_exchange_n(&state->start_replied, false, __ATOMIC_SEQ_CST))
+    {
+        pid = state->start_pid;
 
-    free(start_info);
+        if (state->start_error)
+        {
+            log_warn("Failed to start watch '%s': %s",
+                    name, strerror(state->start_error));
+        }
+    }
+    else
+    {
+        if (time_ms() < state->wakeup_at)
+            return false;
 
-    /* let's check if the process is running at all
-     * we will delay a little bit to give the process some
-     * time to launch 'execvp' */
-    usleep(500000);
+        /* the forker did not reply in time - fall back to
+         * the pid file it is writing */
+        log_warn("No start result of watch '%s' received from forker", name);
 
-    pid_t pid = determine_pid(state->watch->name, state->nyx);
+        forker_cancel(state->nyx, state);
+
+        pid = determine_pid(name, state->nyx);
+    }
 
     if (!valid_pid(pid, state->nyx))
         pid = 0;
 
     if (pid)
     {
-        if (!check_process_running(pid))
+        set_pid(state, pid);
+
+        /* the process might have exited before the PID was known so
+         * its exit event could not be assigned to this watch */
+        fd = process_open_fd(pid);
+
+        if (process_exited(pid, fd))
         {
-            log_debug("Watch '%s' failed to start", state->watch->name);
-            return 0;
+            log_debug("Watch '%s' failed to start", name);
+            set_pid(state, 0);
+            pid = 0;
+        }
+        else
+        {
+            log_debug("Retrieved PID %d for watch '%s'", pid, name);
         }
 
-        state->pid = pid;
-
-        log_debug("Retrieved PID %d for watch '%s'", pid, state->watch->name);
+        if (fd >= 0)
+            close(fd);
     }
 
-    return pid;
+    if (pid > 0)
+        set_state(state, STATE_RUNNING);
+    else
+        set_state(state, STATE_STOPPED);
+
+    return true;
 }
 
 static bool
@@ -347,10 +540,18 @@ start(state_t *state, state_e from, state_e to)
 {
     DEBUG_LOG_STATE_FUNC;
 
-    if (start_state(state) > 0)
-        set_state(state, STATE_RUNNING);
-    else
+    __atomic_store_n(&state->start_replied, false, __ATOMIC_SEQ_CST);
+
+    /* start program via forker */
+    if (!forker_start(state->nyx, state->watch->id, state))
+    {
         set_state(state, STATE_STOPPED);
+        return true;
+    }
+
+    /* the forker replies with the started process' PID
+     * via 'dispatch_fork_result' */
+    state_continue_at(state, start_wait, time_ms() + NYX_START_TIMEOUT);
 
     return true;
 }
@@ -449,24 +650,51 @@ static transition_func_t transition_table[STATE_SIZE][STATE_SIZE] =
 };
 
 static state_t*
-find_state_by_pid(list_t *states, pid_t pid)
+find_state_by_pid(nyx_t *nyx, pid_t pid)
 {
-    if (states == NULL)
+    state_t *state = NULL;
+
+    /* the states are about to be destroyed */
+    if (nyx->states == NULL)
         return NULL;
 
-    list_node_t *node = states->head;
+    pthread_mutex_lock(&nyx->state_pids_lock);
+    state = pidmap_get(nyx->state_pids, pid);
+    pthread_mutex_unlock(&nyx->state_pids_lock);
 
-    while (node)
-    {
-        state_t *state = node->data;
+    return state;
+}
+
+/**
+ * @brief Collect the PIDs of all watched processes
+ * @param nyx   nyx instance
+ * @param count number of collected PIDs
+ * @return array of PIDs (to be freed)
+ *
+ * The PIDs are taken from the 'state_pids' map instead of the states
+ * list because the states may be destroyed concurrently on a reload.
+ */
+pid_t *
+state_collect_pids(nyx_t *nyx, uint32_t *count)
+{
+    pid_t *pids = NULL;
+    pidmap_t *map = nyx->state_pids;
+
+    *count = 0;
+
+    pthread_mutex_lock(&nyx->state_pids_lock);
 
-        if (state != NULL && state->pid == pid)
-            return state;
+    pids = xcalloc(MAX(map->count, 1), sizeof(pid_t));
 
-        node = node->next;
+    for (uint32_t i = 0; i <= map->mask; i++)
+    {
+        if (map->entries[i].pid > 0)
+            pids[(*count)++] = map->entries[i].pid;
     }
 
-    return NULL;
+    pthread_mutex_unlock(&nyx->state_pids_lock);
+
+    return pids;
 }
 
 bool
@@ -482,13 +710,13 @@ dispatch_event(pid_t pid, process_event_data_t *event_data, nyx_t *nyx)
             if (nyx->proc)
                 nyx_proc_remove(nyx->proc, pid);
 
-            state = find_state_by_pid(nyx->states, pid);
+            state = find_state_by_pid(nyx, pid);
 
             if (state != NULL)
             {
                 set_state(state, STATE_STOPPED);
 
-                state->pid = 0;
+                set_pid(state, 0);
                 clear_pid(state->watch->name, nyx);
             }
             break;
@@ -507,16 +735,21 @@ dispatch_poll_result(pid_t pid, bool is_running, nyx_t *nyx)
     log_debug("Incoming polling data for PID %d: running: %s",
             pid, (is_running ? "true" : "false"));
 
-    state_t *state = find_state_by_pid(nyx->states, pid);
+    state_t *state = find_state_by_pid(nyx, pid);
 
     if (state != NULL)
     {
         state_e next_state = is_running ? STATE_RUNNING : STATE_STOPPED;
 
+        /* the process is known to be running already - there is
+         * no need to wake up the state at all */
+        if (is_running && state->state == STATE_RUNNING)
+            return true;
+
         if (!is_running)
         {
             /* TODO: secure this one by semaphore as well? */
-            state->pid = 0;
+            set_pid(state, 0);
             clear_pid(state->watch->name, nyx);
 
             if (nyx->proc)
@@ -529,120 +762,22 @@ dispatch_poll_result(pid_t pid, bool is_running, nyx_t *nyx)
     return true;
 }
 
-#ifdef OSX
-static char *
-named_semaphore_name(watch_t *watch, pid_t nyx_pid, uint32_t idx)
-{
-    size_t sem_name_len = strlen(watch->name) + 16;
-    char *sem_name = xcalloc(sem_name_len, sizeof(char));
-
-    /* generate predictable semaphore name: <watch>_<nyx-pid>_<idx>
-     *
-     * we include nyx's pid in the semaphore name in order to
-     * allow multiple nyx instances on the same machine without
-     * collisions between semaphore names (e.g. local-mode) */
-    snprintf(sem_name, sem_name_len, "%s_%d_%u", watch->name, nyx_pid, idx);
-
-    return sem_name;
-}
-
-static sem_t *
-init_named_semaphore(watch_t *watch, pid_t nyx_pid, uint32_t idx)
-{
-    sem_t *semaphore = NULL;
-    char *sem_name = named_semaphore_name(watch, nyx_pid, idx);
-
-    log_debug("Trying to create a new named semaphore (%s) for watch %s [%u]",
-            sem_name, watch->name, idx);
-
-    /* initialize a named-semaphore as OSX does not support unnamed ones
-     * - chmod of the semaphore (0644)
-     * - initially unlocked (= 1) */
-    semaphore = sem_open(sem_name, O_CREAT | O_EXCL, 0644, 1);
-
-    if (semaphore == SEM_FAILED)
-    {
-        log_debug("Semaphore (%s) already exists - trying to unlink", sem_name);
-
-        /* the semaphore should not exist beforehand ->
-         * try to remove and retry -> then fail */
-        int32_t err = sem_unlink(sem_name);
-        if (err == 0)
-        {
-            log_debug("Try to create semaphore (%s) again", sem_name);
-
-            /* remove succeeded -> try again */
-            semaphore = sem_open(sem_name, O_CREAT | O_EXCL, 0644, 1);
-        }
-        else
-            log_critical_perror("nyx: sem_unlink");
-    }
-
-    if (semaphore == SEM_FAILED)
-        log_critical_perror("nyx: sem_open");
-
-    free(sem_name);
-
-    return semaphore;
-}
-
-static void
-remove_named_semaphore(state_t *state, sem_t *sem, uint32_t idx)
-{
-    watch_t *watch = state->watch;
-    pid_t pid = state->nyx->pid;
-
-    char *sem_name = named_semaphore_name(watch, pid, idx);
-
-    sem_close(sem);
-    sem_unlink(sem_name);
-
-    free(sem_name);
-}
-#endif
-
 state_t *
 state_new(watch_t *watch, nyx_t *nyx)
 {
-    sem_t *states_semaphore = NULL, *notify_semaphore = NULL;
     state_t *state = xcalloc1(sizeof(state_t));
+    state_entry_t initial = { .value = STATE_UNMONITORED, .is_command = false };
 
     state->nyx = nyx;
     state->watch = watch;
     state->state = STATE_UNMONITORED;
+    state->stop_fd = -1;
     state->history = timestack_new(MAX(nyx->options.history_size, 20));
 
     /* initialize states queue and populate with
      * 'initial' state of UNMONITORED */
-    state->states = list_new(free);
-    list_add(state->states, state_entry_new(STATE_UNMONITORED, false));
-
-#ifndef OSX
-    /* initialize unnamed semaphore
-     * - process-local semaphore
-     * - initially unlocked (= 1) */
-    states_semaphore = xcalloc1(sizeof(sem_t));
-    notify_semaphore = xcalloc1(sizeof(sem_t));
-
-    int32_t init = sem_init(states_semaphore, 0, 1);
-
-    if (init == -1)
-        log_critical_perror("nyx: sem_init");
-
-    init = sem_init(notify_semaphore, 0, 1);
-
-    if (init == -1)
-        log_critical_perror("nyx: sem_init");
-#else
-    /* on OSX we have to create named semaphores
-     * that's why we create two semaphores with the
-     * names: '<watch-name>_<nyx-pid>_1' and '<watch-name>_<nyx-pid>_2' */
-    states_semaphore = init_named_semaphore(watch, nyx->pid, 1);
-    notify_semaphore = init_named_semaphore(watch, nyx->pid, 2);
-#endif
-
-    state->states_sem = states_semaphore;
-    state->notify_sem = notify_semaphore;
+    state->states = queue_state_new(NYX_STATE_QUEUE_SIZE);
+    queue_state_push(state->states, initial);
 
     return state;
 }
@@ -650,67 +785,32 @@ state_new(watch_t *watch, nyx_t *nyx)
 void
 state_destroy(state_t *state)
 {
-    if (state->thread != NULL)
+    if (state->nyx->scheduler != NULL)
     {
-        int32_t join = 0, join_timeout = MAX(NYX_STATE_JOIN_TIMEOUT, state->watch->stop_timeout);
+        uint32_t join_timeout = MAX(NYX_STATE_JOIN_TIMEOUT, state->watch->stop_timeout);
         const char *name = state->watch->name;
 
-#ifndef OSX
-        time_t now = time(NULL);
+        log_debug("Waiting for state of watch '%s' to terminate", name);
 
-        const struct timespec timeout =
+        if (!scheduler_detach(state->nyx->scheduler, state, join_timeout))
         {
-            .tv_sec = now + join_timeout,
-            .tv_nsec = 0
-        };
-#endif
+            log_error("State of watch '%s' failed to terminate "
+                      "after waiting %ds", name, join_timeout);
+        }
+    }
 
-        log_debug("Waiting for state thread of watch '%s' to terminate", name);
+    /* the state must not be notified about any forker results anymore */
+    forker_cancel(state->nyx, state);
 
-        /* join thread */
-        join =
-#ifndef OSX
-            pthread_timedjoin_np(*state->thread, NULL, &timeout);
-#else
-            pthread_join(*state->thread, NULL);
-#endif
+    pthread_mutex_lock(&state->nyx->state_pids_lock);
 
-        if (join != 0)
-        {
-            if (errno == ETIMEDOUT)
-            {
-                log_error("State thread of watch '%s' failed to terminate "
-                          "after waiting %ds", name, join_timeout);
-            }
+    if (pidmap_get(state->nyx->state_pids, state->pid) == state)
+        pidmap_remove(state->nyx->state_pids, state->pid);
 
-            log_error("Joining of state thread of watch '%s' failed: %d",
-                    state->watch->name, join);
-        }
+    pthread_mutex_unlock(&state->nyx->state_pids_lock);
 
-        free(state->thread);
-    }
-
-    /* notify semaphore */
-    if (state->notify_sem != NULL)
-    {
-#ifndef OSX
-        sem_destroy(state->notify_sem);
-        free(state->notify_sem);
-#else
-        remove_named_semaphore(state, state->notify_sem, 2);
-#endif
-    }
-
-    /* states semaphore */
-    if (state->states_sem != NULL)
-    {
-#ifndef OSX
-        sem_destroy(state->states_sem);
-        free(state->states_sem);
-#else
-        remove_named_semaphore(state, state->states_sem, 1);
-#endif
-    }
+    if (state->stop_fd >= 0)
+        close(state->stop_fd);
 
     if (state->history)
     {
@@ -718,7 +818,7 @@ state_destroy(state_t *state)
         state->history = NULL;
     }
 
-    list_destroy(state->states);
+    queue_state_destroy(state->states);
 
     free(state);
 }
@@ -768,24 +868,21 @@ is_flapping(state_t *state, uint32_t changes, int32_t within)
 {
     uint32_t i = 0, is_stopped = 0, started = 0;
     timestack_t *hist = state->history;
-    timestack_elem_t *elem = hist->elements;
+    timestack_elem_t *elem = NULL;
 
     if (hist->count < (changes * 2))
         return false;
 
     time_t now_time = time(NULL);
 
-    while (i++ < hist->count)
+    while ((elem = timestack_get(hist, i++)) != NULL)
     {
         state_e value = elem->value;
 
         /* we are interested in counting 'starting' and 'stopped'
          * events only */
         if (value != STATE_STARTING && value != STATE_STOPPED)
-        {
-            elem++;
             continue;
-        }
 
         time_t seconds_ago = now_time - elem->time;
 
@@ -801,160 +898,204 @@ is_flapping(state_t *state, uint32_t changes, int32_t within)
 
         if (started > changes && is_stopped > changes)
             return true;
-
-        elem++;
     }
 
     return false;
 }
 
 static bool
-is_command(void *data)
+has_pending_command(state_t *state)
 {
-    state_entry_t *entry = data;
+    return __atomic_load_n(&state->pending_commands, __ATOMIC_SEQ_CST) > 0 ||
+        __atomic_load_n(&state->quit_pending, __ATOMIC_SEQ_CST);
+}
 
-    return entry->is_command;
+static bool
+has_pending_state(state_t *state)
+{
+    return !queue_state_empty(state->states) ||
+        __atomic_load_n(&state->overflow_state, __ATOMIC_SEQ_CST) != STATE_INIT ||
+        __atomic_load_n(&state->quit_pending, __ATOMIC_SEQ_CST);
 }
 
 static void
-safe_sleep(state_t *state, uint32_t seconds)
+process_next_state(state_t *state)
 {
-    while (seconds-- > 0 && state->state != STATE_QUIT)
-    {
-        /* the 'sleep' may be interrupted by a user-command
-         * i.e. STARTING, STOPPING, RESTARTING or QUIT */
-
-        if (sem_wait(state->states_sem) != 0)
-            break;
-
-        void *command_found = list_find(state->states, is_command);
-
-        sem_post(state->states_sem);
+    state_e current_state;
+    watch_t *watch = state->watch;
+    state_e last_state = state->last_state;
 
-        if (command_found)
-            break;
+    /* check if there is a new state in the queue at all */
+    state_entry_t state_entry;
+    state_e overflow = STATE_INIT;
 
-        sleep(1);
+    if (queue_state_pop(state->states, &state_entry))
+    {
+        if (state_entry.is_command)
+            __atomic_sub_fetch(&state->pending_commands, 1, __ATOMIC_SEQ_CST);
     }
-}
+    /* the newest request that did not fit into the queue */
+    else if ((overflow = __atomic_exchange_n(&state->overflow_state, STATE_INIT,
+                    __ATOMIC_SEQ_CST)) != STATE_INIT)
+        state_entry.value = overflow;
+    /* a QUIT that did not fit into the queue is processed
+     * after all other requests */
+    else if (__atomic_load_n(&state->quit_pending, __ATOMIC_SEQ_CST))
+        state_entry.value = STATE_QUIT;
+    /* no new state found -> nothing to do */
+    else
+        return;
 
-void
-state_loop(state_t *state)
-{
-    int32_t sem_fail = 0;
+    current_state = state_entry.value;
 
-    watch_t *watch = state->watch;
-    state_e last_state = STATE_INIT;
+    /* QUIT is handled immediately */
+    if (current_state == STATE_QUIT)
+    {
+        log_info("Watch '%s' terminating", watch->name);
+        state->state = STATE_QUIT;
+        return;
+    }
 
-    log_debug("Starting state loop for watch '%s'", watch->name);
+    bool result = process_state(state, last_state, current_state);
 
-    /* wait until the event manager triggers this
-     * state semaphore */
-    while ((sem_fail = sem_wait(state->notify_sem)) == 0)
+    if (result)
     {
-        state_e current_state;
+        if (last_state != current_state)
+        {
+            timestack_add(state->history, current_state);
 
-        /* QUIT is handled immediately */
+#ifndef NDEBUG
+            timestack_dump(state->history, state_idx_to_string);
+#endif
+        }
+
+        /* the state might have been set to 'QUIT' during our
+         * process_state step - let's quit now instead of waiting
+         * one more iteration */
         if (state->state == STATE_QUIT)
         {
             log_info("Watch '%s' terminating", watch->name);
-            break;
+            return;
         }
 
-        /* acquire states semaphore */
-        if ((sem_fail = sem_wait(state->states_sem) != 0))
-            break;
+        /* the state transition succeeded ->
+         * set updated state now */
+        state->state = current_state;
+    }
 
-        /* check if there is a new state in the queue at all */
-        state_entry_t *state_entry = NULL;
-        bool state_exists = list_pop(state->states, (void *)&state_entry);
+    /* check for flapping processes
+     * meaning 5 start/stop events within 60 seconds
+     * TODO: configurable */
+    if (current_state == STATE_STOPPED &&
+            is_flapping(state, NYX_FLAPPING_COUNT, NYX_FLAPPING_INTERVAL))
+    {
+        /* increase the delayed time from 5 seconds to 10 minutes at max */
+        uint32_t to_delay_max = 5.0 * pow(2.0, state->failed_counter);
+        uint32_t to_delay = MIN(to_delay_max, NYX_MAX_FLAPPING_DELAY);
 
-        /* release states semaphore immediately after popping the
-         * first element (if set) */
-        sem_post(state->states_sem);
+        state->failed_counter = MIN(state->failed_counter + 1, 10);
 
-        /* no new state found -> continue */
-        if (!state_exists || state_entry == NULL)
-            continue;
+        log_warn("Watch '%s' appears to be flapping - delay for %u seconds. "
+                 "Probably the start command is not executable or does "
+                 "not exist at all.",
+                 watch->name, to_delay);
 
-        /* free popped state entry as early as possible */
-        current_state = state_entry->value;
-        free(state_entry);
-        state_entry = NULL;
+        /* the delay may be interrupted by a user-command
+         * i.e. STARTING, STOPPING, RESTARTING or QUIT */
+        state->delayed_until = time_ms() + to_delay * 1000;
+    }
 
-        /* QUIT is handled immediately */
-        if (current_state == STATE_QUIT)
-        {
-            log_info("Watch '%s' terminating", watch->name);
-            break;
-        }
+    if (result)
+        state->last_state = current_state;
 
-        bool result = process_state(state, last_state, current_state);
+    log_debug("Waiting on next state update for watch '%s'", watch->name);
+}
 
-        if (result)
-        {
-            if (last_state != current_state)
-            {
-                timestack_add(state->history, current_state);
+/**
+ * Process the next pending state request of the given state.
+ *
+ * This function is called by the scheduler's worker threads only
+ * and is never executed concurrently for the same state. The state
+ * stays 'scheduled' until the worker released it according to the
+ * returned outcome (see 'state_has_requests').
+ */
+state_run_e
+state_run(state_t *state)
+{
+    /* QUIT is handled immediately */
+    if (state->state == STATE_QUIT)
+        return STATE_RUN_QUIT;
 
-#ifndef NDEBUG
-                timestack_dump(state->history, state_idx_to_string);
-#endif
-            }
+    /* the last transition is not finished yet (i.e. waiting for
+     * the process to stop) - no further requests are processed
+     * until it is */
+    if (state->continuation != NULL)
+    {
+        bool woken = __atomic_exchange_n(&state->wakeup_pending, false, __ATOMIC_SEQ_CST);
 
-            /* the state might have been set to 'QUIT' during our
-             * process_state step - let's quit now instead of waiting
-             * one more iteration */
-            if (state->state == STATE_QUIT)
-            {
-                log_info("Watch '%s' terminating", watch->name);
-                break;
-            }
+        if ((!woken && time_ms() < state->wakeup_at) || !state->continuation(state))
+            return STATE_RUN_PARKED;
 
-            /* the state transition succeeded ->
-             * set updated state now */
-            state->state = current_state;
-        }
+        /* a wakeup that raced with the finished continuation must not
+         * carry over to the next park */
+        __atomic_store_n(&state->wakeup_pending, false, __ATOMIC_SEQ_CST);
+        state->continuation = NULL;
+    }
 
-        /* check for flapping processes
-         * meaning 5 start/stop events within 60 seconds
-         * TODO: configurable */
-        if (current_state == STATE_STOPPED &&
-                is_flapping(state, NYX_FLAPPING_COUNT, NYX_FLAPPING_INTERVAL))
+    /* the state is delayed (flapping) - we postpone all further
+     * processing unless there is a user command waiting */
+    if (state->delayed_until > 0)
+    {
+        if (time_ms() < state->delayed_until && !has_pending_command(state))
         {
-            /* increase the delayed time from 5 seconds to 10 minutes at max */
-            uint32_t to_delay_max = 5.0 * pow(2.0, state->failed_counter);
-            uint32_t to_delay = MIN(to_delay_max, NYX_MAX_FLAPPING_DELAY);
+            /* there is no continuation to be woken up for (e.g. a late
+             * forker reply) - the state would be re-scheduled right away */
+            __atomic_store_n(&state->wakeup_pending, false, __ATOMIC_SEQ_CST);
 
-            state->failed_counter = MIN(state->failed_counter + 1, 10);
+            state->wakeup_at = state->delayed_until;
+            return STATE_RUN_PARKED;
+        }
 
-            log_warn("Watch '%s' appears to be flapping - delay for %u seconds. "
-                     "Probably the start command is not executable or does "
-                     "not exist at all.",
-                     watch->name, to_delay);
+        state->delayed_until = 0;
+    }
 
-            /* TODO: use select instead */
-            safe_sleep(state, to_delay);
-        }
+    process_next_state(state);
 
-        if (result)
-            last_state = current_state;
+    if (state->state == STATE_QUIT)
+        return STATE_RUN_QUIT;
 
-        log_debug("Waiting on next state update for watch '%s'", watch->name);
-    }
+    /* the transition just started an asynchronous operation that
+     * has to be resumed later on */
+    if (state->continuation != NULL)
+        return STATE_RUN_PARKED;
 
-    if (sem_fail)
-        log_perror("nyx: sem_wait");
+    return STATE_RUN_DONE;
 }
 
-void *
-state_loop_start(void *data)
+/**
+ * Determine whether the given state has to be scheduled again after
+ * the scheduler released it
+ *
+ * Requests that are pushed while the state is processed do not
+ * schedule the state themselves, so this is checked once the
+ * 'scheduled' flag was cleared.
+ */
+bool
+state_has_requests(state_t *state, state_run_e result)
 {
-    state_t *state = data;
+    switch (result)
+    {
+        case STATE_RUN_DONE:
+            return has_pending_state(state);
 
-    state_loop(state);
+        case STATE_RUN_PARKED:
+            /* the flapping delay may be interrupted by a user command
+             * - a continuation is waited for nevertheless */
+            return state->continuation == NULL && has_pending_command(state);
 
-    return NULL;
+        default:
+            return false;
+    }
 }
 
 /* vim: set et sw=4 sts=4 tw=80: */
@@ -16,12 +16,13 @@
 #pragma once
 
 #include "event.h"
+#include "forker.h"
 #include "list.h"
 #include "nyx.h"
+#include "queue.h"
 #include "timestack.h"
 #include "watch.h"
 
-#include <semaphore.h>
 #include <stdlib.h>
 #include <sys/types.h>
 
@@ -39,14 +40,66 @@ typedef enum
 } state_e;
 
 typedef struct
+{
+    state_e value;
+    bool is_command;
+} state_entry_t;
+
+DECLARE_QUEUE(state_entry_t, state)
+
+/** outcome of processing a state by a scheduler worker */
+typedef enum
+{
+    /** the pending request was processed */
+    STATE_RUN_DONE,
+    /** the state waits for its continuation or delay (see 'wakeup_at') */
+    STATE_RUN_PARKED,
+    /** the state terminated and must not be scheduled anymore */
+    STATE_RUN_QUIT
+} state_run_e;
+
+typedef struct state_t
 {
     pid_t pid;
     state_e state;
-    list_t *states;
+    state_e last_state;
+    /** pending state requests (pushed by any thread) */
+    queue_state_t *states;
+    /** number of user commands among the pending state requests */
+    uint32_t pending_commands;
+    /** QUIT was requested while the states queue was full */
+    bool quit_pending;
+    /** newest request (no command) that did not fit into the states
+     * queue (STATE_INIT if none) */
+    state_e overflow_state;
     uint32_t failed_counter;
-    sem_t *states_sem;
-    sem_t *notify_sem;
-    pthread_t *thread;
+    /** whether the state is queued or processed by the scheduler
+     * (only cleared by the scheduler after processing) */
+    bool scheduled;
+    /** whether a scheduler worker is processing the state right now */
+    bool running;
+    /** postpone state processing until this time in ms (flapping) */
+    uint64_t delayed_until;
+    /** pending (asynchronous) part of the last state transition */
+    bool (*continuation)(struct state_t *state);
+    /** time in ms the scheduler should resume the state at */
+    uint64_t wakeup_at;
+    /** a file descriptor the continuation waits for became readable */
+    bool wakeup_pending;
+    /** process that is being stopped right now */
+    pid_t stop_pid;
+    /** pidfd of the process being stopped (-1 if not available) */
+    int32_t stop_fd;
+    /** time in ms the process being stopped is killed at */
+    uint64_t stop_deadline;
+    /** the forker replied to the pending start request */
+    bool start_replied;
+    /** pid of the started process as reported by the forker */
+    pid_t start_pid;
+    /** errno of the failed start as reported by the forker */
+    int32_t start_error;
+    /** next state in the scheduler's ready queue */
+    struct state_t *next_ready;
     watch_t *watch;
     timestack_t *history;
     nyx_t *nyx;
@@ -61,21 +114,33 @@ state_new(watch_t *watch, nyx_t *nyx);
 void
 state_destroy(state_t *state);
 
-void
-state_loop(state_t *state);
+state_run_e
+state_run(state_t *state);
 
-void *
-state_loop_start(void *state);
+bool
+state_has_requests(state_t *state, state_run_e result);
+
+void
+state_notify(state_t *state);
 
 bool
 set_state(state_t *state, state_e value);
 
+void
+set_pid(state_t *state, pid_t pid);
+
 bool
 set_state_command(state_t *state, state_e value);
 
+pid_t *
+state_collect_pids(nyx_t *nyx, uint32_t *count);
+
 bool
 dispatch_event(pid_t pid, process_event_data_t *event_data, nyx_t *nyx);
 
+void
+state_fork_result(state_t *state, forker_result_t *result);
+
 bool
 dispatch_poll_result(pid_t pid, bool is_running, nyx_t *nyx);
 
@@ -34,21 +34,14 @@ timestack_new(uint32_t max)
 void
 timestack_add(timestack_t *timestack, int32_t value)
 {
-    time_t now = time(NULL);
+    timestack_elem_t *elem = &timestack->elements[timestack->head];
 
-    /* move all elements except the last one
-     * a position further */
-    uint32_t size = timestack->max;
-    uint32_t count = timestack->count + 1;
-
-    timestack->count = MIN(size, count);
-    timestack_elem_t *start = timestack->elements;
-    timestack_elem_t *to = start + 1;
+    /* overwrite the oldest element once the stack is full */
+    timestack->head = (timestack->head + 1) % timestack->max;
+    timestack->count = MIN(timestack->max, timestack->count + 1);
 
-    memmove(to, start, sizeof(timestack_elem_t) * (size - 1));
-
-    start->value = value;
-    start->time = now;
+    elem->value = value;
+    elem->time = time(NULL);
 }
 
 void
@@ -57,6 +50,7 @@ timestack_clear(timestack_t *timestack)
     uint32_t size = timestack->max;
 
     timestack->count = 0;
+    timestack->head = 0;
     memset(timestack->elements, 0, sizeof(timestack_elem_t) * size);
 }
 
@@ -67,42 +61,49 @@ timestack_destroy(timestack_t *timestack)
     free(timestack);
 }
 
+/**
+ * @brief Get the element at the given position
+ * @param timestack  timestack to look into
+ * @param index      position of the element (0 being the newest one)
+ * @return element or NULL if there are not that many elements
+ */
+timestack_elem_t *
+timestack_get(timestack_t *timestack, uint32_t index)
+{
+    uint32_t max = timestack->max;
+
+    if (index >= timestack->count)
+        return NULL;
+
+    return &timestack->elements[(timestack->head + max - 1 - index) % max];
+}
+
 int32_t
 timestack_newest(timestack_t *timestack)
 {
-    if (timestack->count < 1)
-        return 0;
+    timestack_elem_t *elem = timestack_get(timestack, 0);
 
-    return timestack->elements[0].value;
+    return elem ? elem->value : 0;
 }
 
 int32_t
 timestack_oldest(timestack_t *timestack)
 {
-    uint32_t idx = timestack->count;
+    timestack_elem_t *elem = timestack_get(timestack, timestack->count - 1);
 
-    if (idx < 1)
-        return 0;
-
-    return timestack->elements[idx-1].value;
+    return elem ? elem->value : 0;
 }
 
 time_t
 timestack_find_latest(timestack_t *timestack, timestack_predicate_t predicate)
 {
     uint32_t i = 0;
-    uint32_t count = timestack->count;
-    timestack_elem_t *elem = timestack->elements;
-
-    if (count < 1)
-        return 0;
+    timestack_elem_t *elem = NULL;
 
-    while (i++ < count)
+    while ((elem = timestack_get(timestack, i++)) != NULL)
     {
         if (predicate(elem->value))
             return elem->time;
-
-        elem++;
     }
 
     return 0;
@@ -112,13 +113,9 @@ void
 timestack_dump(timestack_t *timestack, const char* (*writer)(int32_t))
 {
     uint32_t i = 0;
-    uint32_t count = timestack->count;
-    timestack_elem_t *elem = timestack->elements;
-
-    if (count < 1)
-        return;
+    timestack_elem_t *elem = NULL;
 
-    while (i++ < count)
+    while ((elem = timestack_get(timestack, i++)) != NULL)
     {
         struct tm *ltime = localtime(&elem->time);
         const char *value = writer(elem->value);
@@ -131,8 +128,6 @@ timestack_dump(timestack_t *timestack, const char* (*writer)(int32_t))
                 ltime->tm_min,
                 ltime->tm_sec,
                 value);
-
-        elem++;
     }
 }
 
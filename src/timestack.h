@@ -25,10 +25,13 @@ typedef struct
     int32_t value;
 } timestack_elem_t;
 
+/* Fixed-size ring buffer of the most recent (timestamped) values */
 typedef struct
 {
     uint32_t count;
     uint32_t max;
+    /** index the next value is written to */
+    uint32_t head;
     timestack_elem_t *elements;
 } timestack_t;
 
@@ -49,6 +52,9 @@ timestack_oldest(timestack_t *timestack);
 int32_t
 timestack_newest(timestack_t *timestack);
 
+timestack_elem_t *
+timestack_get(timestack_t *timestack, uint32_t index);
+
 time_t
 timestack_find_latest(timestack_t *timestack, timestack_predicate_t predicate);
 
@@ -26,6 +26,8 @@
 #include <stdlib.h>
 #include <string.h>
 #include <sys/select.h>
+#include <sys/time.h>
+#include <time.h>
 #include <wordexp.h>
 
 bool
@@ -163,6 +165,22 @@ wait_interval(uint32_t seconds)
     select(1, NULL, NULL, NULL, &tv);
 }
 
+/**
+ * @brief Get the current monotonic time in milliseconds
+ *
+ * Unaffected by steps of the system clock, so suitable for deadlines
+ * and intervals only, not for timestamps shown to the user.
+ */
+uint64_t
+time_ms(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+
+    return (uint64_t)ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+}
+
 void
 wait_interval_fd(int32_t fd, uint32_t seconds)
 {
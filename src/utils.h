@@ -55,6 +55,9 @@ strings_free(char **strings);
 void
 wait_interval(uint32_t seconds);
 
+uint64_t
+time_ms(void);
+
 void
 wait_interval_fd(int32_t fd, uint32_t seconds);
 
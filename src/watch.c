@@ -46,6 +46,34 @@ watch_new(const char *name)
     return watch;
 }
 
+/**
+ * @brief Number of snapshots the max_cpu/max_memory thresholds
+ *        are evaluated on
+ */
+uint32_t
+watch_check_window(watch_t *watch)
+{
+    if (watch == NULL || watch->check_window < 1)
+        return WATCH_DEFAULT_CHECK_WINDOW;
+
+    return watch->check_window;
+}
+
+/**
+ * @brief Number of snapshots that have to exceed the max_cpu/max_memory
+ *        thresholds - defaults to 80% of the check window
+ */
+uint32_t
+watch_check_limit(watch_t *watch)
+{
+    uint32_t window = watch_check_window(watch);
+
+    if (watch == NULL || watch->check_limit < 1)
+        return (window * 4 + 4) / 5;
+
+    return MIN(watch->check_limit, window);
+}
+
 static void
 dump_not_empty(const char *key, const char *value)
 {
@@ -81,6 +109,7 @@ watch_destroy(watch_t *watch)
 {
     strings_free((char **)watch->start);
     strings_free((char **)watch->stop);
+    strings_free((char **)watch->exec_check);
 
     if (watch->name)       free((void *)watch->name);
     if (watch->uid)        free((void *)watch->uid);
@@ -132,6 +161,12 @@ watch_validate(watch_t *watch)
 
     result &= valid;
 
+    if (watch->exec_check && *watch->exec_check == NULL)
+    {
+        log_error("Empty 'exec_check' specified");
+        result = false;
+    }
+
     if (watch->uid)
     {
         valid = get_user(watch->uid, &uid, &gid);
@@ -152,6 +187,13 @@ watch_validate(watch_t *watch)
         result &= valid;
     }
 
+    if (watch->check_limit > watch_check_window(watch))
+    {
+        log_error("check_limit (%u) exceeds the check_window (%u)",
+                  watch->check_limit, watch_check_window(watch));
+        result = false;
+    }
+
     if (watch->pid_file)
     {
         valid = dir_writable(watch->pid_file);
@@ -263,12 +305,32 @@ watch_dump(watch_t *watch)
                 http_method_to_string(watch->http_check_method));
     }
 
+    if (watch->exec_check)
+    {
+        dump_strings("exec_check", watch->exec_check);
+
+        if (watch->exec_check_timeout)
+            log_info("  exec_check_timeout: %u", watch->exec_check_timeout);
+    }
+
     if (watch->max_memory)
         log_info("  max_memory: %" PRId64, watch->max_memory);
 
     if (watch->max_cpu)
         log_info("  max_cpu: %u%%", watch->max_cpu);
 
+    if (watch->check_window)
+        log_info("  check_window: %u", watch->check_window);
+
+    if (watch->check_limit)
+        log_info("  check_limit: %u", watch->check_limit);
+
+    if (watch->sample_interval)
+        log_info("  sample_interval: %u", watch->sample_interval);
+
+    if (watch->check_interval)
+        log_info("  check_interval: %u", watch->check_interval);
+
     if (watch->stop_timeout)
         log_info("  stop_timeout: %u", watch->stop_timeout);
 
@@ -18,6 +18,13 @@
 #include "hash.h"
 #include "socket.h"
 
+/** default number of CPU/memory snapshots the max_cpu/max_memory
+ * thresholds are evaluated on */
+#define WATCH_DEFAULT_CHECK_WINDOW 10
+
+/** default time in seconds an exec check has to finish in */
+#define WATCH_DEFAULT_EXEC_CHECK_TIMEOUT 5
+
 typedef struct watch_t
 {
     int32_t id;
@@ -34,9 +41,21 @@ typedef struct watch_t
     uint32_t http_check_port;
     http_method_e http_check_method;
     endpoint_t *port_check;
+    /** command that has to exit with 0 if the process is healthy */
+    const char **exec_check;
+    /** time in seconds the exec check has to finish in */
+    uint32_t exec_check_timeout;
     uint32_t stop_timeout;
     uint32_t max_cpu;
     uint64_t max_memory;
+    /** number of snapshots max_cpu/max_memory are evaluated on */
+    uint32_t check_window;
+    /** number of snapshots that have to exceed max_cpu/max_memory */
+    uint32_t check_limit;
+    /** interval of the CPU/memory snapshots (in seconds) */
+    uint32_t sample_interval;
+    /** interval of the port/HTTP/exec checks (in seconds) */
+    uint32_t check_interval;
     uint32_t startup_delay;
     hash_t *env;
 } watch_t;
@@ -59,4 +78,10 @@ _watch_destroy(void *watch);
 bool
 watch_validate(watch_t *watch);
 
+uint32_t
+watch_check_window(watch_t *watch);
+
+uint32_t
+watch_check_limit(watch_t *watch);
+
 /* vim: set et sw=4 sts=4 tw=80: */
@@ -0,0 +1,175 @@
+/* Copyright 2014-2019 Gregor Uhlenheuer
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#define _GNU_SOURCE
+
+#include "tests.h"
+#include "tests_cgroup.h"
+#include "../src/cgroup.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+void
+test_cgroup_parse_value(UNUSED void **state)
+{
+    uint64_t value = 0;
+    const char *stat = "usage_usec 123456\nuser_usec 100000\n"
+        "system_usec 23456\nnr_periods 0";
+
+    assert_true(cgroup_parse_value(stat, strlen(stat), "usage_usec", &value));
+    assert_int_equal(123456, value);
+
+    assert_true(cgroup_parse_value(stat, strlen(stat), "system_usec", &value));
+    assert_int_equal(23456, value);
+
+    /* last line without newline */
+    assert_true(cgroup_parse_value(stat, strlen(stat), "nr_periods", &value));
+    assert_int_equal(0, value);
+
+    /* prefixes of other keys do not match */
+    assert_false(cgroup_parse_value(stat, strlen(stat), "usage", &value));
+    assert_false(cgroup_parse_value(stat, strlen(stat), "usec", &value));
+
+    const char *events = "low 0\nhigh 0\nmax 12\noom 3\noom_kill 2\n";
+
+    assert_true(cgroup_parse_value(events, strlen(events), "oom", &value));
+    assert_int_equal(3, value);
+
+    assert_true(cgroup_parse_value(events, strlen(events), "oom_kill", &value));
+    assert_int_equal(2, value);
+
+    /* truncated buffer */
+    assert_false(cgroup_parse_value(events, 14, "max", &value));
+}
+
+void
+test_cgroup_path(UNUSED void **state)
+{
+    char *path = cgroup_path("/sys/fs/cgroup/nyx", "app");
+
+    assert_string_equal("/sys/fs/cgroup/nyx/app", path);
+    free(path);
+
+    assert_null(cgroup_path(NULL, "app"));
+    assert_null(cgroup_path("/sys/fs/cgroup/nyx", ""));
+    assert_null(cgroup_path("/sys/fs/cgroup/nyx", ".."));
+    assert_null(cgroup_path("/sys/fs/cgroup/nyx", "app/worker"));
+}
+
+void
+test_cgroup_parse_member(UNUSED void **state)
+{
+    const char *path = "/sys/fs/cgroup/nyx/app";
+    const char *member = "0::/nyx/app\n";
+    const char *hybrid = "1:name=systemd:/user.slice\n0::/nyx/app\n";
+
+    assert_true(cgroup_parse_member(member, strlen(member), path));
+    assert_true(cgroup_parse_member(hybrid, strlen(hybrid), path));
+
+    /* relative to the root of a cgroup namespace */
+    const char *ns = "0::/app\n";
+
+    assert_true(cgroup_parse_member(ns, strlen(ns), path));
+
+    /* other cgroups */
+    const char *other = "0::/nyx/app2\n";
+    const char *partial = "0::/x/app\n";
+    const char *root = "0::/\n";
+
+    assert_false(cgroup_parse_member(other, strlen(other), path));
+    assert_false(cgroup_parse_member(partial, strlen(partial), path));
+    assert_false(cgroup_parse_member(root, strlen(root), path));
+
+    /* cgroup v1 only */
+    const char *v1 = "1:name=systemd:/nyx/app\n";
+
+    assert_false(cgroup_parse_member(v1, strlen(v1), path));
+    assert_false(cgroup_parse_member("", 0, path));
+}
+
+static void
+write_cgroup_file(const char *dir, const char *file, const char *contents)
+{
+    char path[256] = {0};
+    snprintf(path, sizeof(path), "%s/%s", dir, file);
+
+    FILE *fp = fopen(path, "w");
+    assert_non_null(fp);
+
+    fputs(contents, fp);
+    fclose(fp);
+}
+
+static void
+remove_cgroup_file(const char *dir, const char *file)
+{
+    char path[256] = {0};
+    snprintf(path, sizeof(path), "%s/%s", dir, file);
+
+    unlink(path);
+}
+
+void
+test_cgroup_sample(UNUSED void **state)
+{
+    char root[] = "/tmp/nyx-cgroup-XXXXXX";
+    cgroup_stat_t stat;
+
+    assert_non_null(mkdtemp(root));
+
+    cgroup_t *cgroup = cgroup_new(root, "app");
+    assert_non_null(cgroup);
+    assert_true(cgroup_create(cgroup->path));
+
+    /* no statistics available (yet) */
+    assert_false(cgroup_sample(cgroup, &stat));
+
+    write_cgroup_file(cgroup->path, "cpu.stat", "usage_usec 2500000\nuser_usec 2000000\n");
+    write_cgroup_file(cgroup->path, "memory.current", "10485760\n");
+
+    assert_true(cgroup_sample(cgroup, &stat));
+    assert_int_equal(2500000, stat.usage_usec);
+    assert_int_equal(10485760, stat.memory);
+    assert_int_equal(0, stat.oom_kills);
+
+    /* the inactive page cache is not accounted */
+    write_cgroup_file(cgroup->path, "memory.stat", "anon 8388608\ninactive_file 2097152\n");
+    write_cgroup_file(cgroup->path, "memory.events", "low 0\nhigh 0\nmax 1\noom 1\noom_kill 1\n");
+
+    assert_true(cgroup_sample(cgroup, &stat));
+    assert_int_equal(8388608, stat.memory);
+    assert_int_equal(1, stat.oom_kills);
+
+    assert_int_equal(-1, cgroup_populated(cgroup->path));
+
+    write_cgroup_file(cgroup->path, "cgroup.events", "populated 1\nfrozen 0\n");
+    assert_int_equal(1, cgroup_populated(cgroup->path));
+
+    remove_cgroup_file(cgroup->path, "cpu.stat");
+    remove_cgroup_file(cgroup->path, "memory.current");
+    remove_cgroup_file(cgroup->path, "memory.stat");
+    remove_cgroup_file(cgroup->path, "memory.events");
+    remove_cgroup_file(cgroup->path, "cgroup.events");
+
+    assert_int_equal(0, rmdir(cgroup->path));
+    assert_int_equal(0, rmdir(root));
+
+    cgroup_destroy(cgroup);
+}
+
+/* vim: set et sw=4 sts=4 tw=80: */
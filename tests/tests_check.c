@@ -0,0 +1,357 @@
+/* Copyright 2014-2019 Gregor Uhlenheuer
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#define _GNU_SOURCE
+
+#include "tests.h"
+#include "tests_check.h"
+#include "../src/check.h"
+#include "../src/utils.h"
+
+#include <arpa/inet.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+
+typedef struct
+{
+    int32_t sock;
+    uint32_t connections;
+    const char *response;
+} test_server_t;
+
+static int32_t
+listen_local(uint16_t *port)
+{
+    struct sockaddr_in addr;
+    socklen_t len = sizeof(addr);
+    int32_t sock = socket(AF_INET, SOCK_STREAM, 0);
+
+    assert_true(sock >= 0);
+
+    memset(&addr, 0, sizeof(addr));
+    addr.sin_family = AF_INET;
+    addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+
+    assert_int_equal(0, bind(sock, (struct sockaddr *)&addr, sizeof(addr)));
+    assert_int_equal(0, listen(sock, 128));
+    assert_int_equal(0, getsockname(sock, (struct sockaddr *)&addr, &len));
+
+    *port = ntohs(addr.sin_port);
+
+    return sock;
+}
+
+static void *
+serve(void *data)
+{
+    test_server_t *server = data;
+
+    for (uint32_t i = 0; i < server->connections; i++)
+    {
+        char buffer[512];
+        int32_t client = accept(server->sock, NULL, NULL);
+
+        if (client < 0)
+            break;
+
+        if (recv(client, buffer, sizeof(buffer), 0) > 0)
+            send(client, server->response, strlen(server->response), 0);
+
+        close(client);
+    }
+
+    return NULL;
+}
+
+typedef struct
+{
+    int32_t sock;
+    uint32_t connections;
+    uint32_t requests;
+    uint32_t accepted;
+    uint32_t served;
+} test_keep_alive_server_t;
+
+static void *
+serve_keep_alive(void *data)
+{
+    test_keep_alive_server_t *server = data;
+    const char *response = "HTTP/1.1 200 OK\r\nContent-Length: 5\r\n\r\nhello";
+
+    for (uint32_t i = 0; i < server->connections; i++)
+    {
+        int32_t client = accept(server->sock, NULL, NULL);
+
+        if (client < 0)
+            break;
+
+        server->accepted++;
+
+        /* answer a number of requests on the same connection */
+        for (uint32_t j = 0; j < server->requests; j++)
+        {
+            char buffer[512];
+            size_t received = 0;
+
+            while (received < 4 || memcmp(buffer + received - 4, "\r\n\r\n", 4) != 0)
+            {
+                ssize_t res = recv(client, buffer + received, sizeof(buffer) - received, 0);
+
+                if (res <= 0)
+                    break;
+
+                received += res;
+            }
+
+            if (received < 4)
+                break;
+
+            send(client, response, strlen(response), 0);
+            server->served++;
+        }
+
+        close(client);
+    }
+
+    return NULL;
+}
+
+void
+test_http_parse_response(UNUSED void **state)
+{
+    http_response_t response;
+
+#define PARSE(buffer_) http_parse_response(buffer_, strlen(buffer_), &response)
+
+    assert_int_equal(1, PARSE("HTTP/1.1 200 OK\r\nContent-Length: 12\r\n\r\n"));
+    assert_int_equal(200, response.status);
+    assert_true(response.keep_alive);
+    assert_false(response.chunked);
+    assert_int_equal(12, response.content_length);
+    assert_int_equal(39, response.header_length);
+
+    /* header names and values are case insensitive */
+    assert_int_equal(1, PARSE("HTTP/1.1 404 Not Found\r\nconnection:  Close \r\n\r\nbody"));
+    assert_int_equal(404, response.status);
+    assert_false(response.keep_alive);
+    assert_int_equal(-1, response.content_length);
+
+    /* HTTP/1.0 connections are closed unless stated otherwise */
+    assert_int_equal(1, PARSE("HTTP/1.0 200 OK\r\n\r\n"));
+    assert_false(response.keep_alive);
+
+    assert_int_equal(1, PARSE("HTTP/1.0 204\r\nConnection: keep-alive\r\n\r\n"));
+    assert_int_equal(204, response.status);
+    assert_true(response.keep_alive);
+
+    assert_int_equal(1, PARSE("HTTP/1.1 200 OK\r\nTransfer-Encoding: chunked\r\n\r\n"));
+    assert_true(response.chunked);
+
+    /* incomplete headers */
+    assert_int_equal(0, PARSE(""));
+    assert_int_equal(0, PARSE("HTTP/1.1 200 OK\r\nContent-Length: 12\r\n"));
+
+    /* malformed responses */
+    assert_int_equal(-1, PARSE("SSH-2.0-OpenSSH\r\n\r\n"));
+    assert_int_equal(-1, PARSE("HTTP/1.1 2x0 OK\r\n\r\n"));
+    assert_int_equal(-1, PARSE("HTTP/1.1 200 OK\r\nbroken\r\n\r\n"));
+    assert_int_equal(-1, PARSE("HTTP/1.1 200 OK\r\nContent-Length: -1\r\n\r\n"));
+
+#undef PARSE
+}
+
+void
+test_check_engine_port(UNUSED void **state)
+{
+    uint16_t open_port = 0, closed_port = 0;
+    int32_t sock = listen_local(&open_port);
+
+    /* grab a free port that nobody listens on */
+    close(listen_local(&closed_port));
+
+    char remote[32];
+    struct sockaddr_in address;
+
+    snprintf(remote, sizeof(remote), "localhost:%u", open_port);
+
+    endpoint_t *endpoint = parse_endpoint(remote);
+
+    /* wait for the endpoint to be resolved in the background */
+    for (uint32_t i = 0; i < 200 && endpoint_address(endpoint, &address) == 0; i++)
+        usleep(10000);
+
+    check_engine_t *engine = check_engine_new(4);
+    assert_non_null(engine);
+
+    check_engine_add(engine, CHECK_PORT, open_port, 1000);
+    check_engine_add(engine, CHECK_PORT, closed_port, 1000);
+    check_engine_add(engine, CHECK_PORT, open_port, 1000)->endpoint = endpoint;
+
+    assert_true(check_engine_run(engine, NULL));
+
+    assert_true(engine->checks[0].success);
+    assert_false(engine->checks[1].success);
+    assert_true(engine->checks[2].success);
+
+    check_engine_destroy(engine);
+    endpoint_free(endpoint);
+    close(sock);
+}
+
+void
+test_check_engine_http(UNUSED void **state)
+{
+    pthread_t thread;
+    test_server_t ok = { .connections = 8, .response = "HTTP/1.0 200 OK\r\n\r\n" };
+    test_server_t error = { .connections = 1, .response = "HTTP/1.1 503 Service Unavailable\r\n\r\n" };
+    uint16_t ok_port = 0, error_port = 0;
+
+    ok.sock = listen_local(&ok_port);
+    error.sock = listen_local(&error_port);
+
+    check_engine_t *engine = check_engine_new(4);
+
+    /* more checks than allowed to run concurrently */
+    for (uint32_t i = 0; i < ok.connections; i++)
+        check_engine_add(engine, CHECK_HTTP, ok_port, 1000)->url = "/status";
+
+    check_engine_add(engine, CHECK_HTTP, error_port, 1000)->url = "/";
+
+    assert_int_equal(0, pthread_create(&thread, NULL, serve, &ok));
+    pthread_detach(thread);
+    assert_int_equal(0, pthread_create(&thread, NULL, serve, &error));
+    pthread_detach(thread);
+
+    assert_true(check_engine_run(engine, NULL));
+
+    for (uint32_t i = 0; i < ok.connections; i++)
+        assert_true(engine->checks[i].success);
+
+    assert_false(engine->checks[ok.connections].success);
+
+    /* the engine may be reused after a reset */
+    check_engine_reset(engine);
+    assert_int_equal(0, engine->count);
+
+    check_engine_destroy(engine);
+    close(ok.sock);
+    close(error.sock);
+}
+
+void
+test_check_engine_keep_alive(UNUSED void **state)
+{
+    pthread_t thread;
+    uint16_t port = 0;
+    test_keep_alive_server_t server = { .connections = 2, .requests = 2 };
+
+    server.sock = listen_local(&port);
+
+    assert_int_equal(0, pthread_create(&thread, NULL, serve_keep_alive, &server));
+
+    check_engine_t *engine = check_engine_new(4);
+
+    /* the server closes the connection after every second request
+     * so the engine has to reconnect once */
+    for (uint32_t i = 0; i < 4; i++)
+    {
+        check_t *check = check_engine_add(engine, CHECK_HTTP, port, 1000);
+        check->url = "/health";
+
+        assert_true(check_engine_run(engine, NULL));
+        assert_true(engine->checks[0].success);
+        assert_true(engine->checks[0].latency > 0);
+
+        check_engine_reset(engine);
+    }
+
+    pthread_join(thread, NULL);
+
+    assert_int_equal(2, server.accepted);
+    assert_int_equal(4, server.served);
+
+    check_engine_destroy(engine);
+    close(server.sock);
+}
+
+void
+test_check_engine_exec(UNUSED void **state)
+{
+    const char *success[] = { "true", NULL };
+    const char *failure[] = { "false", NULL };
+
+    watch_t healthy, broken;
+    memset(&healthy, 0, sizeof(watch_t));
+    memset(&broken, 0, sizeof(watch_t));
+
+    healthy.exec_check = success;
+    broken.exec_check = failure;
+
+    check_engine_t *engine = check_engine_new(4);
+    engine->runners = runner_pool_new(2);
+
+    /* more checks than runners */
+    for (uint32_t i = 0; i < 6; i++)
+        check_engine_add(engine, CHECK_EXEC, 0, 1000)->watch = i % 2 ? &broken : &healthy;
+
+    assert_true(check_engine_run(engine, NULL));
+
+    for (uint32_t i = 0; i < 6; i++)
+    {
+        check_t *check = &engine->checks[i];
+
+        assert_int_equal(CHECK_DONE, check->state);
+        assert_int_equal(0, check->error);
+        assert_int_equal(i % 2, check->status);
+        assert_true(check->success == (i % 2 == 0));
+    }
+
+    runner_pool_destroy(engine->runners);
+    check_engine_destroy(engine);
+}
+
+void
+test_check_engine_timeout(UNUSED void **state)
+{
+    uint16_t port = 0;
+
+    /* connections are accepted by the kernel but never answered */
+    int32_t sock = listen_local(&port);
+
+    check_engine_t *engine = check_engine_new(NYX_CHECK_MAX_CONCURRENT);
+
+    for (uint32_t i = 0; i < 50; i++)
+        check_engine_add(engine, CHECK_HTTP, port, 200);
+
+    uint64_t start = time_ms();
+
+    assert_true(check_engine_run(engine, NULL));
+
+    uint64_t elapsed = time_ms() - start;
+
+    for (uint32_t i = 0; i < engine->count; i++)
+        assert_false(engine->checks[i].success);
+
+    /* all checks time out at the same time */
+    assert_true(elapsed >= 200);
+    assert_true(elapsed < 1000);
+
+    check_engine_destroy(engine);
+    close(sock);
+}
+
+/* vim: set et sw=4 sts=4 tw=80: */
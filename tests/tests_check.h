@@ -0,0 +1,36 @@
+/* Copyright 2014-2019 Gregor Uhlenheuer
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#pragma once
+
+void
+test_http_parse_response(void **state);
+
+void
+test_check_engine_port(void **state);
+
+void
+test_check_engine_http(void **state);
+
+void
+test_check_engine_keep_alive(void **state);
+
+void
+test_check_engine_exec(void **state);
+
+void
+test_check_engine_timeout(void **state);
+
+/* vim: set et sw=4 sts=4 tw=80: */
@@ -0,0 +1,146 @@
+/* Copyright 2014-2019 Gregor Uhlenheuer
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "tests.h"
+#include "tests_event.h"
+
+#ifndef OSX
+
+#include "../src/event.h"
+
+#include <arpa/inet.h>
+#include <linux/cn_proc.h>
+#include <linux/filter.h>
+#include <stdint.h>
+
+#define ACCEPT 0xffffffff
+
+static struct sock_filter program[BPF_MAXINSNS];
+
+/**
+ * @brief Run the given filter program on an event
+ * @return return value of the program (0 if the event is dropped)
+ *
+ * Only the instructions generated by 'event_build_filter' are
+ * supported: the first load reads the event type, the second the PID.
+ */
+static uint32_t
+run_filter(uint16_t length, uint32_t what, pid_t pid)
+{
+    uint32_t acc = 0, loads = 0;
+    uint16_t pc = 0;
+
+    for (; pc < length; pc++)
+    {
+        struct sock_filter *insn = &program[pc];
+
+        switch (insn->code)
+        {
+            case BPF_LD | BPF_W | BPF_ABS:
+                acc = htonl(loads++ ? (uint32_t)pid : what);
+                break;
+            case BPF_JMP | BPF_JEQ | BPF_K:
+                pc += acc == insn->k ? insn->jt : insn->jf;
+                break;
+            case BPF_JMP | BPF_JA:
+                pc += insn->k;
+                break;
+            case BPF_RET | BPF_K:
+                return insn->k;
+            default:
+                /* unexpected instruction */
+                assert_int_equal(BPF_RET | BPF_K, insn->code);
+        }
+    }
+
+    /* the program ran past its end */
+    assert_true(pc < length);
+    return 0;
+}
+
+/**
+ * @brief Check the filter program of the given number of PIDs
+ *        (1, 2, ... count)
+ */
+static void
+check_filter(uint32_t count)
+{
+    pid_t pids[BPF_MAXINSNS];
+
+    for (uint32_t i = 0; i < count; i++)
+        pids[i] = i + 1;
+
+    uint16_t length = event_build_filter(program, pids, count);
+
+    assert_true(length <= BPF_MAXINSNS);
+
+    /* every PID comparison jumps onto an 'accept' */
+    for (uint16_t pc = 4; pc < length; pc++)
+    {
+        if (program[pc].code != (BPF_JMP | BPF_JEQ | BPF_K))
+            continue;
+
+        uint32_t target = pc + 1 + program[pc].jt;
+
+        assert_true(target < length);
+        assert_int_equal(BPF_RET | BPF_K, program[target].code);
+        assert_int_equal(ACCEPT, program[target].k);
+    }
+
+    for (uint32_t i = 0; i < count; i++)
+        assert_int_equal(ACCEPT, run_filter(length, PROC_EVENT_EXIT, pids[i]));
+
+    assert_int_equal(0, run_filter(length, PROC_EVENT_EXIT, count + 1));
+    assert_int_equal(0, run_filter(length, PROC_EVENT_FORK, 1));
+}
+
+void
+test_event_build_filter(UNUSED void **state)
+{
+    check_filter(0);
+    check_filter(1);
+
+    /* the PID comparisons are split into blocks of 250 */
+    check_filter(249);
+    check_filter(250);
+    check_filter(251);
+    check_filter(500);
+    check_filter(501);
+}
+
+void
+test_event_build_filter_limit(UNUSED void **state)
+{
+    pid_t pids[BPF_MAXINSNS] = {0};
+
+    /* the largest program: 4057 PIDs in 17 blocks */
+    check_filter(4057);
+
+    /* too many PIDs: all exit events are passed */
+    uint16_t length = event_build_filter(program, pids, 4058);
+
+    assert_true(length < 10);
+    assert_int_equal(ACCEPT, run_filter(length, PROC_EVENT_EXIT, 5000));
+    assert_int_equal(0, run_filter(length, PROC_EVENT_FORK, 5000));
+
+    /* no PIDs given at all */
+    length = event_build_filter(program, NULL, 0);
+
+    assert_int_equal(ACCEPT, run_filter(length, PROC_EVENT_EXIT, 1));
+}
+
+#endif
+
+/* vim: set et sw=4 sts=4 tw=80: */
@@ -0,0 +1,115 @@
+/* Copyright 2014-2019 Gregor Uhlenheuer
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "tests.h"
+#include "tests_forker.h"
+#include "../src/def.h"
+#include "../src/forker.h"
+
+#include <stdint.h>
+#include <unistd.h>
+
+#define NUM_REQUESTS 100
+
+void
+test_forker_frames(UNUSED void **state)
+{
+    int32_t fds[2];
+    forker_request_t requests[NUM_REQUESTS];
+    forker_request_t received[NYX_FORKER_MAX_BATCH];
+
+    assert_int_equal(0, pipe(fds));
+
+    for (int32_t i = 0; i < NUM_REQUESTS; i++)
+    {
+        forker_request_t request =
+        {
+            .request_id = i + 1,
+            .watch_id = i,
+            .command = FORKER_STOP,
+            .pid = 1000 + i
+        };
+
+        requests[i] = request;
+    }
+
+    /* more records than fit into one frame */
+    assert_true(forker_write_frames(fds[1], requests, NUM_REQUESTS, sizeof(forker_request_t)));
+
+    int32_t first = forker_read_frame(fds[0], received, sizeof(forker_request_t));
+
+    assert_int_equal(NYX_FORKER_MAX_BATCH, first);
+
+    for (int32_t i = 0; i < first; i++)
+    {
+        assert_int_equal(requests[i].request_id, received[i].request_id);
+        assert_int_equal(requests[i].pid, received[i].pid);
+    }
+
+    int32_t second = forker_read_frame(fds[0], received, sizeof(forker_request_t));
+
+    assert_int_equal(NUM_REQUESTS - NYX_FORKER_MAX_BATCH, second);
+
+    for (int32_t i = 0; i < second; i++)
+    {
+        assert_int_equal(requests[first + i].request_id, received[i].request_id);
+        assert_int_equal(requests[first + i].pid, received[i].pid);
+    }
+
+    /* EOF */
+    close(fds[1]);
+    assert_int_equal(-1, forker_read_frame(fds[0], received, sizeof(forker_request_t)));
+
+    close(fds[0]);
+}
+
+void
+test_forker_invalid_frames(UNUSED void **state)
+{
+    int32_t fds[2];
+    forker_request_t received[NYX_FORKER_MAX_BATCH];
+    forker_frame_t frames[] =
+    {
+        /* unknown version */
+        { .magic = NYX_FORKER_MAGIC, .version = NYX_FORKER_VERSION + 1, .count = 0 },
+        /* more records than a frame may contain */
+        { .magic = NYX_FORKER_MAGIC, .version = NYX_FORKER_VERSION, .count = NYX_FORKER_MAX_BATCH + 1 },
+        /* no frame at all */
+        { .magic = 0, .version = NYX_FORKER_VERSION, .count = 0 }
+    };
+
+    for (size_t i = 0; i < LEN(frames); i++)
+    {
+        assert_int_equal(0, pipe(fds));
+        assert_int_equal(sizeof(forker_frame_t), write(fds[1], &frames[i], sizeof(forker_frame_t)));
+
+        assert_int_equal(-1, forker_read_frame(fds[0], received, sizeof(forker_request_t)));
+
+        close(fds[1]);
+        close(fds[0]);
+    }
+
+    /* a valid (empty) frame is accepted */
+    forker_frame_t empty = { .magic = NYX_FORKER_MAGIC, .version = NYX_FORKER_VERSION, .count = 0 };
+
+    assert_int_equal(0, pipe(fds));
+    assert_int_equal(sizeof(forker_frame_t), write(fds[1], &empty, sizeof(forker_frame_t)));
+    assert_int_equal(0, forker_read_frame(fds[0], received, sizeof(forker_request_t)));
+
+    close(fds[1]);
+    close(fds[0]);
+}
+
+/* vim: set et sw=4 sts=4 tw=80: */
@@ -0,0 +1,104 @@
+/* Copyright 2014-2019 Gregor Uhlenheuer
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "tests.h"
+#include "tests_heap.h"
+#include "../src/heap.h"
+
+#include <stdlib.h>
+
+#define NUM_NODES 1000
+
+void
+test_heap_order(UNUSED void **state)
+{
+    heap_node_t nodes[NUM_NODES];
+    heap_t *heap = heap_new(0);
+
+    assert_null(heap_peek(heap));
+    assert_null(heap_pop(heap));
+
+    /* this forces the heap to grow a few times */
+    for (uint32_t i = 0; i < NUM_NODES; i++)
+    {
+        heap_init_node(&nodes[i]);
+        heap_push(heap, &nodes[i], (i * 7919) % NUM_NODES);
+    }
+
+    assert_int_equal(NUM_NODES, heap->count);
+
+    /* re-queueing a node moves it */
+    heap_push(heap, &nodes[0], NUM_NODES);
+    assert_int_equal(NUM_NODES, heap->count);
+
+    uint64_t last = 0;
+    heap_node_t *node = NULL;
+
+    for (uint32_t i = 0; i < NUM_NODES; i++)
+    {
+        node = heap_pop(heap);
+
+        assert_non_null(node);
+        assert_true(node->key >= last);
+        assert_int_equal(HEAP_NOT_QUEUED, node->index);
+
+        last = node->key;
+    }
+
+    /* the moved node has the largest key */
+    assert_true(&nodes[0] == node);
+    assert_int_equal(0, heap->count);
+
+    heap_destroy(heap);
+}
+
+void
+test_heap_remove(UNUSED void **state)
+{
+    heap_node_t nodes[NUM_NODES];
+    heap_t *heap = heap_new(0);
+
+    srand(42);
+
+    for (uint32_t i = 0; i < NUM_NODES; i++)
+    {
+        heap_init_node(&nodes[i]);
+        heap_push(heap, &nodes[i], rand() % 100);
+    }
+
+    /* remove every other node */
+    for (uint32_t i = 0; i < NUM_NODES; i += 2)
+        heap_remove(heap, &nodes[i]);
+
+    /* removing twice is fine */
+    heap_remove(heap, &nodes[0]);
+
+    assert_int_equal(NUM_NODES / 2, heap->count);
+
+    uint64_t last = 0;
+    heap_node_t *node = NULL;
+
+    while ((node = heap_pop(heap)) != NULL)
+    {
+        assert_true(node->key >= last);
+        assert_true((node - nodes) % 2 == 1);
+
+        last = node->key;
+    }
+
+    heap_destroy(heap);
+}
+
+/* vim: set et sw=4 sts=4 tw=80: */
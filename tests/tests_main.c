@@ -14,12 +14,23 @@
  */
 
 #include "tests.h"
+#include "tests_cgroup.h"
+#include "tests_check.h"
 #include "tests_config.h"
+#include "tests_event.h"
+#include "tests_forker.h"
 #include "tests_fs.h"
 #include "tests_hash.h"
+#include "tests_heap.h"
 #include "tests_list.h"
 #include "tests_proc.h"
+#include "tests_pidfile.h"
+#include "tests_pidmap.h"
+#include "tests_queue.h"
+#include "tests_runner.h"
 #include "tests_socket.h"
+#include "tests_stack.h"
+#include "tests_state.h"
 #include "tests_strbuf.h"
 #include "tests_timestack.h"
 #include "tests_utils.h"
@@ -40,20 +51,62 @@ main(UNUSED int argc, UNUSED char **argv)
         cmocka_unit_test(test_hash_remove),
         cmocka_unit_test(test_timestack_create),
         cmocka_unit_test(test_timestack_add),
+        cmocka_unit_test(test_timestack_get),
+        cmocka_unit_test(test_stack_window),
+        cmocka_unit_test(test_stack_threshold),
+        cmocka_unit_test(test_pidfile_cache),
+        cmocka_unit_test(test_pidfile_cache_open),
+        cmocka_unit_test(test_pidfile_cache_long_paths),
+        cmocka_unit_test(test_cgroup_parse_value),
+        cmocka_unit_test(test_cgroup_path),
+        cmocka_unit_test(test_cgroup_parse_member),
+        cmocka_unit_test(test_cgroup_sample),
+        cmocka_unit_test(test_pidmap_put_get),
+        cmocka_unit_test(test_pidmap_remove),
+        cmocka_unit_test(test_pidmap_random),
+        cmocka_unit_test(test_state_park_delayed),
+        cmocka_unit_test(test_state_release_pending),
+        cmocka_unit_test(test_state_queue_overflow),
+        cmocka_unit_test(test_forker_frames),
+        cmocka_unit_test(test_forker_invalid_frames),
+#ifndef OSX
+        cmocka_unit_test(test_event_build_filter),
+        cmocka_unit_test(test_event_build_filter_limit),
+#endif
+        cmocka_unit_test(test_queue_push_pop),
+        cmocka_unit_test(test_queue_full),
+        cmocka_unit_test(test_queue_last),
+        cmocka_unit_test(test_queue_concurrent_push),
         cmocka_unit_test(test_fs_parent_dir),
         cmocka_unit_test(test_fs_find_local_socket_path),
         cmocka_unit_test(test_fs_create_if_not_exists),
+        cmocka_unit_test(test_heap_order),
+        cmocka_unit_test(test_heap_remove),
+        cmocka_unit_test(test_runner_run),
+        cmocka_unit_test(test_runner_timeout),
+        cmocka_unit_test(test_runner_respawn),
+        cmocka_unit_test(test_runner_pool_owns),
+        cmocka_unit_test(test_http_parse_response),
+        cmocka_unit_test(test_check_engine_port),
+        cmocka_unit_test(test_check_engine_http),
+        cmocka_unit_test(test_check_engine_keep_alive),
+        cmocka_unit_test(test_check_engine_exec),
+        cmocka_unit_test(test_check_engine_timeout),
         cmocka_unit_test(test_proc_system_info),
         cmocka_unit_test(test_proc_total_memory_size),
         cmocka_unit_test(test_proc_stat),
+        cmocka_unit_test(test_proc_stat_parse),
+        cmocka_unit_test(test_proc_system_info_parse),
         cmocka_unit_test(test_proc_num_cpus),
         cmocka_unit_test(test_proc_page_size),
+        cmocka_unit_test(test_proc_tree_sample),
         cmocka_unit_test(test_parse_size_unit),
         cmocka_unit_test(test_parse_command_string),
         cmocka_unit_test(test_substitute_env_string),
         cmocka_unit_test(test_check_http),
         cmocka_unit_test(test_check_port),
         cmocka_unit_test(test_parse_endpoint),
+        cmocka_unit_test(test_endpoint_address),
         cmocka_unit_test(test_strbuf_append),
         cmocka_unit_test(test_is_all)
     };
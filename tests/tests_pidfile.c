@@ -0,0 +1,195 @@
+/* Copyright 2014-2019 Gregor Uhlenheuer
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#define _GNU_SOURCE
+
+#include "tests.h"
+#include "tests_pidfile.h"
+#include "../src/pidfile.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+static void
+write_file(const char *path, const char *contents)
+{
+    FILE *file = fopen(path, "w");
+
+    assert_non_null(file);
+
+    fputs(contents, file);
+    fclose(file);
+}
+
+/**
+ * Wait up to one second for the cache to pick up the given PID
+ */
+static pid_t
+wait_for_pid(pidfile_cache_t *cache, const char *name, pid_t expected)
+{
+    pid_t pid = 0;
+
+    for (int32_t i = 0; i < 100; i++)
+    {
+        assert_true(pidfile_cache_get(cache, name, &pid));
+
+        if (pid == expected)
+            break;
+
+        usleep(10000);
+    }
+
+    return pid;
+}
+
+void
+test_pidfile_cache(UNUSED void **state)
+{
+    pid_t pid = 0;
+    char dir[] = "/tmp/nyx-pidfile-XXXXXX";
+    char path[64];
+
+    assert_non_null(mkdtemp(dir));
+    snprintf(path, sizeof(path), "%s/test", dir);
+
+    write_file(path, "123");
+
+    pidfile_cache_t *cache = pidfile_cache_new();
+    pidfile_cache_add(cache, "test", path, false);
+
+    assert_false(pidfile_cache_get(cache, "unknown", &pid));
+    assert_true(pidfile_cache_get(cache, "test", &pid));
+    assert_int_equal(123, pid);
+
+    /* rewritten by another process */
+    write_file(path, "456");
+    assert_int_equal(456, wait_for_pid(cache, "test", 456));
+
+    /* written by nyx itself */
+    pidfile_cache_set(cache, "test", 789);
+    assert_true(pidfile_cache_get(cache, "test", &pid));
+    assert_int_equal(789, pid);
+
+    assert_int_equal(0, unlink(path));
+    assert_int_equal(0, wait_for_pid(cache, "test", 0));
+
+    /* external pid files are not touched by nyx */
+    pidfile_cache_add(cache, "test", path, true);
+    write_file(path, "321");
+    assert_int_equal(321, wait_for_pid(cache, "test", 321));
+
+    pidfile_cache_set(cache, "test", 1);
+    assert_true(pidfile_cache_get(cache, "test", &pid));
+    assert_int_equal(321, pid);
+
+    pidfile_cache_destroy(cache);
+
+    unlink(path);
+    rmdir(dir);
+}
+
+void
+test_pidfile_cache_open(UNUSED void **state)
+{
+    char dir[] = "/tmp/nyx-pidfile-XXXXXX";
+    char sub[64], path[128];
+
+    assert_non_null(mkdtemp(dir));
+    snprintf(sub, sizeof(sub), "%s/run", dir);
+    snprintf(path, sizeof(path), "%s/test", sub);
+
+    assert_int_equal(0, mkdir(sub, 0755));
+
+    pidfile_cache_t *cache = pidfile_cache_new();
+    pidfile_cache_add(cache, "test", path, true);
+
+    assert_int_equal(0, wait_for_pid(cache, "test", 0));
+
+    /* the pid file is kept open by its daemon */
+    FILE *file = fopen(path, "w");
+
+    assert_non_null(file);
+    fputs("123", file);
+    fflush(file);
+
+    assert_int_equal(123, wait_for_pid(cache, "test", 123));
+
+    fclose(file);
+
+    /* the directory is removed and recreated */
+    assert_int_equal(0, unlink(path));
+    assert_int_equal(0, rmdir(sub));
+    assert_int_equal(0, wait_for_pid(cache, "test", 0));
+
+    assert_int_equal(0, mkdir(sub, 0755));
+    write_file(path, "456");
+    assert_int_equal(456, wait_for_pid(cache, "test", 456));
+
+    /* and watched again */
+    write_file(path, "789");
+    assert_int_equal(789, wait_for_pid(cache, "test", 789));
+
+    pidfile_cache_destroy(cache);
+
+    unlink(path);
+    rmdir(sub);
+    rmdir(dir);
+}
+
+void
+test_pidfile_cache_long_paths(UNUSED void **state)
+{
+    pid_t pid = 0;
+    char dir[] = "/tmp/nyx-pidfile-XXXXXX";
+    char sub[160], first[192], second[192];
+
+    assert_non_null(mkdtemp(dir));
+
+    /* both paths share more than the hash keys' maximum length and
+     * their (anagram) file names end up in the same hash bucket */
+    snprintf(sub, sizeof(sub), "%s/%0120d", dir, 0);
+    snprintf(first, sizeof(first), "%s/ab.pid", sub);
+    snprintf(second, sizeof(second), "%s/ba.pid", sub);
+
+    assert_int_equal(0, mkdir(sub, 0755));
+
+    write_file(first, "123");
+    write_file(second, "456");
+
+    pidfile_cache_t *cache = pidfile_cache_new();
+    pidfile_cache_add(cache, "first", first, true);
+    pidfile_cache_add(cache, "second", second, true);
+
+    assert_true(pidfile_cache_get(cache, "first", &pid));
+    assert_int_equal(123, pid);
+    assert_true(pidfile_cache_get(cache, "second", &pid));
+    assert_int_equal(456, pid);
+
+    write_file(second, "789");
+    assert_int_equal(789, wait_for_pid(cache, "second", 789));
+    assert_true(pidfile_cache_get(cache, "first", &pid));
+    assert_int_equal(123, pid);
+
+    pidfile_cache_destroy(cache);
+
+    unlink(first);
+    unlink(second);
+    rmdir(sub);
+    rmdir(dir);
+}
+
+/* vim: set et sw=4 sts=4 tw=80: */
@@ -0,0 +1,134 @@
+/* Copyright 2014-2019 Gregor Uhlenheuer
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "tests.h"
+#include "tests_pidmap.h"
+#include "../src/pidmap.h"
+
+#include <stdint.h>
+#include <stdlib.h>
+
+#define NUM_PIDS 4096
+
+void
+test_pidmap_put_get(UNUSED void **state)
+{
+    int32_t values[1000];
+    pidmap_t *map = pidmap_new(0);
+
+    assert_null(pidmap_get(map, 1));
+
+    /* invalid PIDs are never stored */
+    pidmap_put(map, 0, values);
+    assert_null(pidmap_get(map, 0));
+    assert_int_equal(0, map->count);
+
+    /* this forces the map to grow a few times */
+    for (int32_t i = 0; i < 1000; i++)
+        pidmap_put(map, i + 1, &values[i]);
+
+    assert_int_equal(1000, map->count);
+
+    for (int32_t i = 0; i < 1000; i++)
+        assert_true(&values[i] == pidmap_get(map, i + 1));
+
+    assert_null(pidmap_get(map, 1001));
+
+    /* existing PIDs are overwritten */
+    pidmap_put(map, 1, &values[500]);
+    assert_true(&values[500] == pidmap_get(map, 1));
+    assert_int_equal(1000, map->count);
+
+    pidmap_destroy(map);
+}
+
+void
+test_pidmap_remove(UNUSED void **state)
+{
+    int32_t values[64];
+    pidmap_t *map = pidmap_new(64);
+
+    for (int32_t i = 0; i < 64; i++)
+        pidmap_put(map, i + 1, &values[i]);
+
+    assert_null(pidmap_remove(map, 100));
+
+    /* remove every other PID */
+    for (int32_t i = 0; i < 64; i += 2)
+        assert_true(&values[i] == pidmap_remove(map, i + 1));
+
+    assert_int_equal(32, map->count);
+
+    for (int32_t i = 0; i < 64; i++)
+    {
+        if (i % 2)
+            assert_true(&values[i] == pidmap_get(map, i + 1));
+        else
+            assert_null(pidmap_get(map, i + 1));
+    }
+
+    pidmap_destroy(map);
+}
+
+void
+test_pidmap_random(UNUSED void **state)
+{
+    /* reference: value of PID i is &reference[i] if present */
+    static bool present[NUM_PIDS];
+    static int32_t reference[NUM_PIDS];
+
+    pidmap_t *map = pidmap_new(0);
+    uint32_t count = 0;
+
+    srand(42);
+
+    for (int32_t round = 0; round < 100000; round++)
+    {
+        int32_t pid = 1 + rand() % (NUM_PIDS - 1);
+
+        if (rand() % 3)
+        {
+            if (!present[pid])
+                count++;
+
+            present[pid] = true;
+            pidmap_put(map, pid, &reference[pid]);
+        }
+        else
+        {
+            void *removed = pidmap_remove(map, pid);
+
+            assert_true(removed == (present[pid] ? &reference[pid] : NULL));
+
+            if (present[pid])
+                count--;
+
+            present[pid] = false;
+        }
+    }
+
+    assert_int_equal(count, map->count);
+
+    for (int32_t pid = 1; pid < NUM_PIDS; pid++)
+    {
+        void *expected = present[pid] ? &reference[pid] : NULL;
+
+        assert_true(pidmap_get(map, pid) == expected);
+    }
+
+    pidmap_destroy(map);
+}
+
+/* vim: set et sw=4 sts=4 tw=80: */
@@ -13,12 +13,17 @@
  * limitations under the License.
  */
 
+#define _GNU_SOURCE
+
 #include "tests.h"
 #include "tests_proc.h"
 #include "../src/proc.h"
 
 #include <inttypes.h>
+#include <signal.h>
 #include <stdio.h>
+#include <string.h>
+#include <sys/wait.h>
 #include <unistd.h>
 
 void
@@ -79,5 +84,134 @@ test_proc_stat(UNUSED void **state)
     free(stat);
 }
 
+void
+test_proc_stat_parse(UNUSED void **state)
+{
+    sys_proc_stat_t stat;
+    const char *line = "cpu  10 2 30 400 5 6 7 0 0 0\ncpu0 10 2 30 400 5 6 7 0 0 0\n";
+
+    assert_true(sys_proc_parse(&stat, line, strlen(line)));
+
+    assert_int_equal(10, stat.user_time);
+    assert_int_equal(2, stat.nice_time);
+    assert_int_equal(30, stat.system_time);
+    assert_int_equal(400, stat.idle_time);
+    assert_int_equal(5, stat.iowait_time);
+    assert_int_equal(447, stat.total);
+
+    /* truncated line */
+    assert_false(sys_proc_parse(&stat, line, 12));
+}
+
+void
+test_proc_system_info_parse(UNUSED void **state)
+{
+    sys_info_t info;
+    const char *line = "1234 (a (b) c) S 1 1234 1234 0 -1 4194560 100 0 0 0 "
+        "11 22 -3 4 20 0 1 0 5000 8192000 300 18446744073709551615\n";
+
+    assert_true(sys_info_parse(&info, line, strlen(line), 4096));
+
+    assert_int_equal(11, info.user_time);
+    assert_int_equal(22, info.system_time);
+    assert_int_equal(-3, info.child_user_time);
+    assert_int_equal(4, info.child_system_time);
+    assert_int_equal(1, info.num_threads);
+    assert_int_equal(5000, info.start_time);
+    assert_int_equal(8192000, info.virtual_size);
+    assert_int_equal(1200, info.resident_set_size);
+    assert_int_equal(34, info.total_time);
+
+    /* missing fields */
+    assert_false(sys_info_parse(&info, line, 60, 4096));
+
+    /* missing process name */
+    assert_false(sys_info_parse(&info, "1234 S 1", 8, 4096));
+}
+
+static bool
+has_child(proc_stat_t *proc, pid_t pid)
+{
+    for (uint32_t i = 0; i < proc->num_children; i++)
+    {
+        if (proc->children[i].pid == pid)
+            return true;
+    }
+
+    return false;
+}
+
+void
+test_proc_tree_sample(UNUSED void **state)
+{
+    int32_t fds[2];
+    pid_t grandchild = 0;
+
+    assert_int_equal(0, pipe(fds));
+
+    /* the first child forks another one itself */
+    pid_t child = fork();
+    assert_true(child >= 0);
+
+    if (child == 0)
+    {
+        setpgid(0, 0);
+
+        pid_t pid = fork();
+
+        if (pid == 0)
+            pause();
+
+        if (write(fds[1], &pid, sizeof(pid)) != sizeof(pid))
+            _exit(1);
+
+        pause();
+    }
+
+    pid_t sibling = fork();
+    assert_true(sibling >= 0);
+
+    if (sibling == 0)
+        pause();
+
+    assert_int_equal(sizeof(grandchild), read(fds[0], &grandchild, sizeof(grandchild)));
+
+    sys_info_t info;
+    memset(&info, 0, sizeof(sys_info_t));
+    assert_true(sys_info_read_proc(&info, getpid(), get_page_size()));
+
+    proc_stat_t *proc = proc_stat_new(getpid(), "test", NULL);
+
+    int64_t rss = 0;
+    int64_t diff = proc_tree_sample(proc, info.num_threads, get_page_size(), &rss);
+
+    assert_true(diff >= 0);
+    assert_true(rss > 0);
+    assert_true(proc->num_children >= 3);
+    assert_true(has_child(proc, child));
+    assert_true(has_child(proc, grandchild));
+    assert_true(has_child(proc, sibling));
+
+    /* the descendants are ordered by PID */
+    for (uint32_t i = 1; i < proc->num_children; i++)
+        assert_true(proc->children[i - 1].pid < proc->children[i].pid);
+
+    kill(-child, SIGKILL);
+    kill(sibling, SIGKILL);
+    waitpid(child, NULL, 0);
+    waitpid(sibling, NULL, 0);
+
+    rss = 0;
+    proc_tree_sample(proc, info.num_threads, get_page_size(), &rss);
+
+    assert_false(has_child(proc, child));
+    assert_false(has_child(proc, grandchild));
+    assert_false(has_child(proc, sibling));
+
+    proc_stat_destroy(proc);
+
+    close(fds[0]);
+    close(fds[1]);
+}
 
 /* vim: set et sw=4 sts=4 tw=80: */
@@ -21,6 +21,12 @@ test_proc_system_info(void **state);
 void
 test_proc_stat(void **state);
 
+void
+test_proc_stat_parse(void **state);
+
+void
+test_proc_system_info_parse(void **state);
+
 void
 test_proc_total_memory_size(void **state);
 
@@ -30,4 +36,7 @@ test_proc_page_size(void **state);
 void
 test_proc_num_cpus(void **state);
 
+void
+test_proc_tree_sample(void **state);
+
 /* vim: set et sw=4 sts=4 tw=80: */
@@ -0,0 +1,156 @@
+/* Copyright 2014-2019 Gregor Uhlenheuer
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "tests.h"
+#include "tests_queue.h"
+#include "../src/queue.h"
+
+#include <pthread.h>
+#include <stdlib.h>
+
+#define NUM_PRODUCERS 4
+#define NUM_PUSHES    10000
+
+DECLARE_QUEUE(uint32_t, test)
+IMPLEMENT_QUEUE(uint32_t, test)
+
+void
+test_queue_push_pop(UNUSED void **state)
+{
+    uint32_t value = 0;
+    queue_test_t *queue = queue_test_new(4);
+
+    assert_true(queue_test_empty(queue));
+    assert_false(queue_test_pop(queue, &value));
+
+    /* push and pop more values than the queue holds
+     * so the positions wrap around a few times */
+    for (uint32_t i = 0; i < 20; i++)
+    {
+        assert_true(queue_test_push(queue, i));
+        assert_true(queue_test_push(queue, i + 100));
+        assert_false(queue_test_empty(queue));
+
+        assert_true(queue_test_pop(queue, &value));
+        assert_int_equal(i, value);
+        assert_true(queue_test_pop(queue, &value));
+        assert_int_equal(i + 100, value);
+    }
+
+    assert_true(queue_test_empty(queue));
+
+    queue_test_destroy(queue);
+}
+
+void
+test_queue_full(UNUSED void **state)
+{
+    uint32_t value = 0;
+    queue_test_t *queue = queue_test_new(8);
+
+    for (uint32_t i = 0; i < 8; i++)
+        assert_true(queue_test_push(queue, i));
+
+    assert_false(queue_test_push(queue, 8));
+
+    /* one free slot may be reused immediately */
+    assert_true(queue_test_pop(queue, &value));
+    assert_int_equal(0, value);
+    assert_true(queue_test_push(queue, 8));
+
+    for (uint32_t i = 1; i < 9; i++)
+    {
+        assert_true(queue_test_pop(queue, &value));
+        assert_int_equal(i, value);
+    }
+
+    assert_false(queue_test_pop(queue, &value));
+
+    queue_test_destroy(queue);
+}
+
+void
+test_queue_last(UNUSED void **state)
+{
+    uint32_t value = 0;
+    queue_test_t *queue = queue_test_new(4);
+
+    assert_false(queue_test_last(queue, &value));
+
+    for (uint32_t i = 0; i < 10; i++)
+    {
+        assert_true(queue_test_push(queue, i));
+        assert_true(queue_test_push(queue, i + 100));
+
+        assert_true(queue_test_last(queue, &value));
+        assert_int_equal(i + 100, value);
+
+        assert_true(queue_test_pop(queue, &value));
+        assert_true(queue_test_last(queue, &value));
+        assert_int_equal(i + 100, value);
+
+        /* the last value is gone as soon as it is popped */
+        assert_true(queue_test_pop(queue, &value));
+        assert_false(queue_test_last(queue, &value));
+    }
+
+    queue_test_destroy(queue);
+}
+
+static void *
+queue_producer(void *data)
+{
+    queue_test_t *queue = data;
+
+    for (uint32_t i = 0; i < NUM_PUSHES; i++)
+    {
+        while (!queue_test_push(queue, i))
+            ;
+    }
+
+    return NULL;
+}
+
+void
+test_queue_concurrent_push(UNUSED void **state)
+{
+    uint32_t value = 0, received = 0;
+    uint64_t sum = 0;
+    pthread_t producers[NUM_PRODUCERS];
+    queue_test_t *queue = queue_test_new(64);
+
+    for (uint32_t i = 0; i < NUM_PRODUCERS; i++)
+        assert_int_equal(0, pthread_create(&producers[i], NULL, queue_producer, queue));
+
+    while (received < NUM_PRODUCERS * NUM_PUSHES)
+    {
+        if (queue_test_pop(queue, &value))
+        {
+            sum += value;
+            received++;
+        }
+    }
+
+    for (uint32_t i = 0; i < NUM_PRODUCERS; i++)
+        pthread_join(producers[i], NULL);
+
+    /* every value has to be received exactly once */
+    assert_int_equal((uint64_t)NUM_PRODUCERS * NUM_PUSHES * (NUM_PUSHES - 1) / 2, sum);
+    assert_true(queue_test_empty(queue));
+
+    queue_test_destroy(queue);
+}
+
+/* vim: set et sw=4 sts=4 tw=80: */
@@ -0,0 +1,148 @@
+/* Copyright 2014-2019 Gregor Uhlenheuer
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#define _GNU_SOURCE
+
+#include "tests.h"
+#include "tests_runner.h"
+#include "../src/runner.h"
+#include "../src/utils.h"
+
+#include <errno.h>
+#include <signal.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+void
+test_runner_run(UNUSED void **state)
+{
+    runner_result_t result;
+    const char *success[] = { "true", NULL };
+    const char *failure[] = { "sh", "-c", "exit 3", NULL };
+    const char *missing[] = { "/non/existing/command", NULL };
+    const char *env[] = { "sh", "-c", "test \"$NYX_TEST\" = value", NULL };
+    const char *fds[] = { "sh", "-c", "test ! -e /proc/$$/fd/3", NULL };
+
+    watch_t watch;
+    memset(&watch, 0, sizeof(watch_t));
+
+    runner_pool_t *pool = runner_pool_new(1);
+    assert_int_equal(1, runner_pool_alive(pool));
+
+    watch.exec_check = success;
+    assert_true(runner_run(pool, &watch, 1000, &result));
+    assert_int_equal(0, result.error);
+    assert_int_equal(0, result.status);
+
+    watch.exec_check = failure;
+    assert_true(runner_run(pool, &watch, 1000, &result));
+    assert_int_equal(0, result.error);
+    assert_int_equal(3, result.status);
+
+    watch.exec_check = missing;
+    assert_true(runner_run(pool, &watch, 1000, &result));
+    assert_int_equal(ENOENT, result.error);
+
+    /* the watch's environment is passed to the command */
+    watch.exec_check = env;
+    watch.env = hash_new(free);
+    hash_add(watch.env, "NYX_TEST", strdup("value"));
+
+    assert_true(runner_run(pool, &watch, 1000, &result));
+    assert_int_equal(0, result.status);
+
+    /* only the standard streams are passed to the command */
+    watch.exec_check = fds;
+
+    assert_true(runner_run(pool, &watch, 1000, &result));
+    assert_int_equal(0, result.status);
+
+    hash_destroy(watch.env);
+    runner_pool_destroy(pool);
+}
+
+void
+test_runner_timeout(UNUSED void **state)
+{
+    runner_result_t result;
+    const char *command[] = { "sleep", "10", NULL };
+
+    watch_t watch;
+    memset(&watch, 0, sizeof(watch_t));
+    watch.exec_check = command;
+
+    runner_pool_t *pool = runner_pool_new(1);
+
+    uint64_t start = time_ms();
+
+    assert_true(runner_run(pool, &watch, 200, &result));
+    assert_int_equal(ETIMEDOUT, result.error);
+    assert_true(time_ms() - start < 1000);
+
+    /* the runner is available right after */
+    assert_non_null(runner_acquire(pool));
+
+    runner_pool_destroy(pool);
+}
+
+void
+test_runner_respawn(UNUSED void **state)
+{
+    runner_result_t result;
+    const char *command[] = { "true", NULL };
+
+    watch_t watch;
+    memset(&watch, 0, sizeof(watch_t));
+    watch.exec_check = command;
+
+    runner_pool_t *pool = runner_pool_new(1);
+    pid_t pid = pool->runners[0].pid;
+
+    assert_true(pid > 0);
+    assert_int_equal(0, kill(pid, SIGKILL));
+
+    /* the terminated runner is noticed on its next use */
+    assert_false(runner_run(pool, &watch, 1000, &result));
+    assert_int_equal(0, runner_pool_alive(pool));
+
+    /* and replaced after the respawn interval */
+    usleep((NYX_RUNNER_RESPAWN_MS + 100) * 1000);
+
+    assert_true(runner_run(pool, &watch, 1000, &result));
+    assert_int_equal(0, result.status);
+    assert_int_equal(1, runner_pool_alive(pool));
+    assert_int_not_equal(pid, pool->runners[0].pid);
+
+    runner_pool_destroy(pool);
+}
+
+void
+test_runner_pool_owns(UNUSED void **state)
+{
+    runner_pool_t *pool = runner_pool_new(2);
+
+    assert_true(runner_pool_owns(pool, pool->spawner_pid));
+    assert_true(runner_pool_owns(pool, pool->runners[0].pid));
+    assert_true(runner_pool_owns(pool, pool->runners[1].pid));
+
+    assert_false(runner_pool_owns(pool, getpid()));
+    assert_false(runner_pool_owns(pool, 0));
+    assert_false(runner_pool_owns(NULL, pool->spawner_pid));
+
+    runner_pool_destroy(pool);
+}
+
+/* vim: set et sw=4 sts=4 tw=80: */
@@ -13,10 +13,15 @@
  * limitations under the License.
  */
 
+#define _GNU_SOURCE
+
 #include "tests.h"
 #include "tests_socket.h"
 #include "../src/socket.h"
 
+#include <arpa/inet.h>
+#include <unistd.h>
+
 void
 test_check_http(UNUSED void **state)
 {
@@ -59,4 +64,39 @@ test_parse_endpoint(UNUSED void **state)
     endpoint_free(e2);
 }
 
+void
+test_endpoint_address(UNUSED void **state)
+{
+    int32_t resolved = 0;
+    struct sockaddr_in address;
+
+    endpoint_t *endpoint = parse_endpoint("localhost:8080");
+
+    /* the address is resolved in the background */
+    for (uint32_t i = 0; i < 200 && resolved == 0; i++)
+    {
+        resolved = endpoint_address(endpoint, &address);
+
+        if (resolved == 0)
+            usleep(10000);
+    }
+
+    assert_int_equal(1, resolved);
+    assert_int_equal(AF_INET, address.sin_family);
+    assert_int_equal(8080, ntohs(address.sin_port));
+    assert_int_equal(INADDR_LOOPBACK, ntohl(address.sin_addr.s_addr));
+    assert_true(endpoint->expires > 0);
+
+    /* a failed address is not preferred anymore */
+    endpoint->addresses[1] = endpoint->addresses[0];
+    endpoint->addresses[1].sin_addr.s_addr = htonl(INADDR_LOOPBACK + 1);
+    endpoint->num_addresses = 2;
+
+    endpoint_failed(endpoint, &address);
+    assert_int_equal(1, endpoint_address(endpoint, &address));
+    assert_int_equal(INADDR_LOOPBACK + 1, ntohl(address.sin_addr.s_addr));
+
+    endpoint_free(endpoint);
+}
+
 /* vim: set et sw=4 sts=4 tw=80: */
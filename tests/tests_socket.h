@@ -24,4 +24,7 @@ test_check_port(void **state);
 void
 test_parse_endpoint(void **state);
 
+void
+test_endpoint_address(void **state);
+
 /* vim: set et sw=4 sts=4 tw=80: */
@@ -0,0 +1,100 @@
+/* Copyright 2014-2019 Gregor Uhlenheuer
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "tests.h"
+#include "tests_stack.h"
+#include "../src/def.h"
+#include "../src/stack.h"
+
+#include <stdlib.h>
+
+DECLARE_STACK(int32_t, test)
+IMPLEMENT_STACK(int32_t, test)
+
+void
+test_stack_window(UNUSED void **state)
+{
+    stack_test_t *stack = stack_test_new(4, 100);
+
+    assert_int_equal(0, stack->count);
+    assert_int_equal(0, stack_test_newest(stack));
+
+    stack_test_add(stack, 5);
+    stack_test_add(stack, 3);
+
+    assert_int_equal(2, stack->count);
+    assert_int_equal(8, stack->sum);
+    assert_int_equal(3, stack->min);
+    assert_int_equal(5, stack->max);
+    assert_int_equal(3, stack_test_newest(stack));
+    assert_int_equal(5, stack_test_get(stack, 1));
+
+    /* add more values than the window holds so the
+     * ring buffer wraps around a few times */
+    for (int32_t i = 1; i <= 10; i++)
+        stack_test_add(stack, i);
+
+    assert_int_equal(4, stack->count);
+    assert_int_equal(7 + 8 + 9 + 10, stack->sum);
+    assert_int_equal(7, stack->min);
+    assert_int_equal(10, stack->max);
+    assert_int_equal(10, stack_test_newest(stack));
+    assert_int_equal(7, stack_test_get(stack, 3));
+    assert_int_equal(0, stack_test_get(stack, 4));
+
+    /* the maximum leaves the window */
+    stack_test_add(stack, 1);
+    stack_test_add(stack, 1);
+    stack_test_add(stack, 1);
+    stack_test_add(stack, 1);
+
+    assert_int_equal(4, stack->sum);
+    assert_int_equal(1, stack->min);
+    assert_int_equal(1, stack->max);
+
+    stack_test_destroy(stack);
+}
+
+void
+test_stack_threshold(UNUSED void **state)
+{
+    stack_test_t *stack = stack_test_new(10, 80);
+
+    for (int32_t i = 0; i < 10; i++)
+        stack_test_add(stack, i % 2 ? 90 : 10);
+
+    assert_int_equal(5, stack->exceeding);
+
+    /* values reaching the threshold count as well */
+    stack_test_add(stack, 80);
+    stack_test_add(stack, 80);
+
+    assert_int_equal(6, stack->exceeding);
+
+    for (int32_t i = 0; i < 10; i++)
+        stack_test_add(stack, 99);
+
+    assert_int_equal(10, stack->exceeding);
+
+    stack_test_set_threshold(stack, 100);
+    assert_int_equal(0, stack->exceeding);
+
+    stack_test_add(stack, 100);
+    assert_int_equal(1, stack->exceeding);
+
+    stack_test_destroy(stack);
+}
+
+/* vim: set et sw=4 sts=4 tw=80: */
@@ -0,0 +1,181 @@
+/* Copyright 2014-2019 Gregor Uhlenheuer
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#define _GNU_SOURCE
+
+#include "tests.h"
+#include "tests_state.h"
+#include "../src/def.h"
+#include "../src/pidmap.h"
+#include "../src/scheduler.h"
+#include "../src/state.h"
+#include "../src/utils.h"
+
+#include <pthread.h>
+#include <stdlib.h>
+#include <string.h>
+
+/**
+ * @brief Create a scheduler without any worker threads so the
+ *        queues can be inspected after 'state_run'
+ */
+static scheduler_t *
+scheduler_without_workers(void)
+{
+    scheduler_t *scheduler = xcalloc1(sizeof(scheduler_t));
+
+    pthread_mutex_init(&scheduler->lock, NULL);
+    pthread_cond_init(&scheduler->ready_cond, NULL);
+    pthread_cond_init(&scheduler->idle_cond, NULL);
+
+    scheduler->delayed = list_new(NULL);
+    scheduler->watching = list_new(NULL);
+#ifndef OSX
+    scheduler->epfd = -1;
+#endif
+
+    return scheduler;
+}
+
+void
+test_state_park_delayed(UNUSED void **state)
+{
+    nyx_t nyx = {0};
+    watch_t *watch = watch_new(strdup("test"));
+
+    nyx.scheduler = scheduler_without_workers();
+    nyx.state_pids = pidmap_new(0);
+    pthread_mutex_init(&nyx.state_pids_lock, NULL);
+
+    state_t *flapping = state_new(watch, &nyx);
+
+    /* a stale wakeup (e.g. a late forker reply) of a state
+     * that is processed by a worker right now */
+    flapping->delayed_until = time_ms() + 60000;
+    flapping->wakeup_pending = true;
+    flapping->scheduled = true;
+
+    assert_int_equal(STATE_RUN_PARKED, state_run(flapping));
+
+    /* the worker still owns the state until it released it */
+    assert_true(flapping->scheduled);
+    assert_int_equal(0, nyx.scheduler->delayed->count);
+
+    scheduler_release(nyx.scheduler, flapping, STATE_RUN_PARKED);
+
+    /* the state is parked until its delay elapsed instead of
+     * being pushed back to the ready queue right away */
+    assert_null(nyx.scheduler->ready_head);
+    assert_int_equal(1, nyx.scheduler->delayed->count);
+    assert_true(nyx.scheduler->delayed->head->data == flapping);
+    assert_false(flapping->wakeup_pending);
+    assert_false(flapping->scheduled);
+    assert_int_equal(flapping->delayed_until, flapping->wakeup_at);
+
+    scheduler_destroy(nyx.scheduler);
+    nyx.scheduler = NULL;
+
+    state_destroy(flapping);
+    watch_destroy(watch);
+    pidmap_destroy(nyx.state_pids);
+    pthread_mutex_destroy(&nyx.state_pids_lock);
+}
+
+void
+test_state_release_pending(UNUSED void **state)
+{
+    nyx_t nyx = {0};
+    watch_t *watch = watch_new(strdup("test"));
+
+    nyx.scheduler = scheduler_without_workers();
+    nyx.state_pids = pidmap_new(0);
+    pthread_mutex_init(&nyx.state_pids_lock, NULL);
+
+    state_t *busy = state_new(watch, &nyx);
+
+    /* a state that is processed by a worker right now */
+    busy->scheduled = true;
+    busy->running = true;
+
+    /* a new request does not hand the state to another worker */
+    assert_true(set_state(busy, STATE_STOPPED));
+    assert_null(nyx.scheduler->ready_head);
+
+    /* but the state is scheduled again once it was released */
+    busy->running = false;
+    scheduler_release(nyx.scheduler, busy, STATE_RUN_DONE);
+
+    assert_true(nyx.scheduler->ready_head == busy);
+    assert_true(busy->scheduled);
+
+    nyx.scheduler->ready_head = nyx.scheduler->ready_tail = NULL;
+
+    scheduler_destroy(nyx.scheduler);
+    nyx.scheduler = NULL;
+
+    state_destroy(busy);
+    watch_destroy(watch);
+    pidmap_destroy(nyx.state_pids);
+    pthread_mutex_destroy(&nyx.state_pids_lock);
+}
+
+void
+test_state_queue_overflow(UNUSED void **state)
+{
+    nyx_t nyx = {0};
+    watch_t *watch = watch_new(strdup("test"));
+
+    nyx.scheduler = scheduler_without_workers();
+    nyx.state_pids = pidmap_new(0);
+    pthread_mutex_init(&nyx.state_pids_lock, NULL);
+
+    state_t *busy = state_new(watch, &nyx);
+
+    /* processed by a worker right now */
+    busy->scheduled = true;
+
+    /* fill the states queue with alternating events */
+    for (uint32_t i = 0; busy->overflow_state == STATE_INIT; i++)
+    {
+        assert_true(i < 1000);
+        assert_true(set_state(busy, i % 2 ? STATE_STOPPED : STATE_RUNNING));
+    }
+
+    /* the newest event is kept instead of being dropped */
+    assert_true(set_state(busy, STATE_RUNNING));
+    assert_true(set_state(busy, STATE_STOPPED));
+    assert_int_equal(STATE_STOPPED, busy->overflow_state);
+
+    /* user commands are rejected */
+    assert_false(set_state_command(busy, STATE_STOPPING));
+
+    /* the kept event is pending even after the queue is drained */
+    state_entry_t entry;
+
+    while (queue_state_pop(busy->states, &entry))
+        ;
+
+    assert_true(state_has_requests(busy, STATE_RUN_DONE));
+
+    scheduler_destroy(nyx.scheduler);
+    nyx.scheduler = NULL;
+
+    state_destroy(busy);
+    watch_destroy(watch);
+    pidmap_destroy(nyx.state_pids);
+    pthread_mutex_destroy(&nyx.state_pids_lock);
+}
+
+/* vim: set et sw=4 sts=4 tw=80: */
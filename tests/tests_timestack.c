@@ -51,4 +51,28 @@ test_timestack_add(UNUSED void **state)
     timestack_destroy(timestack);
 }
 
+void
+test_timestack_get(UNUSED void **state)
+{
+    timestack_t *timestack = timestack_new(3);
+
+    assert_null(timestack_get(timestack, 0));
+
+    for (int32_t i = 0; i < 5; i++)
+        timestack_add(timestack, i);
+
+    assert_int_equal(4, timestack_get(timestack, 0)->value);
+    assert_int_equal(3, timestack_get(timestack, 1)->value);
+    assert_int_equal(2, timestack_get(timestack, 2)->value);
+    assert_null(timestack_get(timestack, 3));
+
+    timestack_clear(timestack);
+
+    assert_int_equal(0, timestack->count);
+    assert_null(timestack_get(timestack, 0));
+    assert_int_equal(0, timestack_oldest(timestack));
+
+    timestack_destroy(timestack);
+}
+
 /* vim: set et sw=4 sts=4 tw=80: */